@@ -0,0 +1,1088 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * The name of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER 
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR 
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF 
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+/** Microbenchmarks for libfc internals.
+ *
+ * Syntax: fcbench [benchmark...]
+ *
+ * Without arguments, all benchmarks are run.  Available benchmarks:
+ *
+ *   kernels   fixed-width transfer kernels (decode_kernels.h) against
+ *             the generic memset-and-reverse transfer they replace
+ *   plans     interpreted against natively compiled decode plans
+ *   columns   whole-data-set column decoding for each instruction set
+ *             against record-by-record decoding
+ *   strings   varlen strings copied into BasicOctetArrays against
+ *             referenced by OctetArrayViews
+ *   lookups   InfoModel::lookupIE, as done for every template field,
+ *             against a tree lookup by PEN and number
+ *   logging   decode plan construction and interpreted execution, the
+ *             paths with TRACE statements; compare builds with
+ *             different LOG_LEVELs (see lib/logging.h)
+ *   sources   parsing a file of small messages through unbuffered
+ *             read(2) calls, FileInputSource, MmapInputSource,
+ *             UringInputSource and WandioInputSource
+ *
+ * Results are in nanoseconds per operation and depend heavily on
+ * compiler and machine, so compare numbers only within one run.
+ *
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "BasicOctetArray.h"
+#include "BufferInputSource.h"
+#include "ColumnDecoder.h"
+#include "DecodePlan.h"
+#include "FileInputSource.h"
+#include "IETemplate.h"
+#include "IPFIXMessageStreamParser.h"
+#include "InfoModel.h"
+#include "MmapInputSource.h"
+#include "NativeDecoder.h"
+#include "OctetArrayView.h"
+#include "ParallelFileCollector.h"
+#include "PipelinedCollector.h"
+#include "PlacementCollector.h"
+#include "PlacementContentHandler.h"
+#include "PlacementTemplate.h"
+#include "UDPCollector.h"
+#include "UringInputSource.h"
+#include "WandioInputSource.h"
+#include "WorkStealingCollector.h"
+
+#include "decode_kernels.h"
+#include "ipfix_endian.h"
+#include "logging.h"
+
+using namespace libfc;
+
+/** Number of values in one pass over the buffer. */
+static const size_t kValues = 4096;
+
+/** Number of passes per measurement. */
+static const size_t kPasses = 20000;
+
+/** Keeps the compiler from optimising measurements away. */
+static volatile uint64_t sink;
+
+/** Generic transfer, as DecodePlan did before the kernels existed. */
+static void generic_transfer(const uint8_t* cur, void* p,
+                             uint16_t length, uint16_t destination_size) {
+  uint8_t* q = static_cast<uint8_t*>(p);
+  memset(q, '\0', destination_size);
+#if defined(IPFIX_LITTLE_ENDIAN)
+  for (uint16_t k = 0; k < length; k++)
+    q[k] = cur[length - (k + 1)];
+#else
+  memcpy(q + destination_size - length, cur, length);
+#endif
+}
+
+template<typename F>
+static double ns_per_op(F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t pass = 0; pass < kPasses; ++pass)
+    f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count()
+    / (kPasses * kValues);
+}
+
+template<unsigned int W, unsigned int D>
+static void bench_kernel(const std::vector<uint8_t>& wire) {
+  typename uint_of_width<D>::type out;
+
+  /* Widths come from memory, as they would from a decision. */
+  volatile uint16_t length = W;
+  volatile uint16_t destination_size = D;
+  uint16_t l = length;
+  uint16_t ds = destination_size;
+
+  double generic = ns_per_op([&]() {
+      uint64_t sum = 0;
+      for (size_t i = 0; i < kValues; ++i) {
+        generic_transfer(&wire[i*W], &out, l, ds);
+        sum += out;
+      }
+      sink = sum;
+    });
+
+  double kernel = ns_per_op([&]() {
+      uint64_t sum = 0;
+      for (size_t i = 0; i < kValues; ++i) {
+        transfer_big_endian<W, D>(&wire[i*W], &out);
+        sum += out;
+      }
+      sink = sum;
+    });
+
+  std::cout << "  " << W << "->" << D
+            << std::fixed << std::setprecision(3)
+            << "  generic " << std::setw(7) << generic << " ns"
+            << "  kernel " << std::setw(7) << kernel << " ns"
+            << "  speedup " << std::setprecision(2)
+            << generic / kernel << "x" << std::endl;
+}
+
+static void bench_kernels() {
+  std::vector<uint8_t> wire(kValues * 8);
+  for (size_t i = 0; i < wire.size(); ++i)
+    wire[i] = static_cast<uint8_t>(i * 131 + 7);
+
+  std::cout << "kernels: ns per transferred value" << std::endl;
+  bench_kernel<1, 1>(wire);
+  bench_kernel<1, 8>(wire);
+  bench_kernel<2, 2>(wire);
+  bench_kernel<2, 4>(wire);
+  bench_kernel<2, 8>(wire);
+  bench_kernel<4, 4>(wire);
+  bench_kernel<4, 8>(wire);
+  bench_kernel<8, 8>(wire);
+}
+
+static void bench_plans() {
+  InfoModel& model = InfoModel::instance();
+  model.defaultIPFIX();
+
+  /* A typical flow record: 5-tuple, counters and timestamps, of which
+   * we keep about a third. */
+  static const char* wire_ies[] = {
+    "sourceIPv4Address", "destinationIPv4Address", "sourceTransportPort",
+    "destinationTransportPort", "protocolIdentifier", "tcpControlBits",
+    "ipClassOfService", "ingressInterface", "egressInterface",
+    "octetDeltaCount", "packetDeltaCount", "flowStartMilliseconds",
+    "flowEndMilliseconds", "bgpSourceAsNumber", "bgpDestinationAsNumber",
+    "ipNextHopIPv4Address",
+  };
+  static const char* kept_ies[] = {
+    "sourceIPv4Address", "destinationIPv4Address", "sourceTransportPort",
+    "destinationTransportPort", "protocolIdentifier", "octetDeltaCount",
+  };
+
+  IETemplate wt;
+  for (size_t k = 0; k < sizeof(wire_ies)/sizeof(wire_ies[0]); ++k)
+    wt.add(model.lookupIE(wire_ies[k]));
+
+  uint64_t values[sizeof(kept_ies)/sizeof(kept_ies[0])];
+  PlacementTemplate pt;
+  for (size_t k = 0; k < sizeof(kept_ies)/sizeof(kept_ies[0]); ++k)
+    pt.register_placement(model.lookupIE(kept_ies[k]), &values[k], 0);
+
+  DecodePlan interpreted(&pt, &wt);
+  DecodePlan compiled(&pt, &wt);
+  interpreted.set_compile_threshold(0);
+  bool is_compiled = compiled.compile();
+
+  uint16_t record_length = interpreted.get_fixed_prefix_length();
+  std::vector<uint8_t> wire(kValues * record_length);
+  for (size_t i = 0; i < wire.size(); ++i)
+    wire[i] = static_cast<uint8_t>(i * 131 + 7);
+
+  double interpreter = ns_per_op([&]() {
+      for (size_t i = 0; i < kValues; ++i)
+        interpreted.execute(&wire[i*record_length], record_length);
+      sink = values[0];
+    });
+
+  double native = ns_per_op([&]() {
+      for (size_t i = 0; i < kValues; ++i)
+        compiled.execute(&wire[i*record_length], record_length);
+      sink = values[0];
+    });
+
+  std::cout << "plans: ns per record (" << wt.size() << " IEs, "
+            << interpreted.size() << " transfers)" << std::endl
+            << std::fixed << std::setprecision(3)
+            << "  interpreted " << std::setw(7) << interpreter << " ns"
+            << std::endl;
+  if (is_compiled)
+    std::cout << "  native      " << std::setw(7) << native << " ns"
+              << "  speedup " << std::setprecision(2)
+              << interpreter / native << "x" << std::endl;
+  else
+    std::cout << "  native code not available on this platform/build"
+              << std::endl;
+}
+
+static void bench_columns() {
+  InfoModel& model = InfoModel::instance();
+  model.defaultIPFIX();
+
+  static const char* names[] = {
+    "sourceIPv4Address", "destinationIPv4Address", "sourceTransportPort",
+    "destinationTransportPort", "protocolIdentifier", "octetDeltaCount",
+    "packetDeltaCount",
+  };
+  const size_t n_fields = sizeof(names)/sizeof(names[0]);
+
+  IETemplate wt;
+  for (size_t f = 0; f < n_fields; ++f)
+    wt.add(model.lookupIE(names[f]));
+  const uint16_t stride = wt.minlen();
+
+  std::vector<uint8_t> wire(kValues * stride);
+  for (size_t i = 0; i < wire.size(); ++i)
+    wire[i] = static_cast<uint8_t>(i * 131 + 7);
+
+  /* Placements large enough for any of the IEs. */
+  std::vector<uint64_t> row(n_fields);
+  std::vector<std::vector<uint64_t> > columns(n_fields,
+                                             std::vector<uint64_t>(kValues));
+
+  PlacementTemplate row_pt;
+  PlacementTemplate column_pt;
+  for (size_t f = 0; f < n_fields; ++f) {
+    row_pt.register_placement(model.lookupIE(names[f]), &row[f], 0);
+    column_pt.register_placement(model.lookupIE(names[f]),
+                                 &columns[f][0], 0);
+  }
+
+  DecodePlan row_plan(&row_pt, &wt);
+  DecodePlan column_plan(&column_pt, &wt);
+  ColumnDecoder decoder(&column_plan);
+
+  std::cout << "columns: ns per record (" << n_fields << " IEs, "
+            << stride << " octets)" << std::endl
+            << std::fixed << std::setprecision(3);
+
+  double by_row = ns_per_op([&]() {
+      for (size_t i = 0; i < kValues; ++i)
+        row_plan.execute(&wire[i*stride], stride);
+      sink = row[0];
+    });
+  std::cout << "  by record   " << std::setw(7) << by_row << " ns"
+            << std::endl;
+
+  static const char* isa_names[] = { "scalar", "ssse3", "avx2" };
+  for (int isa = ColumnDecoder::isa_scalar;
+       isa <= ColumnDecoder::best_isa(); ++isa) {
+    decoder.set_isa(static_cast<ColumnDecoder::isa_t>(isa));
+    double by_column = ns_per_op([&]() {
+        decoder.decode(&wire[0], kValues, 0);
+        sink = columns[0][kValues - 1];
+      });
+    std::cout << "  " << std::left << std::setw(12) << isa_names[isa]
+              << std::right << std::setw(7) << by_column << " ns"
+              << "  speedup " << std::setprecision(2)
+              << by_row / by_column << "x" << std::setprecision(3)
+              << std::endl;
+  }
+}
+
+static void bench_strings() {
+  InfoModel& model = InfoModel::instance();
+  model.defaultIPFIX();
+
+  /* A record that is mostly strings, as from an application-aware
+   * exporter. */
+  IETemplate wt;
+  wt.add(model.lookupIE("sourceIPv4Address"));
+  wt.add(model.lookupIE("interfaceName"));
+  wt.add(model.lookupIE("interfaceDescription"));
+
+  static const char name[] = "eth0.1042";
+  static const char description[]
+    = "uplink to the provider edge router, second line card";
+  std::vector<uint8_t> record(4);
+  record.push_back(sizeof(name) - 1);
+  record.insert(record.end(), name, name + sizeof(name) - 1);
+  record.push_back(sizeof(description) - 1);
+  record.insert(record.end(), description,
+                description + sizeof(description) - 1);
+  const uint16_t record_length = static_cast<uint16_t>(record.size());
+
+  std::vector<uint8_t> wire;
+  for (size_t i = 0; i < kValues; ++i)
+    wire.insert(wire.end(), record.begin(), record.end());
+
+  uint32_t address;
+  BasicOctetArray copies[2];
+  OctetArrayView views[2];
+
+  PlacementTemplate copy_pt;
+  copy_pt.register_placement(model.lookupIE("sourceIPv4Address"),
+                             &address, 0);
+  copy_pt.register_placement(model.lookupIE("interfaceName"),
+                             &copies[0], 0);
+  copy_pt.register_placement(model.lookupIE("interfaceDescription"),
+                             &copies[1], 0);
+
+  PlacementTemplate view_pt;
+  view_pt.register_placement(model.lookupIE("sourceIPv4Address"),
+                             &address, 0);
+  view_pt.register_reference_placement(model.lookupIE("interfaceName"),
+                                       &views[0]);
+  view_pt.register_reference_placement(
+    model.lookupIE("interfaceDescription"), &views[1]);
+
+  DecodePlan copy_plan(&copy_pt, &wt);
+  DecodePlan view_plan(&view_pt, &wt);
+
+  double by_copy = ns_per_op([&]() {
+      for (size_t i = 0; i < kValues; ++i)
+        copy_plan.execute(&wire[i*record_length], record_length);
+      sink = copies[1].get_length();
+    });
+
+  double by_reference = ns_per_op([&]() {
+      for (size_t i = 0; i < kValues; ++i)
+        view_plan.execute(&wire[i*record_length], record_length);
+      sink = views[1].get_length();
+    });
+
+  std::cout << "strings: ns per record (" << record_length << " octets, "
+            << "2 varlen IEs)" << std::endl
+            << std::fixed << std::setprecision(3)
+            << "  copied      " << std::setw(7) << by_copy << " ns"
+            << std::endl
+            << "  referenced  " << std::setw(7) << by_reference << " ns"
+            << "  speedup " << std::setprecision(2)
+            << by_copy / by_reference << "x" << std::endl;
+}
+
+static void bench_lookups() {
+  InfoModel& model = InfoModel::instance();
+  model.default5103();
+
+  /* The fields of a typical biflow template: full-length and
+   * reduced-length IANA IEs, and enterprise-specific reverse IEs. */
+  static const struct { uint32_t pen; uint16_t number; uint16_t len; }
+  fields[] = {
+    { 0, 8, 4 }, { 0, 12, 4 }, { 0, 7, 2 }, { 0, 11, 2 }, { 0, 4, 1 },
+    { 0, 1, 4 }, { 0, 2, 4 }, { 0, 152, 8 }, { 0, 153, 8 }, { 0, 10, 2 },
+    { 29305, 1, 4 }, { 29305, 2, 4 }, { 29305, 6, 1 }, { 0, 136, 1 },
+  };
+  const size_t n_fields = sizeof(fields)/sizeof(fields[0]);
+
+  std::map<uint64_t, const InfoElement*> tree;
+  for (size_t f = 0; f < n_fields; ++f)
+    tree[(static_cast<uint64_t>(fields[f].pen) << 16) | fields[f].number]
+      = model.lookupIE(fields[f].pen, fields[f].number, fields[f].len);
+
+  double by_tree = ns_per_op([&]() {
+      for (size_t i = 0; i < kValues; ++i) {
+        size_t f = i % n_fields;
+        const InfoElement* ie = tree.find(
+          (static_cast<uint64_t>(fields[f].pen) << 16)
+          | fields[f].number)->second;
+        sink = ie->forLen(fields[f].len)->len();
+      }
+    });
+
+  double by_model = ns_per_op([&]() {
+      for (size_t i = 0; i < kValues; ++i) {
+        size_t f = i % n_fields;
+        sink = model.lookupIE(fields[f].pen, fields[f].number,
+                              fields[f].len)->len();
+      }
+    });
+
+  std::cout << "lookups: ns per template field (" << n_fields
+            << " distinct fields)" << std::endl
+            << std::fixed << std::setprecision(3)
+            << "  tree        " << std::setw(7) << by_tree << " ns"
+            << std::endl
+            << "  InfoModel   " << std::setw(7) << by_model << " ns"
+            << "  speedup " << std::setprecision(2)
+            << by_tree / by_model << "x" << std::endl;
+}
+
+static void bench_logging() {
+  InfoModel& model = InfoModel::instance();
+  model.defaultIPFIX();
+
+  /* Varlen fields keep the plan out of the fixed-length prefix, so
+   * every decision goes through the interpreter loop. */
+  IETemplate wt;
+  wt.add(model.lookupIE("interfaceName"));
+  wt.add(model.lookupIE("sourceIPv4Address"));
+  wt.add(model.lookupIE("interfaceDescription"));
+  wt.add(model.lookupIE("destinationIPv4Address"));
+
+  std::vector<uint8_t> record;
+  record.push_back(4);
+  record.insert(record.end(), { 'e', 't', 'h', '0' });
+  record.insert(record.end(), { 10, 0, 0, 1 });
+  record.push_back(6);
+  record.insert(record.end(), { 'u', 'p', 'l', 'i', 'n', 'k' });
+  record.insert(record.end(), { 10, 0, 0, 2 });
+  const uint16_t record_length = static_cast<uint16_t>(record.size());
+
+  uint32_t addresses[2];
+  BasicOctetArray names[2];
+  PlacementTemplate pt;
+  pt.register_placement(model.lookupIE("interfaceName"), &names[0], 0);
+  pt.register_placement(model.lookupIE("sourceIPv4Address"),
+                        &addresses[0], 0);
+  pt.register_placement(model.lookupIE("interfaceDescription"),
+                        &names[1], 0);
+  pt.register_placement(model.lookupIE("destinationIPv4Address"),
+                        &addresses[1], 0);
+
+  double construction = ns_per_op([&]() {
+      for (size_t i = 0; i < kValues / 64; ++i) {
+        DecodePlan plan(&pt, &wt);
+        sink = plan.execute(&record[0], record_length);
+      }
+    }) * 64;
+
+  DecodePlan plan(&pt, &wt);
+  double execution = ns_per_op([&]() {
+      for (size_t i = 0; i < kValues; ++i)
+        plan.execute(&record[0], record_length);
+      sink = addresses[1];
+    });
+
+  static const char* const levels[] = {
+    "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL", "OFF"
+  };
+  std::cout << "logging: static level " << levels[libfc_LOG_LEVEL]
+#if !defined(_libfc_HAVE_LOG4CPLUS_)
+            << " (no log4cplus)"
+#endif /* !defined(_libfc_HAVE_LOG4CPLUS_) */
+            << std::endl
+            << std::fixed << std::setprecision(3)
+            << "  plan construction " << std::setw(9) << construction
+            << " ns" << std::endl
+            << "  record decoding   " << std::setw(9) << execution
+            << " ns" << std::endl;
+}
+
+/** A file input source as it was before reads were buffered. */
+class UnbufferedInputSource : public InputSource {
+public:
+  UnbufferedInputSource(int fd) : fd(fd) {
+  }
+
+  ssize_t read(uint8_t* buf, uint16_t len) {
+    return ::read(fd, buf, len);
+  }
+
+  bool resync() { return true; }
+  size_t get_message_offset() const { return 0; }
+  void advance_message_offset() { }
+  const char* get_name() const { return "unbuffered"; }
+  bool can_peek() const { return false; }
+
+private:
+  int fd;
+};
+
+static void bench_sources() {
+  InfoModel& model = InfoModel::instance();
+  model.defaultIPFIX();
+
+  /* One message with a template and a record, then data-only
+   * messages with one record each. */
+  static const uint8_t first[] = {
+    0x00,0x0a,0x00,0x56,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,0x00,0x02,0x00,0x18,0x03,0xe9,0x00,0x04,0x01,0x36,0x00,0x04,0x00,0x52,0xff,0xff,0x01,0x37,0x00,0x08,0x00,0x53,0xff,0xff,0x03,0xe9,0x00,0x2e,0x10,0x20,0x30,0x40,0x04,0x65,0x74,0x68,0x30,0x3f,0xee,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x46,0x69,0x72,0x73,0x74,0x20,0x65,0x74,0x68,0x65,0x72,0x6e,0x65,0x74,0x20,0x69,0x6e,0x74,0x65,0x72,0x66,0x61,0x63,0x65 };
+  static const size_t kHeaderAndTemplate = 40;
+  const size_t n_messages = 200000;
+
+  std::vector<uint8_t> data_message(first, first + 16);
+  data_message.insert(data_message.end(), first + kHeaderAndTemplate,
+                      first + sizeof(first));
+  data_message[3] = static_cast<uint8_t>(data_message.size());
+
+  char filename[] = "/tmp/fcbenchXXXXXX";
+  int fd = mkstemp(filename);
+  if (fd < 0) {
+    std::cerr << "sources: can't create temporary file" << std::endl;
+    return;
+  }
+
+  std::vector<uint8_t> contents(first, first + sizeof(first));
+  for (size_t i = 1; i < n_messages; ++i)
+    contents.insert(contents.end(), data_message.begin(),
+                    data_message.end());
+  bool written = write(fd, &contents[0], contents.size())
+    == static_cast<ssize_t>(contents.size());
+  (void) close(fd);
+  if (!written) {
+    std::cerr << "sources: can't write temporary file" << std::endl;
+    (void) unlink(filename);
+    return;
+  }
+
+  uint32_t population;
+  PlacementTemplate pt;
+  pt.register_placement(model.lookupIE("samplingPopulation"),
+                        &population, 0);
+
+  class Counter : public PlacementCollector {
+  public:
+    Counter() : PlacementCollector(PlacementCollector::ipfix) { }
+  } counter;
+
+  /* Best of a few runs, to keep the page cache out of it. */
+  auto ns_per_message = [&](int kind) {
+    double best = 0;
+    for (int run = 0; run < 5; ++run) {
+      PlacementContentHandler ch;
+      IPFIXMessageStreamParser parser;
+      ch.register_placement_template(&pt, &counter);
+      parser.set_content_handler(&ch);
+
+      int fd = open(filename, O_RDONLY);
+      auto start = std::chrono::steady_clock::now();
+      if (kind == 0) {
+        UnbufferedInputSource is(fd);
+        parser.parse(is);
+        (void) close(fd);
+      } else if (kind == 1) {
+        FileInputSource is(fd, filename);
+        parser.parse(is);
+      } else if (kind == 2) {
+        MmapInputSource is(fd, filename);
+        parser.parse(is);
+      } else if (kind == 3) {
+        UringInputSource is(fd, filename);
+        parser.parse(is);
+      } else {
+        (void) close(fd);
+        WandioInputSource is(filename);
+        parser.parse(is);
+      }
+      auto end = std::chrono::steady_clock::now();
+
+      double ns = std::chrono::duration<double, std::nano>(end - start)
+        .count() / n_messages;
+      if (run == 0 || ns < best)
+        best = ns;
+    }
+    sink = population;
+    return best;
+  };
+
+  double unbuffered = ns_per_message(0);
+  double buffered = ns_per_message(1);
+  double mapped = ns_per_message(2);
+  double uring = ns_per_message(3);
+  double wandio = ns_per_message(4);
+
+  int fd_probe = open(filename, O_RDONLY);
+  bool have_uring = UringInputSource(fd_probe, filename).is_uring();
+
+  (void) unlink(filename);
+
+  std::cout << "sources: ns per message (" << n_messages << " messages of "
+            << data_message.size() << " bytes)" << std::endl
+            << std::fixed << std::setprecision(3)
+            << "  read(2)          " << std::setw(9) << unbuffered << " ns"
+            << std::endl
+            << "  FileInputSource  " << std::setw(9) << buffered << " ns"
+            << "  speedup " << std::setprecision(2)
+            << unbuffered / buffered << "x" << std::endl
+            << std::setprecision(3)
+            << "  MmapInputSource  " << std::setw(9) << mapped << " ns"
+            << "  speedup " << std::setprecision(2)
+            << unbuffered / mapped << "x" << std::endl
+            << std::setprecision(3)
+            << "  UringInputSource " << std::setw(9) << uring << " ns"
+            << "  speedup " << std::setprecision(2)
+            << unbuffered / uring << "x"
+            << (have_uring ? "" : " (no io_uring, buffered)") << std::endl
+            << std::setprecision(3)
+            << "  WandioInputSource" << std::setw(9) << wandio << " ns"
+            << "  speedup " << std::setprecision(2)
+            << unbuffered / wandio << "x" << std::endl;
+}
+
+static void bench_parallel() {
+  InfoModel& model = InfoModel::instance();
+  model.defaultIPFIX();
+
+  static const uint8_t first[] = {
+    0x00,0x0a,0x00,0x56,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,0x00,0x02,0x00,0x18,0x03,0xe9,0x00,0x04,0x01,0x36,0x00,0x04,0x00,0x52,0xff,0xff,0x01,0x37,0x00,0x08,0x00,0x53,0xff,0xff,0x03,0xe9,0x00,0x2e,0x10,0x20,0x30,0x40,0x04,0x65,0x74,0x68,0x30,0x3f,0xee,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x46,0x69,0x72,0x73,0x74,0x20,0x65,0x74,0x68,0x65,0x72,0x6e,0x65,0x74,0x20,0x69,0x6e,0x74,0x65,0x72,0x66,0x61,0x63,0x65 };
+  static const size_t kHeaderAndTemplate = 40;
+  const size_t n_messages = 1000000;
+
+  std::vector<uint8_t> data_message(first, first + 16);
+  data_message.insert(data_message.end(), first + kHeaderAndTemplate,
+                      first + sizeof(first));
+  data_message[3] = static_cast<uint8_t>(data_message.size());
+
+  char filename[] = "/tmp/fcbenchXXXXXX";
+  int fd = mkstemp(filename);
+  if (fd < 0) {
+    std::cerr << "parallel: can't create temporary file" << std::endl;
+    return;
+  }
+
+  std::vector<uint8_t> contents(first, first + sizeof(first));
+  for (size_t i = 1; i < n_messages; ++i)
+    contents.insert(contents.end(), data_message.begin(),
+                    data_message.end());
+  bool written = write(fd, &contents[0], contents.size())
+    == static_cast<ssize_t>(contents.size());
+  (void) close(fd);
+  if (!written) {
+    std::cerr << "parallel: can't write temporary file" << std::endl;
+    (void) unlink(filename);
+    return;
+  }
+
+  class Counter : public PlacementCollector {
+  public:
+    Counter() : PlacementCollector(PlacementCollector::ipfix) {
+      pt.register_placement(InfoModel::instance()
+                              .lookupIE("samplingPopulation"),
+                            &population, 0);
+      register_placement_template(&pt);
+    }
+
+  private:
+    PlacementTemplate pt;
+    uint32_t population;
+  };
+
+  class Collector : public ParallelFileCollector {
+  public:
+    Collector(unsigned int n_workers) : ParallelFileCollector(n_workers) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new Counter();
+    }
+  };
+
+  auto seconds = [](std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                         - start).count();
+  };
+
+  /* Best of a few runs, to keep the page cache out of it. */
+  double sequential = 0;
+  for (int run = 0; run < 3; ++run) {
+    Counter counter;
+    auto start = std::chrono::steady_clock::now();
+    MmapInputSource is(open(filename, O_RDONLY), filename);
+    counter.collect(is);
+    double s = seconds(start);
+    if (run == 0 || s < sequential)
+      sequential = s;
+  }
+
+  unsigned int n_cores = std::max(std::thread::hardware_concurrency(), 1U);
+
+  std::cout << "parallel: messages per second decoding one file ("
+            << n_messages << " messages of " << data_message.size()
+            << " bytes, " << n_cores << " cores)" << std::endl
+            << std::fixed << std::setprecision(0)
+            << "  sequential " << std::setw(12) << n_messages / sequential
+            << " msg/s" << std::endl;
+
+  for (unsigned int n_workers = 1; n_workers <= n_cores; n_workers *= 2) {
+    double best = 0;
+    for (int run = 0; run < 3; ++run) {
+      Collector collector(n_workers);
+      auto start = std::chrono::steady_clock::now();
+      collector.collect(filename);
+      double s = seconds(start);
+      if (run == 0 || s < best)
+        best = s;
+    }
+    std::cout << "  " << std::setw(2) << n_workers << " workers "
+              << std::setw(12) << n_messages / best << " msg/s  speedup "
+              << std::setprecision(2) << sequential / best << "x"
+              << std::setprecision(0) << std::endl;
+  }
+
+  (void) unlink(filename);
+}
+
+static void bench_udp() {
+  InfoModel& model = InfoModel::instance();
+  model.defaultIPFIX();
+
+  /* Each exporter sends its template once, then data-only
+   * messages. */
+  static const uint8_t first[] = {
+    0x00,0x0a,0x00,0x56,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,0x00,0x02,0x00,0x18,0x03,0xe9,0x00,0x04,0x01,0x36,0x00,0x04,0x00,0x52,0xff,0xff,0x01,0x37,0x00,0x08,0x00,0x53,0xff,0xff,0x03,0xe9,0x00,0x2e,0x10,0x20,0x30,0x40,0x04,0x65,0x74,0x68,0x30,0x3f,0xee,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x46,0x69,0x72,0x73,0x74,0x20,0x65,0x74,0x68,0x65,0x72,0x6e,0x65,0x74,0x20,0x69,0x6e,0x74,0x65,0x72,0x66,0x61,0x63,0x65 };
+  static const size_t kHeaderAndTemplate = 40;
+  static const unsigned int n_exporters = 64;
+  static const unsigned int n_messages = 200000;
+
+  std::vector<uint8_t> data_message(first, first + 16);
+  data_message.insert(data_message.end(), first + kHeaderAndTemplate,
+                      first + sizeof(first));
+  data_message[3] = static_cast<uint8_t>(data_message.size());
+
+  class Counter : public PlacementCollector {
+  public:
+    Counter() : PlacementCollector(PlacementCollector::ipfix) {
+      pt.register_placement(InfoModel::instance()
+                              .lookupIE("samplingPopulation"),
+                            &population, 0);
+      register_placement_template(&pt);
+    }
+
+  private:
+    PlacementTemplate pt;
+    uint32_t population;
+  };
+
+  class Collector : public UDPCollector {
+  public:
+    Collector(unsigned int n_shards) : UDPCollector(n_shards) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int shard) {
+      return new Counter();
+    }
+  };
+
+  unsigned int n_cores = std::max(std::thread::hardware_concurrency(), 1U);
+
+  std::cout << "udp: messages per second over loopback (" << n_exporters
+            << " exporters, " << n_messages << " messages of "
+            << data_message.size() << " bytes, " << n_cores << " cores)"
+            << std::endl;
+
+  for (unsigned int n_shards = 1; n_shards <= n_cores; n_shards *= 2) {
+    Collector collector(n_shards);
+    collector.set_receive_buffer_size(8 << 20);
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (collector.bind(reinterpret_cast<struct sockaddr*>(&sa),
+                       sizeof(sa)) != 0) {
+      std::cerr << "udp: can't bind" << std::endl;
+      return;
+    }
+    sa.sin_port = htons(collector.get_port());
+
+    std::thread runner([&collector]() { collector.run(); });
+
+    std::vector<int> fds;
+    for (unsigned int i = 0; i < n_exporters; ++i) {
+      int fd = socket(AF_INET, SOCK_DGRAM, 0);
+      if (fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&sa),
+                            sizeof(sa)) != 0) {
+        std::cerr << "udp: can't connect" << std::endl;
+        break;
+      }
+      fds.push_back(fd);
+      (void) send(fd, first, sizeof(first), 0);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int m = 0; m < n_messages; ++m)
+      (void) send(fds[m % fds.size()], &data_message[0],
+                  data_message.size(), 0);
+
+    /* Wait until everything that wasn't dropped has arrived. */
+    uint64_t expected = n_messages + fds.size();
+    uint64_t seen = 0;
+    auto end = std::chrono::steady_clock::now();
+    while (true) {
+      UDPCollector::Stats stats = collector.get_stats();
+      auto now = std::chrono::steady_clock::now();
+      if (stats.n_datagrams != seen) {
+        seen = stats.n_datagrams;
+        end = now;
+      }
+      if (stats.n_datagrams + stats.n_kernel_drops >= expected
+          || now - end > std::chrono::milliseconds(200))
+        break;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    collector.stop();
+    runner.join();
+    for (auto fd : fds)
+      (void) close(fd);
+
+    UDPCollector::Stats stats = collector.get_stats();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "  " << std::setw(2) << n_shards << " shards "
+              << std::fixed << std::setprecision(0) << std::setw(10)
+              << stats.n_datagrams / seconds << " msg/s  drops "
+              << stats.n_kernel_drops << std::endl;
+  }
+}
+
+static void bench_pipelined() {
+  InfoModel& model = InfoModel::instance();
+  model.defaultIPFIX();
+
+  static const uint8_t first[] = {
+    0x00,0x0a,0x00,0x56,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,0x00,0x02,0x00,0x18,0x03,0xe9,0x00,0x04,0x01,0x36,0x00,0x04,0x00,0x52,0xff,0xff,0x01,0x37,0x00,0x08,0x00,0x53,0xff,0xff,0x03,0xe9,0x00,0x2e,0x10,0x20,0x30,0x40,0x04,0x65,0x74,0x68,0x30,0x3f,0xee,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x46,0x69,0x72,0x73,0x74,0x20,0x65,0x74,0x68,0x65,0x72,0x6e,0x65,0x74,0x20,0x69,0x6e,0x74,0x65,0x72,0x66,0x61,0x63,0x65 };
+  static const size_t kHeaderAndTemplate = 40;
+  const size_t n_messages = 1000000;
+
+  std::vector<uint8_t> data_message(first, first + 16);
+  data_message.insert(data_message.end(), first + kHeaderAndTemplate,
+                      first + sizeof(first));
+  data_message[3] = static_cast<uint8_t>(data_message.size());
+
+  char filename[] = "/tmp/fcbenchXXXXXX";
+  int fd = mkstemp(filename);
+  if (fd < 0) {
+    std::cerr << "pipelined: can't create temporary file" << std::endl;
+    return;
+  }
+
+  std::vector<uint8_t> contents(first, first + sizeof(first));
+  for (size_t i = 1; i < n_messages; ++i)
+    contents.insert(contents.end(), data_message.begin(),
+                    data_message.end());
+  bool written = write(fd, &contents[0], contents.size())
+    == static_cast<ssize_t>(contents.size());
+  (void) close(fd);
+  if (!written) {
+    std::cerr << "pipelined: can't write temporary file" << std::endl;
+    (void) unlink(filename);
+    return;
+  }
+
+  class Counter : public PlacementCollector {
+  public:
+    Counter() : PlacementCollector(PlacementCollector::ipfix) {
+      pt.register_placement(InfoModel::instance()
+                              .lookupIE("samplingPopulation"),
+                            &population, 0);
+      register_placement_template(&pt);
+    }
+
+  private:
+    PlacementTemplate pt;
+    uint32_t population;
+  };
+
+  class Collector : public PipelinedCollector {
+  public:
+    Collector(unsigned int n_workers) : PipelinedCollector(n_workers) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new Counter();
+    }
+  };
+
+  auto seconds = [](std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                         - start).count();
+  };
+
+  /* Both read the file through FileInputSource, as they would a
+   * stream.  Best of a few runs, to keep the page cache out of it. */
+  double sequential = 0;
+  for (int run = 0; run < 3; ++run) {
+    Counter counter;
+    FileInputSource is(open(filename, O_RDONLY), filename);
+    auto start = std::chrono::steady_clock::now();
+    counter.collect(is);
+    double s = seconds(start);
+    if (run == 0 || s < sequential)
+      sequential = s;
+  }
+
+  unsigned int n_cores = std::max(std::thread::hardware_concurrency(), 1U);
+
+  std::cout << "pipelined: messages per second reading one stream ("
+            << n_messages << " messages of " << data_message.size()
+            << " bytes, " << n_cores << " cores)" << std::endl
+            << std::fixed << std::setprecision(0)
+            << "  sequential " << std::setw(12) << n_messages / sequential
+            << " msg/s" << std::endl;
+
+  for (unsigned int n_workers = 1; n_workers <= n_cores; n_workers *= 2) {
+    double best = 0;
+    PipelinedCollector::Stats stats;
+    for (int run = 0; run < 3; ++run) {
+      Collector collector(n_workers);
+      FileInputSource is(open(filename, O_RDONLY), filename);
+      auto start = std::chrono::steady_clock::now();
+      collector.collect(is);
+      double s = seconds(start);
+      if (run == 0 || s < best) {
+        best = s;
+        stats = collector.get_stats();
+      }
+    }
+    std::cout << "  " << std::setw(2) << n_workers << " workers "
+              << std::setw(12) << n_messages / best << " msg/s  speedup "
+              << std::setprecision(2) << sequential / best << "x"
+              << std::setprecision(0) << "  (" << stats.n_batches
+              << " batches, reader stalled " << stats.n_reader_stalls
+              << "x, workers " << stats.n_worker_stalls << "x)"
+              << std::endl;
+  }
+
+  (void) unlink(filename);
+}
+
+static void bench_stealing() {
+  InfoModel& model = InfoModel::instance();
+  model.defaultIPFIX();
+
+  static const uint8_t first[] = {
+    0x00,0x0a,0x00,0x56,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,0x00,0x02,0x00,0x18,0x03,0xe9,0x00,0x04,0x01,0x36,0x00,0x04,0x00,0x52,0xff,0xff,0x01,0x37,0x00,0x08,0x00,0x53,0xff,0xff,0x03,0xe9,0x00,0x2e,0x10,0x20,0x30,0x40,0x04,0x65,0x74,0x68,0x30,0x3f,0xee,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x46,0x69,0x72,0x73,0x74,0x20,0x65,0x74,0x68,0x65,0x72,0x6e,0x65,0x74,0x20,0x69,0x6e,0x74,0x65,0x72,0x66,0x61,0x63,0x65 };
+  static const size_t kHeaderAndTemplate = 40;
+  static const size_t kDataSetLen = sizeof(first) - kHeaderAndTemplate;
+
+  /* A few huge messages, as from a large exporter: every message
+   * but the first holds as many data sets as fit. */
+  const size_t n_sets_per_message = (65535 - 16) / kDataSetLen;
+  const size_t n_messages = 2000;
+
+  std::vector<uint8_t> huge(first, first + 16);
+  for (size_t i = 0; i < n_sets_per_message; ++i)
+    huge.insert(huge.end(), first + kHeaderAndTemplate,
+                first + sizeof(first));
+  huge[2] = static_cast<uint8_t>(huge.size() >> 8);
+  huge[3] = static_cast<uint8_t>(huge.size());
+
+  std::vector<uint8_t> contents(first, first + sizeof(first));
+  for (size_t i = 1; i < n_messages; ++i)
+    contents.insert(contents.end(), huge.begin(), huge.end());
+
+  class Counter : public PlacementCollector {
+  public:
+    Counter() : PlacementCollector(PlacementCollector::ipfix) {
+      pt.register_placement(InfoModel::instance()
+                              .lookupIE("samplingPopulation"),
+                            &population, 0);
+      register_placement_template(&pt);
+    }
+
+  private:
+    PlacementTemplate pt;
+    uint32_t population;
+  };
+
+  class Collector : public WorkStealingCollector {
+  public:
+    Collector(unsigned int n_workers) : WorkStealingCollector(n_workers) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new Counter();
+    }
+  };
+
+  auto seconds = [](std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                         - start).count();
+  };
+
+  const double n_sets = 1 + (n_messages - 1) * n_sets_per_message;
+
+  double sequential = 0;
+  for (int run = 0; run < 3; ++run) {
+    Counter counter;
+    BufferInputSource is(&contents[0], contents.size());
+    auto start = std::chrono::steady_clock::now();
+    counter.collect(is);
+    double s = seconds(start);
+    if (run == 0 || s < sequential)
+      sequential = s;
+  }
+
+  unsigned int n_cores = std::max(std::thread::hardware_concurrency(), 1U);
+
+  std::cout << "stealing: data sets per second in huge messages ("
+            << n_messages << " messages of " << n_sets_per_message
+            << " data sets, " << n_cores << " cores)" << std::endl
+            << std::fixed << std::setprecision(0)
+            << "  sequential " << std::setw(12) << n_sets / sequential
+            << " sets/s" << std::endl;
+
+  for (unsigned int n_workers = 1; n_workers <= n_cores; n_workers *= 2) {
+    double best = 0;
+    WorkStealingCollector::Stats stats;
+    for (int run = 0; run < 3; ++run) {
+      Collector collector(n_workers);
+      BufferInputSource is(&contents[0], contents.size());
+      auto start = std::chrono::steady_clock::now();
+      collector.collect(is);
+      double s = seconds(start);
+      if (run == 0 || s < best) {
+        best = s;
+        stats = collector.get_stats();
+      }
+    }
+    std::cout << "  " << std::setw(2) << n_workers << " workers "
+              << std::setw(12) << n_sets / best << " sets/s  speedup "
+              << std::setprecision(2) << sequential / best << "x"
+              << std::setprecision(0) << "  (" << stats.n_steals
+              << " steals, reader stalled " << stats.n_reader_stalls
+              << "x)" << std::endl;
+  }
+}
+
+int main(int argc, char* const* argv) {
+  static const struct {
+    const char* name;
+    void (*run)();
+  } benchmarks[] = {
+    { "kernels", bench_kernels },
+    { "plans", bench_plans },
+    { "columns", bench_columns },
+    { "strings", bench_strings },
+    { "lookups", bench_lookups },
+    { "logging", bench_logging },
+    { "sources", bench_sources },
+    { "parallel", bench_parallel },
+    { "pipelined", bench_pipelined },
+    { "stealing", bench_stealing },
+    { "udp", bench_udp },
+  };
+  const size_t n_benchmarks = sizeof(benchmarks)/sizeof(benchmarks[0]);
+
+  for (size_t b = 0; b < n_benchmarks; ++b) {
+    bool selected = argc <= 1;
+    for (int i = 1; i < argc; ++i)
+      selected = selected || benchmarks[b].name == std::string(argv[i]);
+    if (selected)
+      benchmarks[b].run();
+  }
+
+  return 0;
+}
@@ -72,16 +72,25 @@
  * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
  */
 #include <cassert>
+#include <cerrno>
+#include <climits>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <list>
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <sys/stat.h>
 
-#include "FileInputSource.h"
+#include "FileIndex.h"
+#include "IndexedFileInputSource.h"
+#include "MmapInputSource.h"
 #include "InfoElement.h"
 #include "InfoModel.h"
 #include "PlacementCollector.h"
@@ -104,6 +113,9 @@ static int message_version = 10;
 static int full_type_flag = 0;
 static std::list<const char*> ie_names;
 static std::string filename;
+static uint32_t begin_time = 0;
+static uint32_t end_time = UINT32_MAX;
+static bool time_window = false;
 
 /* Code patterned after http://www.gnu.org/software/libc/
  * manual/html_node/Getopt-Long-Option-Example.html
@@ -118,12 +130,14 @@ static void parse_options(int argc, char* const* argv) {
       { "message-version", required_argument, 0, 'm' },
       { "specfile", required_argument, 0, 's' },
       { "full-types", no_argument, &full_type_flag, 't' },
+      { "begin", required_argument, 0, 'b' },
+      { "end", required_argument, 0, 'e' },
       { 0, 0, 0, 0 },
     };
 
     int option_index = 0;
 
-    int c = getopt_long(argc, argv, "hi:m:s:tv", options, &option_index);
+    int c = getopt_long(argc, argv, "b:e:hi:m:s:tv", options, &option_index);
 
     if (c == -1)
       break;
@@ -137,6 +151,14 @@ static void parse_options(int argc, char* const* argv) {
         std::cerr << " with arg \"" << optarg << "\"";
       std::cerr << std::endl;
       break;
+    case 'b':
+      begin_time = strtoul(optarg, 0, 10);
+      time_window = true;
+      break;
+    case 'e':
+      end_time = strtoul(optarg, 0, 10);
+      time_window = true;
+      break;
     case 'i':
       filename = optarg;
       break;
@@ -168,6 +190,17 @@ static void parse_options(int argc, char* const* argv) {
 static void help() {
   std::cerr << "usage: ./ipfix2csv [options] ie-names..." << std::endl
             << "Options:" << std::endl
+            << "  -b time|--begin=time" << std::endl
+            << "  -e time|--end=time" << std::endl
+            << "\tonly print messages exported from TIME (inclusive) to"
+            << std::endl
+            << "\tTIME (exclusive), in seconds since the epoch; needs -i."
+            << std::endl
+            << "\tUses the sidecar index FILE.fcidx, and makes it if"
+            << std::endl
+            << "\tthere is none" << std::endl
+            << "  -i file|--input=file" << std::endl
+            << "\tread FILE instead of standard input" << std::endl
             << "  -s file|--specfile=file" << std::endl
             << "\tuse FILE as IE spec filename" << std::endl
             << "  -h|--help\tprint this help text" << std::endl
@@ -571,20 +604,18 @@ public:
     register_placement_template(csv_template);
   }
   
-  std::shared_ptr<ErrorContext>
-      start_placement(const PlacementTemplate* tmpl) {
-    libfc_RETURN_OK();
+  Status on_start_placement(const PlacementTemplate* tmpl) {
+    return Status::ok();
   }
 
-  std::shared_ptr<ErrorContext>
-      end_placement(const PlacementTemplate* tmpl) {
+  Status on_end_placement(const PlacementTemplate* tmpl) {
     for (unsigned int i = 0; i < n_ies; ++i) {
       if (i > 0)
         std::cout << ';';
       ie_values[i].renderer(std::cout, ie_values[i].type, ie_values[i].val);
     }
     std::cout << std::endl;
-    libfc_RETURN_OK();
+    return Status::ok();
   }
 
   ~CSVCollector() {
@@ -608,6 +639,46 @@ private:
   PlacementTemplate* csv_template;
 };
 
+static int open_input() {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Can't open \"" << filename << "\": "
+              << strerror(errno) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+/* Reads a time window through the sidecar index, which is made if
+ * it isn't there yet or doesn't fit the file anymore. */
+static InputSource* open_time_window() {
+  if (filename.empty()) {
+    std::cerr << "--begin and --end need --input" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  int fd = open_input();
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    std::cerr << "Can't stat \"" << filename << "\": "
+              << strerror(errno) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  FileIndex index;
+  std::string index_name = FileIndex::sidecar_name(filename);
+  if (index.load(index_name) != 0 || !index.fits(st)) {
+    std::shared_ptr<ErrorContext> e = index.build(filename);
+    if (e == 0)
+      e = index.save(index_name);
+    if (e != 0)
+      std::cerr << e->to_string() << std::endl;
+  }
+
+  return new IndexedFileInputSource(fd, filename, index,
+                                    begin_time, end_time);
+}
+
 int main(int argc, char* const* argv) {
 #ifdef _libfc_HAVE_LOG4CPLUS_
   log4cplus::PropertyConfigurator config("log4cplus.properties");
@@ -622,7 +693,12 @@ int main(int argc, char* const* argv) {
   if (message_version == 10) {
     InfoModel::instance().default5103();
     protocol = libfc::PlacementCollector::ipfix;
-    is = new FileInputSource(0, "<stdin>"); // 0 == stdin
+    if (time_window)
+      is = open_time_window();
+    else if (!filename.empty())
+      is = new MmapInputSource(open_input(), filename);
+    else
+      is = new MmapInputSource(0, "<stdin>"); // 0 == stdin
   } else if (message_version == 9) {
     InfoModel::instance().default5103();
     protocol = libfc::PlacementCollector::netflowv9;
@@ -31,18 +31,19 @@
 
 namespace libfc {
 
-  BufferInputSource::BufferInputSource(const uint8_t* buf, size_t len) 
-    : buf(new uint8_t[len]), 
+  BufferInputSource::BufferInputSource(const uint8_t* buf, size_t len,
+                                       uint64_t exporter_id,
+                                       size_t base_offset)
+    : buf(buf), 
       len(len), 
       off(0),
-      message_offset(0),
+      message_offset(base_offset),
       current_offset(0),
+      exporter_id(exporter_id),
       name (0) {
-    memcpy(this->buf, buf, len);
   }
 
   BufferInputSource::~BufferInputSource() {
-    delete[] buf;
     delete[] const_cast<char*>(name);
   }
 
@@ -75,8 +76,21 @@ namespace libfc {
     return static_cast<ssize_t>(bytes_to_copy);
   }
 
+  const uint8_t* BufferInputSource::read_view(uint16_t result_len,
+                                              ssize_t* nbytes) {
+    assert(off <= len);
+
+    size_t n = off + result_len > len ? len - off : result_len;
+    const uint8_t* ret = buf + off;
+
+    off += n;
+    current_offset += n;
+    *nbytes = static_cast<ssize_t>(n);
+    return ret;
+  }
+
   bool BufferInputSource::resync() {
-    // TODO
+    /* Nothing to drop; the parser scans forward through read(). */
     return true;
   }
 
@@ -108,4 +122,8 @@ namespace libfc {
     return true;
   }
 
+  uint64_t BufferInputSource::get_exporter_id() const {
+    return exporter_id;
+  }
+
 } // namespace libfc
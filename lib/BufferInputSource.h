@@ -40,27 +40,38 @@ namespace libfc {
   class BufferInputSource : public InputSource {
   public:
     /** Creates a buffer input source from a buffer.
+     *
+     * The buffer is not copied, so it must outlive the input source.
      *
      * @param buf the buffer containing one or more IPFIX messages
      * @param len the length of the buffer in bytes
+     * @param exporter_id what get_exporter_id() returns, for
+     *   messages that came from some exporter in particular
+     * @param base_offset where the buffer starts in a larger input,
+     *   such as a file; get_message_offset(), and therefore error
+     *   messages, count from the start of that input
      */
-    BufferInputSource(const uint8_t* buf, size_t len);
+    BufferInputSource(const uint8_t* buf, size_t len,
+                      uint64_t exporter_id = 0, size_t base_offset = 0);
     ~BufferInputSource();
 
     ssize_t read(uint8_t* buf, uint16_t len);
     ssize_t peek(uint8_t* buf, uint16_t len);
+    const uint8_t* read_view(uint16_t len, ssize_t* nbytes);
     bool resync();
     size_t get_message_offset() const;
     void advance_message_offset();
     const char* get_name() const;
     bool can_peek() const;
+    uint64_t get_exporter_id() const;
 
   private:
-    uint8_t* buf;
+    const uint8_t* buf;
     size_t len;
     size_t off;
     size_t message_offset;
     size_t current_offset;
+    uint64_t exporter_id;
     mutable const char* name;
   };
 
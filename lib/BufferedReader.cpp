@@ -0,0 +1,105 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "BufferedReader.h"
+
+namespace libfc {
+
+  const size_t BufferedReader::kDefaultBlockSize;
+  const size_t BufferedReader::kMinBlockSize;
+
+  BufferedReader::BufferedReader(int fd, size_t block_size)
+    : fd(fd),
+      block_size(std::max(block_size, kMinBlockSize)),
+      begin(0),
+      end(0),
+      at_eof(false) {
+  }
+
+  ssize_t BufferedReader::read(uint8_t* buf, uint16_t len) {
+    ssize_t n = peek(buf, len);
+    if (n > 0)
+      begin += n;
+    return n;
+  }
+
+  ssize_t BufferedReader::peek(uint8_t* buf, uint16_t len) {
+    ssize_t available = fill(len);
+    if (available < 0)
+      return available;
+
+    size_t n = std::min(static_cast<size_t>(available),
+                        static_cast<size_t>(len));
+    memcpy(buf, &buffer[begin], n);
+    return n;
+  }
+
+  void BufferedReader::advise_sequential() {
+#if defined(POSIX_FADV_SEQUENTIAL)
+    /* Fails with ESPIPE on pipes and sockets, which is fine. */
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif /* defined(POSIX_FADV_SEQUENTIAL) */
+  }
+
+  ssize_t BufferedReader::fill(size_t want) {
+    assert(want <= block_size);
+
+    if (buffer.empty())
+      buffer.resize(block_size);
+
+    while (end - begin < want && !at_eof) {
+      /* Move what's left to the front when the rest won't fit. */
+      if (begin == end)
+        begin = end = 0;
+      else if (buffer.size() - begin < want) {
+        memmove(&buffer[0], &buffer[begin], end - begin);
+        end -= begin;
+        begin = 0;
+      }
+
+      ssize_t ret = ::read(fd, &buffer[end], buffer.size() - end);
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      } else if (ret == 0)
+        at_eof = true;
+      else
+        end += ret;
+    }
+
+    return end - begin;
+  }
+
+} // namespace libfc
@@ -0,0 +1,128 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+#ifndef _libfc_BUFFEREDREADER_H_
+#  define _libfc_BUFFEREDREADER_H_
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <vector>
+
+#  include <sys/types.h>
+
+namespace libfc {
+
+  /** Reads ahead from a file descriptor.
+   *
+   * Message stream parsers read a header and then a body for every
+   * message.  Passing these reads straight to read(2) costs two
+   * system calls per message, which dominates parsing small messages
+   * from a file.  This class reads whole blocks instead and serves
+   * the parser's reads from memory.
+   *
+   * Reads return all bytes asked for unless the stream ends or fails;
+   * partial reads from the descriptor (normal for sockets and pipes)
+   * and interrupted calls are retried.
+   */
+  class BufferedReader {
+  public:
+    /** The default block size for files. */
+    static const size_t kDefaultBlockSize = 1 << 20;
+
+    /** The smallest block size; it holds a maximum-size message, so
+     * that any read can be peeked at. */
+    static const size_t kMinBlockSize = 1 << 16;
+
+    /** Creates a reader.
+     *
+     * @param fd the file descriptor to read from; it is not closed
+     *   by the reader
+     * @param block_size how many bytes to read at once; values below
+     *   kMinBlockSize are rounded up
+     */
+    BufferedReader(int fd, size_t block_size = kDefaultBlockSize);
+
+    /** Reads bytes.
+     *
+     * @param buf the buffer in which to put the bytes
+     * @param len the number of bytes to read
+     *
+     * @return the number of bytes read, which is less than len only
+     *   at the end of the stream, or -1 on error
+     */
+    ssize_t read(uint8_t* buf, uint16_t len);
+
+    /** Reads bytes without consuming them.
+     *
+     * @param buf the buffer in which to put the bytes
+     * @param len the number of bytes to peek at
+     *
+     * @return the number of bytes available, which is less than len
+     *   only at the end of the stream, or -1 on error
+     */
+    ssize_t peek(uint8_t* buf, uint16_t len);
+
+    /** Tells the kernel that the descriptor will be read
+     * sequentially, so that it can read ahead more aggressively.
+     *
+     * This is only a hint; it does nothing for descriptors that
+     * aren't regular files.
+     */
+    void advise_sequential();
+
+  private:
+    /** Makes sure that at least want bytes are buffered, unless the
+     * stream ends first.
+     *
+     * @return the number of bytes buffered, or -1 on error
+     */
+    ssize_t fill(size_t want);
+
+    int fd;
+    size_t block_size;
+
+    /** The buffer; allocated on the first read, so that unused
+     * readers cost nothing. */
+    std::vector<uint8_t> buffer;
+
+    /** Index of the first unconsumed byte in buffer. */
+    size_t begin;
+
+    /** Index one past the last valid byte in buffer. */
+    size_t end;
+
+    bool at_eof;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_BUFFEREDREADER_H_
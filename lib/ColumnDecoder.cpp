@@ -0,0 +1,360 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  include <immintrin.h>
+#  define _libfc_COLUMN_X86_
+#endif
+
+#include "BasicOctetArray.h"
+#include "ColumnDecoder.h"
+
+#include "decode_kernels.h"
+
+namespace libfc {
+
+  template<unsigned int W, unsigned int D>
+  static void scalar_column(const uint8_t* buf, size_t stride,
+                            size_t n_records, uint8_t* out) {
+    for (size_t r = 0; r < n_records; ++r)
+      transfer_big_endian<W, D>(buf + r*stride, out + r*D);
+  }
+
+  /** Decodes an integer column with scalar code.
+   *
+   * @param width wire width of the field
+   * @param destination_size native width of the column elements
+   * @param buf the field in the first record
+   * @param stride record length
+   * @param n_records number of records to decode
+   * @param out first element of the column to write
+   */
+  static void scalar_integer_column(unsigned int width,
+                                    unsigned int destination_size,
+                                    const uint8_t* buf, size_t stride,
+                                    size_t n_records, uint8_t* out) {
+    switch (16*width + destination_size) {
+    case 0x11: scalar_column<1, 1>(buf, stride, n_records, out); break;
+    case 0x12: scalar_column<1, 2>(buf, stride, n_records, out); break;
+    case 0x14: scalar_column<1, 4>(buf, stride, n_records, out); break;
+    case 0x18: scalar_column<1, 8>(buf, stride, n_records, out); break;
+    case 0x22: scalar_column<2, 2>(buf, stride, n_records, out); break;
+    case 0x24: scalar_column<2, 4>(buf, stride, n_records, out); break;
+    case 0x28: scalar_column<2, 8>(buf, stride, n_records, out); break;
+    case 0x44: scalar_column<4, 4>(buf, stride, n_records, out); break;
+    case 0x48: scalar_column<4, 8>(buf, stride, n_records, out); break;
+    case 0x88: scalar_column<8, 8>(buf, stride, n_records, out); break;
+    default: assert(0 == "no kernel for integer column"); break;
+    }
+  }
+
+#if defined(_libfc_COLUMN_X86_)
+  /** Builds a byte shuffle mask for one 128-bit lane.
+   *
+   * The lane holds 16/max(in_size, destination_size) fields, each in
+   * an in_size-octet slot.  The mask moves the width octets of each
+   * field into a destination_size-octet output slot, reversing their
+   * order and zeroing the octets above.
+   */
+  static void make_shuffle_mask(uint8_t* mask, unsigned int width,
+                                unsigned int in_size,
+                                unsigned int destination_size) {
+    unsigned int rows = 16 / std::max(in_size, destination_size);
+
+    memset(mask, 0x80, 16);
+    for (unsigned int r = 0; r < rows; ++r)
+      for (unsigned int j = 0; j < width; ++j)
+        mask[r*destination_size + j] = r*in_size + width - 1 - j;
+  }
+
+  /** Decodes as many records as fit into whole vectors with SSSE3.
+   *
+   * There is no gather in SSSE3, so the fields are collected with
+   * scalar loads and then swapped and widened with one shuffle.
+   *
+   * @return number of records decoded
+   */
+  template<unsigned int W, unsigned int D>
+  __attribute__((target("ssse3")))
+  static size_t ssse3_column(const uint8_t* buf, size_t stride,
+                             size_t n_records, uint8_t* out) {
+    const unsigned int in_size = W <= 4 ? 4 : 8;
+    const unsigned int rows = 16 / (in_size > D ? in_size : D);
+
+    uint8_t mask_bytes[16];
+    make_shuffle_mask(mask_bytes, W, in_size, D);
+    const __m128i mask
+      = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask_bytes));
+
+    size_t r = 0;
+    for (; r + rows <= n_records; r += rows) {
+      /* Assemble the vector in registers; going through memory would
+       * defeat store forwarding. */
+      __m128i v;
+      if (in_size == 4) {
+        __m128i f[4];
+        for (unsigned int k = 0; k < 4; ++k) {
+          uint32_t x = 0;
+          if (k < rows)
+            memcpy(&x, buf + (r + k)*stride, sizeof x);
+          f[k] = _mm_cvtsi32_si128(x);
+        }
+        v = _mm_unpacklo_epi64(_mm_unpacklo_epi32(f[0], f[1]),
+                               _mm_unpacklo_epi32(f[2], f[3]));
+      } else {
+        v = _mm_unpacklo_epi64(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(buf + r*stride)),
+          _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(buf + (r + 1)*stride)));
+      }
+      v = _mm_shuffle_epi8(v, mask);
+
+      uint8_t* q = out + r*D;
+      switch (rows*D) {
+      case 16:
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(q), v);
+        break;
+      case 8:
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(q), v);
+        break;
+      case 4:
+        {
+          uint32_t x = _mm_cvtsi128_si32(v);
+          memcpy(q, &x, sizeof x);
+        }
+        break;
+      }
+    }
+
+    return r;
+  }
+
+  static size_t ssse3_integer_column(unsigned int width,
+                                     unsigned int destination_size,
+                                     const uint8_t* buf, size_t stride,
+                                     size_t n_records, uint8_t* out) {
+    switch (16*width + destination_size) {
+    case 0x11: return ssse3_column<1, 1>(buf, stride, n_records, out);
+    case 0x12: return ssse3_column<1, 2>(buf, stride, n_records, out);
+    case 0x14: return ssse3_column<1, 4>(buf, stride, n_records, out);
+    case 0x18: return ssse3_column<1, 8>(buf, stride, n_records, out);
+    case 0x22: return ssse3_column<2, 2>(buf, stride, n_records, out);
+    case 0x24: return ssse3_column<2, 4>(buf, stride, n_records, out);
+    case 0x28: return ssse3_column<2, 8>(buf, stride, n_records, out);
+    case 0x44: return ssse3_column<4, 4>(buf, stride, n_records, out);
+    case 0x48: return ssse3_column<4, 8>(buf, stride, n_records, out);
+    case 0x88: return ssse3_column<8, 8>(buf, stride, n_records, out);
+    default: return 0;
+    }
+  }
+
+  /** Decodes as many records as fit into whole vectors with AVX2.
+   *
+   * Fields are collected with one gather per vector, then swapped
+   * and narrowed or widened to the destination size.
+   *
+   * @return number of records decoded
+   */
+  __attribute__((target("avx2")))
+  static size_t avx2_column(unsigned int width,
+                            unsigned int destination_size,
+                            const uint8_t* buf, size_t stride,
+                            size_t n_records, uint8_t* out) {
+    const int s = static_cast<int>(stride);
+    uint8_t mask_bytes[16];
+    size_t r = 0;
+
+    if (width <= 4) {
+      /* Eight fields in 32-bit slots; the shuffle produces at most
+       * 32-bit results, which are widened below if need be. */
+      make_shuffle_mask(mask_bytes, width, 4,
+                        std::min(destination_size, 4U));
+      const __m256i mask = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask_bytes)));
+      const __m256i index
+        = _mm256_setr_epi32(0, s, 2*s, 3*s, 4*s, 5*s, 6*s, 7*s);
+
+      for (; r + 8 <= n_records; r += 8) {
+        __m256i v = _mm256_i32gather_epi32(
+          reinterpret_cast<const int*>(buf + r*stride), index, 1);
+        v = _mm256_shuffle_epi8(v, mask);
+
+        uint8_t* q = out + r*destination_size;
+        switch (destination_size) {
+        case 1:
+          v = _mm256_permutevar8x32_epi32(
+            v, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+          _mm_storel_epi64(reinterpret_cast<__m128i*>(q),
+                           _mm256_castsi256_si128(v));
+          break;
+        case 2:
+          v = _mm256_permutevar8x32_epi32(
+            v, _mm256_setr_epi32(0, 1, 4, 5, 0, 0, 0, 0));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(q),
+                           _mm256_castsi256_si128(v));
+          break;
+        case 4:
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(q), v);
+          break;
+        case 8:
+          _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(q),
+            _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v)));
+          _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(q + 32),
+            _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1)));
+          break;
+        }
+      }
+    } else {
+      /* Four 64-bit fields. */
+      make_shuffle_mask(mask_bytes, 8, 8, 8);
+      const __m256i mask = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask_bytes)));
+      const __m128i index = _mm_setr_epi32(0, s, 2*s, 3*s);
+
+      for (; r + 4 <= n_records; r += 4) {
+        __m256i v = _mm256_i32gather_epi64(
+          reinterpret_cast<const long long*>(buf + r*stride), index, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + r*8),
+                            _mm256_shuffle_epi8(v, mask));
+      }
+    }
+
+    return r;
+  }
+#endif /* defined(_libfc_COLUMN_X86_) */
+
+  ColumnDecoder::ColumnDecoder(const DecodePlan* plan)
+    : plan(plan),
+      stride(plan->get_fixed_prefix_length()),
+      isa(best_isa()) {
+    assert(plan->is_fixed_stride());
+
+    for (size_t k = 0; k < plan->plan.size(); ++k) {
+      const DecodePlan::Decision& d = plan->plan[k];
+      Column c;
+
+      c.decision = k;
+      c.offset = d.offset;
+      c.width = 0;
+      c.base = static_cast<uint8_t*>(d.p);
+
+      c.element_size = plan->element_sizes[k];
+
+      switch (d.type) {
+      case DecodePlan::Decision::transfer_be_1_1:
+      case DecodePlan::Decision::transfer_be_1_2:
+      case DecodePlan::Decision::transfer_be_1_4:
+      case DecodePlan::Decision::transfer_be_1_8:
+      case DecodePlan::Decision::transfer_be_2_2:
+      case DecodePlan::Decision::transfer_be_2_4:
+      case DecodePlan::Decision::transfer_be_2_8:
+      case DecodePlan::Decision::transfer_be_4_4:
+      case DecodePlan::Decision::transfer_be_4_8:
+      case DecodePlan::Decision::transfer_be_8_8:
+        c.width = d.length;
+        break;
+
+      default:
+        break;
+      }
+
+      columns.push_back(c);
+    }
+  }
+
+  void ColumnDecoder::decode_column(const Column& c, const uint8_t* buf,
+                                    size_t n_records, size_t first_row) {
+    const uint8_t* in = buf + c.offset;
+    uint8_t* out = c.base + first_row*c.element_size;
+
+    if (c.width != 0) {
+      size_t done = 0;
+
+#if defined(_libfc_COLUMN_X86_)
+      if (isa != isa_scalar) {
+        /* The vector code loads 4 or 8 octets per field, which may be
+         * more than the field has.  Leave the records at the end for
+         * which that would read beyond the last record. */
+        const size_t load = c.width <= 4 ? 4 : 8;
+        const size_t end = n_records*stride;
+        size_t safe = n_records;
+        while (safe > 0 && (safe - 1)*stride + c.offset + load > end)
+          --safe;
+
+        if (isa == isa_avx2)
+          done = avx2_column(c.width, c.element_size, in, stride, safe, out);
+        else
+          done = ssse3_integer_column(c.width, c.element_size, in, stride,
+                                      safe, out);
+      }
+#endif /* defined(_libfc_COLUMN_X86_) */
+
+      scalar_integer_column(c.width, c.element_size, in + done*stride,
+                            stride, n_records - done,
+                            out + done*c.element_size);
+    } else {
+      const DecodePlan::Decision& d = plan->plan[c.decision];
+      for (size_t r = 0; r < n_records; ++r)
+        DecodePlan::transfer_fixed(d, in + r*stride, out + r*c.element_size);
+    }
+  }
+
+  void ColumnDecoder::decode(const uint8_t* buf, size_t n_records,
+                             size_t first_row) {
+    for (auto c = columns.begin(); c != columns.end(); ++c)
+      decode_column(*c, buf, n_records, first_row);
+  }
+
+  uint16_t ColumnDecoder::get_stride() const {
+    return stride;
+  }
+
+  ColumnDecoder::isa_t ColumnDecoder::get_isa() const {
+    return isa;
+  }
+
+  void ColumnDecoder::set_isa(isa_t isa) {
+    isa_t best = best_isa();
+    this->isa = isa > best ? best : isa;
+  }
+
+  ColumnDecoder::isa_t ColumnDecoder::best_isa() {
+#if defined(_libfc_COLUMN_X86_)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return isa_avx2;
+    if (__builtin_cpu_supports("ssse3"))
+      return isa_ssse3;
+#endif /* defined(_libfc_COLUMN_X86_) */
+    return isa_scalar;
+  }
+
+} // namespace libfc
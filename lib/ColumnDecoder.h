@@ -0,0 +1,163 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_COLUMNDECODER_H_
+#  define _libfc_COLUMNDECODER_H_
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <vector>
+
+#  include "DecodePlan.h"
+
+namespace libfc {
+
+  /** Decodes entire data sets of fixed-length records into columns.
+   *
+   * If a wire template has no variable-length fields, every record in
+   * a data set starts at a multiple of the record length.  Instead of
+   * decoding record by record, this class decodes one IE at a time
+   * for many records at once, and writes the values into an array
+   * (a column) per IE.
+   *
+   * The columns are taken from the decode plan: each placement
+   * pointer in the plan's placement template is taken to be the start
+   * of an array of values of the placement's type, e.g., an array of
+   * uint32_t for sourceIPv4Address, or an array of BasicOctetArray
+   * for a fixed-length octetArray IE.  Row r of the column for a
+   * decision thus lives at that pointer plus r times the size of the
+   * native type.
+   *
+   * Big-endian integer transfers (see decode_kernels.h) are done with
+   * AVX2 gathers and byte shuffles where the CPU supports them, with
+   * SSSE3 byte shuffles as a second choice and with scalar code
+   * otherwise.  The choice is made at runtime.  All other transfers
+   * use the scalar code of DecodePlan.
+   */
+  class ColumnDecoder {
+  public:
+    /** Instruction set used for integer columns. */
+    enum isa_t {
+      /** Portable scalar code. */
+      isa_scalar,
+
+      /** 128-bit byte shuffles (x86 SSSE3). */
+      isa_ssse3,
+
+      /** 256-bit gathers and byte shuffles (x86 AVX2). */
+      isa_avx2,
+    };
+
+    /** Creates a column decoder for a plan.
+     *
+     * @param plan a plan with is_fixed_stride() true.  The plan must
+     *   outlive the decoder.
+     */
+    explicit ColumnDecoder(const DecodePlan* plan);
+
+    /** Decodes a number of consecutive records.
+     *
+     * The caller must make sure that buf contains at least n_records
+     * times get_stride() octets.
+     *
+     * @param buf first octet of the first record to decode
+     * @param n_records number of records to decode
+     * @param first_row row in the columns where the first record goes
+     */
+    void decode(const uint8_t* buf, size_t n_records, size_t first_row);
+
+    /** Returns the record length.
+     *
+     * @return the distance between two records in a data set
+     */
+    uint16_t get_stride() const;
+
+    /** Returns the instruction set in use.
+     *
+     * @return the instruction set used for integer columns
+     */
+    isa_t get_isa() const;
+
+    /** Selects the instruction set to use.
+     *
+     * This is meant for testing and benchmarking.  Asking for an
+     * instruction set that the CPU doesn't support selects the best
+     * one that it does.
+     *
+     * @param isa the instruction set to use
+     */
+    void set_isa(isa_t isa);
+
+    /** Determines the best instruction set for this CPU.
+     *
+     * @return the best supported instruction set
+     */
+    static isa_t best_isa();
+
+  private:
+    /** One output column. */
+    struct Column {
+      /** Index of the decision in the plan. */
+      size_t decision;
+
+      /** Offset of the field in the record. */
+      uint16_t offset;
+
+      /** Wire width, for integer columns, else 0. */
+      uint8_t width;
+
+      /** Size of one element of the column. */
+      uint16_t element_size;
+
+      /** Start of the column. */
+      uint8_t* base;
+    };
+
+    void decode_column(const Column& c, const uint8_t* buf,
+                       size_t n_records, size_t first_row);
+
+    /** The plan; owns the decisions the columns refer to. */
+    const DecodePlan* plan;
+
+    /** The columns, in record order. */
+    std::vector<Column> columns;
+
+    /** Record length. */
+    uint16_t stride;
+
+    /** Instruction set in use. */
+    isa_t isa;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_COLUMNDECODER_H_
@@ -30,4 +30,9 @@ namespace libfc {
   ContentHandler::~ContentHandler() {
   }
 
+  std::shared_ptr<ErrorContext>
+  ContentHandler::set_exporter(uint64_t exporter_id) {
+    libfc_RETURN_OK();
+  }
+
 } // namespace libfc
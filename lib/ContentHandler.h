@@ -72,6 +72,22 @@ namespace libfc {
      */
     virtual std::shared_ptr<ErrorContext> end_session() = 0;
 
+    /** Receives notification of the exporter of the next message.
+     *
+     * This is called before every start_message(), with the value of
+     * InputSource::get_exporter_id().  Handlers that keep templates
+     * should keep them per exporter, since different exporters may
+     * use the same observation domains and template IDs.
+     *
+     * The default implementation does nothing.
+     *
+     * @param exporter_id identifies the exporter of the next message
+     *
+     * @return a (shared) pointer to an error context, or null if no
+     * error occurred
+     */
+    virtual std::shared_ptr<ErrorContext> set_exporter(uint64_t exporter_id);
+
     /** Receives notification that a new message has started.
      *
      * This callback reports properties of the message, some taken
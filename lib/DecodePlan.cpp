@@ -26,16 +26,15 @@
 #include <climits>
 #include <sstream>
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#include "logging.h"
 
 #include "BasicOctetArray.h"
 #include "DecodePlan.h"
+#include "NativeDecoder.h"
+#include "OctetArrayView.h"
 #include "PlacementTemplate.h"
 
+#include "decode_kernels.h"
 #include "decode_util.h"
 #include "ipfix_endian.h"
 
@@ -44,6 +43,13 @@
 
 namespace libfc {
 
+  libfc_DEFINE_LOGGER(logger, "DecodePlan");
+
+  /** Number of executions after which a plan is compiled to native
+   * code.  Most templates decode only a few records; the ones that
+   * decode many are worth the compilation. */
+  static const uint32_t kNativeCompileThreshold = 1024;
+
   std::string DecodePlan::Decision::to_string() const {
     std::stringstream sstr;
 
@@ -69,8 +75,25 @@ namespace libfc {
       sstr << "transfer_float_into_double_endianness"; break;
     case transfer_varlen:
       sstr << "transfer_varlen"; break;
+    case transfer_be_1_1:
+    case transfer_be_1_2:
+    case transfer_be_1_4:
+    case transfer_be_1_8:
+    case transfer_be_2_2:
+    case transfer_be_2_4:
+    case transfer_be_2_8:
+    case transfer_be_4_4:
+    case transfer_be_4_8:
+    case transfer_be_8_8:
+      sstr << "transfer_be_" << length << "_" << destination_size; break;
+    case transfer_octets_16:
+      sstr << "transfer_octets_16"; break;
+    case reference_fixlen_octets:
+      sstr << "reference_fixlen_octets " << length; break;
+    case reference_varlen:
+      sstr << "reference_varlen"; break;
     };
-    sstr << "]";
+    sstr << " @" << offset << "]";
   
     return sstr.str();
   }
@@ -78,14 +101,14 @@ namespace libfc {
 
   DecodePlan::DecodePlan(const libfc::PlacementTemplate* placement_template,
                          const libfc::IETemplate* wire_template) 
-    : plan(wire_template->size())
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-    ,
-      logger(log4cplus::Logger::getInstance(LOG4CPLUS_TEXT("DecodePlan")))
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+    : prefix_decisions(0),
+      fixed_prefix_length(0),
+      native_decoder(0),
+      native_prefix(0),
+      executions_until_compile(kNativeCompileThreshold)
   {
 
-    LOG4CPLUS_TRACE(logger, "ENTER DecodePlan::DecodePlan (wt with "
+    LOG4CPLUS_TRACE(logger(), "ENTER DecodePlan::DecodePlan (wt with "
                     << wire_template->size() << " entries)");
 
 #if defined(IPFIX_BIG_ENDIAN)
@@ -102,17 +125,22 @@ namespace libfc {
 #  error libfc does not compile on weird-endian machines.
 #endif
 
+    /* Decisions in wire template order, and the wire IE for each. */
+    std::vector<Decision> decisions(wire_template->size());
+    std::vector<const InfoElement*> ies(wire_template->size());
+
     unsigned int decision_number = 0;
     for (auto ie = wire_template->begin(); ie != wire_template->end(); ie++) {
       assert(*ie != 0);
-      LOG4CPLUS_TRACE(logger, "  decision " << (decision_number + 1)
+      LOG4CPLUS_TRACE(logger(), "  decision " << (decision_number + 1)
                       << ": looking up placement for " << (*ie)->toIESpec());
 
-      Decision d;
+      Decision d = Decision();
+      const InfoElement* wire_ie = 0;
 
       if (placement_template->lookup_placement(*ie, &d.p, 0)) { /* IE present */
-        LOG4CPLUS_TRACE(logger, "    found -> transfer");
-        d.wire_ie = *ie;
+        LOG4CPLUS_TRACE(logger(), "    found -> transfer");
+        wire_ie = *ie;
 
         /* This object is needed for an interesting reason.  Previous
          * versions of this code had lines like these:
@@ -226,7 +254,7 @@ namespace libfc {
 
         case libfc::IEType::kFloat64:
           assert((*ie)->len() == sizeof(float)
-                 || d.length == sizeof(double));
+                 || (*ie)->len() == sizeof(double));
           d.length = (*ie)->len();
           if (d.length == sizeof(float))
             d.type = transfer_float_into_double_maybe_endianness;
@@ -341,8 +369,16 @@ namespace libfc {
           report_error("Unknown IE type");
           break;
         }
+
+        /* Octet strings that the user wants to see in place. */
+        if (placement_template->is_reference_placement(*ie)) {
+          if (d.type == Decision::transfer_varlen)
+            d.type = Decision::reference_varlen;
+          else if (d.type == Decision::transfer_fixlen_octets)
+            d.type = Decision::reference_fixlen_octets;
+        }
       } else {                    /* Encode skip decision */
-        LOG4CPLUS_TRACE(logger, "    not found -> skip");
+        LOG4CPLUS_TRACE(logger(), "    not found -> skip");
         if ((*ie)->len() == libfc::kIpfixVarlen) {
           d.type = Decision::skip_varlen;
         } else {
@@ -351,37 +387,140 @@ namespace libfc {
         }
       }
 
-      plan[decision_number++] = d;
-      LOG4CPLUS_TRACE(logger, "  decision " << decision_number
+      specialize(d);
+      ies[decision_number] = wire_ie;
+      decisions[decision_number++] = d;
+      LOG4CPLUS_TRACE(logger(), "  decision " << decision_number
                       << " entered as " << d.to_string());
     }
 
-    /* Coalesce adjacent skip_fixlen decisions. */
-    for (auto decision = plan.begin(); decision != plan.end(); ++decision) {
-      if (decision->type == Decision::skip_fixlen) {
-        auto skips = decision;
-        auto next = decision;
-        uint16_t length = decision->length;
-      
-        ++next;
-        for (++skips;
-             skips != plan.end() && skips->type == Decision::skip_fixlen;
-             ++skips)
-          length += skips->length;
-        plan.erase(next, skips);
-        decision->length = length;
+    /* Compile the fixed-length prefix.  Every field before the first
+     * varlen field is at a fixed offset, so transfers get absolute
+     * offsets and skips disappear. */
+    size_t k = 0;
+    size_t offset = 0;
+    for (; k < decisions.size(); ++k) {
+      Decision& d = decisions[k];
+      if (d.type == Decision::skip_varlen
+          || d.type == Decision::transfer_varlen
+          || d.type == Decision::reference_varlen)
+        break;
+
+      if (d.type != Decision::skip_fixlen) {
+        d.offset = static_cast<uint16_t>(offset);
+        plan.push_back(d);
+        wire_ies.push_back(ies[k]);
+      }
+      offset += d.length;
+
+      if (offset > USHRT_MAX)
+        report_error("fixed-length prefix of template longer than %d bytes",
+                     USHRT_MAX);
+    }
+    prefix_decisions = plan.size();
+    fixed_prefix_length = static_cast<uint16_t>(offset);
+
+    /* The rest is executed sequentially.  Coalesce adjacent
+     * skip_fixlen decisions. */
+    for (; k < decisions.size(); ++k) {
+      const Decision& d = decisions[k];
+      if (d.type == Decision::skip_fixlen
+          && plan.size() > prefix_decisions
+          && plan.back().type == Decision::skip_fixlen
+          && plan.back().length + d.length <= USHRT_MAX)
+        plan.back().length += d.length;
+      else {
+        plan.push_back(d);
+        wire_ies.push_back(ies[k]);
       }
     }
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-    if (logger.getLogLevel() <= log4cplus::DEBUG_LOG_LEVEL) {
-      LOG4CPLUS_TRACE(logger, "  plan is: ");
+    for (auto d = plan.begin(); d != plan.end(); ++d)
+      element_sizes.push_back(column_element_size(*d));
+
+#if libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE
+    if (logger().getLogLevel() <= log4cplus::TRACE_LOG_LEVEL) {
+      LOG4CPLUS_TRACE(logger(), "  plan is: ");
       for (auto d = plan.begin(); d != plan.end(); ++d)
-        LOG4CPLUS_TRACE(logger, "    " << d->to_string());
+        LOG4CPLUS_TRACE(logger(), "    " << d->to_string());
     }
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#endif /* libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE */
+
+    LOG4CPLUS_TRACE(logger(), "LEAVE DecodePlan::DecodePlan");
+  }
+
+  DecodePlan::~DecodePlan() {
+    delete native_decoder;
+  }
+
+  bool DecodePlan::compile() {
+    if (native_prefix != 0)
+      return true;
+
+    /* Don't try again on the automatic path, whatever happens. */
+    executions_until_compile = 0;
+
+    if (!NativeDecoder::is_supported() || prefix_decisions == 0)
+      return false;
+
+    NativeDecoder* decoder = new NativeDecoder();
+
+    for (size_t k = 0; k < prefix_decisions; ++k) {
+      const Decision& d = plan[k];
+
+      switch (d.type) {
+      case Decision::transfer_be_1_1:
+      case Decision::transfer_be_1_2:
+      case Decision::transfer_be_1_4:
+      case Decision::transfer_be_1_8:
+      case Decision::transfer_be_2_2:
+      case Decision::transfer_be_2_4:
+      case Decision::transfer_be_2_8:
+      case Decision::transfer_be_4_4:
+      case Decision::transfer_be_4_8:
+      case Decision::transfer_be_8_8:
+        decoder->emit_transfer_big_endian(d.offset, d.length,
+                                          d.destination_size, d.p);
+        break;
+
+      case Decision::transfer_octets_16:
+        decoder->emit_transfer_octets_16(d.offset, d.p);
+        break;
+
+      case Decision::transfer_float_into_double_endianness:
+        decoder->emit_transfer_float_into_double(d.offset, d.p);
+        break;
+
+      case Decision::reference_fixlen_octets:
+        decoder->emit_reference_octets(d.offset, d.length, d.p);
+        break;
+
+      default:
+        LOG4CPLUS_TRACE(logger(), "  not compiling plan: unsupported "
+                        << d.to_string());
+        delete decoder;
+        return false;
+      }
+    }
+
+    if (!decoder->finish()) {
+      delete decoder;
+      return false;
+    }
+
+    LOG4CPLUS_TRACE(logger(), "  compiled " << prefix_decisions
+                    << " decisions into " << decoder->size() << " bytes");
+    native_decoder = decoder;
+    native_prefix = decoder->get_function();
+    return true;
+  }
 
-    LOG4CPLUS_TRACE(logger, "LEAVE DecodePlan::DecodePlan");
+  void DecodePlan::set_compile_threshold(uint32_t executions) {
+    executions_until_compile = executions;
+  }
+
+  bool DecodePlan::is_compiled() const {
+    return native_prefix != 0;
   }
 
   static uint16_t decode_varlen_length(const uint8_t** cur,
@@ -439,198 +578,319 @@ namespace libfc {
   }
 #endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
 
-  uint16_t DecodePlan::execute(const uint8_t* buf, uint16_t length) {
-    LOG4CPLUS_TRACE(logger, "ENTER DecodePlan::execute");
+  void DecodePlan::specialize(Decision& d) {
+    static const struct {
+      uint16_t length;
+      uint16_t destination_size;
+      Decision::decision_type_t type;
+    } kernels[] = {
+      { 1, 1, Decision::transfer_be_1_1 },
+      { 1, 2, Decision::transfer_be_1_2 },
+      { 1, 4, Decision::transfer_be_1_4 },
+      { 1, 8, Decision::transfer_be_1_8 },
+      { 2, 2, Decision::transfer_be_2_2 },
+      { 2, 4, Decision::transfer_be_2_4 },
+      { 2, 8, Decision::transfer_be_2_8 },
+      { 4, 4, Decision::transfer_be_4_4 },
+      { 4, 8, Decision::transfer_be_4_8 },
+      { 8, 8, Decision::transfer_be_8_8 },
+    };
 
-    const uint8_t* cur = buf;
-    const uint8_t* buf_end = buf + length;
+    /* On big-endian machines, transfer_fixlen right-justifies the
+     * value, which is the same as zero-extending it.  On little-endian
+     * machines, it is a plain copy, which is the same as the
+     * conversion only for single octets. */
+#if defined(IPFIX_BIG_ENDIAN)
+    bool is_integer = d.type == Decision::transfer_fixlen
+      || d.type == Decision::transfer_fixlen_endianness;
+#else
+    bool is_integer = d.type == Decision::transfer_fixlen_endianness
+      || (d.type == Decision::transfer_fixlen && d.length == 1);
+#endif
 
-    for (auto i = plan.begin(); i != plan.end(); ++i) {
-      assert(cur < buf_end);
+    if (d.type == Decision::transfer_fixlen
+        && d.length == 16 && d.destination_size == 16) {
+      d.type = Decision::transfer_octets_16;
+      return;
+    }
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-      switch (i->type) {
-      case Decision::skip_fixlen:
-        LOG4CPLUS_TRACE(logger, "  decision: skip_fixlen");
-        break;
-      case Decision::skip_varlen:
-        LOG4CPLUS_TRACE(logger, "  decision: skip_varlen");
-        break;
-      case Decision::transfer_boolean:
-        LOG4CPLUS_TRACE(logger, "  decision: transfer_boolean");
-        break;
-      case Decision::transfer_fixlen:
-        LOG4CPLUS_TRACE(logger, "  decision: transfer_fixlen");
-        break;
-      case Decision::transfer_fixlen_endianness:
-        LOG4CPLUS_TRACE(logger, "  decision: transfer_fixlen_endianness");
-        break;
-      case Decision::transfer_varlen:
-        LOG4CPLUS_TRACE(logger, "  decision: transfer_varlen");
-        break;
-      case Decision::transfer_fixlen_octets:
-        LOG4CPLUS_TRACE(logger, "  decision: transfer_fixlen_octets");
-        break;
-      case Decision::transfer_float_into_double:
-        LOG4CPLUS_TRACE(logger, "  decision: transfer_float_into_double");
-        break;
-      case Decision::transfer_float_into_double_endianness:
-        LOG4CPLUS_TRACE(logger, "  decision: transfer_float_into_double_endianness");
-        break;
+    if (!is_integer)
+      return;
+
+    for (size_t k = 0; k < sizeof(kernels)/sizeof(kernels[0]); ++k) {
+      if (kernels[k].length == d.length
+          && kernels[k].destination_size == d.destination_size) {
+        d.type = kernels[k].type;
+        return;
       }
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+    }
+  }
 
-      switch (i->type) {
-      case Decision::skip_fixlen:
-        assert (cur + i->length <= buf_end);
-        cur += i->length;
-        break;
+  void DecodePlan::transfer_fixed(const Decision& d, const uint8_t* cur,
+                                  void* p) {
+    switch (d.type) {
+    case Decision::transfer_boolean:
+      // Undo RFC 2579 madness
+      {
+        bool *q = static_cast<bool*>(p);
+        if (*cur == 1)
+          *q = 1;
+        else if (*cur == 2)
+          *q = 0;
+        else
+          report_error("bool encoding wrong");
+      }
+      break;
+
+    case Decision::transfer_be_1_1:
+      transfer_big_endian<1, 1>(cur, p); break;
+    case Decision::transfer_be_1_2:
+      transfer_big_endian<1, 2>(cur, p); break;
+    case Decision::transfer_be_1_4:
+      transfer_big_endian<1, 4>(cur, p); break;
+    case Decision::transfer_be_1_8:
+      transfer_big_endian<1, 8>(cur, p); break;
+    case Decision::transfer_be_2_2:
+      transfer_big_endian<2, 2>(cur, p); break;
+    case Decision::transfer_be_2_4:
+      transfer_big_endian<2, 4>(cur, p); break;
+    case Decision::transfer_be_2_8:
+      transfer_big_endian<2, 8>(cur, p); break;
+    case Decision::transfer_be_4_4:
+      transfer_big_endian<4, 4>(cur, p); break;
+    case Decision::transfer_be_4_8:
+      transfer_big_endian<4, 8>(cur, p); break;
+    case Decision::transfer_be_8_8:
+      transfer_big_endian<8, 8>(cur, p); break;
+    case Decision::transfer_octets_16:
+      transfer_octets<16>(cur, p); break;
+
+    case Decision::transfer_fixlen:
+      assert(d.length <= d.destination_size);
+
+      /* Assume all-zero bit pattern is zero, null, 0.0 etc.  The
+       * common widths have been specialised away by specialize(), so
+       * this handles only the odd ones (e.g., MAC addresses). */
+      {
+        uint8_t* q = static_cast<uint8_t*>(p);
+        memset(q, '\0', d.destination_size);
+        // Intention: right-justify value at cur in field at p
+        memcpy(q + d.destination_size - d.length, cur, d.length);
+      }
+      break;
+
+    case Decision::transfer_fixlen_endianness:
+      assert(d.length <= d.destination_size);
+
+      /* Assume all-zero bit pattern is zero, null, 0.0 etc.  As
+       * above, only odd widths (3, 5, 6 or 7 octets) end up here. */
+      {
+        uint8_t* q = static_cast<uint8_t*>(p);
+        memset(q, '\0', d.destination_size);
+        // Intention: left-justify value at cur in field at p
+        for (uint16_t k = 0; k < d.length; k++)
+          q[k] = cur[d.length - (k + 1)];
+      }
+      break;
+
+    case Decision::transfer_fixlen_octets:
+      reinterpret_cast<libfc::BasicOctetArray*>(p)->copy_content(cur,
+                                                                 d.length);
+      break;
+
+    case Decision::reference_fixlen_octets:
+      static_cast<OctetArrayView*>(p)->set(cur, d.length);
+      break;
+
+    case Decision::transfer_float_into_double:
+      {
+        float f;
+        memcpy(&f, cur, sizeof(float));
+        *static_cast<double*>(p) = f;
+      }
+      break;
+
+    case Decision::transfer_float_into_double_endianness:
+      {
+        uint32_t bits = load_big_endian<sizeof(float)>(cur);
+        float f;
+        memcpy(&f, &bits, sizeof(float));
+        *static_cast<double*>(p) = f;
+      }
+      break;
 
-      case Decision::skip_varlen:
-        {
-          uint16_t varlen_length = decode_varlen_length(&cur, buf_end);
-          assert(cur + varlen_length <= buf_end);
-          cur += varlen_length;
-        }
-        break;
+    default:
+      assert(0 == "transfer_fixed() called on skip or varlen decision");
+      break;
+    }
+  }
 
-      case Decision::transfer_boolean:
-        assert(cur + 1 <= buf_end);
-        // Undo RFC 2579 madness
-        {
-          bool *q = static_cast<bool*>(i->p);
-          if (*cur == 1)
-            *q = 1;
-          else if (*cur == 2)
-            *q = 0;
-          else
-            report_error("bool encoding wrong");
-        }
-        cur++;
-        break;
+  uint16_t DecodePlan::column_element_size(const Decision& d) {
+    switch (d.type) {
+    case Decision::transfer_boolean:
+      return sizeof(bool);
+    case Decision::transfer_fixlen_octets:
+    case Decision::transfer_varlen:
+      return sizeof(BasicOctetArray);
+    case Decision::transfer_float_into_double:
+    case Decision::transfer_float_into_double_endianness:
+      return sizeof(double);
+    case Decision::transfer_octets_16:
+      return 16;
+    case Decision::reference_fixlen_octets:
+    case Decision::reference_varlen:
+      return sizeof(OctetArrayView);
+    case Decision::skip_fixlen:
+    case Decision::skip_varlen:
+      return 0;
+    default:
+      return d.destination_size;
+    }
+  }
 
-      case Decision::transfer_fixlen:
-        if (cur + i->length > buf_end) {
-          std::string ie_spec = i->wire_ie->toIESpec();
-          report_error("IE %s length beyond buffer: cur=%p, ielen=%zu, end=%p",
-                       ie_spec.c_str(), cur, i->length, buf_end);
-        }
+  void DecodePlan::report_overrun(size_t decision_number,
+                                  const uint8_t* cur,
+                                  const uint8_t* buf_end) const {
+    const InfoElement* ie = wire_ies[decision_number];
+    std::string ie_spec = ie != 0 ? ie->toIESpec() : "(skipped)";
+    report_error("IE %s length beyond buffer: cur=%p, ielen=%zu, end=%p",
+                 ie_spec.c_str(), cur,
+                 static_cast<size_t>(plan[decision_number].length), buf_end);
+  }
 
-        assert(i->length <= i->destination_size);
+  uint16_t DecodePlan::execute(const uint8_t* buf, uint16_t length) {
+    return execute_impl<false>(buf, length, 0);
+  }
 
-        /* Assume all-zero bit pattern is zero, null, 0.0 etc. */
-        // FIXME: Check if transferring native data types is faster
-        // (e.g., short when i->length == 2, long when i->length == 4
-        // etc).
-        {
-          uint8_t* q = static_cast<uint8_t*>(i->p);
-          LOG4CPLUS_TRACE(logger, "  fixlen: q == " << static_cast<void*>(q)
-                          << ", size=" << i->destination_size);
+  uint16_t DecodePlan::execute(const uint8_t* buf, uint16_t length,
+                               size_t row) {
+    if (row == 0)
+      return execute_impl<false>(buf, length, 0);
+    else
+      return execute_impl<true>(buf, length, row);
+  }
 
-          memset(q, '\0', i->destination_size);
-          // Intention: right-justify value at cur in field at i->p
-          memcpy(q + i->destination_size - i->length, cur, i->length);
-        }
-        cur += i->length;
-        break;
+  template<bool use_row>
+  uint16_t DecodePlan::execute_impl(const uint8_t* buf, uint16_t length,
+                                    size_t row) {
+    LOG4CPLUS_TRACE(logger(), "ENTER DecodePlan::execute");
 
-      case Decision::transfer_fixlen_endianness:
-        if (cur + i->length > buf_end) {
-          std::string ie_spec = i->wire_ie->toIESpec();
-          report_error("IE %s length beyond buffer: cur=%p, ielen=%zu, end=%p",
-                       ie_spec.c_str(), cur, i->length, buf_end);
-        }
+    /* Where the value for decision k goes. For row 0, and for
+     * ordinary placements, that's the placement itself. */
+#define DESTINATION(k) \
+    (use_row \
+     ? static_cast<void*>(static_cast<uint8_t*>(plan[k].p)             \
+                          + row*element_sizes[k])                      \
+     : plan[k].p)
 
-        assert(i->length <= i->destination_size);
+    const uint8_t* buf_end = buf + length;
 
-#if defined(_libfc_HAVE_LOG4CPLUS_) && defined(_LIBFC_DO_HEXDUMP_)
-        {
-          LOG4CPLUS_TRACE(logger, "transfer w/endianness Before");
-          hexdump(logger, buf, cur);
-          LOG4CPLUS_TRACE(logger, "At and after");
-          hexdump(logger, cur, cur + 8);
-        }
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+    /* One bounds check covers the entire fixed-length prefix. */
+    if (fixed_prefix_length > length) {
+      for (size_t k = 0; k < prefix_decisions; ++k)
+        if (plan[k].offset + plan[k].length > length)
+          report_overrun(k, buf + plan[k].offset, buf_end);
+      report_error("fixed-length record prefix of %u bytes beyond buffer "
+                   "of %u bytes", static_cast<unsigned int>(fixed_prefix_length),
+                   static_cast<unsigned int>(length));
+    }
 
-        /* Assume all-zero bit pattern is zero, null, 0.0 etc. */
-        // FIXME: Check if transferring native data types is faster
-        // (e.g., short when i->length == 2, long when i->length == 4
-        // etc).
-        {
-          uint8_t* q = static_cast<uint8_t*>(i->p);        
-          LOG4CPLUS_TRACE(logger, "  fixlen_endianness: q == " << static_cast<void*>(q) << ", size=" << i->destination_size);
-          memset(q, '\0', i->destination_size);
-          // Intention: left-justify value at cur in field at i->p
-          for (uint16_t k = 0; k < i->length; k++)
-            q[k] = cur[i->length - (k + 1)];
-        }
-        LOG4CPLUS_TRACE(logger, "  transfer done");
-        cur += i->length;
-        break;
+    auto i = plan.begin();
+    const auto prefix_end = i + prefix_decisions;
 
-      case Decision::transfer_fixlen_octets:
-        assert(cur + i->length <= buf_end);
-        { 
-          libfc::BasicOctetArray* p
-            = reinterpret_cast<libfc::BasicOctetArray*>(i->p);
-          p->copy_content(cur, i->length);
-        }
+#if defined(_libfc_HAVE_JIT_)
+    /* Native code has the placement addresses built in. */
+    if (use_row)
+      ;
+    else if (native_prefix != 0) {
+      native_prefix(buf);
+      i = prefix_end;
+    } else if (executions_until_compile > 0
+               && --executions_until_compile == 0)
+      compile();
+#endif /* defined(_libfc_HAVE_JIT_) */
 
-        cur += i->length;
-        break;
+    for (; i != prefix_end; ++i)
+      transfer_fixed(*i, buf + i->offset, DESTINATION(i - plan.begin()));
 
-      case Decision::transfer_float_into_double:
-        assert(cur + sizeof(float) <= buf_end);
-        {
-          float f;
-          memcpy(&f, cur, sizeof(float));
-          *static_cast<double*>(i->p) = f;
-        }
-        cur += sizeof(float);
-        break;
+    const uint8_t* cur = buf + fixed_prefix_length;
 
-      case Decision::transfer_float_into_double_endianness:
-        assert(cur + sizeof(float) <= buf_end);
+    for (; i != plan.end(); ++i) {
+      LOG4CPLUS_TRACE(logger(), "  decision: " << i->to_string());
+
+      switch (i->type) {
+      case Decision::skip_varlen:
         {
-          union {
-            uint8_t b[sizeof(float)];
-            float f;
-          } val;
-          val.b[0] = cur[3];
-          val.b[1] = cur[2];
-          val.b[2] = cur[1];
-          val.b[3] = cur[0];
-          *static_cast<double*>(i->p) = val.f;
+          uint16_t varlen_length = decode_varlen_length(&cur, buf_end);
+          assert(cur + varlen_length <= buf_end);
+          cur += varlen_length;
         }
-        cur += sizeof(uint32_t);
         break;
 
       case Decision::transfer_varlen:
         {
 #if defined(_libfc_HAVE_LOG4CPLUS_) && defined(_LIBFC_DO_HEXDUMP_)
           {
-            LOG4CPLUS_TRACE(logger, "Before");
-            hexdump(logger, buf, cur);
-            LOG4CPLUS_TRACE(logger, "At and after");
-            hexdump(logger, cur, std::min(cur + 12, buf_end));
+            LOG4CPLUS_TRACE(logger(), "Before");
+            hexdump(logger(), buf, cur);
+            LOG4CPLUS_TRACE(logger(), "At and after");
+            hexdump(logger(), cur, std::min(cur + 12, buf_end));
           }
 #endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
           uint16_t varlen_length = decode_varlen_length(&cur, buf_end);
-          LOG4CPLUS_TRACE(logger, "  varlen length " << varlen_length);
+          LOG4CPLUS_TRACE(logger(), "  varlen length " << varlen_length);
           assert(cur + varlen_length <= buf_end);
       
           libfc::BasicOctetArray* p
-            = reinterpret_cast<libfc::BasicOctetArray*>(i->p);
+            = reinterpret_cast<libfc::BasicOctetArray*>(
+                DESTINATION(i - plan.begin()));
           p->copy_content(cur, varlen_length);
 
           cur += varlen_length;
         }
         break;
+
+      case Decision::reference_varlen:
+        {
+          uint16_t varlen_length = decode_varlen_length(&cur, buf_end);
+          assert(cur + varlen_length <= buf_end);
+          static_cast<OctetArrayView*>(DESTINATION(i - plan.begin()))
+            ->set(cur, varlen_length);
+          cur += varlen_length;
+        }
+        break;
+
+      case Decision::skip_fixlen:
+        if (cur + i->length > buf_end)
+          report_overrun(i - plan.begin(), cur, buf_end);
+        cur += i->length;
+        break;
+
+      default:
+        if (cur + i->length > buf_end)
+          report_overrun(i - plan.begin(), cur, buf_end);
+        transfer_fixed(*i, cur, DESTINATION(i - plan.begin()));
+        cur += i->length;
+        break;
       }
     }
 
+#undef DESTINATION
+
     assert ((cur - buf) <= USHRT_MAX);
     return static_cast<uint16_t>(cur - buf);
   }
 
+  size_t DecodePlan::size() const {
+    return plan.size();
+  }
+
+  uint16_t DecodePlan::get_fixed_prefix_length() const {
+    return fixed_prefix_length;
+  }
+
+  bool DecodePlan::is_fixed_stride() const {
+    return prefix_decisions == plan.size();
+  }
+
 } /* namespace libfc */
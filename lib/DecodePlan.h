@@ -35,15 +35,14 @@
 
 #  include <vector>
 
-#  if defined(_libfc_HAVE_LOG4CPLUS_)
-#    include <log4cplus/logger.h>
-#  endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
 
 #  include "PlacementTemplate.h"
 #  include "IETemplate.h"
 
 namespace libfc {
 
+  class NativeDecoder;
+
   /** Decode plans describe how a data record is to be decoded.
    *
    * Decoding a data record means determining, for each data field, 
@@ -83,10 +82,27 @@ namespace libfc {
    * depending on whether the corresponding field is fixed-length field
    * or a variable-length field.
    *
-   * It would be nice if we could collapse two adjacent SKIP decisions
-   * into one, but that can only be done if the two fields in question
-   * are fixed-length fields.  We might do this in a future release if
-   * it turns out to be a performance problem.
+   * After the decisions have been made, the plan is compiled:
+   *
+   *   - All fields before the first variable-length field are at a
+   *     fixed offset from the start of the record.  For these, the
+   *     plan records the absolute offset of each transfer decision and
+   *     drops the SKIP decisions entirely, so that decoding the fixed
+   *     prefix of a record needs one bounds check and one operation
+   *     per transferred field, no matter how many fields are skipped.
+   *   - After the fixed prefix, offsets depend on the lengths of the
+   *     variable-length fields, so decoding proceeds sequentially.
+   *     Adjacent fixed-length SKIP decisions are collapsed into one.
+   *
+   * Decisions are kept small (16 bytes on LP64 platforms), so that
+   * the plans for typical templates fit into a few cache lines.
+   * Information that is only needed for error reporting is kept in a
+   * separate vector.
+   *
+   * Finally, a plan that has been executed often enough has its
+   * fixed-length prefix compiled to native code by a NativeDecoder,
+   * if the platform supports it and all decisions in the prefix are
+   * simple transfers.  Otherwise, the plan keeps being interpreted.
    */
   class DecodePlan {
   public:
@@ -100,6 +116,11 @@ namespace libfc {
      */
     DecodePlan(const PlacementTemplate* placement_template,
                const IETemplate* wire_template);
+
+    ~DecodePlan();
+
+    DecodePlan(const DecodePlan&) = delete;
+    DecodePlan& operator=(const DecodePlan&) = delete;
     
     /** Executes the plan.
      *
@@ -117,8 +138,78 @@ namespace libfc {
      * @return number of bytes decoded
      */
     uint16_t execute(const uint8_t* buf, uint16_t length);
+
+    /** Executes the plan for one row of column placements.
+     *
+     * Here, every placement pointer is taken to be the start of an
+     * array of values (a column), and the decoded values go to
+     * element @a row of these arrays.  See ColumnDecoder for how the
+     * element sizes are determined.
+     *
+     * @param buf the buffer containing the data record (and the
+     *     remaining data set)
+     * @param length length of the remaining data set
+     * @param row the row to write
+     *
+     * @return number of bytes decoded
+     */
+    uint16_t execute(const uint8_t* buf, uint16_t length, size_t row);
+
+    /** Returns the number of decisions in the compiled plan.
+     *
+     * @return number of decisions
+     */
+    size_t size() const;
+
+    /** Returns the length of the fixed-length prefix of the record.
+     *
+     * This is the sum of the lengths of all fields that come before
+     * the first variable-length field.  For a template without
+     * variable-length fields, it is the record length.
+     *
+     * @return length of the fixed-length prefix in bytes
+     */
+    uint16_t get_fixed_prefix_length() const;
+
+    /** Tells whether every record decoded by this plan has the same
+     * length.
+     *
+     * This is the case if the wire template has no variable-length
+     * fields.  The record length is then get_fixed_prefix_length().
+     *
+     * @return true if records are at a fixed stride in the data set
+     */
+    bool is_fixed_stride() const;
+
+    /** Compiles the fixed-length prefix of the plan to native code.
+     *
+     * This happens automatically once a plan has been executed often
+     * enough, but can be requested earlier.  Calling it on a plan that
+     * is already compiled has no effect.
+     *
+     * @return true if the prefix is now executed as native code, false
+     *   if the platform does not support this or the prefix contains
+     *   decisions that cannot be compiled
+     */
+    bool compile();
+
+    /** Sets after how many more executions the plan is compiled.
+     *
+     * @param executions number of executions before compile() is
+     *   called automatically, or 0 to never compile automatically
+     */
+    void set_compile_threshold(uint32_t executions);
+
+    /** Tells whether the fixed-length prefix runs as native code.
+     *
+     * @return true if the prefix has been compiled
+     */
+    bool is_compiled() const;
     
   private:
+    /* Decodes columns from the decisions of fixed-stride plans. */
+    friend class ColumnDecoder;
+
     struct Decision {
       /** The decision type. */
       enum decision_type_t {
@@ -156,7 +247,37 @@ namespace libfc {
         
         /** Transfer a variable amount. */
         transfer_varlen,
-      } type;
+
+        /** Transfer a big-endian unsigned integer of W octets into a
+         * native integer of D octets (transfer_be_W_D).  These are
+         * specialisations of transfer_fixlen and
+         * transfer_fixlen_endianness for the common widths; see
+         * decode_kernels.h. */
+        transfer_be_1_1,
+        transfer_be_1_2,
+        transfer_be_1_4,
+        transfer_be_1_8,
+        transfer_be_2_2,
+        transfer_be_2_4,
+        transfer_be_2_8,
+        transfer_be_4_4,
+        transfer_be_4_8,
+        transfer_be_8_8,
+
+        /** Transfer 16 octets without conversion (IPv6 addresses). */
+        transfer_octets_16,
+
+        /** Point an OctetArrayView at an octet string with fixed
+         * length. */
+        reference_fixlen_octets,
+
+        /** Point an OctetArrayView at a varlen octet string. */
+        reference_varlen,
+      };
+
+      /** The decision type, one of decision_type_t.  Stored as a
+       * single octet to keep the decision small. */
+      uint8_t type;
       
       /** How much data is affected in the data set?  This field makes
        * sense only in fixlen decisions. */
@@ -165,6 +286,11 @@ namespace libfc {
       /** Destination type size in bytes.  This field makes sense only in
        * transfer_fixlen decisions. */
       uint16_t destination_size;
+
+      /** Offset of the field from the start of the record.  This
+       * field makes sense only in decisions that are part of the
+       * fixed-length prefix. */
+      uint16_t offset;
       
       /** Transfer target. This field makes sense only in transfer
        * decisions.  The caller must make sure that these pointers are
@@ -173,20 +299,79 @@ namespace libfc {
        * varlen transfers). */
       void* p;
       
-      /** Original wire template IE. This field makes sense only in
-       * transfer decisions. */
-      const InfoElement* wire_ie;
-      
       std::string to_string() const;
     };
-    
+
+    /** Replaces a generic fixed-length transfer decision by a
+     * specialised one, if there is a kernel for its widths.
+     *
+     * @param d the decision to specialise
+     */
+    static void specialize(Decision& d);
+
+    /** Transfers one fixed-length field.
+     *
+     * @param d the decision, which must not be a skip or a varlen
+     *   transfer
+     * @param cur the start of the field in the data record
+     * @param p where to put the value; usually d.p
+     */
+    static void transfer_fixed(const Decision& d, const uint8_t* cur,
+                               void* p);
+
+    /** Returns the size of one element of the column that a decision
+     * writes to when placements are columns.
+     *
+     * @param d the decision
+     *
+     * @return the size of the native type of the decision, or 0 for
+     *   skip decisions
+     */
+    static uint16_t column_element_size(const Decision& d);
+
+    /** Executes the plan, optionally for a row of column placements. */
+    template<bool use_row>
+    uint16_t execute_impl(const uint8_t* buf, uint16_t length, size_t row);
+
+    /** Reports a field that extends beyond the end of the record.
+     *
+     * @param decision_number index of the offending decision
+     * @param cur start of the offending field
+     * @param buf_end end of the data set
+     */
+    void report_overrun(size_t decision_number, const uint8_t* cur,
+                        const uint8_t* buf_end) const;
+
+    /** The compiled plan.  The first prefix_decisions entries have
+     * absolute offsets, the rest are executed sequentially. */
     std::vector<Decision> plan;
-    
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-    log4cplus::Logger logger;
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+
+    /** Original wire template IE for each decision in the plan, or
+     * NULL for skip decisions.  Kept apart from the decisions, since
+     * it is needed only for error reporting. */
+    std::vector<const InfoElement*> wire_ies;
+
+    /** Column element size for each decision in the plan; see
+     * column_element_size(). */
+    std::vector<uint16_t> element_sizes;
+
+    /** Number of decisions in the fixed-length prefix. */
+    size_t prefix_decisions;
+
+    /** Length of the fixed-length prefix of the record. */
+    uint16_t fixed_prefix_length;
+
+    /** Native code for the fixed-length prefix, or NULL. */
+    NativeDecoder* native_decoder;
+
+    /** Entry point of the native code, or NULL while the prefix is
+     * interpreted. */
+    void (*native_prefix)(const uint8_t* buf);
+
+    /** Number of executions left before the plan is compiled. */
+    uint32_t executions_until_compile;
   };
   
-#endif /* _libfc_DECODEPLAN_H_ */
-
 } /* namespace libfc */
+
+#endif /* _libfc_DECODEPLAN_H_ */
@@ -49,6 +49,7 @@ namespace libfc {
     case ipfix_basetime: return "got basetime in IPFIX message";
     case format_error: return "format error";
     case inconsistent_state: return "inconsistent internal state";
+    case too_many_exporters: return "too many exporters";
     case again: return "try again";
     }
     // This fall-through cannot happen if the switch above contains
@@ -86,6 +86,9 @@ namespace libfc {
       /** Internal inconsistency. */
       inconsistent_state,
 
+      /** More exporters than a content handler can keep apart. */
+      too_many_exporters,
+
       /** The operation was not successful, but the caller should try
        * the operation again.  This is not an error code like the
        * others. */
@@ -27,13 +27,6 @@
 #include <cstring>
 #include <sstream>
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-#  include <log4cplus/logger.h>
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
-
 #include "ErrorContext.h"
 
 namespace libfc {
@@ -54,10 +47,6 @@ namespace libfc {
       message(0),
       size(message != 0 ? size : 0),
       off(off)
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-                      ,
-      logger(log4cplus::Logger::getInstance(LOG4CPLUS_TEXT("logger")))
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
   {
     if (message != 0) {
       this->message = new uint8_t[size];
@@ -79,6 +68,10 @@ namespace libfc {
     return e.get_error();
   }
 
+  ErrorContext::error_severity_t ErrorContext::get_severity() const {
+    return severity;
+  }
+
   const int ErrorContext::get_system_errno() const {
     return system_errno;
   }
@@ -37,10 +37,6 @@
 
 #  include <sstream>
 
-#  if defined(_libfc_HAVE_LOG4CPLUS_)
-#    include <log4cplus/logger.h>
-#  endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
-
 #  include "Error.h"
 #  include "InputSource.h"
 #  include <sstream>
@@ -225,6 +221,12 @@ namespace libfc {
      */
     const Error::error_t get_error() const;
 
+    /** Returns the severity.
+     *
+     * @return the severity given in the constructor
+     */
+    error_severity_t get_severity() const;
+
     /** Returns the value of errno when the error occurred.
      *
      * @return the saved value of errno (might be zero)
@@ -308,10 +310,6 @@ namespace libfc {
     const uint8_t* message;
     uint16_t size;
     uint16_t off;
-
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-    log4cplus::Logger logger;
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
   };
 
 } // namespace libfc
@@ -26,11 +26,7 @@
 #include <unistd.h>
 #include <errno.h>
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#include "logging.h"
 
 #include "Constants.h"
 #include "FileExportDestination.h"
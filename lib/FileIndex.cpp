@@ -0,0 +1,405 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Constants.h"
+#include "FileIndex.h"
+#include "TemplateSnapshot.h"
+#include "decode_util.h"
+
+namespace libfc {
+
+  const size_t FileIndex::kDefaultCheckpointInterval;
+
+  static const char kMagic[8] = { 'l', 'i', 'b', 'f', 'c', 'i', 'd', 'x' };
+  static const uint32_t kFormatVersion = 2;
+
+  /** Reads numbers from a buffer, remembering when it ran out. */
+  class IndexReader {
+  public:
+    IndexReader(const uint8_t* buf, size_t len)
+      : cur(buf), end(buf + len), ok(true) {
+    }
+
+    const uint8_t* get(size_t n) {
+      if (!ok || static_cast<size_t>(end - cur) < n) {
+        ok = false;
+        return 0;
+      }
+      const uint8_t* ret = cur;
+      cur += n;
+      return ret;
+    }
+
+    uint32_t get_uint32() {
+      const uint8_t* p = get(4);
+      return p == 0 ? 0 : decode_uint32(p);
+    }
+
+    uint64_t get_uint64() {
+      uint64_t high = get_uint32();
+      return (high << 32) | get_uint32();
+    }
+
+    size_t remaining() const {
+      return end - cur;
+    }
+
+    bool is_ok() const {
+      return ok;
+    }
+
+  private:
+    const uint8_t* cur;
+    const uint8_t* end;
+    bool ok;
+  };
+
+  /** Returns a file's modification time in nanoseconds. */
+  static uint64_t mtime_ns(const struct stat& st) {
+    return static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000
+      + st.st_mtim.tv_nsec;
+  }
+
+  FileIndex::FileIndex()
+    : file_size(0), file_mtime(0), indexed_end(0) {
+  }
+
+  std::string FileIndex::sidecar_name(const std::string& file_name) {
+    return file_name + ".fcidx";
+  }
+
+  std::shared_ptr<ErrorContext>
+  FileIndex::build(const std::string& file_name,
+                   size_t checkpoint_interval) {
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0)
+      libfc_RETURN_ERROR(fatal, system_error,
+                         "Can't open \"" << file_name << "\"", errno,
+                         0, 0, 0, 0);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      int e = errno;
+      (void) close(fd);
+      libfc_RETURN_ERROR(fatal, system_error,
+                         "Can't stat \"" << file_name << "\"", e,
+                         0, 0, 0, 0);
+    }
+
+    size_t size = st.st_size;
+    void* map = size == 0 ? 0
+      : mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int e = errno;
+    (void) close(fd);
+    if (map == MAP_FAILED)
+      libfc_RETURN_ERROR(fatal, system_error,
+                         "Can't map \"" << file_name << "\"", e,
+                         0, 0, 0, 0);
+
+    if (size > 0)
+      (void) madvise(map, size, MADV_SEQUENTIAL);
+
+    build(static_cast<const uint8_t*>(map), size, checkpoint_interval);
+    file_mtime = mtime_ns(st);
+
+    if (size > 0)
+      (void) munmap(map, size);
+
+    libfc_RETURN_OK();
+  }
+
+  void FileIndex::build(const uint8_t* file, size_t size,
+                        size_t checkpoint_interval) {
+    entries.clear();
+    checkpoints.clear();
+
+    TemplateSnapshot snapshot;
+    size_t off = 0;
+
+    while (size - off >= kIpfixMessageHeaderLen) {
+      const uint8_t* message = file + off;
+      uint16_t message_size = decode_uint16(message + 2);
+      if (decode_uint16(message) != kIpfixVersion
+          || message_size < kIpfixMessageHeaderLen
+          || message_size > size - off)
+        break;
+
+      Entry e;
+      e.offset = off;
+      e.export_time = decode_uint32(message + 4);
+      e.observation_domain = decode_uint32(message + 12);
+
+      if (checkpoints.empty()
+          || off - entries[checkpoints.back().message].offset
+             >= checkpoint_interval) {
+        Checkpoint c;
+        c.message = entries.size();
+        snapshot.append_messages(e.export_time, c.templates);
+        checkpoints.push_back(c);
+      }
+
+      entries.push_back(e);
+      snapshot.add_message(message, message_size);
+      off += message_size;
+    }
+
+    file_size = size;
+    file_mtime = 0;
+    indexed_end = off;
+    compute_time_bounds();
+  }
+
+  void FileIndex::compute_time_bounds() {
+    max_times.resize(entries.size());
+    uint32_t latest = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+      latest = std::max(latest, entries[i].export_time);
+      max_times[i] = latest;
+    }
+
+    min_times.resize(entries.size());
+    uint32_t earliest = UINT32_MAX;
+    for (size_t i = entries.size(); i-- > 0; ) {
+      earliest = std::min(earliest, entries[i].export_time);
+      min_times[i] = earliest;
+    }
+  }
+
+  std::shared_ptr<ErrorContext>
+  FileIndex::save(const std::string& index_name) const {
+    std::vector<uint8_t> out(kMagic, kMagic + sizeof(kMagic));
+    append_uint32(out, kFormatVersion);
+    append_uint64(out, file_size);
+    append_uint64(out, file_mtime);
+    append_uint64(out, indexed_end);
+
+    append_uint64(out, entries.size());
+    for (auto i = entries.begin(); i != entries.end(); ++i) {
+      append_uint64(out, i->offset);
+      append_uint32(out, i->export_time);
+      append_uint32(out, i->observation_domain);
+    }
+
+    append_uint64(out, checkpoints.size());
+    for (auto i = checkpoints.begin(); i != checkpoints.end(); ++i) {
+      append_uint64(out, i->message);
+      append_uint32(out, i->templates.size());
+      out.insert(out.end(), i->templates.begin(), i->templates.end());
+    }
+
+    int fd = open(index_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      libfc_RETURN_ERROR(fatal, system_error,
+                         "Can't create \"" << index_name << "\"", errno,
+                         0, 0, 0, 0);
+
+    for (size_t off = 0; off < out.size(); ) {
+      ssize_t n = write(fd, &out[off], out.size() - off);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        int e = errno;
+        (void) close(fd);
+        libfc_RETURN_ERROR(fatal, system_error,
+                           "Can't write \"" << index_name << "\"", e,
+                           0, 0, 0, 0);
+      }
+      off += n;
+    }
+
+    if (close(fd) < 0)
+      libfc_RETURN_ERROR(fatal, system_error,
+                         "Can't write \"" << index_name << "\"", errno,
+                         0, 0, 0, 0);
+
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  FileIndex::load(const std::string& index_name) {
+    int fd = open(index_name.c_str(), O_RDONLY);
+    if (fd < 0)
+      libfc_RETURN_ERROR(fatal, system_error,
+                         "Can't open \"" << index_name << "\"", errno,
+                         0, 0, 0, 0);
+
+    std::vector<uint8_t> in;
+    uint8_t buf[1 << 16];
+    while (true) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        int e = errno;
+        (void) close(fd);
+        libfc_RETURN_ERROR(fatal, system_error,
+                           "Can't read \"" << index_name << "\"", e,
+                           0, 0, 0, 0);
+      }
+      if (n == 0)
+        break;
+      in.insert(in.end(), buf, buf + n);
+    }
+    (void) close(fd);
+
+    IndexReader r(in.data(), in.size());
+    const uint8_t* magic = r.get(sizeof(kMagic));
+    if (magic == 0 || memcmp(magic, kMagic, sizeof(kMagic)) != 0
+        || r.get_uint32() != kFormatVersion)
+      libfc_RETURN_ERROR(recoverable, format_error,
+                         "\"" << index_name << "\" is not a libfc index",
+                         0, 0, 0, 0, 0);
+
+    uint64_t new_file_size = r.get_uint64();
+    uint64_t new_file_mtime = r.get_uint64();
+    uint64_t new_indexed_end = r.get_uint64();
+
+    /* An entry takes 16 bytes, so a larger count is damage, not a
+     * reason to allocate a lot of memory. */
+    std::vector<Entry> new_entries;
+    uint64_t n_entries = r.get_uint64();
+    bool damaged = n_entries > r.remaining() / 16
+      || new_indexed_end > new_file_size;
+    if (!damaged)
+      new_entries.resize(n_entries);
+
+    /* Messages must follow one another, each at least a header long,
+     * and the last one must end where the index says. */
+    uint64_t next_offset = 0;
+    for (auto i = new_entries.begin(); i != new_entries.end(); ++i) {
+      i->offset = r.get_uint64();
+      i->export_time = r.get_uint32();
+      i->observation_domain = r.get_uint32();
+      if (i->offset < next_offset || i->offset > new_indexed_end
+          || new_indexed_end - i->offset < kIpfixMessageHeaderLen)
+        damaged = true;
+      next_offset = i->offset + kIpfixMessageHeaderLen;
+    }
+
+    /* Checkpoints must be in order, and the first must be at the
+     * first message. */
+    std::vector<Checkpoint> new_checkpoints;
+    uint64_t n_checkpoints = r.get_uint64();
+    for (uint64_t k = 0; !damaged && r.is_ok() && k < n_checkpoints; k++) {
+      Checkpoint c;
+      c.message = r.get_uint64();
+      uint32_t len = r.get_uint32();
+      const uint8_t* templates = r.get(len);
+      if (templates != 0)
+        c.templates.assign(templates, templates + len);
+      damaged = c.message >= n_entries
+        || (new_checkpoints.empty() && c.message != 0)
+        || (!new_checkpoints.empty()
+            && c.message <= new_checkpoints.back().message);
+      new_checkpoints.push_back(c);
+    }
+
+    if (damaged || !r.is_ok() || r.remaining() != 0
+        || (n_entries > 0 && new_checkpoints.empty()))
+      libfc_RETURN_ERROR(recoverable, format_error,
+                         "\"" << index_name << "\" is damaged",
+                         0, 0, 0, 0, 0);
+
+    file_size = new_file_size;
+    file_mtime = new_file_mtime;
+    indexed_end = new_indexed_end;
+    entries.swap(new_entries);
+    checkpoints.swap(new_checkpoints);
+    compute_time_bounds();
+
+    libfc_RETURN_OK();
+  }
+
+  uint64_t FileIndex::get_file_size() const {
+    return file_size;
+  }
+
+  bool FileIndex::fits(const struct stat& st) const {
+    return static_cast<uint64_t>(st.st_size) == file_size
+      && (file_mtime == 0 || mtime_ns(st) == file_mtime);
+  }
+
+  size_t FileIndex::size() const {
+    return entries.size();
+  }
+
+  const FileIndex::Entry& FileIndex::get_entry(size_t i) const {
+    return entries[i];
+  }
+
+  uint64_t FileIndex::get_end_offset(size_t i) const {
+    return i + 1 < entries.size() ? entries[i + 1].offset : indexed_end;
+  }
+
+  size_t FileIndex::find_time(uint32_t export_time) const {
+    return std::lower_bound(max_times.begin(), max_times.end(), export_time)
+      - max_times.begin();
+  }
+
+  size_t FileIndex::find_end_time(uint32_t export_time) const {
+    return std::lower_bound(min_times.begin(), min_times.end(), export_time)
+      - min_times.begin();
+  }
+
+  void FileIndex::get_templates(size_t i, const uint8_t* file,
+                                std::vector<uint8_t>& out) const {
+    if (i == 0 || entries.empty())
+      return;
+
+    /* The last checkpoint at or before message i. */
+    auto c = std::upper_bound(checkpoints.begin(), checkpoints.end(), i,
+                              [](size_t i, const Checkpoint& c) {
+                                return i < c.message;
+                              }) - 1;
+
+    TemplateSnapshot snapshot;
+    const std::vector<uint8_t>& t = c->templates;
+    for (size_t off = 0; t.size() - off >= kIpfixMessageHeaderLen; ) {
+      uint16_t message_size = decode_uint16(&t[off + 2]);
+      if (message_size < kIpfixMessageHeaderLen
+          || message_size > t.size() - off)
+        break;
+      snapshot.add_message(&t[off], message_size);
+      off += message_size;
+    }
+
+    for (size_t k = c->message; k < i; k++)
+      snapshot.add_message(file + entries[k].offset,
+                           get_end_offset(k) - entries[k].offset);
+
+    snapshot.append_messages(entries[std::min(i, entries.size() - 1)]
+                               .export_time, out);
+  }
+
+} // namespace libfc
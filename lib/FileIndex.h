@@ -0,0 +1,216 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_FILEINDEX_H_
+#  define _libfc_FILEINDEX_H_
+
+#  include <cstdint>
+#  include <memory>
+#  include <string>
+#  include <vector>
+
+#  include <sys/stat.h>
+
+#  include "ErrorContext.h"
+
+namespace libfc {
+
+  /** A sidecar index for an IPFIX file.
+   *
+   * Records every message's offset, export time and observation
+   * domain, and every so many bytes a checkpoint with the templates
+   * in effect at that point (see TemplateSnapshot).  With it, a time
+   * window can be read without parsing the file from the start; see
+   * IndexedFileInputSource.
+   *
+   * The index is kept next to the file, under sidecar_name().  Its
+   * format is:
+   *
+   * @code
+   * "libfcidx"                   8 bytes
+   * format version (2)           uint32
+   * size of the indexed file     uint64
+   * its modification time, in ns uint64
+   * end of the last message      uint64
+   * number of messages           uint64
+   * per message:
+   *   offset                     uint64
+   *   export time                uint32
+   *   observation domain         uint32
+   * number of checkpoints        uint64
+   * per checkpoint:
+   *   index of the next message  uint64
+   *   length of the templates    uint32
+   *   templates, as IPFIX messages
+   * @endcode
+   *
+   * All numbers are in network byte order.  A modification time of
+   * 0 means that the index was built from memory.
+   */
+  class FileIndex {
+  public:
+    /** What the index knows about one message. */
+    struct Entry {
+      uint64_t offset;
+      uint32_t export_time;
+      uint32_t observation_domain;
+    };
+
+    /** The default number of bytes between checkpoints. */
+    static const size_t kDefaultCheckpointInterval = 1 << 24;
+
+    FileIndex();
+
+    /** Returns the usual name of the index for a file. */
+    static std::string sidecar_name(const std::string& file_name);
+
+    /** Indexes a file.
+     *
+     * Indexing stops at the first malformed message.
+     *
+     * @param file_name the file to index
+     * @param checkpoint_interval the number of bytes between
+     *   template checkpoints
+     *
+     * @return an error context, or null if no error occurred
+     */
+    std::shared_ptr<ErrorContext>
+      build(const std::string& file_name,
+            size_t checkpoint_interval = kDefaultCheckpointInterval);
+
+    /** Indexes a file in memory.
+     *
+     * @param file the file's contents
+     * @param size the file's size
+     * @param checkpoint_interval the number of bytes between
+     *   template checkpoints
+     */
+    void build(const uint8_t* file, size_t size,
+               size_t checkpoint_interval = kDefaultCheckpointInterval);
+
+    /** Writes the index to a file.
+     *
+     * @param index_name the name of the index file
+     *
+     * @return an error context, or null if no error occurred
+     */
+    std::shared_ptr<ErrorContext> save(const std::string& index_name) const;
+
+    /** Reads the index from a file.
+     *
+     * @param index_name the name of the index file
+     *
+     * @return an error context, or null if no error occurred
+     */
+    std::shared_ptr<ErrorContext> load(const std::string& index_name);
+
+    /** Returns the size the indexed file had when it was indexed. */
+    uint64_t get_file_size() const;
+
+    /** Returns whether the index still describes a file.
+     *
+     * @param st the file's status
+     *
+     * @return true if the file has the size and, if the index knows
+     *   it, the modification time it had when it was indexed
+     */
+    bool fits(const struct stat& st) const;
+
+    /** Returns the number of messages. */
+    size_t size() const;
+
+    /** Returns what the index knows about message @a i. */
+    const Entry& get_entry(size_t i) const;
+
+    /** Returns the offset just after message @a i. */
+    uint64_t get_end_offset(size_t i) const;
+
+    /** Returns the first message with an export time of at least
+     * @a export_time, or size() if there is none.
+     *
+     * All messages before the one returned are older.  Export times
+     * need not be sorted: messages from several exporters may be
+     * interleaved.
+     */
+    size_t find_time(uint32_t export_time) const;
+
+    /** Returns the first message from which on all messages have an
+     * export time of at least @a export_time, or size() if there is
+     * none.
+     *
+     * This is where a window ending at @a export_time ends.  With
+     * sorted export times it is find_time(@a export_time); otherwise
+     * it may be later, so that the window misses no older message.
+     */
+    size_t find_end_time(uint32_t export_time) const;
+
+    /** Makes messages defining the templates in effect just before
+     * message @a i.
+     *
+     * Starts with the last checkpoint before message @a i and adds
+     * the template sets of the messages in between, which are read
+     * from @a file.
+     *
+     * @param i the message
+     * @param file the indexed file's contents
+     * @param out where to append the messages
+     */
+    void get_templates(size_t i, const uint8_t* file,
+                       std::vector<uint8_t>& out) const;
+
+  private:
+    struct Checkpoint {
+      /** The templates are those in effect before this message. */
+      uint64_t message;
+      std::vector<uint8_t> templates;
+    };
+
+    void compute_time_bounds();
+
+    uint64_t file_size;
+    uint64_t file_mtime;
+    uint64_t indexed_end;
+    std::vector<Entry> entries;
+    std::vector<Checkpoint> checkpoints;
+
+    /** max_times[i] is the latest export time of messages 0 to i. */
+    std::vector<uint32_t> max_times;
+
+    /** min_times[i] is the earliest export time of messages i to the
+     * last one. */
+    std::vector<uint32_t> min_times;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_FILEINDEX_H_
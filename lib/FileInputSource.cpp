@@ -32,12 +32,15 @@
 
 namespace libfc {
 
-  FileInputSource::FileInputSource(int fd, std::string file_name)
+  FileInputSource::FileInputSource(int fd, std::string file_name,
+                                   size_t block_size)
     : fd(fd),
+      reader(fd, block_size),
       message_offset(0),
       current_offset(0),
       file_name(file_name),
       name(0) {
+    reader.advise_sequential();
   }
 
   FileInputSource::~FileInputSource() {
@@ -45,14 +48,18 @@ namespace libfc {
   }
 
   ssize_t FileInputSource::read(uint8_t* buf, uint16_t len) {
-    ssize_t ret = ::read(fd, buf, len);
+    ssize_t ret = reader.read(buf, len);
     if (ret > 0)
       current_offset += ret;
     return ret;
   }
 
+  ssize_t FileInputSource::peek(uint8_t* buf, uint16_t len) {
+    return reader.peek(buf, len);
+  }
+
   bool FileInputSource::resync() {
-    // TODO
+    /* Nothing to drop; the parser scans forward through read(). */
     return true;
   }
 
@@ -80,7 +87,7 @@ namespace libfc {
   }
 
   bool FileInputSource::can_peek() const {
-    return false;
+    return true;
   }
 
 } // namespace libfc
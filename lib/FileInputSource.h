@@ -35,21 +35,27 @@
 
 #  include <string>
 
+#  include "BufferedReader.h"
 #  include "InputSource.h"
 
 namespace libfc {
 
   class FileInputSource : public InputSource {
   public:
-    /** Creates a TCP input source from a file descriptor.
+    /** Creates a file input source from a file descriptor.
+     *
+     * Reads are buffered; see BufferedReader.
      *
      * @param fd the file descriptor belonging to an IPFIX data file
      * @param name the name you want this file to be known to diagnostics
+     * @param block_size how many bytes to read from the file at once
      */
-    FileInputSource(int fd, std::string file_name);
+    FileInputSource(int fd, std::string file_name,
+                    size_t block_size = BufferedReader::kDefaultBlockSize);
     ~FileInputSource();
 
     ssize_t read(uint8_t* buf, uint16_t len);
+    ssize_t peek(uint8_t* buf, uint16_t len);
     bool resync();
     size_t get_message_offset() const;
     void advance_message_offset();
@@ -58,6 +64,7 @@ namespace libfc {
 
   private:
     int fd;
+    BufferedReader reader;
     size_t message_offset;
     size_t current_offset;
     std::string file_name;
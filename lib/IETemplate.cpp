@@ -25,29 +25,22 @@
  */
 #include <algorithm>
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#  define LOG4CPLUS_WARN(logger, expr)
-#  define LOG4CPLUS_INFO(logger, expr)
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#include "logging.h"
 
 #include "IETemplate.h"
 
 namespace libfc {
 
+  libfc_DEFINE_LOGGER(logger, "IETemplate");
+
   IETemplate::IETemplate()
-    : minlen_(0)
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-                , 
-      logger(log4cplus::Logger::getInstance(LOG4CPLUS_TEXT("IETemplate")))
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+    : signature_(0),
+      minlen_(0)
   {
   }
    
   bool IETemplate::contains(const InfoElement* ie) const {
-    return find(ie) != ies_.end();
+    return std::binary_search(keys_.begin(), keys_.end(), ie->key());
   }
 
   bool IETemplate::containsAll(const IETemplate* rhs) const {
@@ -72,14 +65,14 @@ namespace libfc {
 
   std::vector<const InfoElement *>::const_iterator 
   IETemplate::find(const InfoElement* ie) const {
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-    if (logger.getLogLevel() <= log4cplus::TRACE_LOG_LEVEL) {
-      LOG4CPLUS_TRACE(logger, 
+#if libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE
+    if (logger().getLogLevel() <= log4cplus::TRACE_LOG_LEVEL) {
+      LOG4CPLUS_TRACE(logger(), 
                       "  test if template contains " << ie->toIESpec());
       for (auto i = ies_.begin(); i != ies_.end(); ++i)
-        LOG4CPLUS_TRACE(logger, " --> " << (*i)->toIESpec());
+        LOG4CPLUS_TRACE(logger(), " --> " << (*i)->toIESpec());
     }
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#endif /* libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE */
 
     for (auto i = ies_.begin(); i != ies_.end(); ++i) {
       if ((*i)->matches(*ie))
@@ -93,8 +86,20 @@ namespace libfc {
     return ies_.size();
   }
 
+  const std::vector<uint64_t>& IETemplate::sorted_keys() const {
+    return keys_;
+  }
+
+  uint64_t IETemplate::signature() const {
+    return signature_;
+  }
+
   void IETemplate::add_inner(const InfoElement* ie) {
     ies_.push_back(ie);
+
+    uint64_t key = ie->key();
+    keys_.insert(std::upper_bound(keys_.begin(), keys_.end(), key), key);
+    signature_ |= static_cast<uint64_t>(1) << (key % 64);
   }
 
   void IETemplate::add(const InfoElement* ie) {
@@ -47,9 +47,6 @@
 #  include <map>
 #  include <vector>
 
-#  if defined(_libfc_HAVE_LOG4CPLUS_)
-#    include <log4cplus/logger.h>
-#  endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
 
 #  include "InfoElement.h"
 
@@ -111,6 +108,25 @@ namespace libfc {
      */
     size_t size() const;
 
+    /** Returns the keys of the IEs in this template, sorted.
+     *
+     * @return the InfoElement::key() of each IE in this template, in
+     *   ascending order
+     */
+    const std::vector<uint64_t>& sorted_keys() const;
+
+    /** Returns a 64-bit signature of the IEs in this template.
+     *
+     * Bit (k mod 64) is set for the key k of each IE.  If a template
+     * T contains all IEs of another template, then the other
+     * template's signature has no bits that are not in T's, which
+     * makes for a quick test that rejects most non-matching
+     * templates.
+     *
+     * @return the signature of this template
+     */
+    uint64_t signature() const;
+
     /** Adds the Information Element to the template.
      *
      * @param ie the IE to add
@@ -150,13 +166,15 @@ namespace libfc {
     // pointer to session containing template vector of information elements
     std::vector <const InfoElement *> ies_;
 
+    // keys of ies_, sorted; see sorted_keys()
+    std::vector<uint64_t> keys_;
+
+    // see signature()
+    uint64_t signature_;
+
     // minimum length of record represented by template
     size_t minlen_;
 
-#  if defined(_libfc_HAVE_LOG4CPLUS_)
-    log4cplus::Logger logger;
-#  endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
-
   };
 
 } // namespace libfc
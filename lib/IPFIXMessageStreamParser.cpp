@@ -32,20 +32,19 @@
 #include "ErrorContext.h"
 #include "IPFIXMessageStreamParser.h"
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-#  include <log4cplus/logger.h>
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#include "logging.h"
 
 #include "decode_util.h"
 
+#include "exceptions/FormatError.h"
+
 
 namespace libfc {
 
   IPFIXMessageStreamParser::IPFIXMessageStreamParser() 
-    : offset(0)
+    : message(message_buf),
+      offset(0),
+      message_len(0)
 #if defined(_libfc_HAVE_LOG4CPLUS_)
                ,
     logger(log4cplus::Logger::getInstance(LOG4CPLUS_TEXT("IPFIXMessageStreamParser")))
@@ -66,9 +65,11 @@ namespace libfc {
      * libfc_RETURN_CALLBACK_ERROR macro. */
     uint16_t message_size = 0;
 
-    libfc_RETURN_CALLBACK_ERROR(start_session());
+    start_parse();
 
-    memset(message, '\0', sizeof(message));
+    message = message_buf;
+
+    libfc_RETURN_CALLBACK_ERROR(start_session());
 
     /* Member `offset' initialised here as well as in the constructor
      * so that you know it's not forgotten. */
@@ -77,144 +78,44 @@ namespace libfc {
     /** The number of bytes available after the latest read operation,
      * or -1 if a read error occurred. */
     errno = 0;
-    ssize_t nbytes = is.read(message, kIpfixMessageHeaderLen);
+    ssize_t nbytes;
+    message = read_input_view(is, message_buf, kIpfixMessageHeaderLen,
+                              &nbytes);
 
     while (nbytes > 0) {
-      uint8_t* cur = message;
-
-      if (static_cast<size_t>(nbytes) < kIpfixMessageHeaderLen) {
-        libfc_RETURN_ERROR(recoverable, short_header, 
-                           "Wanted " 
-                           << kIpfixMessageHeaderLen
-                           << " bytes for IPFIX message header, got only "
-                           << nbytes,
-                           0, &is, message, nbytes, 0);
-      }
-      assert(static_cast<size_t>(nbytes) == kIpfixMessageHeaderLen);
-
-      uint16_t version = decode_uint16(cur +  0);
-      if (version != kIpfixVersion)
-        libfc_RETURN_ERROR(recoverable, message_version_number, 
-                           "Expected message version " 
-                           << libfc_HEX(4) << kIpfixVersion
-                           << ", got " << libfc_HEX(4) << version,
-                           0, &is, message, nbytes, 0);
-
-      message_size = decode_uint16(cur +  2);
-      libfc_RETURN_CALLBACK_ERROR(
-        start_message(version,
-                      message_size,
-                      decode_uint32(cur +  4),
-                      decode_uint32(cur +  8),
-                      decode_uint32(cur + 12),
-                      0));
-      
-      const uint8_t* message_end = message + message_size;
-
-      cur += nbytes;
-      assert (cur <= message_end);
+      size_t message_start = offset;
 
-      offset += kIpfixMessageHeaderLen;
+      framing_error = false;
+      in_message = false;
+      message_len = nbytes;
 
-      errno = 0;
-      nbytes = is.read(cur, message_size - kIpfixMessageHeaderLen);
-      if (nbytes < 0) {
-        libfc_RETURN_ERROR(fatal, system_error, 
-                           "Wanted to read " 
-                           << message_size - kIpfixMessageHeaderLen
-                           << " bytes, got a read error", errno, &is,
-                           message, message_size, offset);
-      } else if (static_cast<size_t>(nbytes) 
-                 != message_size - kIpfixMessageHeaderLen) {
-        libfc_RETURN_ERROR(recoverable, short_body, 
-                           "Wanted " << message_size - kIpfixMessageHeaderLen
-                           << " bytes for message body, got " << nbytes,
-                           0, &is, message, message_size, offset);
-      }
-      
-      /* Decode sets.
-       *
-       * Note to prospective debuggers of the code below: I am aware
-       * that the various comparisons of pointers to message
-       * boundaries with "<=" instead of "<" look wrong.  After all,
-       * we all write "while (p < end) p++;". But, gentle reader,
-       * please be assured that these comparisons have all been
-       * meticulously checked and found to be correct.  There are two
-       * reasons for the use of "<=" over "<":
-       *
-       * (1) In one case, I check whether there are still N bytes left
-       * in the buffer. In this case, if "end" points to just beyond
-       * the buffer boundary, "cur + N <= end" is the correct
-       * comparison. (Think about it.)
-       *
-       * (2) In the other case, I check that "cur" hasn't been
-       * incremented to the point where it's already beyond the end of
-       * the buffer, but where it's OK if it's just one byte past
-       * (because that will be checked on the next iteration
-       * anyway). In this case too, "cur <= end" is the correct test.
-       *
-       * -- Stephan Neuhaus
-       */
-      while (cur + kIpfixSetHeaderLen <= message_end) {
-        /* Decode set header. */
-        uint16_t set_id = decode_uint16(cur + 0);
-        uint16_t set_length = decode_uint16(cur + 2);
-        const uint8_t* set_end = cur + set_length;
-        
-        if (set_end > message_end) {
-          std::stringstream sstr;
-          sstr << "set_len=" << set_length 
-               << ",set_end=" << static_cast<const void*>(set_end) 
-               << ",message_len=" << message_size
-               << ",message_end=" << static_cast<const void*>(message_end);
-          libfc_RETURN_ERROR(recoverable, long_set, 
-                             "Long set: set_len=" << set_length 
-                             << ",set_end=" << static_cast<const void*>(set_end) 
-                             << ",message_len=" << message_size
-                             << ",message_end=" << static_cast<const void*>(message_end),
-                             0, &is, message, message_size, offset);
-        }
-
-        cur += kIpfixSetHeaderLen;
-
-        if (set_id == kIpfixTemplateSetID) {
-          libfc_RETURN_CALLBACK_ERROR(
-            start_template_set(
-              set_id, set_length - kIpfixSetHeaderLen, cur));
-          cur += set_length - kIpfixSetHeaderLen;
-          libfc_RETURN_CALLBACK_ERROR(end_template_set());
-        } else if (set_id == kIpfixOptionTemplateSetID) {
-          libfc_RETURN_CALLBACK_ERROR(
-            start_options_template_set(
-              set_id, set_length - kIpfixSetHeaderLen, cur));
-          cur += set_length - kIpfixSetHeaderLen;
-          libfc_RETURN_CALLBACK_ERROR(
-            end_options_template_set());
-        } else  if (set_id >= kMinDataSetId) {
-          libfc_RETURN_CALLBACK_ERROR(
-            start_data_set(
-              set_id, set_length - kIpfixSetHeaderLen, cur));
-          cur += set_length - kIpfixSetHeaderLen;
-          libfc_RETURN_CALLBACK_ERROR(end_data_set());
-        } else
-          libfc_RETURN_ERROR(recoverable, format_error,
-                             "Set has ID " << set_id << ", which is not "
-                             "an IPFIX template, options template or data "
-                             "set ID",
-                             0, &is, message, message_size, offset);
-
-
-        assert(cur == set_end);
-        assert(cur <= message_end);
+      std::shared_ptr<ErrorContext> err;
+      try {
+        err = parse_message(is, nbytes);
+      } catch (FormatError& e) {
+        /* Records that don't fit their set are reported by
+         * exception.  Callers that stop on errors get it as before. */
+        if (resync_policy != resync_on_error)
+          throw;
+        err.reset(new ErrorContext(ErrorContext::recoverable,
+                                   Error(Error::format_error), 0, e.what(),
+                                   &is, message,
+                                   static_cast<uint16_t>(message_len), 0));
       }
 
-      libfc_RETURN_CALLBACK_ERROR(end_message());
+      if (err != 0) {
+        uint64_t skipped_before = get_n_skipped_bytes();
+        if (!recover(is, message, message_len, err))
+          return err;
+        offset = message_start + (framing_error
+                                  ? get_n_skipped_bytes() - skipped_before
+                                  : message_len);
+      }
 
-      offset += nbytes;
       is.advance_message_offset();
-      memset(message, '\0', sizeof(message));
       errno = 0;
-      nbytes = is.read(message, kIpfixMessageHeaderLen);
+      message = read_input_view(is, message_buf, kIpfixMessageHeaderLen,
+                                &nbytes);
     }
 
     if (nbytes < 0) {
@@ -230,11 +131,231 @@ namespace libfc {
      * end_session() gives an error, message_size bytes may be copied
      * from a (now non-existent) message. */
     message_size = 0;
-    memset(message, '\0', sizeof(message));
+    message = message_buf;
 
     libfc_RETURN_CALLBACK_ERROR(end_session());
 
     libfc_RETURN_OK();
   }
 
+  std::shared_ptr<ErrorContext>
+  IPFIXMessageStreamParser::parse_message(InputSource& is, ssize_t nbytes) {
+    uint16_t message_size = 0;
+
+    const uint8_t* cur = message;
+
+    if (static_cast<size_t>(nbytes) < kIpfixMessageHeaderLen) {
+      framing_error = true;
+      libfc_RETURN_ERROR(recoverable, short_header, 
+                         "Wanted " 
+                         << kIpfixMessageHeaderLen
+                         << " bytes for IPFIX message header, got only "
+                         << nbytes,
+                         0, &is, message, nbytes, 0);
+    }
+    assert(static_cast<size_t>(nbytes) == kIpfixMessageHeaderLen);
+
+    uint16_t version = decode_uint16(cur +  0);
+    if (version != kIpfixVersion) {
+      framing_error = true;
+      libfc_RETURN_ERROR(recoverable, message_version_number, 
+                         "Expected message version " 
+                         << libfc_HEX(4) << kIpfixVersion
+                         << ", got " << libfc_HEX(4) << version,
+                         0, &is, message, nbytes, 0);
+    }
+
+    message_size = decode_uint16(cur +  2);
+    if (message_size < kIpfixMessageHeaderLen) {
+      framing_error = true;
+      libfc_RETURN_ERROR(recoverable, short_message, 
+                         "Message length " << message_size
+                         << " is shorter than the message header",
+                         0, &is, message, nbytes, 0);
+    }
+
+    const uint8_t* message_end = message + message_size;
+
+    cur += nbytes;
+    assert (cur <= message_end);
+
+    offset += kIpfixMessageHeaderLen;
+
+    /* If the header came straight from the input source's memory, so
+     * does the body, right behind it. */
+    errno = 0;
+    if (message == message_buf)
+      nbytes = read_input(is, message_buf + kIpfixMessageHeaderLen,
+                          message_size - kIpfixMessageHeaderLen);
+    else {
+      const uint8_t* body
+        = is.read_view(message_size - kIpfixMessageHeaderLen, &nbytes);
+      assert(body == cur);
+      (void) body;
+    }
+
+    if (nbytes < 0) {
+      libfc_RETURN_ERROR(fatal, system_error, 
+                         "Wanted to read " 
+                         << message_size - kIpfixMessageHeaderLen
+                         << " bytes, got a read error", errno, &is,
+                         message, message_len, offset);
+    }
+
+    message_len += nbytes;
+    if (static_cast<size_t>(nbytes) 
+        != message_size - kIpfixMessageHeaderLen) {
+      framing_error = true;
+      libfc_RETURN_ERROR(recoverable, short_body, 
+                         "Wanted " << message_size - kIpfixMessageHeaderLen
+                         << " bytes for message body, got " << nbytes,
+                         0, &is, message, message_len, offset);
+    }
+
+    libfc_RETURN_CALLBACK_ERROR(set_exporter(is.get_exporter_id()));
+    libfc_RETURN_CALLBACK_ERROR(
+      start_message(version,
+                    message_size,
+                    decode_uint32(message +  4),
+                    decode_uint32(message +  8),
+                    decode_uint32(message + 12),
+                    0));
+    in_message = true;
+    
+    /* Decode sets.
+     *
+     * Note to prospective debuggers of the code below: I am aware
+     * that the various comparisons of pointers to message
+     * boundaries with "<=" instead of "<" look wrong.  After all,
+     * we all write "while (p < end) p++;". But, gentle reader,
+     * please be assured that these comparisons have all been
+     * meticulously checked and found to be correct.  There are two
+     * reasons for the use of "<=" over "<":
+     *
+     * (1) In one case, I check whether there are still N bytes left
+     * in the buffer. In this case, if "end" points to just beyond
+     * the buffer boundary, "cur + N <= end" is the correct
+     * comparison. (Think about it.)
+     *
+     * (2) In the other case, I check that "cur" hasn't been
+     * incremented to the point where it's already beyond the end of
+     * the buffer, but where it's OK if it's just one byte past
+     * (because that will be checked on the next iteration
+     * anyway). In this case too, "cur <= end" is the correct test.
+     *
+     * -- Stephan Neuhaus
+     */
+    while (cur + kIpfixSetHeaderLen <= message_end) {
+      /* Decode set header. */
+      uint16_t set_id = decode_uint16(cur + 0);
+      uint16_t set_length = decode_uint16(cur + 2);
+      const uint8_t* set_end = cur + set_length;
+      
+      if (set_length < kIpfixSetHeaderLen) {
+        framing_error = true;
+        libfc_RETURN_ERROR(recoverable, format_error,
+                           "Set length " << set_length << " is shorter "
+                           "than the set header",
+                           0, &is, message, message_size, offset);
+      }
+
+      if (set_end > message_end) {
+        std::stringstream sstr;
+        sstr << "set_len=" << set_length 
+             << ",set_end=" << static_cast<const void*>(set_end) 
+             << ",message_len=" << message_size
+             << ",message_end=" << static_cast<const void*>(message_end);
+        framing_error = true;
+        libfc_RETURN_ERROR(recoverable, long_set, 
+                           "Long set: set_len=" << set_length 
+                           << ",set_end=" << static_cast<const void*>(set_end) 
+                           << ",message_len=" << message_size
+                           << ",message_end=" << static_cast<const void*>(message_end),
+                           0, &is, message, message_size, offset);
+      }
+
+      cur += kIpfixSetHeaderLen;
+
+      if (set_id == kIpfixTemplateSetID) {
+        libfc_RETURN_CALLBACK_ERROR(
+          start_template_set(
+            set_id, set_length - kIpfixSetHeaderLen, cur));
+        cur += set_length - kIpfixSetHeaderLen;
+        libfc_RETURN_CALLBACK_ERROR(end_template_set());
+      } else if (set_id == kIpfixOptionTemplateSetID) {
+        libfc_RETURN_CALLBACK_ERROR(
+          start_options_template_set(
+            set_id, set_length - kIpfixSetHeaderLen, cur));
+        cur += set_length - kIpfixSetHeaderLen;
+        libfc_RETURN_CALLBACK_ERROR(
+          end_options_template_set());
+      } else  if (set_id >= kMinDataSetId) {
+        libfc_RETURN_CALLBACK_ERROR(
+          start_data_set(
+            set_id, set_length - kIpfixSetHeaderLen, cur));
+        cur += set_length - kIpfixSetHeaderLen;
+        libfc_RETURN_CALLBACK_ERROR(end_data_set());
+      } else {
+        framing_error = true;
+        libfc_RETURN_ERROR(recoverable, format_error,
+                           "Set has ID " << set_id << ", which is not "
+                           "an IPFIX template, options template or data "
+                           "set ID",
+                           0, &is, message, message_size, offset);
+      }
+
+
+      assert(cur == set_end);
+      assert(cur <= message_end);
+    }
+
+    in_message = false;
+    libfc_RETURN_CALLBACK_ERROR(end_message());
+
+    offset += nbytes;
+    libfc_RETURN_OK();
+  }
+
+  MessageStreamParser::Plausibility
+  IPFIXMessageStreamParser::check_message_start(const uint8_t* buf,
+                                                size_t len,
+                                                size_t* needed) const {
+    if (len < kIpfixMessageHeaderLen) {
+      *needed = kIpfixMessageHeaderLen;
+      return need_more;
+    }
+
+    if (decode_uint16(buf + 0) != kIpfixVersion)
+      return implausible;
+
+    uint16_t message_size = decode_uint16(buf + 2);
+    if (message_size < kIpfixMessageHeaderLen + kIpfixSetHeaderLen)
+      return implausible;
+
+    if (len < message_size) {
+      *needed = message_size;
+      return need_more;
+    }
+
+    /* The sets must have valid IDs and tile the message exactly. */
+    const uint8_t* cur = buf + kIpfixMessageHeaderLen;
+    const uint8_t* message_end = buf + message_size;
+
+    while (cur + kIpfixSetHeaderLen <= message_end) {
+      uint16_t set_id = decode_uint16(cur + 0);
+      uint16_t set_length = decode_uint16(cur + 2);
+
+      if (set_id != kIpfixTemplateSetID
+          && set_id != kIpfixOptionTemplateSetID
+          && set_id < kMinDataSetId)
+        return implausible;
+      if (set_length < kIpfixSetHeaderLen || cur + set_length > message_end)
+        return implausible;
+
+      cur += set_length;
+    }
+
+    return cur == message_end ? plausible : implausible;
+  }
+
 } // namespace libfc
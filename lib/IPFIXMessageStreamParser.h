@@ -47,15 +47,38 @@ namespace libfc {
     IPFIXMessageStreamParser();
     std::shared_ptr<ErrorContext> parse(InputSource& is);
 
+  protected:
+    Plausibility check_message_start(const uint8_t* buf, size_t len,
+                                     size_t* needed) const;
+
   private:
+    /** Parses one message whose header has just been read.
+     *
+     * @param is the input source
+     * @param nbytes the number of header bytes read
+     *
+     * @return an ErrorContext, describing the error, or 0 if there
+     *   was no error.
+     */
+    std::shared_ptr<ErrorContext> parse_message(InputSource& is,
+                                                ssize_t nbytes);
+
+    /** Buffer for messages that have to be copied out of the input
+     * source. */
+    uint8_t message_buf[kMaxMessageLen];
 
-    /** The current message. */
-    uint8_t message[kMaxMessageLen];
+    /** The current message, either in message_buf or, if the input
+     * source supports InputSource::read_view(), in the input
+     * source's memory. */
+    const uint8_t* message;
 
     /** The current offset into the message stream. Used for error
      * reporting, and for error reporting @em{only}. */
     size_t offset;
 
+    /** The number of bytes of the current message read so far. */
+    size_t message_len;
+
 
 #  if defined(_libfc_HAVE_LOG4CPLUS_)
     log4cplus::Logger logger;
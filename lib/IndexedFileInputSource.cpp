@@ -0,0 +1,199 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "IndexedFileInputSource.h"
+
+namespace libfc {
+
+  IndexedFileInputSource::IndexedFileInputSource(int fd,
+                                                 std::string file_name,
+                                                 const FileIndex& index,
+                                                 uint32_t begin_time,
+                                                 uint32_t end_time)
+    : fd(fd),
+      map(0),
+      map_len(0),
+      error(0),
+      window_begin(0),
+      window_end(0),
+      cur(0),
+      end(0),
+      in_window(false),
+      first_message(index.find_time(begin_time)),
+      n_messages(0),
+      message_offset(0),
+      current_offset(0),
+      file_name(file_name),
+      name(0) {
+    size_t last_message = std::max(index.find_end_time(end_time),
+                                   first_message);
+    n_messages = last_message - first_message;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      error = errno;
+      return;
+    }
+    if (!index.fits(st)) {
+      error = ESTALE;
+      return;
+    }
+    if (n_messages == 0)
+      return;
+
+    map_len = static_cast<size_t>(st.st_size);
+    void* p = mmap(0, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      error = errno;
+      map_len = 0;
+      return;
+    }
+    map = static_cast<const uint8_t*>(p);
+
+    window_begin = map + index.get_entry(first_message).offset;
+    window_end = map + index.get_end_offset(last_message - 1);
+
+    /* Read ahead in the window only. */
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t advice_off = (window_begin - map) / page * page;
+    (void) madvise(const_cast<uint8_t*>(map) + advice_off,
+                   window_end - map - advice_off, MADV_WILLNEED);
+
+    index.get_templates(first_message, map, templates);
+    cur = templates.data();
+    end = cur + templates.size();
+  }
+
+  IndexedFileInputSource::~IndexedFileInputSource() {
+    if (map != 0)
+      (void) munmap(const_cast<uint8_t*>(map), map_len);
+    (void) close(fd);
+    delete[] const_cast<char*>(name);
+  }
+
+  bool IndexedFileInputSource::next_segment() {
+    if (cur < end)
+      return true;
+    if (in_window)
+      return false;
+
+    cur = window_begin;
+    end = window_end;
+    in_window = true;
+    return cur < end;
+  }
+
+  ssize_t IndexedFileInputSource::read(uint8_t* buf, uint16_t len) {
+    ssize_t ret = peek(buf, len);
+    if (ret > 0) {
+      cur += ret;
+      current_offset += ret;
+    }
+    return ret;
+  }
+
+  ssize_t IndexedFileInputSource::peek(uint8_t* buf, uint16_t len) {
+    if (error != 0) {
+      errno = error;
+      return -1;
+    }
+    if (!next_segment())
+      return 0;
+
+    size_t n = std::min(static_cast<size_t>(end - cur),
+                        static_cast<size_t>(len));
+    memcpy(buf, cur, n);
+    return static_cast<ssize_t>(n);
+  }
+
+  const uint8_t* IndexedFileInputSource::read_view(uint16_t len,
+                                                   ssize_t* nbytes) {
+    /* Let read() report errors and the end of the window.  Messages
+     * never straddle the end of the templates, so views don't have
+     * to, either. */
+    if (error != 0 || !next_segment())
+      return 0;
+
+    size_t n = std::min(static_cast<size_t>(end - cur),
+                        static_cast<size_t>(len));
+    const uint8_t* ret = cur;
+
+    cur += n;
+    current_offset += n;
+    *nbytes = static_cast<ssize_t>(n);
+    return ret;
+  }
+
+  bool IndexedFileInputSource::resync() {
+    /* Nothing to drop; the parser scans forward through read(). */
+    return true;
+  }
+
+  size_t IndexedFileInputSource::get_message_offset() const {
+    return message_offset;
+  }
+
+  void IndexedFileInputSource::advance_message_offset() {
+    message_offset += current_offset;
+    current_offset = 0;
+  }
+
+  const char* IndexedFileInputSource::get_name() const {
+    if (name == 0) {
+      std::ostringstream sstr;
+
+      sstr << "Indexed(name=\"" << file_name << "\")";
+      std::string s = sstr.str();
+
+      name = new char[s.length() + 1];
+      std::strcpy(const_cast<char*>(name), s.c_str());
+    }
+    
+    return name;
+  }
+
+  bool IndexedFileInputSource::can_peek() const {
+    return true;
+  }
+
+  size_t IndexedFileInputSource::get_first_message() const {
+    return first_message;
+  }
+
+  size_t IndexedFileInputSource::get_n_messages() const {
+    return n_messages;
+  }
+
+} // namespace libfc
@@ -0,0 +1,136 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_INDEXEDFILEINPUTSOURCE_H_
+#  define _libfc_INDEXEDFILEINPUTSOURCE_H_
+
+#  include <string>
+#  include <vector>
+
+#  include "FileIndex.h"
+#  include "InputSource.h"
+
+namespace libfc {
+
+  /** Reads the messages of a time window from an indexed IPFIX file.
+   *
+   * Uses a FileIndex to find the first message exported at or after
+   * the start of the window and the first one after which all are
+   * exported at or after its end, and reads the messages in between
+   * straight from the memory-mapped file.  If export times are out of
+   * order, some of these messages may lie outside the window, but
+   * none inside it is missed.  Before them, it serves IPFIX messages that
+   * define the templates in effect at the start of the window (see
+   * FileIndex::get_templates()), so a collector decodes the window
+   * just as it would have after parsing the file from the start.
+   * Only the pages of the window (and those since the last template
+   * checkpoint) are touched.
+   *
+   * If the file has changed since it was indexed (see
+   * FileIndex::fits()), or can't be mapped, reads fail, with errno
+   * set to ESTALE or to the mapping error.
+   */
+  class IndexedFileInputSource : public InputSource {
+  public:
+    /** Creates an input source for a time window.
+     *
+     * @param fd the file descriptor belonging to an IPFIX data file;
+     *   it is closed when the input source is destroyed
+     * @param file_name the name you want this file to be known to
+     *   diagnostics
+     * @param index the file's index; it is only used by the
+     *   constructor
+     * @param begin_time the start of the window, as an export time
+     * @param end_time the end of the window, as an export time;
+     *   messages exported at this time are not part of the window
+     */
+    IndexedFileInputSource(int fd, std::string file_name,
+                           const FileIndex& index,
+                           uint32_t begin_time, uint32_t end_time);
+    ~IndexedFileInputSource();
+
+    ssize_t read(uint8_t* buf, uint16_t len);
+    ssize_t peek(uint8_t* buf, uint16_t len);
+    const uint8_t* read_view(uint16_t len, ssize_t* nbytes);
+    bool resync();
+    size_t get_message_offset() const;
+    void advance_message_offset();
+    const char* get_name() const;
+    bool can_peek() const;
+
+    /** Returns the index of the first message of the window. */
+    size_t get_first_message() const;
+
+    /** Returns the number of messages in the window. */
+    size_t get_n_messages() const;
+
+  private:
+    /** Moves on to the file once the templates have been read.
+     *
+     * @return false if there is nothing left to read
+     */
+    bool next_segment();
+
+    int fd;
+
+    /** The mapping, or 0 if the file isn't mapped. */
+    const uint8_t* map;
+    size_t map_len;
+
+    /** The error to report on reads, or 0. */
+    int error;
+
+    /** Messages defining the templates. */
+    std::vector<uint8_t> templates;
+
+    /** The window, within the mapping. */
+    const uint8_t* window_begin;
+    const uint8_t* window_end;
+
+    /** What is being read: the templates, then the window. */
+    const uint8_t* cur;
+    const uint8_t* end;
+    bool in_window;
+
+    size_t first_message;
+    size_t n_messages;
+
+    size_t message_offset;
+    size_t current_offset;
+    std::string file_name;
+    mutable const char* name;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_INDEXEDFILEINPUTSOURCE_H_
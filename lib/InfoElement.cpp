@@ -36,6 +36,7 @@ namespace libfc {
       number_(rhs.number()),
       ietype_(rhs.ietype()),
       len_(rhs.len()) {
+    init_short_rle();
   }   
 
   InfoElement::InfoElement(const std::string &name, 
@@ -48,6 +49,7 @@ namespace libfc {
       number_(number),
       ietype_(ietype),
       len_(len) {
+    init_short_rle();
   }
 
   InfoElement::InfoElement(const InfoElement &rhs, uint16_t nlen)
@@ -56,6 +58,12 @@ namespace libfc {
       number_(rhs.number()),
       ietype_(rhs.ietype()),
       len_(nlen) {
+    init_short_rle();
+  }
+
+  void InfoElement::init_short_rle() {
+    for (uint16_t i = 0; i < kInlineLengths; ++i)
+      short_rle_[i].store(0, std::memory_order_relaxed);
   }
 
   const std::string& InfoElement::name() const {
@@ -69,6 +77,10 @@ namespace libfc {
   uint16_t InfoElement::number() const {
     return number_;
   }
+
+  uint64_t InfoElement::key() const {
+    return (static_cast<uint64_t>(pen_) << 16) | number_;
+  }
   
   const IEType* InfoElement::ietype() const {
     return ietype_;
@@ -79,6 +91,8 @@ namespace libfc {
   }
 
   std::string InfoElement::toIESpec() const {
+    std::lock_guard<std::mutex> locker(lock_);
+
     if (spec == "") {
       std::ostringstream os;
 
@@ -93,9 +107,20 @@ namespace libfc {
 
   const InfoElement* InfoElement::forLen(uint16_t len) const {
     if (len_ == len || len == 0) return this;
+
+    if (len <= kInlineLengths) {
+      const InfoElement* ret
+        = short_rle_[len - 1].load(std::memory_order_acquire);
+      if (ret != 0)
+        return ret;
+    }
+
+    std::lock_guard<std::mutex> locker(lock_);
     
     if (!rle_[len]) {
       rle_[len] = std::shared_ptr<const InfoElement>(new InfoElement(*this, len));
+      if (len <= kInlineLengths)
+        short_rle_[len - 1].store(rle_[len].get(), std::memory_order_release);
     }
     
     return rle_[len].get();
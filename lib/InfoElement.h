@@ -38,8 +38,11 @@
 #ifndef _libfc_INFOELEMENT_H_ // idem
 #define _libfc_INFOELEMENT_H_ // hack
 
-#include <string>
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <stdint.h>
 
 #include "IEType.h"
@@ -141,6 +144,16 @@ public:
    */
   bool matches(const InfoElement& rhs) const;
 
+  /** Gets a key that identifies this IE for purposes of template
+   * compatibility.
+   *
+   * Two IEs match() iff their keys are equal, so sorted key vectors
+   * can be compared instead of scanning templates for matching IEs.
+   *
+   * @return PEN and number of this IE, in one integer
+   */
+  uint64_t key() const;
+
   /** Gets a complete IESpec for this InfoElement.
    *
    * @return an iespec
@@ -166,6 +179,8 @@ public:
   };
 
 private:
+  void init_short_rle();
+
   std::string   name_;
   uint32_t      pen_;
   uint16_t      number_;
@@ -173,6 +188,19 @@ private:
   uint16_t      len_;
   mutable std::map<uint16_t, std::shared_ptr<const InfoElement> > rle_;
   mutable std::string spec;
+
+  /** Reduced-length variants up to this length are also kept inline,
+   * so forLen() can find them without a lock or a tree walk. This
+   * covers all reduced-size encodings of numeric and address types. */
+  static const uint16_t kInlineLengths = 16;
+
+  /** Variant for length i + 1, or null if not created yet; owned by
+   * rle_. */
+  mutable std::atomic<const InfoElement*> short_rle_[kInlineLengths];
+
+  /** Guards the lazily filled rle_ and spec, since canonical IEs are
+   * shared between threads. */
+  mutable std::mutex lock_;
 };
 
 }
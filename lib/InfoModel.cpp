@@ -38,14 +38,43 @@
 
 namespace libfc {
 
+  /** An open change to the registries of an InfoModel.
+   *
+   * While at least one Update is open, changes go to a private copy
+   * of the current registry, which the outermost Update publishes
+   * when it closes.  This way, loading a whole spec copies the
+   * registry only once.
+   */
+  class InfoModel::Update {
+  public:
+    Update(InfoModel& _model) : model(_model), locker(_model.lock) {
+      if (model.update_depth_++ == 0)
+        model.pending_
+          = new Registry(*model.registry_.load(std::memory_order_relaxed));
+    }
+
+    ~Update() {
+      if (--model.update_depth_ == 0) {
+        model.registries_.push_back(
+          std::unique_ptr<const Registry>(model.pending_));
+        model.registry_.store(model.pending_, std::memory_order_release);
+        model.pending_ = 0;
+      }
+    }
+
+  private:
+    InfoModel& model;
+    std::lock_guard<std::recursive_mutex> locker;
+  };
+
   InfoModel& InfoModel::instance() {
     static InfoModel instance_;
     return instance_;
   }
 
+  /* The type tables are filled in by the constructor and never
+   * changed afterwards, so they need no locking. */
   const IEType* InfoModel::lookupIEType(const std::string &name) const {
-    std::lock_guard<std::recursive_mutex> locker(lock);
-
     std::map<std::string, const IEType*>::const_iterator iter;
     
     if ((iter = ietypes_byname_.find(name)) == ietypes_byname_.end()) {
@@ -56,15 +85,34 @@ namespace libfc {
   }
 
   const IEType* InfoModel::lookupIEType(const unsigned int number) const { 
-    std::lock_guard<std::recursive_mutex> locker(lock);
-
     return ietypes_bynum_.at(number); 
   }
 
-  InfoModel::InfoModel() {
+  InfoModel::InfoModel() : pending_(0), update_depth_(0) {
+    for (size_t i = 0; i < kUnknownChains; ++i)
+      unknown_[i].store(0, std::memory_order_relaxed);
+    registries_.push_back(std::unique_ptr<const Registry>(new Registry()));
+    registry_.store(registries_.back().get(), std::memory_order_release);
     initTypes();
   }
 
+  InfoModel::~InfoModel() {
+    for (size_t i = 0; i < kUnknownChains; ++i) {
+      const Unknown* u = unknown_[i].load(std::memory_order_relaxed);
+      while (u != 0) {
+        const Unknown* next = u->next;
+        delete u;
+        u = next;
+      }
+    }
+  }
+
+  /* Multiplicative hashing, as in TemplateTable. */
+  static size_t unknown_chain(uint64_t key, size_t n_chains) {
+    return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> 32)
+      & (n_chains - 1);
+  }
+
   static void parseIESpec_NumPen(std::istringstream& iestream, 
                                  unsigned int& number,
                                  unsigned int& pen) {
@@ -186,8 +234,6 @@ namespace libfc {
   }
 
   const InfoElement InfoModel::parseIESpec(const std::string& iespec) const {
-    std::lock_guard<std::recursive_mutex> locker(lock);
-    
     // check for name-only IE
     // WORKAROUND for broken libc++ on Mac OS X Lion
     if ((iespec.find('(') == std::string::npos) &&
@@ -225,7 +271,8 @@ namespace libfc {
   }
 
   const InfoElement* InfoModel::add(const InfoElement& ie) {
-    std::lock_guard<std::recursive_mutex> locker(lock);
+    Update update(*this);
+    Registry& r = *pending_;
 
     // Short circuit unless we have a record valid for insertion:
     // at least a name, number, and valid, known type
@@ -236,26 +283,29 @@ namespace libfc {
     const InfoElement* ret = 0;
 
     // Only add if we don't have an existing IE for the given name and pen
-    if ((ret = lookupIE(ie.pen(), ie.number(), ie.len())) != 0) return ret;
+    if ((ret = find(r, ie.pen(), ie.number())) != 0)
+      return ret->forLen(ie.len());
 
 
-    if (ie.pen()) {
-      name_registry_[ie.name()] = 
-        pen_registry_[ie.pen()][ie.number()] = 
+    if (ie.pen() || ie.number() >= kMaxDirectNumber) {
+      r.name[ie.name()] = 
+        r.pen[ie.key()] = 
         std::shared_ptr<InfoElement>(new InfoElement(ie));
       // std::cerr << "add  PEN IE " << ie.pen() << "/" << ie.number() << " " << ie.name() << std::endl;
     } else {
-      name_registry_[ie.name()] = 
-        iana_registry_[ie.number()] = 
+      if (ie.number() >= r.iana.size())
+        r.iana.resize(ie.number() + 1);
+      r.name[ie.name()] = 
+        r.iana[ie.number()] = 
         std::shared_ptr<InfoElement>(new InfoElement(ie));
       // std::cerr << "add IANA IE " << ie.number() << " " << ie.name() << std::endl;
     }
 
-    return name_registry_[ie.name()].get();
+    return r.name[ie.name()].get();
   }
 
   void InfoModel::add(const std::string& iespec) {
-    std::lock_guard<std::recursive_mutex> locker(lock);
+    Update update(*this);
 
     add(parseIESpec(iespec));
   }
@@ -263,45 +313,61 @@ namespace libfc {
   const InfoElement* InfoModel::add_unknown(uint32_t pen, uint16_t number, uint16_t len) {
     std::lock_guard<std::recursive_mutex> locker(lock);
 
+    /* Someone may have added it since the caller looked it up. */
+    const InfoElement* ie
+      = find(*registry_.load(std::memory_order_relaxed), pen, number);
+    uint64_t key = (static_cast<uint64_t>(pen) << 16) | number;
+    if (ie == 0)
+      ie = find_unknown(key);
+    if (ie != 0)
+      return ie->forLen(len);
+
     /* Naming convention from Brian's Python code. */
     std::string name = "__ipfix_";
 
-    InfoElement ie(name, pen, number, lookupIEType("octetArray"), len);
+    Unknown* u = new Unknown();
+    u->key = key;
+    u->ie.reset(new InfoElement(name, pen, number,
+                                lookupIEType("octetArray"), len));
 
-    return add(ie);
+    std::atomic<const Unknown*>& chain
+      = unknown_[unknown_chain(key, kUnknownChains)];
+    u->next = chain.load(std::memory_order_relaxed);
+    chain.store(u, std::memory_order_release);
+
+    return u->ie.get();
   }
-  
-  const InfoElement* InfoModel::lookupIE(uint32_t pen, uint16_t number, uint16_t len) const {  
-    std::lock_guard<std::recursive_mutex> locker(lock);
 
-    std::map<uint16_t, std::shared_ptr<InfoElement> >::const_iterator iter;
+  const InfoElement* InfoModel::find_unknown(uint64_t key) const {
+    for (const Unknown* u
+           = unknown_[unknown_chain(key, kUnknownChains)]
+               .load(std::memory_order_acquire);
+         u != 0; u = u->next)
+      if (u->key == key)
+        return u->ie.get();
+    return 0;
+  }
+  
+  InfoElement* InfoModel::find(const Registry& r, uint32_t pen,
+                               uint16_t number) {
+    if (pen || number >= kMaxDirectNumber) {
+      const std::shared_ptr<InfoElement>* ie
+        = r.pen.find((static_cast<uint64_t>(pen) << 16) | number);
+      return ie == 0 ? NULL : ie->get();
+    } else
+      return number < r.iana.size() ? r.iana[number].get() : NULL;
+  }
 
-    //std::cerr << "lookupIE (" << pen << "/" << number << ")[" << len << "]" << std::endl;
-    if (pen) {
-      std::map<uint32_t, std::map<uint16_t, std::shared_ptr<InfoElement> > >::const_iterator peniter;
+  const InfoElement* InfoModel::lookupIE(uint32_t pen, uint16_t number, uint16_t len) const {  
+    const InfoElement* ie
+      = find(*registry_.load(std::memory_order_acquire), pen, number);
+    if (ie == NULL)
+      ie = find_unknown((static_cast<uint64_t>(pen) << 16) | number);
 
-      if ((peniter = pen_registry_.find(pen)) == pen_registry_.end()) {
-        //std::cerr << "    no such pen" << std::endl;
-        return NULL;
-      } else {
-        if ((iter = peniter->second.find(number)) == peniter->second.end()) {
-          //std::cerr << "    not in pen registry" << std::endl;
-          return NULL;
-        }
-      }
-    } else {
-      if ((iter = iana_registry_.find(number)) == iana_registry_.end()) {
-        //std::cerr << "    not in iana registry" << std::endl;
-        return NULL;
-      }
-    }
-    
-    return iter->second->forLen(len);
+    return ie == NULL ? NULL : ie->forLen(len);
   }
 
   const InfoElement *InfoModel::lookupIE(const InfoElement& specie) const {
-    std::lock_guard<std::recursive_mutex> locker(lock);
-
     if (specie.number()) {
       return lookupIE(specie.pen(), specie.number(), specie.len());
     } else if (specie.name().empty()) {
@@ -309,8 +375,9 @@ namespace libfc {
       throw IESpecError("incomplete IESpec for InfoModel lookup.");
     } else {
       // std::cerr << "lookupIE " << specie.name() << std::endl;
-      std::map<std::string, std::shared_ptr<InfoElement> >::const_iterator iter = name_registry_.find(specie.name());
-      if (iter == name_registry_.end()) {
+      const Registry& r = *registry_.load(std::memory_order_acquire);
+      std::map<std::string, std::shared_ptr<InfoElement> >::const_iterator iter = r.name.find(specie.name());
+      if (iter == r.name.end()) {
         // std::cerr << "    not in name registry" << std::endl;
         return NULL;
       } else {
@@ -320,23 +387,24 @@ namespace libfc {
   }
 
   const InfoElement *InfoModel::lookupIE(const std::string& iespec) const {
-    std::lock_guard<std::recursive_mutex> locker(lock);
-
     // Parse the Information Element and look it up
     // std::cerr << "lookup " << iespec << " by std::string" << std::endl;
     return lookupIE(parseIESpec(iespec));
   }    
 
   void InfoModel::dump(std::ostream &os) const {
-    std::lock_guard<std::recursive_mutex> locker(lock);
-
-    std::map<uint16_t, std::shared_ptr<InfoElement> >::const_iterator   iana_keyiter;
+    const Registry& r = *registry_.load(std::memory_order_acquire);
 
-    for (iana_keyiter = iana_registry_.begin();
-         iana_keyiter != iana_registry_.end();
-         iana_keyiter++) {
-      os << iana_keyiter->second->toIESpec() << std::endl;
+    for (auto i = r.iana.begin(); i != r.iana.end(); ++i) {
+      if (*i)
+        os << (*i)->toIESpec() << std::endl;
     }
+
+    for (size_t i = 0; i < kUnknownChains; ++i)
+      for (const Unknown* u = unknown_[i].load(std::memory_order_acquire);
+           u != 0; u = u->next)
+        if (u->ie->pen() == 0)
+          os << u->ie->toIESpec() << std::endl;
   }
 
   void InfoModel::registerIEType(const IEType *iet) {
@@ -374,7 +442,7 @@ namespace libfc {
 
 
   void InfoModel::defaultIPFIX() {
-    std::lock_guard<std::recursive_mutex> locker(lock);
+    Update update(*this);
 
       add("octetDeltaCount(1)<unsigned64>[8]");
       add("packetDeltaCount(2)<unsigned64>[8]");
@@ -760,7 +828,7 @@ namespace libfc {
 }
 
   void InfoModel::default5103() {
-    std::lock_guard<std::recursive_mutex> locker(lock);
+    Update update(*this);
 
     defaultIPFIX();
     add("reverseOctetDeltaCount(29305/1)<unsigned64>[8]");
@@ -36,6 +36,7 @@
 #ifndef _libfc_INFOMODEL_H_ // idem
 #define _libfc_INFOMODEL_H_ // hack
 
+#include <atomic>
 #include <cstdint>
 #include <iostream>
 #include <map>
@@ -43,10 +44,10 @@
 #include <mutex>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "IEType.h"
-
-// FIXME enforce thread safety on changes to the infomodel
+#include "TemplateTable.h"
 
 namespace libfc {
 
@@ -55,6 +56,18 @@ namespace libfc {
   /**
    * Represents an IPFIX Information Model, a collection of canonical 
    * Information Elements. 
+   *
+   * The registries are published as immutable snapshots. Lookups read
+   * the current snapshot without taking a lock, so any number of
+   * threads can parse templates concurrently.  Changes (add(),
+   * add_unknown(), defaultIPFIX(), ...) are serialised among
+   * themselves, work on a private copy, and publish it atomically
+   * when they are done.  Canonical IEs are never freed, so pointers
+   * returned by lookupIE() stay valid across changes.
+   *
+   * Unknown IEs, which add_unknown() makes for templates from the
+   * wire, are kept in a separate table that grows in place, so that
+   * an exporter can't make the model copy its registries.
    */
   class InfoModel {
   public:
@@ -189,6 +202,8 @@ namespace libfc {
      */
     const IEType* lookupIEType(const unsigned int number) const;
 
+    ~InfoModel();
+
     /** Dumps this InfoModel as a bunch of IESpect to a given output stream.
      *
      * This method is used only for debugging.
@@ -210,26 +225,77 @@ namespace libfc {
     void registerIEType(const IEType* iet);
     void initTypes();
 
-    // Information element registry. Keep canonical IEs by autopointer.
-    std::map<uint16_t, std::shared_ptr<InfoElement> > iana_registry_;
-    std::map<uint32_t, std::map<uint16_t,
-                                std::shared_ptr<InfoElement> > >  pen_registry_;
-    std::vector<std::shared_ptr<InfoElement> > rle_registry_;
-    
-    // Information element name lookup. 
-    std::map<std::string, std::shared_ptr<InfoElement> >  name_registry_;
+    /** One immutable version of the information element registries.
+     *
+     * Once published, a registry is never changed again.  Superseded
+     * registries are kept until the model goes away, because a
+     * reader might still be looking at them; they are only replaced
+     * when IEs are added, which is rare after startup.
+     */
+    struct Registry {
+      /** IANA IEs numbered below kMaxDirectNumber, indexed directly
+       * by IE number.  Standard IANA numbers are dense and small, so
+       * this wastes few empty slots. */
+      std::vector<std::shared_ptr<InfoElement> > iana;
+
+      /** Enterprise-specific IEs, and IANA IEs numbered
+       * kMaxDirectNumber or above, keyed by InfoElement::key(). */
+      TemplateTable<std::shared_ptr<InfoElement> > pen;
+
+      // Information element name lookup. 
+      std::map<std::string, std::shared_ptr<InfoElement> > name;
+    };
+
+    /** IANA IEs with smaller numbers are looked up by direct index.
+     * This covers every standard IE, and keeps one large number from
+     * growing the table in every later registry. */
+    static const uint16_t kMaxDirectNumber = 1024;
+
+    /** Opens a change to the registries; see InfoModel.cpp. */
+    class Update;
+
+    static InfoElement* find(const Registry& r, uint32_t pen,
+                             uint16_t number);
+
+    /** An IE made by add_unknown(). */
+    struct Unknown {
+      uint64_t key;
+      std::unique_ptr<InfoElement> ie;
+      const Unknown* next;
+    };
+
+    /** Number of chains in the table of unknown IEs; a power of two. */
+    static const size_t kUnknownChains = 1024;
+
+    const InfoElement* find_unknown(uint64_t key) const;
+
+    /** The current registry, read without locking. */
+    std::atomic<const Registry*> registry_;
+
+    /** The registry being changed, if an Update is open. */
+    Registry* pending_;
+
+    /** Nesting depth of open Updates. */
+    unsigned int update_depth_;
+
+    /** All registries ever published, including the current one. */
+    std::vector<std::unique_ptr<const Registry> > registries_;
+
+    /** Unknown IEs, hashed by InfoElement::key() into chains.  New
+     * entries go to the front of a chain, so readers walk the chains
+     * without locking.  Entries are freed with the model. */
+    std::atomic<const Unknown*> unknown_[kUnknownChains];
     
     // Information element type lookup.
     std::map<std::string, const IEType*> ietypes_byname_;
     std::vector<const IEType*>  ietypes_bynum_;
 
-    /** Makes sure that accesses to instance variables happen
-     * under mutual exclusion.
+    /** Serialises changes to the registries.
      *
-     * Needs to be mutable so that logically const methods like
-     * lookupIE() can still acquire the lock.
+     * Readers never take this lock.  It is recursive because adding
+     * IEs from a spec calls add() for every IE.
      */
-    mutable std::recursive_mutex lock;
+    std::recursive_mutex lock;
   };
 
 } // namespace libfc
@@ -25,6 +25,9 @@
  */
 #include <cerrno>
 
+#include <netinet/in.h>
+#include <sys/socket.h>
+
 #include "InputSource.h"
 
 namespace libfc {
@@ -37,4 +40,44 @@ namespace libfc {
     return -1;
   }
 
+  const uint8_t* InputSource::read_view(uint16_t len, ssize_t* nbytes) {
+    return 0;
+  }
+
+  uint64_t InputSource::get_exporter_id() const {
+    return 0;
+  }
+
+  /** FNV-1a, continuing from hash h. */
+  static uint64_t fnv1a(uint64_t h, const void* buf, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    for (size_t k = 0; k < len; ++k)
+      h = (h ^ p[k]) * 0x100000001b3ULL;
+    return h;
+  }
+
+  uint64_t InputSource::make_exporter_id(const struct sockaddr* sa,
+                                         size_t sa_len) {
+    static const uint64_t ipv4_tag = static_cast<uint64_t>(1) << 48;
+    static const uint64_t hash_tag = static_cast<uint64_t>(1) << 63;
+    static const uint64_t fnv_basis = 0xcbf29ce484222325ULL;
+
+    if (sa->sa_family == AF_INET && sa_len >= sizeof(struct sockaddr_in)) {
+      const struct sockaddr_in* sin
+        = reinterpret_cast<const struct sockaddr_in*>(sa);
+      return ipv4_tag
+        | (static_cast<uint64_t>(ntohl(sin->sin_addr.s_addr)) << 16)
+        | ntohs(sin->sin_port);
+    } else if (sa->sa_family == AF_INET6
+               && sa_len >= sizeof(struct sockaddr_in6)) {
+      /* Only address and port; the rest may contain junk. */
+      const struct sockaddr_in6* sin6
+        = reinterpret_cast<const struct sockaddr_in6*>(sa);
+      uint64_t h = fnv1a(fnv_basis, &sin6->sin6_addr,
+                         sizeof(sin6->sin6_addr));
+      return fnv1a(h, &sin6->sin6_port, sizeof(sin6->sin6_port)) | hash_tag;
+    } else
+      return fnv1a(fnv_basis, sa, sa_len) | hash_tag;
+  }
+
 } // namespace libfc
@@ -37,6 +37,8 @@
 
 #  include <unistd.h>
 
+struct sockaddr;
+
 namespace libfc {
 
 /** Augments the error context from a callback and returns it.
@@ -95,15 +97,45 @@ namespace libfc {
      */
     virtual ssize_t peek(uint8_t* buf, uint16_t len);
 
+    /** Reads a number of bytes from the input source without copying
+     *   them, advancing the offset.
+     *
+     * Input sources that hold their whole input in memory can hand
+     * out pointers into that memory instead of copying it into the
+     * parser's buffer.  The bytes stay valid for as long as the input
+     * source exists, and the bytes of consecutive calls are
+     * contiguous in memory, so that a parser can read a message
+     * header and then its body and see one message.
+     *
+     * The default implementation returns 0 and reads nothing; parsers
+     * then fall back to read().
+     *
+     * @param len the number of bytes to read
+     * @param nbytes set to the number of bytes read (0 indicates end
+     *   of file), unless 0 is returned
+     *
+     * @return a pointer to the bytes read, or 0 if this input source
+     *   cannot read without copying
+     */
+    virtual const uint8_t* read_view(uint16_t len, ssize_t* nbytes);
+
     /** Attempts to re-synchronise the stream to the beginning of a valid
      * message.
      *
+     * Message stream parsers call this after a malformed message,
+     * before they scan forward for the next plausible message header
+     * (see MessageStreamParser::set_resync_policy()).  The scan
+     * itself is done by the parser, which knows what a message
+     * header looks like, so stream-based input sources have nothing
+     * to do here and return true.
+     *
      * This method has no meaning in message-based input sources, such
      * as UDP. In such cases, the method should simply throw away any
      * buffers that it might have and receive the next message.
      *
      * @return true if resynchronisation worked, false if the stream
-     * has ended before resynchronisation.
+     * has ended before resynchronisation or the source cannot skip
+     * ahead.
      */
     virtual bool resync() = 0;
 
@@ -142,6 +174,36 @@ namespace libfc {
      * @return true if this input source supports peek(), false if not.
      */
     virtual bool can_peek() const = 0;
+
+    /** Returns an identifier for the exporter of the current message.
+     *
+     * Template IDs and observation domains are chosen by exporters,
+     * so two exporters may well use the same ones for different
+     * templates.  Content handlers use this identifier to keep their
+     * templates apart.  For network input sources, this is derived
+     * from the peer's address and port, see make_exporter_id(); a UDP
+     * source may see a different exporter for every message.
+     *
+     * The default implementation returns 0, which stands for "the one
+     * and only exporter".
+     *
+     * @return an identifier for the exporter of the current message
+     */
+    virtual uint64_t get_exporter_id() const;
+
+    /** Makes an exporter identifier from a socket address.
+     *
+     * IPv4 addresses and ports map to distinct identifiers.  IPv6
+     * addresses are hashed, so that collisions are possible, but
+     * vanishingly unlikely.  The result is never 0.
+     *
+     * @param sa the socket address of the exporter
+     * @param sa_len the length of the socket address, in bytes
+     *
+     * @return an identifier for the exporter
+     */
+    static uint64_t make_exporter_id(const struct sockaddr* sa,
+                                     size_t sa_len);
   };
 
 } // namespace libfc
@@ -24,19 +24,26 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-#  include <log4cplus/logger.h>
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include "logging.h"
 
 #include "MessageStreamParser.h"
 
 namespace libfc {
 
   MessageStreamParser::MessageStreamParser() 
-    : content_handler(0)
+    : content_handler(0),
+      resync_policy(stop_on_error),
+      framing_error(false),
+      in_message(false),
+      pushback_off(0),
+      n_resyncs(0),
+      n_skipped_bytes(0),
+      n_skipped_messages(0)
 #if defined(_libfc_HAVE_LOG4CPLUS_)
                       ,
       logger(log4cplus::Logger::getInstance(LOG4CPLUS_TEXT("logger")))
@@ -51,5 +58,206 @@ namespace libfc {
     content_handler = handler;
   }
 
+  void MessageStreamParser::set_resync_policy(ResyncPolicy policy) {
+    resync_policy = policy;
+  }
+
+  uint64_t MessageStreamParser::get_n_resyncs() const {
+    return n_resyncs.load(std::memory_order_relaxed);
+  }
+
+  uint64_t MessageStreamParser::get_n_skipped_bytes() const {
+    return n_skipped_bytes.load(std::memory_order_relaxed);
+  }
+
+  uint64_t MessageStreamParser::get_n_skipped_messages() const {
+    return n_skipped_messages.load(std::memory_order_relaxed);
+  }
+
+  ssize_t MessageStreamParser::read_input(InputSource& is, uint8_t* buf,
+                                          uint16_t len) {
+    if (pushback_off == pushback.size())
+      return is.read(buf, len);
+
+    size_t n = std::min(static_cast<size_t>(len),
+                        pushback.size() - pushback_off);
+    memcpy(buf, &pushback[pushback_off], n);
+    pushback_off += n;
+    if (pushback_off == pushback.size()) {
+      pushback.clear();
+      pushback_off = 0;
+    }
+
+    if (n == len)
+      return n;
+
+    ssize_t ret = is.read(buf + n, len - n);
+    return ret < 0 ? ret : static_cast<ssize_t>(n) + ret;
+  }
+
+  const uint8_t* MessageStreamParser::read_input_view(InputSource& is,
+                                                     uint8_t* buf,
+                                                     uint16_t len,
+                                                     ssize_t* nbytes) {
+    if (pushback_off == pushback.size()) {
+      const uint8_t* view = is.read_view(len, nbytes);
+      if (view != 0)
+        return view;
+    }
+
+    *nbytes = read_input(is, buf, len);
+    return buf;
+  }
+
+  ssize_t MessageStreamParser::peek_input(InputSource& is, uint8_t* buf,
+                                          uint16_t len) {
+    if (pushback_off == pushback.size())
+      return is.peek(buf, len);
+
+    size_t n = std::min(static_cast<size_t>(len),
+                        pushback.size() - pushback_off);
+    memcpy(buf, &pushback[pushback_off], n);
+
+    if (n == len)
+      return n;
+
+    ssize_t ret = is.peek(buf + n, len - n);
+    return ret < 0 ? ret : static_cast<ssize_t>(n) + ret;
+  }
+
+  void MessageStreamParser::start_parse() {
+    pushback.clear();
+    pushback_off = 0;
+    n_resyncs = 0;
+    n_skipped_bytes = 0;
+    n_skipped_messages = 0;
+    framing_error = false;
+  }
+
+  /** Appends at least want bytes to a resynchronisation window, if
+   * the input source has them.
+   *
+   * Reads in chunks of at least 4 KiB so that scanning forward byte
+   * by byte does not turn into a read call per byte.
+   *
+   * @return false if the input source has ended (or failed)
+   */
+  static bool read_more(InputSource& is, std::vector<uint8_t>& window,
+                        size_t want) {
+    const size_t chunk = std::min(std::max(want, static_cast<size_t>(4096)),
+                                  static_cast<size_t>(UINT16_MAX));
+    size_t old_size = window.size();
+
+    window.resize(old_size + chunk);
+    errno = 0;
+    ssize_t ret = is.read(&window[old_size], static_cast<uint16_t>(chunk));
+    window.resize(old_size + (ret > 0 ? ret : 0));
+
+    return ret > 0;
+  }
+
+  bool MessageStreamParser::resynchronize(InputSource& is,
+                                          const uint8_t* buf, size_t len) {
+    if (!is.resync())
+      return false;
+
+    /* The window holds the bytes that have been read from the input
+     * source but not yet parsed: the malformed message and anything
+     * that was pushed back by an earlier resynchronisation.  A
+     * message cannot start at the first byte of the malformed
+     * message, so the scan starts one byte later. */
+    std::vector<uint8_t> window(buf, buf + len);
+    window.insert(window.end(), pushback.begin() + pushback_off,
+                  pushback.end());
+    pushback.clear();
+    pushback_off = 0;
+
+    size_t start = len > 0 ? 1 : 0;
+    uint64_t discarded = 0;
+    bool at_eof = false;
+
+    while (true) {
+      if (start >= window.size()) {
+        if (at_eof || !read_more(is, window, 0)) {
+          at_eof = true;
+          start = window.size();
+          break;
+        }
+        continue;
+      }
+
+      size_t needed = 0;
+      Plausibility p = check_message_start(&window[start],
+                                           window.size() - start, &needed);
+      if (p == plausible)
+        break;
+      else if (p == need_more && !at_eof) {
+        assert(needed > window.size() - start);
+        if (read_more(is, window, start + needed - window.size()))
+          continue;
+        /* A candidate that needs more bytes than the stream has is no
+         * message. */
+        at_eof = true;
+      }
+
+      start++;
+
+      /* Don't let the window grow without bound while skipping over
+       * long stretches of garbage. */
+      if (start >= UINT16_MAX && start >= window.size() / 2) {
+        window.erase(window.begin(), window.begin() + start);
+        discarded += start;
+        start = 0;
+      }
+    }
+
+    uint64_t skipped = discarded + start;
+    n_resyncs.store(n_resyncs.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    n_skipped_bytes.store(
+      n_skipped_bytes.load(std::memory_order_relaxed) + skipped,
+      std::memory_order_relaxed);
+
+    LOG4CPLUS_WARN(logger, "Resynchronised after malformed message, "
+                   "skipped " << skipped << " bytes");
+
+    pushback.assign(window.begin() + start, window.end());
+    return true;
+  }
+
+
+  bool MessageStreamParser::recover(InputSource& is, const uint8_t* buf,
+                                    size_t len,
+                                    std::shared_ptr<ErrorContext>& err) {
+    if (resync_policy != resync_on_error)
+      return false;
+    if (!framing_error && err->get_severity() != ErrorContext::recoverable)
+      return false;
+
+    /* Deliver what was decoded before the error, so that partial
+     * batches don't end up with the next message's records. */
+    if (in_message) {
+      in_message = false;
+      std::shared_ptr<ErrorContext> end_err = content_handler->end_message();
+      if (end_err != 0) {
+        end_err->set_input_source(&is);
+        err = end_err;
+        return false;
+      }
+    }
+
+    if (framing_error)
+      return resynchronize(is, buf, len);
+
+    /* The message was read in full, so the next one starts right
+     * behind it. */
+    n_skipped_messages.store(
+      n_skipped_messages.load(std::memory_order_relaxed) + 1,
+      std::memory_order_relaxed);
+
+    LOG4CPLUS_WARN(logger, "Skipped the rest of a message: "
+                   << err->get_explanation());
+    return true;
+  }
 
 } // namespace libfc
@@ -33,7 +33,10 @@
 #ifndef _libfc_MESSAGESTREAMPARSER_H_
 #  define _libfc_MESSAGESTREAMPARSER_H_
 
+#  include <atomic>
+#  include <cstdint>
 #  include <memory>
+#  include <vector>
 
 #  if defined(_libfc_HAVE_LOG4CPLUS_)
 #    include <log4cplus/logger.h>
@@ -77,10 +80,160 @@ namespace libfc {
      */
     void set_content_handler(ContentHandler* handler);
 
+    /** What to do when a message is malformed. */
+    enum ResyncPolicy {
+      /** Return the error from parse(); this is the default. */
+      stop_on_error,
+
+      /** Skip malformed messages and go on parsing.
+       *
+       * After an error in the framing of messages (bad version
+       * numbers, truncated messages, sets that overrun their message,
+       * bad set IDs), skip ahead to the next plausible message
+       * header.  After a recoverable error in the content of a
+       * well-framed message, such as a record that overruns its set
+       * (whether the content handler returns it or throws a
+       * FormatError), skip the rest of that message.  Either way,
+       * the content handler gets end_message() for a message that it
+       * got start_message() for, so that records decoded before the
+       * error are delivered with their own message.  Fatal errors
+       * from the content handler still end the parse.
+       */
+      resync_on_error,
+    };
+
+    /** Sets what to do when a message is malformed.
+     *
+     * @param policy the new policy
+     */
+    void set_resync_policy(ResyncPolicy policy);
+
+    /** Returns how often the last parse() resynchronised.
+     *
+     * This and get_n_skipped_bytes() may be called from another
+     * thread while parse() is running. */
+    uint64_t get_n_resyncs() const;
+
+    /** Returns how many bytes the last parse() skipped while
+     * resynchronising. */
+    uint64_t get_n_skipped_bytes() const;
+
+    /** Returns how many well-framed messages the last parse() skipped
+     * the rest of because of an error in their content. */
+    uint64_t get_n_skipped_messages() const;
+
   protected:
+    /** Result of checking whether a message may start at some
+     * position. */
+    enum Plausibility {
+      /** Something is wrong with the bytes seen. */
+      implausible,
+
+      /** This looks like the start of a message. */
+      plausible,
+
+      /** More bytes are needed to decide. */
+      need_more,
+    };
+
+    /** Checks whether a message may start at a buffer.
+     *
+     * This is what resynchronisation looks for.
+     *
+     * @param buf the bytes to check
+     * @param len the number of bytes available at buf
+     * @param needed if the result is need_more, set to the number of
+     *   bytes needed to decide, which is larger than len
+     *
+     * @return whether a message may start at buf
+     */
+    virtual Plausibility check_message_start(const uint8_t* buf, size_t len,
+                                             size_t* needed) const = 0;
+
+    /** Reads from an input source, taking bytes that resynchronisation
+     * has pushed back first.
+     *
+     * Parsers must read through this method, not InputSource::read().
+     */
+    ssize_t read_input(InputSource& is, uint8_t* buf, uint16_t len);
+
+    /** Reads from an input source like read_input(), but without
+     * copying if the input source supports InputSource::read_view()
+     * and nothing is pushed back.
+     *
+     * @param is the input source
+     * @param buf the buffer to copy into if copying is necessary
+     * @param len the number of bytes to read
+     * @param nbytes set to the number of bytes read, or -1 on error
+     *
+     * @return either buf or a pointer into the input source's memory
+     */
+    const uint8_t* read_input_view(InputSource& is, uint8_t* buf,
+                                   uint16_t len, ssize_t* nbytes);
+
+    /** Peeks at an input source, like read_input(). */
+    ssize_t peek_input(InputSource& is, uint8_t* buf, uint16_t len);
+
+    /** Starts a new parse: resets counters and forgets pushed-back
+     * bytes. */
+    void start_parse();
+
+    /** Skips ahead to the next plausible message.
+     *
+     * Afterwards, read_input() will return the first byte of that
+     * message.
+     *
+     * @param is the input source
+     * @param buf the bytes of the malformed message that were read
+     *   so far
+     * @param len the number of bytes at buf
+     *
+     * @return true if parsing can continue (possibly at the end of
+     *   the stream), false if the input source cannot resynchronise
+     */
+    bool resynchronize(InputSource& is, const uint8_t* buf, size_t len);
+
+    /** Decides whether parsing can go on after an error in a message,
+     * according to the resync policy.
+     *
+     * Ends the message if it was started, and resynchronises after
+     * framing errors.
+     *
+     * @param is the input source
+     * @param buf the bytes of the message that were read so far
+     * @param len the number of bytes at buf
+     * @param err the error; replaced by the content handler's error
+     *   if end_message() fails
+     *
+     * @return true if parsing can continue after the message, false
+     *   if parse() must return err
+     */
+    bool recover(InputSource& is, const uint8_t* buf, size_t len,
+                 std::shared_ptr<ErrorContext>& err);
+
     ContentHandler* content_handler;
 
+    ResyncPolicy resync_policy;
+
+    /** Whether the last error was one in the framing of messages,
+     * after which resynchronisation makes sense. */
+    bool framing_error;
+
+    /** Whether the content handler got start_message() for the
+     * current message, but not yet end_message(). */
+    bool in_message;
+
   private:
+    /** Bytes that were read from the input source during
+     * resynchronisation but not yet returned by read_input(). */
+    std::vector<uint8_t> pushback;
+
+    /** Index of the next byte to return from pushback. */
+    size_t pushback_off;
+
+    std::atomic<uint64_t> n_resyncs;
+    std::atomic<uint64_t> n_skipped_bytes;
+    std::atomic<uint64_t> n_skipped_messages;
 
 #if defined(_libfc_HAVE_LOG4CPLUS_)
     log4cplus::Logger logger;
@@ -0,0 +1,160 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <sstream>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MmapInputSource.h"
+
+namespace libfc {
+
+  MmapInputSource::MmapInputSource(int fd, std::string file_name)
+    : fd(fd),
+      reader(fd),
+      map(0),
+      map_len(0),
+      mapped(false),
+      off(0),
+      message_offset(0),
+      current_offset(0),
+      file_name(file_name),
+      name(0) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      reader.advise_sequential();
+      return;
+    }
+
+    map_len = static_cast<size_t>(st.st_size);
+    if (map_len == 0) {
+      mapped = true;
+      return;
+    }
+
+    void* p = mmap(0, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      map_len = 0;
+      reader.advise_sequential();
+      return;
+    }
+
+    /* Messages are parsed front to back, so let the kernel read
+     * ahead aggressively and drop pages behind us. */
+    (void) madvise(p, map_len, MADV_SEQUENTIAL);
+    (void) madvise(p, map_len, MADV_WILLNEED);
+
+    map = static_cast<const uint8_t*>(p);
+    mapped = true;
+  }
+
+  MmapInputSource::~MmapInputSource() {
+    if (map != 0)
+      (void) munmap(const_cast<uint8_t*>(map), map_len);
+    (void) close(fd); // FIXME: Error handling?
+    delete[] const_cast<char*>(name);
+  }
+
+  ssize_t MmapInputSource::read(uint8_t* buf, uint16_t len) {
+    ssize_t ret;
+
+    if (mapped) {
+      ret = peek(buf, len);
+      off += ret;
+    } else
+      ret = reader.read(buf, len);
+
+    if (ret > 0)
+      current_offset += ret;
+    return ret;
+  }
+
+  ssize_t MmapInputSource::peek(uint8_t* buf, uint16_t len) {
+    if (!mapped)
+      return reader.peek(buf, len);
+
+    assert(off <= map_len);
+    size_t n = std::min(map_len - off, static_cast<size_t>(len));
+    memcpy(buf, map + off, n);
+    return static_cast<ssize_t>(n);
+  }
+
+  const uint8_t* MmapInputSource::read_view(uint16_t len, ssize_t* nbytes) {
+    if (!mapped)
+      return 0;
+
+    assert(off <= map_len);
+    size_t n = std::min(map_len - off, static_cast<size_t>(len));
+    const uint8_t* ret = map + off;
+
+    off += n;
+    current_offset += n;
+    *nbytes = static_cast<ssize_t>(n);
+    return ret;
+  }
+
+  bool MmapInputSource::resync() {
+    /* Nothing to drop; the parser scans forward through read(). */
+    return true;
+  }
+
+  size_t MmapInputSource::get_message_offset() const {
+    return message_offset;
+  }
+
+  void MmapInputSource::advance_message_offset() {
+    message_offset += current_offset;
+    current_offset = 0;
+  }
+
+  const char* MmapInputSource::get_name() const {
+    if (name == 0) {
+      std::ostringstream sstr;
+
+      sstr << "Mmap(name=\"" << file_name << "\")";
+      std::string s = sstr.str();
+
+      name = new char[s.length() + 1];
+      std::strcpy(const_cast<char*>(name), s.c_str());
+    }
+    
+    return name;
+  }
+
+  bool MmapInputSource::can_peek() const {
+    return true;
+  }
+
+  bool MmapInputSource::is_mapped() const {
+    return mapped;
+  }
+
+} // namespace libfc
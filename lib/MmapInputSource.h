@@ -0,0 +1,100 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_MMAPINPUTSOURCE_H_
+#  define _libfc_MMAPINPUTSOURCE_H_
+
+#  include <string>
+
+#  include "BufferedReader.h"
+#  include "InputSource.h"
+
+namespace libfc {
+
+  /** An input source that maps a whole file into memory.
+   *
+   * Parsers read messages through read_view(), so that they work on
+   * the mapping directly instead of copying every message.  This is
+   * the fastest way to parse local archives.
+   *
+   * Descriptors that cannot be mapped, such as pipes, are read
+   * through a BufferedReader instead, as by FileInputSource.
+   */
+  class MmapInputSource : public InputSource {
+  public:
+    /** Creates a memory-mapped input source from a file descriptor.
+     *
+     * @param fd the file descriptor belonging to an IPFIX data file;
+     *   it is closed when the input source is destroyed
+     * @param name the name you want this file to be known to diagnostics
+     */
+    MmapInputSource(int fd, std::string file_name);
+    ~MmapInputSource();
+
+    ssize_t read(uint8_t* buf, uint16_t len);
+    ssize_t peek(uint8_t* buf, uint16_t len);
+    const uint8_t* read_view(uint16_t len, ssize_t* nbytes);
+    bool resync();
+    size_t get_message_offset() const;
+    void advance_message_offset();
+    const char* get_name() const;
+    bool can_peek() const;
+
+    /** Returns whether the file could be mapped.
+     *
+     * @return true if the file is mapped, false if it is read
+     *   through a buffer instead
+     */
+    bool is_mapped() const;
+
+  private:
+    int fd;
+    BufferedReader reader;
+
+    /** The mapping, or 0 if the file isn't mapped or empty. */
+    const uint8_t* map;
+    size_t map_len;
+    bool mapped;
+
+    /** Offset of the next byte to read from the mapping. */
+    size_t off;
+
+    size_t message_offset;
+    size_t current_offset;
+    std::string file_name;
+    mutable const char* name;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_MMAPINPUTSOURCE_H_
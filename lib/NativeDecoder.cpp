@@ -0,0 +1,196 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#if defined(_libfc_HAVE_JIT_) && defined(__x86_64__)
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  define _libfc_NATIVE_X86_64_
+#endif /* defined(_libfc_HAVE_JIT_) && defined(__x86_64__) */
+
+#include "NativeDecoder.h"
+#include "OctetArrayView.h"
+
+/* All generated code follows the System V AMD64 calling convention:
+ * the record pointer arrives in rdi.  Only rax, rcx and xmm0 are
+ * used, all of which are caller-saved, so there is no prologue or
+ * epilogue. */
+
+namespace libfc {
+
+  bool NativeDecoder::is_supported() {
+#if defined(_libfc_NATIVE_X86_64_)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  NativeDecoder::NativeDecoder()
+    : mapping(0), mapping_size(0) {
+  }
+
+  NativeDecoder::~NativeDecoder() {
+#if defined(_libfc_NATIVE_X86_64_)
+    if (mapping != 0)
+      munmap(mapping, mapping_size);
+#endif
+  }
+
+  void NativeDecoder::emit(std::initializer_list<uint8_t> bytes) {
+    code.insert(code.end(), bytes);
+  }
+
+  void NativeDecoder::emit_uint32(uint32_t value) {
+    for (int k = 0; k < 4; ++k)
+      code.push_back(static_cast<uint8_t>(value >> (8*k)));
+  }
+
+  void NativeDecoder::emit_uint64(uint64_t value) {
+    for (int k = 0; k < 8; ++k)
+      code.push_back(static_cast<uint8_t>(value >> (8*k)));
+  }
+
+  void NativeDecoder::emit_load_address(void* p) {
+    emit({ 0x48, 0xb9 });                          // mov rcx, imm64
+    emit_uint64(reinterpret_cast<uintptr_t>(p));
+  }
+
+  void NativeDecoder::emit_transfer_big_endian(uint16_t offset,
+                                               unsigned int width,
+                                               unsigned int destination_size,
+                                               void* p) {
+    assert(width <= destination_size);
+
+    /* Load and zero-extend into rax.  32-bit operations clear the
+     * upper half of rax, so that is zero in every case. */
+    switch (width) {
+    case 1: emit({ 0x0f, 0xb6, 0x87 }); break;     // movzx eax, byte [rdi+d32]
+    case 2: emit({ 0x0f, 0xb7, 0x87 }); break;     // movzx eax, word [rdi+d32]
+    case 4: emit({ 0x8b, 0x87 }); break;           // mov eax, [rdi+d32]
+    case 8: emit({ 0x48, 0x8b, 0x87 }); break;     // mov rax, [rdi+d32]
+    default: assert(0 == "unsupported wire width"); break;
+    }
+    emit_uint32(offset);
+
+    /* Convert to host byte order. */
+    switch (width) {
+    case 2: emit({ 0x66, 0xc1, 0xc0, 0x08 }); break; // rol ax, 8
+    case 4: emit({ 0x0f, 0xc8 }); break;             // bswap eax
+    case 8: emit({ 0x48, 0x0f, 0xc8 }); break;       // bswap rax
+    }
+
+    emit_load_address(p);
+
+    switch (destination_size) {
+    case 1: emit({ 0x88, 0x01 }); break;           // mov [rcx], al
+    case 2: emit({ 0x66, 0x89, 0x01 }); break;     // mov [rcx], ax
+    case 4: emit({ 0x89, 0x01 }); break;           // mov [rcx], eax
+    case 8: emit({ 0x48, 0x89, 0x01 }); break;     // mov [rcx], rax
+    default: assert(0 == "unsupported destination size"); break;
+    }
+  }
+
+  void NativeDecoder::emit_transfer_octets_16(uint16_t offset, void* p) {
+    emit({ 0xf3, 0x0f, 0x6f, 0x87 });              // movdqu xmm0, [rdi+d32]
+    emit_uint32(offset);
+    emit_load_address(p);
+    emit({ 0xf3, 0x0f, 0x7f, 0x01 });              // movdqu [rcx], xmm0
+  }
+
+  void NativeDecoder::emit_reference_octets(uint16_t offset,
+                                            uint16_t length, void* p) {
+#if defined(_libfc_NATIVE_X86_64_)
+    static_assert(offsetof(OctetArrayView, buf) == 0
+                  && offsetof(OctetArrayView, length) == 8
+                  && sizeof(OctetArrayView::length) == 8,
+                  "emitted code assumes { buf, length } layout");
+#endif /* defined(_libfc_NATIVE_X86_64_) */
+
+    emit({ 0x48, 0x8d, 0x87 });                    // lea rax, [rdi+d32]
+    emit_uint32(offset);
+    emit_load_address(p);
+    emit({ 0x48, 0x89, 0x01 });                    // mov [rcx], rax
+    emit({ 0x48, 0xc7, 0x41, 0x08 });              // mov qword [rcx+8], imm32
+    emit_uint32(length);
+  }
+
+  void NativeDecoder::emit_transfer_float_into_double(uint16_t offset,
+                                                      void* p) {
+    emit({ 0x8b, 0x87 });                          // mov eax, [rdi+d32]
+    emit_uint32(offset);
+    emit({ 0x0f, 0xc8 });                          // bswap eax
+    emit({ 0x66, 0x0f, 0x6e, 0xc0 });              // movd xmm0, eax
+    emit({ 0xf3, 0x0f, 0x5a, 0xc0 });              // cvtss2sd xmm0, xmm0
+    emit_load_address(p);
+    emit({ 0xf2, 0x0f, 0x11, 0x01 });              // movsd [rcx], xmm0
+  }
+
+  bool NativeDecoder::finish() {
+#if defined(_libfc_NATIVE_X86_64_)
+    assert(mapping == 0);
+
+    emit({ 0xc3 });                                // ret
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0)
+      page_size = 4096;
+    mapping_size = (code.size() + page_size - 1) / page_size * page_size;
+
+    void* m = mmap(0, mapping_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+      return false;
+
+    memcpy(m, code.data(), code.size());
+
+    /* Never writable and executable at the same time. */
+    if (mprotect(m, mapping_size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(m, mapping_size);
+      return false;
+    }
+
+    mapping = m;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  NativeDecoder::function_t NativeDecoder::get_function() const {
+    /* Converting an object pointer to a function pointer is
+     * conditionally supported, but fine on every platform that gets
+     * here. */
+    return reinterpret_cast<function_t>(mapping);
+  }
+
+  size_t NativeDecoder::size() const {
+    return code.size();
+  }
+
+} // namespace libfc
@@ -0,0 +1,164 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_NATIVEDECODER_H_
+#  define _libfc_NATIVEDECODER_H_
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <initializer_list>
+#  include <vector>
+
+namespace libfc {
+
+  /** Straight-line machine code that decodes the fixed-length prefix
+   * of a data record.
+   *
+   * A DecodePlan that is executed very often can hand the transfers
+   * in its fixed-length prefix (see DecodePlan) to this class, which
+   * turns each of them into a handful of instructions: an unaligned
+   * load relative to the start of the record, a byte swap and a store
+   * to the placement address, which is built into the code as a
+   * constant.  The result is a function without any dispatch at all.
+   * The variable-length rest of the record is still executed by the
+   * DecodePlan.
+   *
+   * Code generation is only available on x86-64, and only if libfc
+   * was built with _libfc_HAVE_JIT_ defined (the CMake option
+   * WITH_JIT).  Everywhere else, is_supported() returns false and
+   * clients must fall back to interpreting the plan.
+   *
+   * Usage: create the object, call the emit_ functions in any order,
+   * then finish().  If finish() returns true, get_function() returns
+   * the generated function, which remains valid for the lifetime of
+   * this object.
+   */
+  class NativeDecoder {
+  public:
+    /** Signature of the generated code.
+     *
+     * @param buf start of the data record; the caller must have made
+     *   sure that the entire fixed-length prefix is within the buffer
+     */
+    typedef void (*function_t)(const uint8_t* buf);
+
+    /** Tells whether code generation is available on this platform.
+     *
+     * @return true if native code can be generated
+     */
+    static bool is_supported();
+
+    NativeDecoder();
+    ~NativeDecoder();
+
+    NativeDecoder(const NativeDecoder&) = delete;
+    NativeDecoder& operator=(const NativeDecoder&) = delete;
+
+    /** Emits code that transfers a big-endian unsigned integer into a
+     * native one, zero-extending it, like transfer_big_endian() in
+     * decode_kernels.h.
+     *
+     * @param offset offset of the field in the record
+     * @param width wire width, one of 1, 2, 4 or 8
+     * @param destination_size native width, one of 1, 2, 4 or 8, and
+     *   no smaller than width
+     * @param p destination address
+     */
+    void emit_transfer_big_endian(uint16_t offset,
+                                  unsigned int width,
+                                  unsigned int destination_size,
+                                  void* p);
+
+    /** Emits code that copies 16 octets without conversion.
+     *
+     * @param offset offset of the field in the record
+     * @param p destination address
+     */
+    void emit_transfer_octets_16(uint16_t offset, void* p);
+
+    /** Emits code that points an OctetArrayView at a field.
+     *
+     * @param offset offset of the field in the record
+     * @param length length of the field
+     * @param p address of the OctetArrayView
+     */
+    void emit_reference_octets(uint16_t offset, uint16_t length, void* p);
+
+    /** Emits code that transfers a big-endian float32 into a double.
+     *
+     * @param offset offset of the field in the record
+     * @param p destination address, which must hold a double
+     */
+    void emit_transfer_float_into_double(uint16_t offset, void* p);
+
+    /** Finishes code generation and makes the code executable.
+     *
+     * @return true if the code is ready to run, false if the platform
+     *   does not support code generation or the code could not be
+     *   made executable
+     */
+    bool finish();
+
+    /** Returns the generated function.
+     *
+     * @return the generated function, or NULL if finish() has not
+     *   been called or has failed
+     */
+    function_t get_function() const;
+
+    /** Returns the size of the generated code.
+     *
+     * @return size of the generated code in bytes
+     */
+    size_t size() const;
+
+  private:
+    void emit(std::initializer_list<uint8_t> bytes);
+    void emit_uint32(uint32_t value);
+    void emit_uint64(uint64_t value);
+
+    /** Emits "mov rcx, p". */
+    void emit_load_address(void* p);
+
+    /** The code being assembled. */
+    std::vector<uint8_t> code;
+
+    /** Executable mapping holding the finished code, or NULL. */
+    void* mapping;
+
+    /** Size of the mapping. */
+    size_t mapping_size;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_NATIVEDECODER_H_
@@ -0,0 +1,111 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+#ifndef _libfc_OCTETARRAYVIEW_H_
+#  define _libfc_OCTETARRAYVIEW_H_
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+
+namespace libfc {
+
+  /** A reference to an array of octets in a message.
+   *
+   * This is the zero-copy counterpart of BasicOctetArray.  Instead of
+   * copying an octetArray or string IE, the decoder merely records
+   * where in the message the value is, and how long it is.  This
+   * saves a memcpy (and sometimes an allocation) per IE, which
+   * matters for records with many strings that are looked at once
+   * and then discarded.
+   *
+   * The price is that the view is only valid as long as the message
+   * it points into: until end_placement() returns for ordinary
+   * placements, or until end_batch() returns for batch placements.
+   * Use to_string() or copy the octets if you need them for longer.
+   *
+   * See PlacementTemplate::register_reference_placement() for how to
+   * use this.
+   */
+  class OctetArrayView {
+  public:
+    /** Creates an empty view. */
+    OctetArrayView() : buf(0), length(0) {
+    }
+
+    /** Returns the length of the viewed octets.
+     *
+     * @return the length of the viewed octets
+     */
+    size_t get_length() const {
+      return length;
+    }
+
+    /** Returns the viewed octets.
+     *
+     * @return the viewed octets
+     */
+    const uint8_t* get_buf() const {
+      return buf;
+    }
+
+    /** Makes this view refer to other octets.
+     *
+     * @param new_buf the new octets
+     * @param new_length number of octets
+     */
+    void set(const uint8_t* new_buf, size_t new_length) {
+      buf = new_buf;
+      length = new_length;
+    }
+
+    /** Copies the viewed octets to a string.
+     *
+     * @return the viewed octets, as a string
+     */
+    const std::string to_string() const;
+
+  private:
+    /* NativeDecoder writes these two members directly, so keep the
+     * layout in sync with emit_reference_octets(). */
+    friend class NativeDecoder;
+
+    /** The start of the octets, in the message. */
+    const uint8_t* buf;
+
+    /** The number of octets. */
+    size_t length;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_OCTETARRAYVIEW_H_
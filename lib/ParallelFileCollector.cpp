@@ -0,0 +1,290 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BufferInputSource.h"
+#include "Constants.h"
+#include "ParallelFileCollector.h"
+#include "TemplateSnapshot.h"
+#include "decode_util.h"
+
+#include "exceptions/FormatError.h"
+
+namespace libfc {
+
+  /** The state of one collect() call, shared by the workers. */
+  class ParallelFileCollector::Run {
+  public:
+    Run() : next_range(0), failed(false), next_to_end(0) {
+    }
+
+    /** For every range, messages defining the templates in effect at
+     * its start. */
+    std::vector<std::vector<uint8_t> > preambles;
+
+    /** For every range, the result of decoding it. */
+    std::vector<std::shared_ptr<ErrorContext> > results;
+
+    /** The next range to hand to a worker. */
+    std::atomic<size_t> next_range;
+
+    /** Whether some range has failed. */
+    std::atomic<bool> failed;
+
+    /** For ordered end_range() calls: the next range to end. */
+    std::mutex lock;
+    std::condition_variable ended;
+    size_t next_to_end;
+  };
+
+  ParallelFileCollector::ParallelFileCollector(unsigned int n_workers)
+    : n_messages(0),
+      range_size(0),
+      ordered(false),
+      resync_policy(MessageStreamParser::stop_on_error) {
+    collectors.resize(n_workers == 0 ? 1 : n_workers);
+  }
+
+  ParallelFileCollector::~ParallelFileCollector() {
+  }
+
+  void ParallelFileCollector::set_range_size(size_t bytes) {
+    range_size = bytes;
+  }
+
+  void ParallelFileCollector::set_ordered(bool _ordered) {
+    ordered = _ordered;
+  }
+
+  void ParallelFileCollector::set_resync_policy(
+      MessageStreamParser::ResyncPolicy policy) {
+    resync_policy = policy;
+  }
+
+  unsigned int ParallelFileCollector::get_n_workers() const {
+    return collectors.size();
+  }
+
+  PlacementCollector*
+  ParallelFileCollector::get_collector(unsigned int worker) const {
+    return collectors[worker].get();
+  }
+
+  const std::vector<ParallelFileCollector::Range>&
+  ParallelFileCollector::get_ranges() const {
+    return ranges;
+  }
+
+  uint64_t ParallelFileCollector::get_n_messages() const {
+    return n_messages;
+  }
+
+  void ParallelFileCollector::start_range(unsigned int worker,
+                                          const Range& range) {
+  }
+
+  void ParallelFileCollector::end_range(unsigned int worker,
+                                        const Range& range) {
+  }
+
+  void ParallelFileCollector::scan(const uint8_t* file, size_t size,
+                                   Run& run) {
+    static const size_t kMinRangeSize = 1 << 20;
+    static const size_t kRangesPerWorker = 8;
+
+    size_t target = range_size;
+    if (target == 0)
+      target = std::max(size / (kRangesPerWorker * collectors.size()),
+                        kMinRangeSize);
+
+    TemplateSnapshot snapshot;
+    size_t off = 0;
+
+    auto new_range = [&](size_t begin, uint32_t export_time) {
+      Range r = { ranges.size(), begin, begin };
+      ranges.push_back(r);
+      run.preambles.push_back(std::vector<uint8_t>());
+      snapshot.append_messages(export_time, run.preambles.back());
+    };
+
+    while (size - off >= kIpfixMessageHeaderLen) {
+      const uint8_t* message = file + off;
+      uint16_t message_size = decode_uint16(message + 2);
+      if (decode_uint16(message) != kIpfixVersion
+          || message_size < kIpfixMessageHeaderLen
+          || message_size > size - off)
+        break;
+
+      if (ranges.empty() || off - ranges.back().begin >= target)
+        new_range(off, decode_uint32(message + 4));
+
+      snapshot.add_message(message, message_size);
+      off += message_size;
+      ranges.back().end = off;
+      n_messages++;
+    }
+
+    /* Whatever is left doesn't look like messages; let the last
+     * range's parser say what's wrong with it. */
+    if (off < size) {
+      if (ranges.empty())
+        new_range(off, 0);
+      ranges.back().end = size;
+    }
+
+    run.results.resize(ranges.size());
+    failed_inputs.resize(ranges.size());
+  }
+
+  std::shared_ptr<ErrorContext>
+  ParallelFileCollector::collect(const std::string& file_name) {
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0)
+      libfc_RETURN_ERROR(fatal, system_error,
+                         "Can't open \"" << file_name << "\"", errno,
+                         0, 0, 0, 0);
+
+    std::shared_ptr<ErrorContext> ret = collect(fd, file_name);
+    (void) close(fd);
+    return ret;
+  }
+
+  /** Runs one collect(), turning a decode error thrown under
+   * stop_on_error into an error context. */
+  static std::shared_ptr<ErrorContext>
+  collect_once(PlacementCollector& collector, InputSource& is) {
+    try {
+      return collector.collect(is);
+    } catch (FormatError& e) {
+      libfc_RETURN_ERROR(recoverable, format_error, e.what(), 0, &is,
+                         0, 0, 0);
+    }
+  }
+
+  std::shared_ptr<ErrorContext>
+  ParallelFileCollector::collect(int fd, const std::string& file_name) {
+    ranges.clear();
+    failed_inputs.clear();
+    n_messages = 0;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+      libfc_RETURN_ERROR(fatal, system_error,
+                         "Can't stat \"" << file_name << "\"", errno,
+                         0, 0, 0, 0);
+    size_t size = st.st_size;
+    if (size == 0)
+      libfc_RETURN_OK();
+
+    void* map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+      libfc_RETURN_ERROR(fatal, system_error,
+                         "Can't map \"" << file_name << "\"", errno,
+                         0, 0, 0, 0);
+    const uint8_t* file = static_cast<const uint8_t*>(map);
+
+    Run run;
+    scan(file, size, run);
+
+    for (unsigned int w = 0; w < collectors.size(); w++) {
+      collectors[w].reset(make_collector(w));
+      collectors[w]->set_resync_policy(resync_policy);
+    }
+
+    auto work = [&](unsigned int w) {
+      PlacementCollector* c = collectors[w].get();
+
+      while (!run.failed.load(std::memory_order_relaxed)) {
+        size_t k = run.next_range++;
+        if (k >= ranges.size())
+          break;
+        const Range& r = ranges[k];
+
+        /* Each range is its own exporter, so that its templates
+         * don't leak into the next range this worker decodes. */
+        uint64_t exporter_id = k + 1;
+
+        start_range(w, r);
+
+        std::shared_ptr<ErrorContext> err;
+        std::unique_ptr<InputSource> is;
+        const std::vector<uint8_t>& preamble = run.preambles[k];
+        if (!preamble.empty()) {
+          is.reset(new BufferInputSource(&preamble[0], preamble.size(),
+                                         exporter_id));
+          err = collect_once(*c, *is);
+        }
+        if (err == 0) {
+          is.reset(new BufferInputSource(file + r.begin, r.end - r.begin,
+                                         exporter_id, r.begin));
+          err = collect_once(*c, *is);
+        }
+        c->drop_exporter(exporter_id);
+
+        run.results[k] = err;
+        if (err != 0) {
+          failed_inputs[k] = std::move(is);
+          run.failed = true;
+        }
+
+        if (ordered) {
+          std::unique_lock<std::mutex> l(run.lock);
+          run.ended.wait(l, [&run, k]() { return run.next_to_end == k; });
+          end_range(w, r);
+          run.next_to_end++;
+          run.ended.notify_all();
+        } else
+          end_range(w, r);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int w = 1; w < collectors.size(); w++)
+      threads.push_back(std::thread(work, w));
+    work(0);
+    for (auto& t : threads)
+      t.join();
+
+    (void) munmap(map, size);
+
+    for (auto& err : run.results)
+      if (err != 0)
+        return err;
+
+    libfc_RETURN_OK();
+  }
+
+} // namespace libfc
@@ -0,0 +1,198 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_PARALLELFILECOLLECTOR_H_
+#  define _libfc_PARALLELFILECOLLECTOR_H_
+
+#  include <cstdint>
+#  include <memory>
+#  include <string>
+#  include <vector>
+
+#  include "ErrorContext.h"
+#  include "PlacementCollector.h"
+
+namespace libfc {
+
+  /** Decodes one IPFIX file on several threads.
+   *
+   * Works in two passes over the memory-mapped file.  The first pass
+   * walks only message and set headers (and template sets), cuts the
+   * file into ranges of whole messages and takes a TemplateSnapshot
+   * at the start of every range.  The second pass decodes the ranges
+   * concurrently: a worker first parses the range's template
+   * snapshot, then the range itself, so that it sees the same
+   * templates that a sequential parse would have seen at that point.
+   *
+   * Every worker has its own PlacementCollector, made by the virtual
+   * make_collector() factory.  Ranges are numbered in file order, and
+   * start_range() and end_range() bracket the callbacks for one
+   * range, so results can be kept per range and merged in order.
+   * With set_ordered(), end_range() is called in file order, which
+   * makes that merge trivial: keep a range's results until its
+   * end_range(), and pass them on there.
+   *
+   * If the first pass finds a malformed message, the rest of the file
+   * becomes part of the last range, so that its parser reports the
+   * error (or resynchronises, see set_resync_policy()).  If a range
+   * fails, no new ranges are started, and collect() returns the
+   * error of the first failing range in file order.  Ranges after it
+   * may have been decoded already.
+   */
+  class ParallelFileCollector {
+  public:
+    /** A piece of the file, made of whole messages. */
+    struct Range {
+      /** Ranges are numbered from 0, in file order. */
+      size_t index;
+
+      /** File offset of the first message. */
+      uint64_t begin;
+
+      /** File offset just past the last message. */
+      uint64_t end;
+    };
+
+    /** Creates a collector.
+     *
+     * @param n_workers the number of worker threads, at least 1
+     */
+    ParallelFileCollector(unsigned int n_workers);
+
+    virtual ~ParallelFileCollector();
+
+    /** Decodes a file.
+     *
+     * @param file_name the name of the file to decode
+     *
+     * @return the error of the first failing range, or null
+     */
+    std::shared_ptr<ErrorContext> collect(const std::string& file_name);
+
+    /** Decodes a file.
+     *
+     * @param fd a file descriptor for the file, which must be
+     *   mappable; it is not closed
+     * @param file_name the name of the file, for error messages
+     *
+     * @return the error of the first failing range, or null
+     */
+    std::shared_ptr<ErrorContext> collect(int fd,
+                                          const std::string& file_name);
+
+    /** Sets the size of the ranges, in bytes.
+     *
+     * Ranges end at the first message boundary after this many
+     * bytes.  Smaller ranges balance the load better, but every
+     * range costs a template snapshot.  0, the default, makes about
+     * eight ranges per worker, but none smaller than 1 MiB.
+     */
+    void set_range_size(size_t bytes);
+
+    /** Sets whether end_range() is called in file order. */
+    void set_ordered(bool ordered);
+
+    /** Sets what the workers' parsers do with malformed messages. */
+    void set_resync_policy(MessageStreamParser::ResyncPolicy policy);
+
+    /** Returns the number of workers. */
+    unsigned int get_n_workers() const;
+
+    /** Returns worker @a worker's collector, or null before the first
+     * collect().  The collectors are kept until the next collect()
+     * or until this object is destroyed. */
+    PlacementCollector* get_collector(unsigned int worker) const;
+
+    /** Returns the ranges of the last collect(). */
+    const std::vector<Range>& get_ranges() const;
+
+    /** Returns the number of messages the first pass of the last
+     * collect() found. */
+    uint64_t get_n_messages() const;
+
+  protected:
+    /** Makes the collector for one worker.
+     *
+     * Called by collect(), on the calling thread, once per worker.
+     * The collector is owned by this object.
+     *
+     * @param worker the worker number, from 0 to get_n_workers() - 1
+     *
+     * @return a new collector
+     */
+    virtual PlacementCollector* make_collector(unsigned int worker) = 0;
+
+    /** Called on a worker before the callbacks for a range.
+     *
+     * The default implementation does nothing.
+     *
+     * @param worker the worker decoding the range
+     * @param range the range
+     */
+    virtual void start_range(unsigned int worker, const Range& range);
+
+    /** Called on a worker after the callbacks for a range, even if
+     * decoding the range failed.  With set_ordered(), calls for
+     * different ranges are made in file order and never overlap.
+     *
+     * The default implementation does nothing.
+     *
+     * @param worker the worker that decoded the range
+     * @param range the range
+     */
+    virtual void end_range(unsigned int worker, const Range& range);
+
+  private:
+    ParallelFileCollector(const ParallelFileCollector&) = delete;
+    ParallelFileCollector& operator=(const ParallelFileCollector&) = delete;
+
+    class Run;
+
+    void scan(const uint8_t* file, size_t size, Run& run);
+
+    std::vector<std::unique_ptr<PlacementCollector> > collectors;
+    std::vector<Range> ranges;
+
+    /** The input sources of ranges that failed, which their error
+     * contexts point to; kept until the next collect(). */
+    std::vector<std::unique_ptr<InputSource> > failed_inputs;
+
+    uint64_t n_messages;
+    size_t range_size;
+    bool ordered;
+    MessageStreamParser::ResyncPolicy resync_policy;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_PARALLELFILECOLLECTOR_H_
@@ -0,0 +1,558 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <thread>
+
+#include "BufferInputSource.h"
+#include "Constants.h"
+#include "PipelinedCollector.h"
+#include "RingBuffer.h"
+#include "decode_util.h"
+
+#include "exceptions/FormatError.h"
+
+namespace libfc {
+
+  /** Whole messages on their way from the reader to the workers. */
+  struct PipelinedCollector::Batch {
+    std::vector<uint8_t> bytes;
+
+    /** The exporter of all messages in the batch. */
+    uint64_t exporter_id;
+
+    /** Batches are numbered in stream order. */
+    uint64_t index;
+
+    /** Workers that have yet to decode this batch; when it drops to
+     * zero, the batch goes back to the pool. */
+    std::atomic<unsigned int> n_owners;
+  };
+
+  /** The state of one collect() call.
+   *
+   * This is also the content handler of the reader's parser: it
+   * copies the data sets of every message into the current batch,
+   * and the template sets into a message that goes to all workers.
+   */
+  class PipelinedCollector::Pipeline : public ContentHandler {
+  public:
+    Pipeline(PipelinedCollector& owner, unsigned int n_workers);
+
+    std::shared_ptr<ErrorContext> start_session();
+    std::shared_ptr<ErrorContext> end_session();
+    std::shared_ptr<ErrorContext> set_exporter(uint64_t exporter_id);
+    std::shared_ptr<ErrorContext> start_message(uint16_t version,
+                                                uint16_t length,
+                                                uint32_t export_time,
+                                                uint32_t sequence_number,
+                                                uint32_t observation_domain,
+                                                uint64_t base_time);
+    std::shared_ptr<ErrorContext> end_message();
+    std::shared_ptr<ErrorContext> start_template_set(uint16_t set_id,
+                                                     uint16_t set_length,
+                                                     const uint8_t* buf);
+    std::shared_ptr<ErrorContext> end_template_set();
+    std::shared_ptr<ErrorContext> start_options_template_set(
+        uint16_t set_id, uint16_t set_length, const uint8_t* buf);
+    std::shared_ptr<ErrorContext> end_options_template_set();
+    std::shared_ptr<ErrorContext> start_data_set(uint16_t id,
+                                                 uint16_t length,
+                                                 const uint8_t* buf);
+    std::shared_ptr<ErrorContext> end_data_set();
+
+    /** Hands on what is left of the stream and tells the workers to
+     * stop. */
+    void finish();
+
+    /** The first error of each worker, with the index of its batch. */
+    struct Result {
+      uint64_t index;
+      std::shared_ptr<ErrorContext> error;
+      std::unique_ptr<InputSource> is;
+    };
+
+    std::vector<Result> results;
+    std::vector<std::unique_ptr<SpscRing<Batch*> > > queues;
+    std::vector<std::unique_ptr<Waiter> > worker_waiters;
+    MpscRing<Batch*> free_batches;
+    Waiter reader_waiter;
+    std::atomic<bool> failed;
+
+  private:
+    /** Takes a batch from the pool, waiting for one if necessary. */
+    Batch* take();
+
+    /** Hands a batch of data sets to the next worker with room. */
+    void dispatch(Batch* b);
+
+    /** Hands a batch of template sets to all workers. */
+    void broadcast(Batch* b);
+
+    /** Hands on the sets of the current message. */
+    void finish_message();
+
+    /** Ends the data sets copied from the current message so far:
+     * sets the length of their message, or drops its header if
+     * there are none. */
+    void close_data_sets();
+
+    /** Hands on the template sets collected since the last data
+     * set. */
+    void flush_templates();
+
+    void append_header(Batch* b);
+    void append_set(Batch* b, uint16_t set_id, uint16_t length,
+                    const uint8_t* buf);
+
+    PipelinedCollector& owner;
+    std::vector<std::unique_ptr<Batch> > pool;
+    unsigned int next_worker;
+    uint64_t next_index;
+
+    /** The batch that data sets are copied into. */
+    Batch* data;
+
+    /** The template sets of the current message, if it has any. */
+    Batch* templates;
+
+    uint64_t exporter_id;
+    bool in_message;
+    size_t message_start;
+    uint32_t export_time;
+    uint32_t sequence_number;
+    uint32_t observation_domain;
+  };
+
+  PipelinedCollector::Pipeline::Pipeline(PipelinedCollector& owner,
+                                         unsigned int n_workers)
+    : results(n_workers),
+      /* Every queue can be full, every worker busy with a batch, and
+       * the reader can hold one data batch, the one split off at a
+       * template set, and the templates. */
+      free_batches(n_workers * (owner.queue_depth + 1) + 3),
+      failed(false),
+      owner(owner),
+      next_worker(0),
+      next_index(0),
+      data(0),
+      templates(0),
+      exporter_id(0),
+      in_message(false),
+      message_start(0),
+      export_time(0),
+      sequence_number(0),
+      observation_domain(0) {
+    for (unsigned int w = 0; w < n_workers; w++) {
+      queues.push_back(std::unique_ptr<SpscRing<Batch*> >(
+                         new SpscRing<Batch*>(owner.queue_depth)));
+      worker_waiters.push_back(std::unique_ptr<Waiter>(new Waiter()));
+    }
+
+    for (size_t k = 0; k < n_workers * (owner.queue_depth + 1) + 3; k++) {
+      Batch* b = new Batch();
+      b->bytes.reserve(owner.batch_size + kMaxMessageLen);
+      pool.push_back(std::unique_ptr<Batch>(b));
+      bool pushed = free_batches.push(b);
+      assert(pushed);
+      (void) pushed;
+    }
+  }
+
+  PipelinedCollector::Batch* PipelinedCollector::Pipeline::take() {
+    Batch* b = 0;
+    if (!free_batches.pop(b)) {
+      owner.n_reader_stalls.fetch_add(1, std::memory_order_relaxed);
+      reader_waiter.wait([this, &b]() { return free_batches.pop(b); });
+    }
+    b->bytes.clear();
+    b->exporter_id = exporter_id;
+    return b;
+  }
+
+  void PipelinedCollector::Pipeline::dispatch(Batch* b) {
+    b->index = next_index++;
+    b->n_owners.store(1, std::memory_order_relaxed);
+    owner.n_batches.fetch_add(1, std::memory_order_relaxed);
+
+    const unsigned int n_workers = queues.size();
+    for (;;) {
+      for (unsigned int k = 0; k < n_workers; k++) {
+        unsigned int w = (next_worker + k) % n_workers;
+        if (queues[w]->push(b)) {
+          next_worker = (w + 1) % n_workers;
+          worker_waiters[w]->wake();
+          return;
+        }
+      }
+
+      owner.n_reader_stalls.fetch_add(1, std::memory_order_relaxed);
+      reader_waiter.wait([this]() {
+          for (auto& q : queues)
+            if (!q->full())
+              return true;
+          return false;
+        });
+    }
+  }
+
+  void PipelinedCollector::Pipeline::broadcast(Batch* b) {
+    b->index = next_index++;
+    b->n_owners.store(queues.size(), std::memory_order_relaxed);
+    owner.n_template_messages.fetch_add(1, std::memory_order_relaxed);
+
+    for (unsigned int w = 0; w < queues.size(); w++) {
+      if (!queues[w]->push(b)) {
+        owner.n_reader_stalls.fetch_add(1, std::memory_order_relaxed);
+        reader_waiter.wait([this, w, b]() { return queues[w]->push(b); });
+      }
+      worker_waiters[w]->wake();
+    }
+  }
+
+  void PipelinedCollector::Pipeline::append_header(Batch* b) {
+    append_uint16(b->bytes, kIpfixVersion);
+    append_uint16(b->bytes, 0);
+    append_uint32(b->bytes, export_time);
+    append_uint32(b->bytes, sequence_number);
+    append_uint32(b->bytes, observation_domain);
+  }
+
+  void PipelinedCollector::Pipeline::append_set(Batch* b, uint16_t set_id,
+                                                uint16_t length,
+                                                const uint8_t* buf) {
+    append_uint16(b->bytes, set_id);
+    append_uint16(b->bytes, length + kIpfixSetHeaderLen);
+    b->bytes.insert(b->bytes.end(), buf, buf + length);
+  }
+
+  void PipelinedCollector::Pipeline::close_data_sets() {
+    size_t data_len = data->bytes.size() - message_start;
+    if (data_len > kIpfixMessageHeaderLen)
+      put_uint16(data->bytes, message_start + 2, data_len);
+    else
+      data->bytes.resize(message_start);
+  }
+
+  void PipelinedCollector::Pipeline::flush_templates() {
+    put_uint16(templates->bytes, 2, templates->bytes.size());
+    broadcast(templates);
+    templates = 0;
+  }
+
+  void PipelinedCollector::Pipeline::finish_message() {
+    in_message = false;
+
+    if (templates != 0)
+      flush_templates();
+    close_data_sets();
+
+    if (data->bytes.size() >= owner.batch_size) {
+      dispatch(data);
+      data = 0;
+    }
+  }
+
+  void PipelinedCollector::Pipeline::finish() {
+    if (in_message)
+      finish_message();
+
+    if (templates != 0)
+      (void) free_batches.push(templates);
+    if (data != 0) {
+      if (data->bytes.empty())
+        (void) free_batches.push(data);
+      else
+        dispatch(data);
+    }
+    templates = 0;
+    data = 0;
+
+    for (unsigned int w = 0; w < queues.size(); w++) {
+      if (!queues[w]->push(0))
+        reader_waiter.wait([this, w]() { return queues[w]->push(0); });
+      worker_waiters[w]->wake();
+    }
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::start_session() {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::end_session() {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::set_exporter(uint64_t exporter_id) {
+    /* A message cut short by a framing error has no end_message(). */
+    if (in_message)
+      finish_message();
+
+    if (data != 0 && exporter_id != data->exporter_id) {
+      if (data->bytes.empty())
+        data->exporter_id = exporter_id;
+      else {
+        dispatch(data);
+        data = 0;
+      }
+    }
+    this->exporter_id = exporter_id;
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::start_message(uint16_t version,
+                                              uint16_t length,
+                                              uint32_t export_time,
+                                              uint32_t sequence_number,
+                                              uint32_t observation_domain,
+                                              uint64_t base_time) {
+    if (failed.load(std::memory_order_relaxed))
+      libfc_RETURN_ERROR(fatal, aborted_by_user,
+                         "A decoder failed", 0, 0, 0, 0, 0);
+
+    this->export_time = export_time;
+    this->sequence_number = sequence_number;
+    this->observation_domain = observation_domain;
+
+    if (data == 0)
+      data = take();
+    in_message = true;
+    message_start = data->bytes.size();
+    append_header(data);
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::end_message() {
+    finish_message();
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::start_template_set(uint16_t set_id,
+                                                   uint16_t set_length,
+                                                   const uint8_t* buf) {
+    if (templates == 0) {
+      /* Data sets before the template set, in this message or in
+       * earlier ones, must not see it, and those after it must; they
+       * go into the next batch, in a message of their own. */
+      close_data_sets();
+      if (!data->bytes.empty()) {
+        dispatch(data);
+        data = take();
+      }
+      message_start = 0;
+      append_header(data);
+
+      templates = take();
+      append_header(templates);
+    }
+    append_set(templates, set_id, set_length, buf);
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::end_template_set() {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::start_options_template_set(
+      uint16_t set_id, uint16_t set_length, const uint8_t* buf) {
+    return start_template_set(set_id, set_length, buf);
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::end_options_template_set() {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::start_data_set(uint16_t id,
+                                               uint16_t length,
+                                               const uint8_t* buf) {
+    if (templates != 0)
+      flush_templates();
+    append_set(data, id, length, buf);
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::Pipeline::end_data_set() {
+    libfc_RETURN_OK();
+  }
+
+  PipelinedCollector::PipelinedCollector(unsigned int n_workers)
+    : resync_policy(MessageStreamParser::stop_on_error),
+      batch_size(kDefaultBatchSize),
+      queue_depth(kDefaultQueueDepth),
+      n_batches(0),
+      n_template_messages(0),
+      n_reader_stalls(0),
+      n_worker_stalls(0) {
+    collectors.resize(n_workers == 0 ? 1 : n_workers);
+  }
+
+  PipelinedCollector::~PipelinedCollector() {
+  }
+
+  void PipelinedCollector::set_batch_size(size_t bytes) {
+    batch_size = std::max(bytes, static_cast<size_t>(1));
+  }
+
+  void PipelinedCollector::set_queue_depth(size_t n_batches) {
+    queue_depth = std::max(n_batches, static_cast<size_t>(1));
+  }
+
+  void PipelinedCollector::set_resync_policy(
+      MessageStreamParser::ResyncPolicy policy) {
+    reader.set_resync_policy(policy);
+    resync_policy = policy;
+  }
+
+  unsigned int PipelinedCollector::get_n_workers() const {
+    return collectors.size();
+  }
+
+  PlacementCollector*
+  PipelinedCollector::get_collector(unsigned int worker) const {
+    return collectors[worker].get();
+  }
+
+  const MessageStreamParser* PipelinedCollector::get_parser() const {
+    return &reader;
+  }
+
+  PipelinedCollector::Stats PipelinedCollector::get_stats() const {
+    Stats stats;
+    stats.n_batches = n_batches.load(std::memory_order_relaxed);
+    stats.n_template_messages
+      = n_template_messages.load(std::memory_order_relaxed);
+    stats.n_reader_stalls = n_reader_stalls.load(std::memory_order_relaxed);
+    stats.n_worker_stalls = n_worker_stalls.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  /** Runs one collect(), turning a decode error thrown under
+   * stop_on_error into an error context. */
+  static std::shared_ptr<ErrorContext>
+  collect_once(PlacementCollector& collector, InputSource& is) {
+    try {
+      return collector.collect(is);
+    } catch (FormatError& e) {
+      libfc_RETURN_ERROR(recoverable, format_error, e.what(), 0, &is,
+                         0, 0, 0);
+    }
+  }
+
+  void PipelinedCollector::work(unsigned int worker, Pipeline& pipeline) {
+    PlacementCollector* c = collectors[worker].get();
+    SpscRing<Batch*>& queue = *pipeline.queues[worker];
+    Pipeline::Result& result = pipeline.results[worker];
+
+    for (;;) {
+      Batch* b = 0;
+      if (!queue.pop(b)) {
+        n_worker_stalls.fetch_add(1, std::memory_order_relaxed);
+        pipeline.worker_waiters[worker]->wait([&queue, &b]() {
+            return queue.pop(b);
+          });
+      }
+      if (b == 0)
+        break;
+
+      /* After a failure, batches are only passed back, so that the
+       * reader doesn't wait for them forever. */
+      if (!pipeline.failed.load(std::memory_order_relaxed)) {
+        std::unique_ptr<InputSource> is(
+          new BufferInputSource(&b->bytes[0], b->bytes.size(),
+                                b->exporter_id));
+        std::shared_ptr<ErrorContext> err = collect_once(*c, *is);
+        if (err != 0) {
+          if (result.error == 0) {
+            result.index = b->index;
+            result.error = err;
+            result.is = std::move(is);
+          }
+          pipeline.failed = true;
+        }
+      }
+
+      if (b->n_owners.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        bool pushed = pipeline.free_batches.push(b);
+        assert(pushed);
+        (void) pushed;
+      }
+      pipeline.reader_waiter.wake();
+    }
+  }
+
+  std::shared_ptr<ErrorContext>
+  PipelinedCollector::collect(InputSource& is) {
+    failed_inputs.clear();
+    n_batches = 0;
+    n_template_messages = 0;
+    n_reader_stalls = 0;
+    n_worker_stalls = 0;
+
+    for (unsigned int w = 0; w < collectors.size(); w++) {
+      if (collectors[w] == 0)
+        collectors[w].reset(make_collector(w));
+      collectors[w]->set_resync_policy(resync_policy);
+    }
+
+    Pipeline pipeline(*this, collectors.size());
+    reader.set_content_handler(&pipeline);
+
+    std::vector<std::thread> threads;
+    for (unsigned int w = 0; w < collectors.size(); w++)
+      threads.push_back(std::thread(&PipelinedCollector::work, this, w,
+                                    std::ref(pipeline)));
+
+    std::shared_ptr<ErrorContext> reader_error = reader.parse(is);
+    pipeline.finish();
+
+    for (auto& t : threads)
+      t.join();
+
+    Pipeline::Result* first = 0;
+    for (auto& r : pipeline.results)
+      if (r.error != 0 && (first == 0 || r.index < first->index))
+        first = &r;
+
+    if (first == 0)
+      return reader_error;
+
+    failed_inputs.push_back(std::move(first->is));
+    return first->error;
+  }
+
+} // namespace libfc
@@ -0,0 +1,195 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_PIPELINEDCOLLECTOR_H_
+#  define _libfc_PIPELINEDCOLLECTOR_H_
+
+#  include <atomic>
+#  include <cstdint>
+#  include <memory>
+#  include <vector>
+
+#  include "ErrorContext.h"
+#  include "IPFIXMessageStreamParser.h"
+#  include "InputSource.h"
+#  include "PlacementCollector.h"
+
+namespace libfc {
+
+  /** Collects an IPFIX message stream with a reader thread and
+   * several decoder threads.
+   *
+   * The thread that calls collect() becomes the reader.  It reads and
+   * frames messages with an ordinary IPFIXMessageStreamParser, so
+   * malformed messages are reported (or resynchronised, see
+   * set_resync_policy()) exactly as in a sequential parse, and copies
+   * them into batches of whole messages.  Batches come from a fixed
+   * pool and go to the workers through one lock-free single-producer
+   * queue per worker; workers give them back through one
+   * multiple-producer queue.  Reading the next batch thus overlaps
+   * with decoding the previous ones.
+   *
+   * Workers must see the templates that a sequential parse would
+   * have seen at the same point.  The reader therefore takes template
+   * and options template sets out of their messages and sends them,
+   * in a message of their own, to @em all workers, in stream order
+   * with the batches.  A worker decodes its queue in order, so it
+   * has applied every template set that came before a batch when it
+   * decodes that batch, and none that came after.  A message with
+   * data sets on both sides of a template set is split there.
+   *
+   * Every worker has its own PlacementCollector, made by the virtual
+   * make_collector() factory on the first collect() and kept until
+   * this object is destroyed.  Callbacks on different workers run
+   * concurrently, so records from different batches may be delivered
+   * out of stream order; records within a batch are delivered in
+   * order, by one worker.
+   *
+   * If a worker fails, the others stop decoding, the reader stops
+   * reading, and collect() returns the error of the failing batch
+   * that came first in the stream.  Offsets in such an error are
+   * relative to the start of the batch, not the stream.
+   *
+   * Only IPFIX is supported.
+   */
+  class PipelinedCollector {
+  public:
+    /** Default for set_batch_size(). */
+    static const size_t kDefaultBatchSize = 64 * 1024;
+
+    /** Default for set_queue_depth(). */
+    static const size_t kDefaultQueueDepth = 4;
+
+    /** Counters for the last collect(). */
+    struct Stats {
+      /** Batches of data sets handed to workers. */
+      uint64_t n_batches;
+
+      /** Messages with template sets sent to all workers. */
+      uint64_t n_template_messages;
+
+      /** How often the reader had to wait for a worker. */
+      uint64_t n_reader_stalls;
+
+      /** How often a worker had to wait for the reader. */
+      uint64_t n_worker_stalls;
+    };
+
+    /** Creates a collector.
+     *
+     * @param n_workers the number of decoder threads, at least 1
+     */
+    PipelinedCollector(unsigned int n_workers);
+
+    virtual ~PipelinedCollector();
+
+    /** Collects an IPFIX message stream.
+     *
+     * @param is the input source to read from
+     *
+     * @return the error of the first failing batch, or of the reader,
+     *   or null
+     */
+    std::shared_ptr<ErrorContext> collect(InputSource& is);
+
+    /** Sets how many bytes of messages the reader puts in a batch
+     * before handing it to a worker.  Larger batches cost fewer
+     * hand-offs; smaller ones spread the work more evenly. */
+    void set_batch_size(size_t bytes);
+
+    /** Sets how many batches may wait in each worker's queue. */
+    void set_queue_depth(size_t n_batches);
+
+    /** Sets what the reader does with malformed messages, and what
+     * the workers do with messages whose records fail to decode.
+     * Under MessageStreamParser::resync_on_error, a worker skips such
+     * a message and goes on with the rest of its batch.  Takes effect
+     * for the workers with the next collect(). */
+    void set_resync_policy(MessageStreamParser::ResyncPolicy policy);
+
+    /** Returns the number of workers. */
+    unsigned int get_n_workers() const;
+
+    /** Returns worker @a worker's collector, or null before the first
+     * collect(). */
+    PlacementCollector* get_collector(unsigned int worker) const;
+
+    /** Returns the reader's parser, for its resynchronisation
+     * counters. */
+    const MessageStreamParser* get_parser() const;
+
+    /** Returns the counters for the last collect().  May be called
+     * from another thread while collect() is running. */
+    Stats get_stats() const;
+
+  protected:
+    /** Makes the collector for one worker.
+     *
+     * Called by the first collect(), on the calling thread, once per
+     * worker.  The collector is owned by this object.
+     *
+     * @param worker the worker number, from 0 to get_n_workers() - 1
+     *
+     * @return a new collector
+     */
+    virtual PlacementCollector* make_collector(unsigned int worker) = 0;
+
+  private:
+    PipelinedCollector(const PipelinedCollector&) = delete;
+    PipelinedCollector& operator=(const PipelinedCollector&) = delete;
+
+    struct Batch;
+    class Pipeline;
+
+    void work(unsigned int worker, Pipeline& pipeline);
+
+    std::vector<std::unique_ptr<PlacementCollector> > collectors;
+    IPFIXMessageStreamParser reader;
+    MessageStreamParser::ResyncPolicy resync_policy;
+
+    /** The input sources of batches that failed, which their error
+     * contexts point to; kept until the next collect(). */
+    std::vector<std::unique_ptr<InputSource> > failed_inputs;
+
+    size_t batch_size;
+    size_t queue_depth;
+
+    std::atomic<uint64_t> n_batches;
+    std::atomic<uint64_t> n_template_messages;
+    std::atomic<uint64_t> n_reader_stalls;
+    std::atomic<uint64_t> n_worker_stalls;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_PIPELINEDCOLLECTOR_H_
@@ -24,6 +24,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cassert>
+
 #include "IPFIXMessageStreamParser.h"
 #include "PlacementCollector.h"
 #include "V9MessageStreamParser.h"
@@ -55,11 +57,49 @@ namespace libfc {
     return ir->parse(is);
   }
 
+  void PlacementCollector::set_resync_policy(
+      MessageStreamParser::ResyncPolicy policy) {
+    ir->set_resync_policy(policy);
+  }
+
+  const MessageStreamParser* PlacementCollector::get_parser() const {
+    return ir;
+  }
+
+  ContentHandler* PlacementCollector::get_content_handler() {
+    return &d;
+  }
+
+  void PlacementCollector::drop_exporter(uint64_t exporter_id) {
+    d.drop_exporter(exporter_id);
+  }
+
   void PlacementCollector::register_placement_template(
       const PlacementTemplate* placement) {
     d.register_placement_template(placement, this);
   }
 
+  void PlacementCollector::register_batch_placement_template(
+      const PlacementTemplate* placement, size_t capacity) {
+    d.register_batch_placement_template(placement, this, capacity);
+  }
+
+  std::shared_ptr<ErrorContext>
+  PlacementCollector::start_placement(const PlacementTemplate* tmpl) {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PlacementCollector::end_placement(const PlacementTemplate* tmpl) {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  PlacementCollector::end_batch(const PlacementTemplate* tmpl,
+                                size_t n_records) {
+    libfc_RETURN_OK();
+  }
+
   std::shared_ptr<ErrorContext>
   PlacementCollector::unhandled_data_set(
       uint32_t observation_domain, uint16_t id,
@@ -74,6 +114,42 @@ namespace libfc {
     libfc_RETURN_OK();
   }
 
+  Status
+  PlacementCollector::on_start_placement(const PlacementTemplate* tmpl) {
+    return adapt(start_placement(tmpl));
+  }
+
+  Status
+  PlacementCollector::on_end_placement(const PlacementTemplate* tmpl) {
+    return adapt(end_placement(tmpl));
+  }
+
+  Status
+  PlacementCollector::on_end_batch(const PlacementTemplate* tmpl,
+                                   size_t n_records) {
+    return adapt(end_batch(tmpl, n_records));
+  }
+
+  Status PlacementCollector::adapt(std::shared_ptr<ErrorContext> e) {
+    if (e == 0)
+      return Status::ok();
+
+    adapted_error = e;
+    /* Any non-null context stops processing, even one that says
+     * no_error, so the status must not be ok. */
+    return Status(e->get_error() == Error::no_error
+                  ? Error::aborted_by_user : e->get_error());
+  }
+
+  std::shared_ptr<ErrorContext>
+  PlacementCollector::take_error_context(const Status& status) {
+    assert(!status.is_ok());
+
+    std::shared_ptr<ErrorContext> e;
+    e.swap(adapted_error);
+    return e != 0 ? e : status.to_error_context();
+  }
+
   void PlacementCollector::give_me_unhandled_data_sets() {
     d.register_unhandled_data_set_handler(const_cast<PlacementCollector*>(this));
   }
@@ -36,6 +36,7 @@
 #  include "PlacementContentHandler.h"
 #  include "MessageStreamParser.h"
 #  include "PlacementTemplate.h"
+#  include "Status.h"
 
 namespace libfc {
 
@@ -65,20 +66,106 @@ namespace libfc {
      */
     std::shared_ptr<ErrorContext> collect(InputSource& is);
 
+    /** Sets what collect() does with malformed messages.
+     *
+     * @param policy the new policy; see MessageStreamParser::ResyncPolicy
+     */
+    void set_resync_policy(MessageStreamParser::ResyncPolicy policy);
+
+    /** Returns the parser that collect() uses, for example to query
+     * its resynchronisation counters. */
+    const MessageStreamParser* get_parser() const;
+
+    /** Returns the content handler that collect() feeds.
+     *
+     * Collectors that frame the stream themselves, such as
+     * WorkStealingCollector, call it directly instead of going
+     * through collect().
+     */
+    ContentHandler* get_content_handler();
+
+    /** Forgets everything about an exporter.
+     *
+     * @param exporter_id the exporter to forget
+     *
+     * @see PlacementContentHandler::drop_exporter()
+     */
+    void drop_exporter(uint64_t exporter_id);
+
     /** Signals that placement of values will now begin. 
+     *
+     * The default implementation does nothing, which is what
+     * collectors that only register batch placement templates want.
      *
      * @param template placement template for current placements
      */
     virtual std::shared_ptr<ErrorContext>
-      start_placement(const PlacementTemplate* tmpl) = 0;
+      start_placement(const PlacementTemplate* tmpl);
 
     /** Signals that placement of values has ended. 
+     *
+     * The default implementation does nothing.
      *
      * @param template placement template for current placements
      * @return If <= 0, stop processing.
      */
     virtual std::shared_ptr<ErrorContext>
-      end_placement(const PlacementTemplate* tmpl) = 0;
+      end_placement(const PlacementTemplate* tmpl);
+
+    /** Signals that a batch of records has been placed.
+     *
+     * This is called instead of start_placement() and end_placement()
+     * for templates registered with
+     * register_batch_placement_template(), once the columns are full
+     * or at the end of a message.  Rows 0 to n_records - 1 of the
+     * columns are valid; they are overwritten after this function
+     * returns.
+     *
+     * The default implementation does nothing.
+     *
+     * @param tmpl placement template for the batch
+     * @param n_records number of records in the batch, at least 1
+     *
+     * @return a (shared) pointer to an error context, or null if no
+     * error occurred
+     */
+    virtual std::shared_ptr<ErrorContext>
+      end_batch(const PlacementTemplate* tmpl, size_t n_records);
+
+    /** Signals that placement of values will now begin.
+     *
+     * This is what is actually called for every record.  Override it
+     * instead of start_placement() so that the per-record call returns
+     * a Status in registers instead of a shared pointer.  The default
+     * implementation calls start_placement().
+     *
+     * @param tmpl placement template for current placements
+     *
+     * @return Status::ok(), or an error status to stop processing
+     */
+    virtual Status on_start_placement(const PlacementTemplate* tmpl);
+
+    /** Signals that placement of values has ended.
+     *
+     * Like on_start_placement(), but for end_placement().
+     *
+     * @param tmpl placement template for current placements
+     *
+     * @return Status::ok(), or an error status to stop processing
+     */
+    virtual Status on_end_placement(const PlacementTemplate* tmpl);
+
+    /** Signals that a batch of records has been placed.
+     *
+     * Like on_start_placement(), but for end_batch().
+     *
+     * @param tmpl placement template for the batch
+     * @param n_records number of records in the batch, at least 1
+     *
+     * @return Status::ok(), or an error status to stop processing
+     */
+    virtual Status on_end_batch(const PlacementTemplate* tmpl,
+                                size_t n_records);
 
     /** Will be called on unhandled data sets.
      *
@@ -138,14 +225,42 @@ namespace libfc {
      */
     void register_placement_template(const PlacementTemplate*);
 
+    /** Registers a placement template for batch delivery.
+     *
+     * @param placement_template the placement template to register,
+     *   whose placements point to arrays of @a capacity values
+     * @param capacity number of records per batch
+     *
+     * @see PlacementContentHandler::register_batch_placement_template()
+     */
+    void register_batch_placement_template(const PlacementTemplate*,
+                                           size_t capacity);
+
     /** Registers this object as the one to call on unhandled/unknown
      * data sets.
      */
     void give_me_unhandled_data_sets();
 
   private:
+    friend class PlacementContentHandler;
+
+    /** Turns the result of an old-style callback into a Status.
+     *
+     * A non-null error context is kept in adapted_error, so that
+     * take_error_context() can hand it on unchanged.
+     */
+    Status adapt(std::shared_ptr<ErrorContext> e);
+
+    /** Gets the error context for an error status returned by one of
+     * the on_... callbacks.
+     */
+    std::shared_ptr<ErrorContext> take_error_context(const Status& status);
+
     PlacementContentHandler d;
     MessageStreamParser* ir;
+
+    /** Error context returned by the last failing old-style callback. */
+    std::shared_ptr<ErrorContext> adapted_error;
   };
 
 } // namespace libfc
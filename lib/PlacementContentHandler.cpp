@@ -24,6 +24,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
 #include <cstdarg>
@@ -33,18 +34,13 @@
 
 #include <time.h>
 
-#ifdef _libfc_HAVE_LOG4CPLUS_
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#  define LOG4CPLUS_WARN(logger, expr)
-#  define LOG4CPLUS_INFO(logger, expr)
-#endif /* _libfc_HAVE_LOG4CPLUS_ */
+#include "logging.h"
 
 #include "decode_util.h"
 #include "pointer_checks.h"
 
 #include "BasicOctetArray.h"
+#include "ColumnDecoder.h"
 #include "DecodePlan.h"
 #include "PlacementContentHandler.h"
 #include "PlacementCollector.h"
@@ -65,11 +61,23 @@ namespace libfc {
         return err;                                                     \
     } while (0)
 
+#define CH_REPORT_CALLBACK_STATUS(callback, call)                       \
+    do {                                                                \
+      /* Make sure call is evaluated only once */                       \
+      Status status = call;                                             \
+      if (!status.is_ok())                                              \
+        return (callback)->take_error_context(status);                  \
+    } while (0)
+
 
   PlacementContentHandler::PlacementContentHandler()
-    : info_model(InfoModel::instance()),
+    : exporter_id(0),
+      exporter_key(0),
+      next_exporter_index(1),
+      info_model(InfoModel::instance()),
       unhandled_data_set_handler(0),
-      use_matched_template_cache(false),
+      plan_cache_hits(0),
+      plan_cache_misses(0),
       current_wire_template(0),
       parse_is_good(true)
 #ifdef _libfc_HAVE_LOG4CPLUS_
@@ -84,11 +92,17 @@ namespace libfc {
       assert (current_wire_template == 0);
     }
 
-    for (auto i = wire_templates.begin(); i != wire_templates.end(); ++i)
-      delete i->second;
+    for (auto i = plan_cache.begin(); i != plan_cache.end(); ++i) {
+      delete i->second.columns;
+      delete i->second.plan;
+    }
+
+    wire_templates.for_each([](uint64_t key, WireTemplateInfo& info) {
+        delete info.wire_template;
+      });
   }
 
-#ifdef _libfc_HAVE_LOG4CPLUS_
+#if libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE
   static const char* make_time(uint32_t export_time) {
     struct tm tms;
     time_t then = export_time;
@@ -100,7 +114,7 @@ namespace libfc {
 
     return gmtime_buf;
   }
-#endif /* _libfc_HAVE_LOG4CPLUS_ */
+#endif /* libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE */
 
   std::shared_ptr<ErrorContext> PlacementContentHandler::start_session() {
     LOG4CPLUS_TRACE(logger, "Session starts");
@@ -109,9 +123,86 @@ namespace libfc {
 
   std::shared_ptr<ErrorContext> PlacementContentHandler::end_session() {
     LOG4CPLUS_TRACE(logger, "Session ends");
+    CH_REPORT_CALLBACK_ERROR(flush_batches());
     return std::shared_ptr<ErrorContext>(0);
   }
 
+  std::shared_ptr<ErrorContext>
+  PlacementContentHandler::set_exporter(uint64_t exporter_id) {
+    if (exporter_id == this->exporter_id)
+      libfc_RETURN_OK();
+
+    uint16_t index = 0;
+    if (exporter_id != 0) {
+      const uint16_t* known = exporter_indexes.find(exporter_id);
+      if (known != 0)
+        index = *known;
+      else {
+        if (!free_exporter_indexes.empty()) {
+          index = free_exporter_indexes.back();
+          free_exporter_indexes.pop_back();
+        } else if (next_exporter_index <= UINT16_MAX)
+          index = static_cast<uint16_t>(next_exporter_index++);
+        else
+          libfc_RETURN_ERROR(recoverable, too_many_exporters,
+                             "More than " << UINT16_MAX
+                             << " exporters; drop_exporter() some",
+                             0, 0, 0, 0, 0);
+
+        LOG4CPLUS_INFO(logger, "  New exporter " << libfc_HEX(16)
+                       << exporter_id << ", index " << index);
+        exporter_indexes[exporter_id] = index;
+      }
+    }
+
+    this->exporter_id = exporter_id;
+    exporter_key = static_cast<uint64_t>(index) << 48;
+    libfc_RETURN_OK();
+  }
+
+  void PlacementContentHandler::drop_exporter(uint64_t exporter_id) {
+    uint16_t index = 0;
+    if (exporter_id != 0) {
+      const uint16_t* known = exporter_indexes.find(exporter_id);
+      if (known == 0)
+        return;
+      index = *known;
+    }
+
+    const uint64_t first = static_cast<uint64_t>(index) << 48;
+    const uint64_t last = first | ((static_cast<uint64_t>(1) << 48) - 1);
+
+    std::vector<uint64_t> keys;
+    wire_templates.for_each([&](uint64_t key, WireTemplateInfo& info) {
+        if (first <= key && key <= last)
+          keys.push_back(key);
+      });
+    for (auto k = keys.begin(); k != keys.end(); ++k) {
+      const IETemplate* wire_template = wire_templates.find(*k)->wire_template;
+      invalidate_plans(wire_template);
+      delete wire_template;
+      wire_templates.erase(*k);
+    }
+
+    incomplete_template_ids.erase(incomplete_template_ids.lower_bound(first),
+                                  incomplete_template_ids.upper_bound(last));
+    unknown_template_ids.erase(unknown_template_ids.lower_bound(first),
+                               unknown_template_ids.upper_bound(last));
+    unmatched_template_ids.erase(unmatched_template_ids.lower_bound(first),
+                                 unmatched_template_ids.upper_bound(last));
+
+    if (exporter_id != 0) {
+      exporter_indexes.erase(exporter_id);
+      free_exporter_indexes.push_back(index);
+    }
+
+    /* The next message from this exporter must get a new index. */
+    if (exporter_id == this->exporter_id) {
+      this->exporter_id = 0;
+      exporter_key = 0;
+    }
+  }
+
   std::shared_ptr<ErrorContext> PlacementContentHandler::start_message(
       uint16_t version,
       uint16_t length,
@@ -155,7 +246,11 @@ namespace libfc {
 
   std::shared_ptr<ErrorContext> PlacementContentHandler::end_message() {
     LOG4CPLUS_TRACE(logger, "ENTER end_message");
-    assert(current_wire_template == 0);
+    /* A template record is left open only if an error cut the
+     * message short; it goes with the rest of the message. */
+    delete current_wire_template;
+    current_wire_template = 0;
+    CH_REPORT_CALLBACK_ERROR(flush_batches());
     LOG4CPLUS_TRACE(logger, "LEAVE end_message");
     return std::shared_ptr<ErrorContext>(0);
   }
@@ -247,7 +342,8 @@ namespace libfc {
   }
 
   uint64_t PlacementContentHandler::make_template_key(uint16_t tid) const {
-    return (static_cast<uint64_t>(observation_domain) << 16) + tid;
+    return exporter_key
+      | (static_cast<uint64_t>(observation_domain) << 16) | tid;
   }
 
 
@@ -286,19 +382,21 @@ namespace libfc {
                        << ", ID "
                        << current_template_id);
 
-        incomplete_template_ids.erase(current_template_id);
+        incomplete_template_ids.erase(make_template_key(current_template_id));
 
-        delete wire_templates[make_template_key(current_template_id)];
-        wire_templates[make_template_key(current_template_id)]
-          = current_wire_template;
+        invalidate_plans(my_wire_template);
+        delete my_wire_template;
 
-        matched_templates.erase(my_wire_template);
+        /* This also forgets the dispatch information. */
+        WireTemplateInfo info;
+        info.wire_template = current_wire_template;
+        wire_templates[make_template_key(current_template_id)] = info;
       } else if (my_wire_template == 0) {
         LOG4CPLUS_INFO(logger, "  New template for domain " 
                        << observation_domain 
                        << ", ID " << current_template_id);
         wire_templates[make_template_key(current_template_id)]
-          = current_wire_template;
+          .wire_template = current_wire_template;
       } else {
         assert (my_wire_template != 0 
                 && *my_wire_template == *current_wire_template);
@@ -309,7 +407,7 @@ namespace libfc {
       }
 
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
+#if libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE
       if (logger.getLogLevel() <= log4cplus::TRACE_LOG_LEVEL) {
         LOG4CPLUS_TRACE(logger,
                         "  current wire template has "
@@ -321,7 +419,7 @@ namespace libfc {
         for (auto i = current_wire_template->begin(); i != current_wire_template->end(); i++)
           LOG4CPLUS_TRACE(logger, "  " << n++ << " " << (*i)->toIESpec());
       }
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#endif /* libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE */
     }
 
     if (current_field_count != current_field_no)
@@ -445,9 +543,37 @@ namespace libfc {
 
   const IETemplate*
   PlacementContentHandler::find_wire_template(uint16_t id) const {
-    std::map<uint64_t, const IETemplate*>::const_iterator i
-      = wire_templates.find(make_template_key(id));
-    return i == wire_templates.end() ? 0 : i->second;
+    const WireTemplateInfo* info = wire_templates.find(make_template_key(id));
+    return info == 0 ? 0 : info->wire_template;
+  }
+
+  void PlacementContentHandler::resolve_dispatch(uint16_t id,
+                                                 WireTemplateInfo& info) {
+    info.placement_template
+      = match_placement_template(id, info.wire_template);
+    info.plan = 0;
+    info.callback = 0;
+    info.batch = 0;
+
+    if (info.placement_template != 0) {
+      info.plan = &lookup_plan(info.wire_template, info.placement_template);
+
+      auto callback = callbacks.find(info.placement_template);
+      assert(callback != callbacks.end());
+      info.callback = callback->second;
+
+      auto batch = batches.find(info.placement_template);
+      if (batch != batches.end())
+        info.batch = &batch->second;
+    }
+
+    info.resolved = true;
+  }
+
+  void PlacementContentHandler::forget_dispatch() {
+    wire_templates.for_each([](uint64_t key, WireTemplateInfo& info) {
+        info.resolved = false;
+      });
   }
 
   const PlacementTemplate*
@@ -457,55 +583,43 @@ namespace libfc {
     LOG4CPLUS_TRACE(logger, "ENTER match_placement_template");
 
     /* This strategy: return first match. Other strategies are also
-     * possible, such as "return match with most IEs". */
-    std::map<const IETemplate*, const PlacementTemplate*>::const_iterator m;
-
-    if (use_matched_template_cache)
-      m = matched_templates.find(wire_template);
-    else
-      m = matched_templates.end();
-
-    if (m == matched_templates.end()) {
-      for (auto i = placement_templates.begin();
-           i != placement_templates.end();
-           ++i) {
-        std::set<const InfoElement*>* unmatched 
-          = new std::set<const InfoElement*>();
-
-        unsigned int n_matches = (*i)->is_match(wire_template, unmatched);
-        LOG4CPLUS_TRACE(logger, "n_matches=" << n_matches 
-                        << ",unmatched->size()=" << unmatched->size()
-                        << ",wire_template->size()="
-                        << wire_template->size());
-
-        if (n_matches > 0) {
-          assert(n_matches <= wire_template->size());
-
-          if (n_matches < wire_template->size()) {
-            /* We're losing columns, so let's warn about them. */
-            assert(unmatched->size() == wire_template->size() - n_matches);
-
-            if (incomplete_template_ids.count(make_template_key(id)) == 0) {
-              LOG4CPLUS_WARN(logger, "  Template match on wire template "
-                             "for domain " << observation_domain
-                             << " and template ID " << id 
-                             << " successful, but incomplete");
-
-              LOG4CPLUS_WARN(logger, "  List of unmatched IEs follows:");
-              for (auto k = unmatched->begin(); k != unmatched->end(); ++k)
-                LOG4CPLUS_WARN(logger, "    " << (*k)->toIESpec());
-              incomplete_template_ids.insert(make_template_key(id));
-            }
-          }
-          delete unmatched;
-
-          matched_templates[wire_template] = *i;
-          return *i;
+     * possible, such as "return match with most IEs". The result is
+     * kept in the wire template's dispatch information, so this is
+     * called only once per wire template. */
+    for (auto i = placement_templates.begin();
+         i != placement_templates.end();
+         ++i) {
+      unsigned int n_matches = (*i)->is_match(wire_template, 0);
+      LOG4CPLUS_TRACE(logger, "n_matches=" << n_matches 
+                      << ",wire_template->size()="
+                      << wire_template->size());
+
+      if (n_matches > 0) {
+        assert(n_matches <= wire_template->size());
+
+        if (n_matches < wire_template->size()
+            && incomplete_template_ids.count(make_template_key(id)) == 0) {
+          /* We're losing columns, so let's warn about them. Only
+           * now is it worth finding out which ones. */
+          std::set<const InfoElement*> unmatched;
+          (*i)->is_match(wire_template, &unmatched);
+          assert(unmatched.size() == wire_template->size() - n_matches);
+
+          LOG4CPLUS_WARN(logger, "  Template match on wire template "
+                         "for domain " << observation_domain
+                         << " and template ID " << id 
+                         << " successful, but incomplete");
+
+          LOG4CPLUS_WARN(logger, "  List of unmatched IEs follows:");
+          for (auto k = unmatched.begin(); k != unmatched.end(); ++k)
+            LOG4CPLUS_WARN(logger, "    " << (*k)->toIESpec());
+          incomplete_template_ids.insert(make_template_key(id));
         }
+
+        return *i;
       }
-      return 0;
-    } else
-      return m->second;
+    }
+    return 0;
   }
 
   std::shared_ptr<ErrorContext> PlacementContentHandler::start_data_set(
@@ -518,11 +632,12 @@ namespace libfc {
                     << ", length=" << length);
 
     // Find out who is interested in data from this data set
-    const IETemplate* wire_template = find_wire_template(id);
+    WireTemplateInfo* info = wire_templates.find(make_template_key(id));
 
-    LOG4CPLUS_TRACE(logger, "  wire_template=" << wire_template);
+    LOG4CPLUS_TRACE(logger, "  wire_template="
+                    << (info == 0 ? 0 : info->wire_template));
 
-    if (wire_template == 0) {
+    if (info == 0) {
       if (unhandled_data_set_handler == 0) {
         if (unmatched_template_ids.count(make_template_key(id)) == 0) {
           LOG4CPLUS_WARN(logger, "  No placement for data set with "
@@ -536,27 +651,32 @@ namespace libfc {
         std::shared_ptr<ErrorContext> e 
           = unhandled_data_set_handler->unhandled_data_set(
               observation_domain, id, length, buf);
-        if (e->get_error() == Error::again) {
-          wire_template = find_wire_template(id);
-          if (wire_template == 0) {
-            if (unmatched_template_ids.count(make_template_key(id)) == 0) {
-              LOG4CPLUS_WARN(logger, "  No placement for data set with "
-                             "observation domain " << observation_domain
-                             << " and template id " << id 
-                             << "; skipping after second chance"
-                             " (this warning will appear only once)");
-              unmatched_template_ids.insert(make_template_key(id));
-            }
-            libfc_RETURN_OK();
+        if (e == 0 || e->get_error() != Error::again)
+          return e;
+
+        info = wire_templates.find(make_template_key(id));
+        if (info == 0) {
+          if (unmatched_template_ids.count(make_template_key(id)) == 0) {
+            LOG4CPLUS_WARN(logger, "  No placement for data set with "
+                           "observation domain " << observation_domain
+                           << " and template id " << id 
+                           << "; skipping after second chance"
+                           " (this warning will appear only once)");
+            unmatched_template_ids.insert(make_template_key(id));
           }
+          libfc_RETURN_OK();
         }
       }
     }
 
-    assert(wire_template != 0);
+    assert(info != 0 && info->wire_template != 0);
+
+    if (info->resolved)
+      plan_cache_hits += info->plan != 0;
+    else
+      resolve_dispatch(id, *info);
 
-    const PlacementTemplate* placement_template
-      = match_placement_template(id, wire_template);
+    const PlacementTemplate* placement_template = info->placement_template;
 
     LOG4CPLUS_TRACE(logger, "  placement_template=" << placement_template);
 
@@ -565,21 +685,25 @@ namespace libfc {
       libfc_RETURN_OK();
     }
 
-    DecodePlan plan(placement_template, wire_template);
+    const CachedPlan& cached_plan = *info->plan;
+    PlacementCollector* callback = info->callback;
+
+    if (info->batch != 0)
+      return decode_batch(placement_template, *info->batch,
+                          cached_plan, buf, length);
+
+    DecodePlan& plan = *cached_plan.plan;
 
     const uint8_t* buf_end = buf + length;
     const uint8_t* cur = buf;
-    const uint16_t min_length = wire_template_min_length(wire_template);
-    
-    auto callback = callbacks.find(placement_template);
-    assert(callback != callbacks.end());
+    const uint16_t min_length = cached_plan.min_length;
 
     while (cur < buf_end && length >= min_length) {
-      CH_REPORT_CALLBACK_ERROR(
-        callback->second->start_placement(placement_template));
+      CH_REPORT_CALLBACK_STATUS(
+        callback, callback->on_start_placement(placement_template));
       uint16_t consumed = plan.execute(cur, length);
-      CH_REPORT_CALLBACK_ERROR(
-        callback->second->end_placement(placement_template));
+      CH_REPORT_CALLBACK_STATUS(
+        callback, callback->on_end_placement(placement_template));
       cur += consumed;
       length -= consumed;
     }
@@ -587,6 +711,67 @@ namespace libfc {
     libfc_RETURN_OK();
   }
 
+  std::shared_ptr<ErrorContext> PlacementContentHandler::decode_batch(
+      const PlacementTemplate* placement_template, Batch& batch,
+      const CachedPlan& cached_plan, const uint8_t* buf, uint16_t length) {
+    if (cached_plan.columns != 0) {
+      /* Fixed stride: whatever is left after the last whole record is
+       * padding, and the records can be decoded column by column. */
+      size_t stride = cached_plan.columns->get_stride();
+      size_t n_records = stride == 0 ? 0 : length / stride;
+
+      while (n_records > 0) {
+        size_t n = std::min(n_records, batch.capacity - batch.fill);
+        cached_plan.columns->decode(buf, n, batch.fill);
+        batch.fill += n;
+        buf += n*stride;
+        n_records -= n;
+
+        if (batch.fill == batch.capacity) {
+          batch.fill = 0;
+          CH_REPORT_CALLBACK_STATUS(
+            batch.callback,
+            batch.callback->on_end_batch(placement_template,
+                                         batch.capacity));
+        }
+      }
+    } else {
+      DecodePlan& plan = *cached_plan.plan;
+      const uint8_t* buf_end = buf + length;
+      const uint8_t* cur = buf;
+      const uint16_t min_length = cached_plan.min_length;
+
+      while (cur < buf_end && length >= min_length) {
+        uint16_t consumed = plan.execute(cur, length, batch.fill);
+        cur += consumed;
+        length -= consumed;
+
+        if (++batch.fill == batch.capacity) {
+          batch.fill = 0;
+          CH_REPORT_CALLBACK_STATUS(
+            batch.callback,
+            batch.callback->on_end_batch(placement_template,
+                                         batch.capacity));
+        }
+      }
+    }
+
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext> PlacementContentHandler::flush_batches() {
+    for (auto i = batches.begin(); i != batches.end(); ++i) {
+      if (i->second.fill > 0) {
+        size_t n_records = i->second.fill;
+        i->second.fill = 0;
+        CH_REPORT_CALLBACK_STATUS(
+          i->second.callback,
+          i->second.callback->on_end_batch(i->first, n_records));
+      }
+    }
+    libfc_RETURN_OK();
+  }
+
   std::shared_ptr<ErrorContext> PlacementContentHandler::end_data_set() {
     LOG4CPLUS_TRACE(logger, "ENTER end_data_set");
     LOG4CPLUS_TRACE(logger, "LEAVE end_data_set");
@@ -599,6 +784,29 @@ namespace libfc {
   {
     placement_templates.push_back(placement_template);
     callbacks[placement_template] = callback;
+
+    /* Wire templates that matched nothing so far might match this
+     * one. */
+    forget_dispatch();
+  }
+
+  void PlacementContentHandler::register_batch_placement_template(
+      const PlacementTemplate* placement_template,
+      PlacementCollector* callback,
+      size_t capacity)
+  {
+    assert(capacity > 0);
+
+    register_placement_template(placement_template, callback);
+
+    Batch batch;
+    batch.capacity = capacity;
+    batch.fill = 0;
+    batch.callback = callback;
+    batches[placement_template] = batch;
+
+    /* Data sets for this template must now go to the batch. */
+    forget_dispatch();
   }
 
   void PlacementContentHandler::register_unhandled_data_set_handler(
@@ -607,6 +815,56 @@ namespace libfc {
     unhandled_data_set_handler = callback;
   }
     
+  uint64_t PlacementContentHandler::get_plan_cache_hits() const {
+    return plan_cache_hits;
+  }
+
+  uint64_t PlacementContentHandler::get_plan_cache_misses() const {
+    return plan_cache_misses;
+  }
+
+  const PlacementContentHandler::CachedPlan&
+  PlacementContentHandler::lookup_plan(
+      const IETemplate* wire_template,
+      const PlacementTemplate* placement_template) {
+    auto key = std::make_pair(wire_template, placement_template);
+    auto i = plan_cache.find(key);
+
+    if (i != plan_cache.end()) {
+      plan_cache_hits++;
+      return i->second;
+    }
+
+    LOG4CPLUS_TRACE(logger, "  no cached plan for wire template "
+                    << wire_template << " and placement template "
+                    << placement_template << "; building one");
+    plan_cache_misses++;
+
+    /* Build the plan before touching the cache, since the DecodePlan
+     * constructor may throw on malformed templates. */
+    CachedPlan cached_plan;
+    cached_plan.plan = new DecodePlan(placement_template, wire_template);
+    cached_plan.min_length = wire_template_min_length(wire_template);
+    cached_plan.columns = 0;
+    if (batches.count(placement_template) != 0
+        && cached_plan.plan->is_fixed_stride())
+      cached_plan.columns = new ColumnDecoder(cached_plan.plan);
+    return plan_cache[key] = cached_plan;
+  }
+
+  void PlacementContentHandler::invalidate_plans(
+      const IETemplate* wire_template) {
+    auto i = plan_cache.lower_bound(
+      std::make_pair(wire_template,
+                     static_cast<const PlacementTemplate*>(0)));
+
+    while (i != plan_cache.end() && i->first.first == wire_template) {
+      delete i->second.columns;
+      delete i->second.plan;
+      plan_cache.erase(i++);
+    }
+  }
+
   uint16_t PlacementContentHandler::wire_template_min_length(const IETemplate* t) {
     uint16_t min = 0;
 
@@ -35,6 +35,7 @@
 
 #  include <list>
 #  include <map>
+#  include <utility>
 #  include <vector>
 
 #  if defined(_libfc_HAVE_LOG4CPLUS_)
@@ -47,9 +48,12 @@
 #  include "InputSource.h"
 #  include "IETemplate.h"
 #  include "PlacementTemplate.h"
+#  include "TemplateTable.h"
 
 namespace libfc {
 
+  class ColumnDecoder;
+  class DecodePlan;
   class PlacementCollector;
 
   /** This class decodes data sets, and is the main go-to point when
@@ -72,6 +76,7 @@ namespace libfc {
     /* From ContentHandler */
     std::shared_ptr<ErrorContext> start_session();
     std::shared_ptr<ErrorContext> end_session();
+    std::shared_ptr<ErrorContext> set_exporter(uint64_t exporter_id);
 
     std::shared_ptr<ErrorContext> start_message(uint16_t version,
                        uint16_t length,
@@ -107,6 +112,30 @@ namespace libfc {
         const PlacementTemplate* placement_template,
         PlacementCollector* callback);
 
+    /** Registers a placement template for batch delivery.
+     *
+     * Works like register_placement_template(), except that every
+     * placement in the template must point to an array (a column) of
+     * @a capacity values of the placement's type.  Instead of
+     * start_placement() and end_placement() being called for every
+     * record, record k of a batch is decoded into element k of each
+     * column, and the callback's end_batch() is called once the
+     * columns are full, or at the end of a message, whichever comes
+     * first.  A batch never spans messages.
+     *
+     * Octet array IEs use a column of BasicOctetArray, and float IEs a
+     * column of double, just as a single placement would.
+     *
+     * @param placement_template the placement template
+     * @param callback which functions to call on a full batch
+     * @param capacity number of records that fit into the columns;
+     *   must be at least 1
+     */
+    void register_batch_placement_template(
+        const PlacementTemplate* placement_template,
+        PlacementCollector* callback,
+        size_t capacity);
+
     /** Registers handler for unhandled data sets.
      *
      * If there is no handler for unhandled data sets, they will simply
@@ -117,10 +146,172 @@ namespace libfc {
      */
     void register_unhandled_data_set_handler(PlacementCollector* callback);
 
+    /** Forgets everything about an exporter.
+     *
+     * Templates are kept per exporter (see
+     * InputSource::get_exporter_id()), and they are kept until they
+     * are overwritten.  Call this when an exporter has gone away for
+     * good, for example when its TCP connection has closed, so that
+     * its templates don't pile up.
+     *
+     * @param exporter_id the exporter to forget
+     */
+    void drop_exporter(uint64_t exporter_id);
+
+    /** Returns the number of data sets whose decode plan was found in
+     * the plan cache.
+     *
+     * @return number of plan cache hits so far
+     */
+    uint64_t get_plan_cache_hits() const;
+
+    /** Returns the number of data sets for which a decode plan had to
+     * be built.
+     *
+     * @return number of plan cache misses so far
+     */
+    uint64_t get_plan_cache_misses() const;
+
   private:
+    /** A decode plan, together with the data that goes along with it
+     * and that is too expensive to recompute for every data set. */
+    struct CachedPlan {
+      /** The plan itself; owned by the cache. */
+      DecodePlan* plan;
+
+      /** Minimum wire length of a record; see
+       * wire_template_min_length(). */
+      uint16_t min_length;
+
+      /** Column decoder for batch placements of fixed-stride data
+       * sets, or null; owned by the cache. */
+      ColumnDecoder* columns;
+    };
+
+    /** The state of a placement template that is delivered in
+     * batches. */
+    struct Batch {
+      /** Number of records that fit into the columns. */
+      size_t capacity;
+
+      /** Number of records decoded into the columns so far. */
+      size_t fill;
+
+      /** Collector to call when the batch is complete. */
+      PlacementCollector* callback;
+    };
+
+    /** A wire template, and where its data sets go.
+     *
+     * Everything that is needed to dispatch a data set is here, so
+     * that it takes a single lookup in wire_templates.  The dispatch
+     * information is filled in by resolve_dispatch() for the first
+     * data set after the template was defined, and thrown away when
+     * the template is overwritten or when a placement template is
+     * registered.
+     */
+    struct WireTemplateInfo {
+      WireTemplateInfo()
+        : wire_template(0), resolved(false), placement_template(0),
+          plan(0), callback(0), batch(0) {
+      }
+
+      /** The wire template; owned by this object. */
+      const IETemplate* wire_template;
+
+      /** Whether the fields below are valid. */
+      bool resolved;
+
+      /** The matching placement template, or null if none matches. */
+      const PlacementTemplate* placement_template;
+
+      /** The plan for the wire and placement template. */
+      const CachedPlan* plan;
+
+      /** The collector for the placement template. */
+      PlacementCollector* callback;
+
+      /** The batch state, or null if the placement template is not a
+       * batch template. */
+      Batch* batch;
+    };
+
+    /** Fills in the dispatch information of a wire template.
+     *
+     * @param id the template ID (used for reporting only)
+     * @param info the wire template
+     */
+    void resolve_dispatch(uint16_t id, WireTemplateInfo& info);
+
+    /** Throws away the dispatch information of all wire templates. */
+    void forget_dispatch();
+
+    /** Decodes the records of a data set into a batch.
+     *
+     * @param placement_template the (batch) placement template
+     * @param batch the batch state of this template
+     * @param cached_plan the plan for this data set
+     * @param buf the start of the data records
+     * @param length the length of the data records
+     *
+     * @return an error context if a callback failed, null otherwise
+     */
+    std::shared_ptr<ErrorContext> decode_batch(
+      const PlacementTemplate* placement_template, Batch& batch,
+      const CachedPlan& cached_plan, const uint8_t* buf, uint16_t length);
+
+    /** Delivers all partially filled batches.
+     *
+     * @return an error context if a callback failed, null otherwise
+     */
+    std::shared_ptr<ErrorContext> flush_batches();
+
+    /** Finds or builds the decode plan for a pair of templates.
+     *
+     * @param wire_template the wire template of the data set
+     * @param placement_template the placement template that matched
+     *
+     * @return the cached plan for this pair of templates
+     */
+    const CachedPlan& lookup_plan(const IETemplate* wire_template,
+                                  const PlacementTemplate* placement_template);
+
+    /** Discards all cached plans that were built for a wire template.
+     *
+     * This must be called before a wire template is deleted, since
+     * its address would otherwise live on as a key in the cache.
+     *
+     * @param wire_template the wire template that is going away
+     */
+    void invalidate_plans(const IETemplate* wire_template);
+
     /** Observation domain for this message. */
     uint32_t observation_domain;
 
+    /** Exporter of this message; see set_exporter(). */
+    uint64_t exporter_id;
+
+    /** Index of the exporter of this message, shifted into place for
+     * make_template_key(). */
+    uint64_t exporter_key;
+
+    /** Indexes of the exporters seen so far.
+     *
+     * Exporter identifiers are 64 bits wide, and so don't fit into a
+     * template key together with observation domain and template ID.
+     * Therefore, every exporter gets a 16-bit index when it is first
+     * seen.  Exporter 0 (the default for input sources that don't
+     * tell exporters apart) always has index 0 and is not in this
+     * table.
+     */
+    TemplateTable<uint16_t> exporter_indexes;
+
+    /** Indexes released by drop_exporter(), for reuse. */
+    std::vector<uint16_t> free_exporter_indexes;
+
+    /** Lowest exporter index never handed out. */
+    uint32_t next_exporter_index;
+
     /** The cached InfoModel instance. */
     InfoModel& info_model;
 
@@ -173,7 +364,12 @@ namespace libfc {
     match_placement_template(uint16_t id,
                              const IETemplate* wire_template) const;
 
-    /** Makes unique template key from template ID and observation domain. 
+    /** Makes unique template key from template ID, observation domain
+     * and exporter.
+     *
+     * The template ID is in bits 0-15, the observation domain in bits
+     * 16-47, and the exporter index (see exporter_indexes) in bits
+     * 48-63.
      *
      * @param tid template id
      *
@@ -226,11 +422,12 @@ namespace libfc {
         uint16_t ie_length,
         uint32_t enterprise_number);
 
-    /** Wire templates as they're read from template sets.
+    /** Wire templates as they're read from template sets, keyed by
+     * make_template_key().
      *
-     * This map is kept between messages.
+     * This table is kept between messages.
      */
-    std::map<uint64_t, const IETemplate*> wire_templates;
+    TemplateTable<WireTemplateInfo> wire_templates;
 
     /** Placement templates.
      *
@@ -242,31 +439,29 @@ namespace libfc {
     /** Association between placement template and callback. */
     std::map<const PlacementTemplate*, PlacementCollector*> callbacks;
 
+    /** Batch state of placement templates registered with
+     * register_batch_placement_template(). */
+    std::map<const PlacementTemplate*, Batch> batches;
+
     /** Unhandled data set handler, if any. */
     PlacementCollector* unhandled_data_set_handler;
 
-    /** Says whether to use the matched template cache. 
+    /** Decode plans, keyed by wire template and placement template.
      *
-     * At the moment, this is statically set in the constructor (to
-     * false), but it could be made into a constructor parameter.
+     * Building a DecodePlan means walking both templates and looking
+     * up every IE, which is much more work than decoding the handful
+     * of records in a typical data set. Since wire templates are
+     * repeated only rarely, the plan is built once and then reused
+     * until the wire template is overwritten.
      */
-    bool use_matched_template_cache;
+    std::map<std::pair<const IETemplate*, const PlacementTemplate*>,
+             CachedPlan> plan_cache;
 
-    /** Association between wire template and placement template.
-     *
-     * We are using the strategy that we choose the @em{first}
-     * placement template that matches as @em{the} matching
-     * template. This means that a match, once found, cannot later be
-     * replaced by a better match.  Therefore, once we've found a
-     * matching template, we record it in this cache and look it up,
-     * potentially saving long matching operations.
-     *
-     * Profiling shows that for simple cases, this caching slows the
-     * collection process down, therefore this member might not be
-     * used.
-     */
-    mutable std::map<const IETemplate*, const PlacementTemplate*>
-      matched_templates;
+    /** Number of plan cache hits. */
+    uint64_t plan_cache_hits;
+
+    /** Number of plan cache misses. */
+    uint64_t plan_cache_misses;
 
     /** The current wire template that is being assembled. 
      *
@@ -32,11 +32,7 @@
 
 #include <unistd.h>
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#include "logging.h"
 
 #include "ipfix_endian.h"
 
@@ -704,7 +700,7 @@ namespace libfc {
     }
   }
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
+#if libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE
   static const char* make_time(uint32_t export_time) {
     struct tm tms;
     time_t then = export_time;
@@ -716,7 +712,7 @@ namespace libfc {
 
     return gmtime_buf;
   }
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#endif /* libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE */
 
   bool PlacementExporter::flush() {
     LOG4CPLUS_TRACE(logger, "ENTER flush");
@@ -791,9 +787,9 @@ namespace libfc {
       ret = os.writev(iovecs);
       LOG4CPLUS_TRACE(logger, "wrote " << ret << " bytes");
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
+#if libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE
       int n = 0;
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#endif /* libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE */
       for (auto i = iovecs.begin(); i != iovecs.end(); ++i) {
         LOG4CPLUS_TRACE(logger, "  iovec " << ++n
                         << " size " << i->iov_len);
@@ -907,12 +903,12 @@ namespace libfc {
       new_bytes += kIpfixSetHeaderLen;
     }
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
+#if libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE
     if (n_message_octets + new_bytes > kMaxMessageLen)
       LOG4CPLUS_TRACE(logger,
                       "n_message_octets=" << n_message_octets
                       << ", new_bytes=" << new_bytes);
-#endif /* defined(_LIBGC_HAVE_LOG4CPLUS_) */
+#endif /* libfc_LOG_LEVEL <= libfc_LOG_LEVEL_TRACE */
     n_message_octets += new_bytes;
     assert(n_message_octets <= kMaxMessageLen);
 
@@ -23,24 +23,24 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
 #include <climits>
 
 #include <arpa/inet.h>
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#include "logging.h"
 
 #include "BasicOctetArray.h"
 #include "PlacementTemplate.h"
 
 namespace libfc {
 
+  libfc_DEFINE_LOGGER(logger, "PlacementTemplate");
+
   class PlacementTemplate::PlacementInfo {
   public:
-    PlacementInfo(const InfoElement* ie, void* address, size_t size_on_wire);
+    PlacementInfo(const InfoElement* ie, void* address, size_t size_on_wire,
+                  bool by_reference);
 
     /** Information element.
      *
@@ -54,22 +54,26 @@ namespace libfc {
     /** Size of InfoElement on the wire. This is useful only when
      * exporting. */
     size_t size_on_wire;
+
+    /** Whether address is an OctetArrayView rather than a place for
+     * the value itself. */
+    bool by_reference;
   };
 
   PlacementTemplate::PlacementInfo::PlacementInfo(const InfoElement* _ie,
                                                   void* _address,
-                                                  size_t _size_on_wire) 
-    : ie(_ie), address(_address), size_on_wire(_size_on_wire) {
+                                                  size_t _size_on_wire,
+                                                  bool _by_reference) 
+    : ie(_ie), address(_address), size_on_wire(_size_on_wire),
+      by_reference(_by_reference) {
   }
 
   PlacementTemplate::PlacementTemplate() 
     : buf(0), 
       size(0),
       fixlen_data_record_size(0),
-      template_id(0)
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-    , logger(log4cplus::Logger::getInstance(LOG4CPLUS_TEXT("PlacementTemplate")))
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+      template_id(0),
+      signature(0)
   {
   }
 
@@ -81,8 +85,9 @@ namespace libfc {
                                              void* p, size_t size) {
     if (size == 0)
       size = ie->len();
-    placements[ie] = new PlacementInfo(ie, p, size);
+    placements[ie] = new PlacementInfo(ie, p, size, false);
     ies.push_back(ie);
+    add_key(ie);
 
     if (size == kIpfixVarlen)
       varlen_ies.push_back(placements[ie]);
@@ -92,9 +97,36 @@ namespace libfc {
     return true;
   }
 
+  bool PlacementTemplate::register_reference_placement(
+      const InfoElement* ie, OctetArrayView* p) {
+    if (ie->ietype() == 0
+        || (ie->ietype()->number() != IEType::kOctetArray
+            && ie->ietype()->number() != IEType::kString))
+      return false;
+
+    placements[ie] = new PlacementInfo(ie, p, ie->len(), true);
+    ies.push_back(ie);
+    add_key(ie);
+
+    if (ie->len() == kIpfixVarlen)
+      varlen_ies.push_back(placements[ie]);
+    else
+      fixlen_data_record_size += ie->len();
+
+    return true;
+  }
+
+  void PlacementTemplate::add_key(const InfoElement* ie) {
+    uint64_t key = ie->key();
+    auto i = std::lower_bound(keys.begin(), keys.end(), key);
+    if (i == keys.end() || *i != key)
+      keys.insert(i, key);
+    signature |= static_cast<uint64_t>(1) << (key % 64);
+  }
+
   bool PlacementTemplate::lookup_placement(const InfoElement* ie,
                                            void** p, size_t* size) const {
-    LOG4CPLUS_TRACE(logger, "ENTER lookup_placement");
+    LOG4CPLUS_TRACE(logger(), "ENTER lookup_placement");
     for (auto i = placements.begin(); i != placements.end(); ++i) {
       if (i->first->matches(*ie)) {
         *p = i->second->address;
@@ -108,38 +140,35 @@ namespace libfc {
     return false;
   }
 
+  bool PlacementTemplate::is_reference_placement(
+      const InfoElement* ie) const {
+    for (auto i = placements.begin(); i != placements.end(); ++i) {
+      if (i->first->matches(*ie))
+        return i->second->by_reference;
+    }
+    return false;
+  }
+
   unsigned int PlacementTemplate::is_match(
       const IETemplate* t,
       std::set<const InfoElement*>* unmatched) const {
-    LOG4CPLUS_TRACE(logger, "ENTER is_match");
+    LOG4CPLUS_TRACE(logger(), "ENTER is_match");
     
-    bool found = true;
-
-    for (auto i = placements.begin(); i != placements.end(); ++i) {
-      LOG4CPLUS_TRACE(logger, "  looking up IE " << i->first->toIESpec());
-      if (!t->contains(i->first)) {
-        LOG4CPLUS_TRACE(logger, "    not found -> false");
-        found = false;
-        break;
-      }
-    }
+    /* Both key vectors are sorted, so this is a single merge pass,
+     * and the signature test rejects most mismatches before that. */
+    bool found = (signature & ~t->signature()) == 0
+      && std::includes(t->sorted_keys().begin(), t->sorted_keys().end(),
+                       keys.begin(), keys.end());
 
     if (found) {
-      LOG4CPLUS_TRACE(logger, "  all found -> return " << placements.size());
+      LOG4CPLUS_TRACE(logger(), "  all found -> return " << placements.size());
       assert(placements.size() <= UINT_MAX);
 
       if (unmatched != 0) {
         unmatched->clear();
 
         for (auto i = t->begin(); i != t->end(); ++i) {
-          bool found = false;
-          for (auto k = placements.begin(); k != placements.end(); ++k) {
-            if (k->first->matches(*(*i))) {
-              found = true;
-              break;
-            }
-          }
-          if (!found)
+          if (!std::binary_search(keys.begin(), keys.end(), (*i)->key()))
             unmatched->insert(*i);
         }
       }
@@ -153,9 +182,9 @@ namespace libfc {
       uint16_t _template_id,
       const uint8_t** _buf,
       size_t* _size) const {
-    LOG4CPLUS_TRACE(logger, "ENTER wire_template");
+    LOG4CPLUS_TRACE(logger(), "ENTER wire_template");
     if (buf == 0) {
-      LOG4CPLUS_TRACE(logger,
+      LOG4CPLUS_TRACE(logger(),
                       "  computing wire template, id=" << _template_id);
       assert(_template_id != 0);
       /* Templates start with a 2-byte template ID and a 2-byte field
@@ -183,7 +212,7 @@ namespace libfc {
       /* Use IES, not PLACEMENTS for iteration, because now, sequence
        * matters. */
       for (auto i = ies.begin(); i != ies.end(); ++i) {
-        LOG4CPLUS_TRACE(logger,
+        LOG4CPLUS_TRACE(logger(),
                         "  wire template for (" << (*i)->pen()
                         << "/" << (*i)->number()
                         << ")[" << (*i)->len() << "]");
@@ -222,8 +251,9 @@ namespace libfc {
 
     if (varlen_ies.size() != 0) {
       for (auto i = varlen_ies.begin(); i != varlen_ies.end(); ++i) {
-        uint16_t varlen_len
-          = reinterpret_cast<BasicOctetArray*>((*i)->address)->get_length();
+        uint16_t varlen_len = (*i)->by_reference
+          ? reinterpret_cast<OctetArrayView*>((*i)->address)->get_length()
+          : reinterpret_cast<BasicOctetArray*>((*i)->address)->get_length();
         ret += varlen_len + (varlen_len < 255 ? 1 : 3);
       }
     }
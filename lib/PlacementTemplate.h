@@ -36,13 +36,12 @@
 #  include <list>
 #  include <map>
 #  include <set>
+#  include <vector>
 
-#  if defined(_libfc_HAVE_LOG4CPLUS_)
-#    include <log4cplus/logger.h>
-#  endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
 
 #  include "InfoElement.h"
 #  include "IETemplate.h"
+#  include "OctetArrayView.h"
 
 namespace libfc {
 
@@ -291,6 +290,24 @@ namespace libfc {
      */
     bool register_placement(const InfoElement* ie, void* p, size_t size);
 
+    /** Registers an IE whose value is to be referenced, not copied.
+     *
+     * When collecting, the view is set to point at the value in the
+     * message buffer instead of the value being copied into a
+     * BasicOctetArray.  See OctetArrayView for how long the view
+     * stays valid.  Reference placements are only meaningful when
+     * collecting.
+     *
+     * @param ie the information element, which must be of type
+     *     octetArray or string
+     * @param p the view to be associated with the IE
+     *
+     * @return true if the operation was successful, false if the IE
+     *     is not of type octetArray or string.
+     */
+    bool register_reference_placement(const InfoElement* ie,
+                                       OctetArrayView* p);
+
     /** Retrieves the memory location given an IE.
      *
      * @param ie the information element to look for
@@ -304,11 +321,25 @@ namespace libfc {
      */
     bool lookup_placement(const InfoElement* ie, void** p, size_t* size) const;
 
+    /** Tells whether an IE was registered with
+     * register_reference_placement().
+     *
+     * @param ie the information element to look for
+     *
+     * @return true if the IE was registered as a reference placement,
+     *     false if it was registered with register_placement() or not
+     *     at all
+     */
+    bool is_reference_placement(const InfoElement* ie) const;
+
     /** Tells whether a given template matches this template.
      *
      * A template T matches this template iff T's set of IEs is a
      * subset of this template's set of IEs.
      *
+     * This takes time linear in the number of IEs in both templates
+     * and allocates nothing, unless @a unmatched is non-null.
+     *
      * @param t the template to match
      * @param unmatched pointer to a set of InfoElements; if non-null,
      *   @emph{and} if the return value was greater than zero, this
@@ -365,6 +396,12 @@ namespace libfc {
     std::list<const InfoElement*>::const_iterator end() const;
 
   private:
+    /** Enters an IE into keys and signature.
+     *
+     * @param ie the IE that has just been registered
+     */
+    void add_key(const InfoElement* ie);
+
     class PlacementInfo;
     std::map<const InfoElement*, PlacementInfo*> placements;
 
@@ -386,9 +423,12 @@ namespace libfc {
     /** The template ID for the wire representation of this template. */
     mutable uint16_t template_id;
 
-#  if defined(_libfc_HAVE_LOG4CPLUS_)
-    log4cplus::Logger logger;
-#  endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+    /** Keys of the registered IEs, sorted and without duplicates; see
+     * IETemplate::sorted_keys(). */
+    std::vector<uint64_t> keys;
+
+    /** Signature of the registered IEs; see IETemplate::signature(). */
+    uint64_t signature;
   };
 
 } // namespace libfc
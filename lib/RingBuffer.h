@@ -0,0 +1,399 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_RINGBUFFER_H_
+#  define _libfc_RINGBUFFER_H_
+
+#  include <atomic>
+#  include <condition_variable>
+#  include <cstddef>
+#  include <memory>
+#  include <mutex>
+#  include <thread>
+
+namespace libfc {
+
+  /** Size of a cache line.  The indices that different threads write
+   * are kept this far apart, so that they don't share a line. */
+  static const size_t kCacheLineSize = 64;
+
+  /** Rounds up to a power of two, which is at least 2. */
+  inline size_t ring_capacity(size_t n) {
+    size_t capacity = 2;
+    while (capacity < n)
+      capacity *= 2;
+    return capacity;
+  }
+
+  /** A bounded lock-free queue for one producer and one consumer.
+   *
+   * push() may only be called by one thread at a time, and pop() by
+   * one (other) thread at a time.  Neither ever blocks: they fail if
+   * the queue is full or empty, and the caller decides how to wait.
+   * Each side keeps a copy of the other side's index, so that the
+   * shared index cache line is only touched when the copy says the
+   * queue is full or empty.
+   *
+   * @param T the element type, which must be default-constructible
+   *   and copyable; usually a pointer
+   */
+  template<typename T>
+  class SpscRing {
+  public:
+    /** Creates an empty queue.
+     *
+     * @param n the least number of elements the queue can hold; it is
+     *   rounded up to a power of two
+     */
+    explicit SpscRing(size_t n)
+      : mask(ring_capacity(n) - 1),
+        slots(new T[mask + 1]),
+        head(0), tail_copy(0), tail(0), head_copy(0) {
+    }
+
+    /** Appends an element; producer only.
+     *
+     * @return false if the queue is full
+     */
+    bool push(const T& value) {
+      size_t t = tail.load(std::memory_order_relaxed);
+      if (t - head_copy > mask) {
+        head_copy = head.load(std::memory_order_acquire);
+        if (t - head_copy > mask)
+          return false;
+      }
+      slots[t & mask] = value;
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    /** Removes the oldest element; consumer only.
+     *
+     * @return false if the queue is empty
+     */
+    bool pop(T& value) {
+      size_t h = head.load(std::memory_order_relaxed);
+      if (h == tail_copy) {
+        tail_copy = tail.load(std::memory_order_acquire);
+        if (h == tail_copy)
+          return false;
+      }
+      value = slots[h & mask];
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+    /** Returns whether the queue is empty.  Exact only on the consumer
+     * thread, and there only until the producer pushes. */
+    bool empty() const {
+      return head.load(std::memory_order_relaxed)
+        == tail.load(std::memory_order_acquire);
+    }
+
+    /** Returns whether the queue is full.  Exact only on the producer
+     * thread, and there only until the consumer pops. */
+    bool full() const {
+      return tail.load(std::memory_order_relaxed)
+        - head.load(std::memory_order_acquire) > mask;
+    }
+
+  private:
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    const size_t mask;
+    std::unique_ptr<T[]> slots;
+
+    /** Written by the consumer. */
+    char consumer_pad[kCacheLineSize];
+    std::atomic<size_t> head;
+    size_t tail_copy;
+
+    /** Written by the producer. */
+    char producer_pad[kCacheLineSize];
+    std::atomic<size_t> tail;
+    size_t head_copy;
+  };
+
+  /** A bounded lock-free queue for many producers and one consumer.
+   *
+   * Producers claim a slot by advancing the tail with a
+   * compare-and-swap, and publish it through the slot's sequence
+   * number, so a producer that is preempted between the two holds up
+   * only the consumer, never the other producers.
+   *
+   * @param T the element type, which must be default-constructible
+   *   and copyable; usually a pointer
+   */
+  template<typename T>
+  class MpscRing {
+  public:
+    /** Creates an empty queue.
+     *
+     * @param n the least number of elements the queue can hold; it is
+     *   rounded up to a power of two
+     */
+    explicit MpscRing(size_t n)
+      : mask(ring_capacity(n) - 1),
+        cells(new Cell[mask + 1]),
+        head(0), tail(0) {
+      for (size_t i = 0; i <= mask; i++)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /** Appends an element; any thread.
+     *
+     * @return false if the queue is full
+     */
+    bool push(const T& value) {
+      size_t t = tail.load(std::memory_order_relaxed);
+      for (;;) {
+        Cell& cell = cells[t & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if (sequence == t) {
+          if (tail.compare_exchange_weak(t, t + 1,
+                                         std::memory_order_relaxed))
+            break;
+        } else if (static_cast<ptrdiff_t>(sequence - t) < 0)
+          return false;
+        else
+          t = tail.load(std::memory_order_relaxed);
+      }
+
+      Cell& cell = cells[t & mask];
+      cell.value = value;
+      cell.sequence.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    /** Removes the oldest element; consumer only.
+     *
+     * @return false if the queue is empty, or if the producer of the
+     *   oldest element has not finished pushing it yet
+     */
+    bool pop(T& value) {
+      size_t h = head.load(std::memory_order_relaxed);
+      Cell& cell = cells[h & mask];
+      if (cell.sequence.load(std::memory_order_acquire) != h + 1)
+        return false;
+      value = cell.value;
+      cell.sequence.store(h + mask + 1, std::memory_order_release);
+      head.store(h + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+  private:
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    struct Cell {
+      /** Equal to the position for a free slot, and to the position
+       * plus one for a filled one. */
+      std::atomic<size_t> sequence;
+      T value;
+    };
+
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+
+    /** Written by the consumer. */
+    char consumer_pad[kCacheLineSize];
+    std::atomic<size_t> head;
+
+    /** Written by the producers. */
+    char producer_pad[kCacheLineSize];
+    std::atomic<size_t> tail;
+  };
+
+  /** A bounded lock-free queue for one producer and many consumers.
+   *
+   * This is the queue of one worker in a work-stealing pool that is
+   * fed by a single thread: the worker takes from its own queue, and
+   * when that is empty, it steals from the others'.  Everybody takes
+   * from the front, so that work is done roughly in the order it was
+   * queued.  Consumers claim an element by advancing the head with a
+   * compare-and-swap; slots carry sequence numbers as in MpscRing.
+   *
+   * @param T the element type, which must be default-constructible
+   *   and copyable
+   */
+  template<typename T>
+  class SpmcRing {
+  public:
+    /** Creates an empty queue.
+     *
+     * @param n the least number of elements the queue can hold; it is
+     *   rounded up to a power of two
+     */
+    explicit SpmcRing(size_t n)
+      : mask(ring_capacity(n) - 1),
+        cells(new Cell[mask + 1]),
+        head(0), tail(0) {
+      for (size_t i = 0; i <= mask; i++)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /** Appends an element; producer only.
+     *
+     * @return false if the queue is full
+     */
+    bool push(const T& value) {
+      size_t t = tail.load(std::memory_order_relaxed);
+      Cell& cell = cells[t & mask];
+      if (cell.sequence.load(std::memory_order_acquire) != t)
+        return false;
+      cell.value = value;
+      cell.sequence.store(t + 1, std::memory_order_release);
+      tail.store(t + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    /** Removes the oldest element; any thread.
+     *
+     * @return false if the queue is empty
+     */
+    bool pop(T& value) {
+      size_t h = head.load(std::memory_order_relaxed);
+      for (;;) {
+        Cell& cell = cells[h & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        ptrdiff_t diff = static_cast<ptrdiff_t>(sequence - (h + 1));
+        if (diff == 0) {
+          if (head.compare_exchange_weak(h, h + 1,
+                                         std::memory_order_relaxed)) {
+            value = cell.value;
+            cell.sequence.store(h + mask + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0)
+          return false;
+        else
+          h = head.load(std::memory_order_relaxed);
+      }
+    }
+
+    /** Returns whether the queue is empty.  Only a hint, since other
+     * threads may change the queue at any time. */
+    bool empty() const {
+      size_t h = head.load(std::memory_order_relaxed);
+      return cells[h & mask].sequence.load(std::memory_order_acquire)
+        != h + 1;
+    }
+
+  private:
+    SpmcRing(const SpmcRing&) = delete;
+    SpmcRing& operator=(const SpmcRing&) = delete;
+
+    struct Cell {
+      /** Equal to the position for a free slot, and to the position
+       * plus one for a filled one. */
+      std::atomic<size_t> sequence;
+      T value;
+    };
+
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+
+    /** Written by the consumers. */
+    char consumer_pad[kCacheLineSize];
+    std::atomic<size_t> head;
+
+    /** Written by the producer. */
+    char producer_pad[kCacheLineSize];
+    std::atomic<size_t> tail;
+  };
+
+  /** Lets threads sleep until another thread has made progress, for
+   * example until it has pushed onto or popped from a ring.
+   *
+   * A waiting thread spins for a while first, since the progress it
+   * waits for is usually only a moment away.  A thread that makes
+   * progress calls wake(), which is cheap unless somebody actually
+   * sleeps.
+   */
+  class Waiter {
+  public:
+    Waiter() : n_sleeping(0) {
+    }
+
+    /** Waits until @a ready returns true. */
+    template<typename Predicate>
+    void wait(Predicate ready) {
+      static const int kSpins = 100;
+
+      for (int i = 0; i < kSpins; i++) {
+        if (ready())
+          return;
+        std::this_thread::yield();
+      }
+
+      std::unique_lock<std::mutex> l(lock);
+      n_sleeping.fetch_add(1, std::memory_order_relaxed);
+      /* Pairs with the fence in wake(): either ready() sees the
+       * progress, or wake() sees that we sleep. */
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (!ready())
+        progress.wait(l);
+      n_sleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /** Wakes one sleeping thread, if there is one. */
+    void wake() {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (n_sleeping.load(std::memory_order_relaxed) != 0) {
+        std::lock_guard<std::mutex> l(lock);
+        progress.notify_one();
+      }
+    }
+
+    /** Wakes all sleeping threads. */
+    void wake_all() {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (n_sleeping.load(std::memory_order_relaxed) != 0) {
+        std::lock_guard<std::mutex> l(lock);
+        progress.notify_all();
+      }
+    }
+
+  private:
+    Waiter(const Waiter&) = delete;
+    Waiter& operator=(const Waiter&) = delete;
+
+    std::atomic<unsigned int> n_sleeping;
+    std::mutex lock;
+    std::condition_variable progress;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_RINGBUFFER_H_
@@ -0,0 +1,112 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_STATUS_H_
+#  define _libfc_STATUS_H_
+
+#  include <memory>
+#  include <type_traits>
+
+#  include "Error.h"
+#  include "ErrorContext.h"
+
+namespace libfc {
+
+  /** Outcome of a callback that is called once per record.
+   *
+   * Unlike std::shared_ptr<ErrorContext>, a Status is trivially
+   * copyable and two words long, so it is returned in registers, and
+   * returning success costs nothing.  The detail text is a static
+   * string; it is only formatted into an ErrorContext, by
+   * to_error_context(), if the status is an error.
+   */
+  class Status {
+  public:
+    /** Creates a successful status. */
+    Status()
+      : severity(ErrorContext::fine), e(Error::no_error), detail(0) {
+    }
+
+    /** Creates an error status.
+     *
+     * @param _e the error; must not be Error::no_error
+     * @param _detail a static explanation, or null
+     * @param _severity the severity of the error
+     */
+    Status(Error::error_t _e, const char* _detail = 0,
+           ErrorContext::error_severity_t _severity
+             = ErrorContext::recoverable)
+      : severity(_severity), e(_e), detail(_detail) {
+    }
+
+    /** Returns a successful status. */
+    static Status ok() {
+      return Status();
+    }
+
+    /** Tells whether this status signals success. */
+    bool is_ok() const {
+      return e == Error::no_error;
+    }
+
+    Error::error_t get_error() const {
+      return e;
+    }
+
+    ErrorContext::error_severity_t get_severity() const {
+      return severity;
+    }
+
+    /** Returns the explanation, or null if there is none. */
+    const char* get_detail() const {
+      return detail;
+    }
+
+    /** Converts an error status for callers that expect an error
+     * context.
+     *
+     * @return a new error context, or null if this status is ok
+     */
+    std::shared_ptr<ErrorContext> to_error_context() const;
+
+  private:
+    ErrorContext::error_severity_t severity;
+    Error::error_t e;
+    const char* detail;
+  };
+
+  static_assert(std::is_trivially_copyable<Status>::value,
+                "Status must stay trivially copyable");
+
+} // namespace libfc
+
+#endif /* _libfc_STATUS_H_ */
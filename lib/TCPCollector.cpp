@@ -0,0 +1,479 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "BufferInputSource.h"
+#include "Constants.h"
+#include "TCPCollector.h"
+
+#include "exceptions/FormatError.h"
+
+namespace libfc {
+
+  /** One worker thread, with its epoll instance and connections. */
+  class TCPCollector::Worker {
+  public:
+    Worker()
+      : epoll_fd(-1), listen_fd(-1), stop_fd(-1),
+        n_accepted(0), n_open(0), n_messages(0), n_bytes(0), n_errors(0) {
+    }
+
+    ~Worker() {
+      if (epoll_fd >= 0)
+        (void) close(epoll_fd);
+    }
+
+    std::shared_ptr<ErrorContext> start(PlacementCollector* c,
+                                        int listen_fd, int stop_fd);
+    void run();
+    Stats get_stats() const;
+    std::shared_ptr<ErrorContext> get_last_error() const;
+
+    std::unique_ptr<PlacementCollector> collector;
+
+  private:
+    struct Connection {
+      int fd;
+      uint64_t exporter_id;
+
+      /** Bytes of a message whose end hasn't arrived yet. */
+      std::vector<uint8_t> pending;
+    };
+
+    /** Bytes read from a connection at most per wakeup.  Reading
+     * once per wakeup keeps one busy exporter from starving the
+     * others; epoll is level-triggered, so we come back for the
+     * rest. */
+    static const size_t kReadSize = 1 << 18;
+
+    /** Events handled per epoll_wait() at most. */
+    static const int kMaxEvents = 64;
+
+    void accept_connections();
+    void receive(Connection* c);
+    bool deliver(Connection* c, const uint8_t* buf, size_t len,
+                 size_t* used);
+    void close_connection(int fd, bool error);
+    void keep_error(std::shared_ptr<ErrorContext> err,
+                    std::unique_ptr<InputSource> is);
+
+    static void add(std::atomic<uint64_t>& counter, int64_t delta) {
+      counter.store(counter.load(std::memory_order_relaxed) + delta,
+                    std::memory_order_relaxed);
+    }
+
+    int epoll_fd;
+    int listen_fd;
+    int stop_fd;
+    std::unordered_map<int, std::unique_ptr<Connection> > connections;
+    std::vector<uint8_t> scratch;
+
+    /** Only the worker thread writes these. */
+    std::atomic<uint64_t> n_accepted;
+    std::atomic<uint64_t> n_open;
+    std::atomic<uint64_t> n_messages;
+    std::atomic<uint64_t> n_bytes;
+    std::atomic<uint64_t> n_errors;
+
+    /** The error that closed the last failed connection, and the
+     * input source it refers to. */
+    mutable std::mutex error_lock;
+    std::shared_ptr<ErrorContext> last_error;
+    std::unique_ptr<InputSource> failed_input;
+  };
+
+  const size_t TCPCollector::Worker::kReadSize;
+
+  std::shared_ptr<ErrorContext>
+  TCPCollector::Worker::start(PlacementCollector* c, int _listen_fd,
+                              int _stop_fd) {
+    collector.reset(c);
+    listen_fd = _listen_fd;
+    stop_fd = _stop_fd;
+    scratch.resize(kReadSize);
+    keep_error(std::shared_ptr<ErrorContext>(),
+               std::unique_ptr<InputSource>());
+
+    if (epoll_fd >= 0)
+      (void) close(epoll_fd);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+      libfc_RETURN_ERROR(fatal, system_error, "Can't create epoll instance",
+                         errno, 0, 0, 0, 0);
+
+    /* Wake only one worker per incoming connection, not all. */
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+#if defined(EPOLLEXCLUSIVE)
+    ev.events |= EPOLLEXCLUSIVE;
+#endif /* defined(EPOLLEXCLUSIVE) */
+    ev.data.fd = listen_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+      libfc_RETURN_ERROR(fatal, system_error, "Can't watch listening socket",
+                         errno, 0, 0, 0, 0);
+
+    /* But wake all of them when it's time to stop. */
+    ev.events = EPOLLIN;
+    ev.data.fd = stop_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev) < 0)
+      libfc_RETURN_ERROR(fatal, system_error, "Can't watch stop event",
+                         errno, 0, 0, 0, 0);
+
+    libfc_RETURN_OK();
+  }
+
+  void TCPCollector::Worker::run() {
+    struct epoll_event events[kMaxEvents];
+    bool stopping = false;
+
+    while (!stopping) {
+      int n = epoll_wait(epoll_fd, events, kMaxEvents, -1);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+
+      for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == stop_fd)
+          stopping = true;
+        else if (fd == listen_fd)
+          accept_connections();
+        else {
+          auto c = connections.find(fd);
+          if (c != connections.end())
+            receive(c->second.get());
+        }
+      }
+    }
+
+    while (!connections.empty())
+      close_connection(connections.begin()->first, false);
+  }
+
+  void TCPCollector::Worker::accept_connections() {
+    while (true) {
+      struct sockaddr_storage sa;
+      socklen_t sa_len = sizeof(sa);
+      int fd = accept4(listen_fd, reinterpret_cast<struct sockaddr*>(&sa),
+                       &sa_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        /* EAGAIN: another worker got it, or there are no more. */
+        return;
+      }
+
+      struct epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        (void) close(fd);
+        continue;
+      }
+
+      Connection* c = new Connection();
+      c->fd = fd;
+      c->exporter_id = InputSource::make_exporter_id(
+        reinterpret_cast<struct sockaddr*>(&sa), sa_len);
+      connections[fd].reset(c);
+
+      add(n_accepted, 1);
+      add(n_open, 1);
+    }
+  }
+
+  void TCPCollector::Worker::receive(Connection* c) {
+    ssize_t n = ::read(c->fd, &scratch[0], scratch.size());
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        close_connection(c->fd, true);
+      return;
+    } else if (n == 0) {
+      /* A message cut off by the end of the stream is an error. */
+      close_connection(c->fd, !c->pending.empty());
+      return;
+    }
+
+    add(n_bytes, n);
+
+    /* Usually, nothing is pending and we parse straight from the
+     * read buffer. */
+    const uint8_t* buf = &scratch[0];
+    size_t len = n;
+    if (!c->pending.empty()) {
+      c->pending.insert(c->pending.end(), buf, buf + len);
+      buf = &c->pending[0];
+      len = c->pending.size();
+    }
+
+    size_t used;
+    if (!deliver(c, buf, len, &used)) {
+      close_connection(c->fd, true);
+      return;
+    }
+
+    if (buf == &scratch[0])
+      c->pending.assign(buf + used, buf + len);
+    else
+      c->pending.erase(c->pending.begin(), c->pending.begin() + used);
+  }
+
+  /** Runs one collect(), turning a decode error thrown under
+   * stop_on_error into an error context. */
+  static std::shared_ptr<ErrorContext>
+  collect_once(PlacementCollector& collector, InputSource& is) {
+    try {
+      return collector.collect(is);
+    } catch (FormatError& e) {
+      libfc_RETURN_ERROR(recoverable, format_error, e.what(), 0, &is,
+                         0, 0, 0);
+    }
+  }
+
+  bool TCPCollector::Worker::deliver(Connection* c, const uint8_t* buf,
+                                     size_t len, size_t* used) {
+    /* Find the complete messages at the start of the buffer. */
+    size_t off = 0;
+    uint64_t n_complete = 0;
+    bool framed = true;
+    while (len - off >= kIpfixMessageHeaderLen) {
+      uint16_t version = (buf[off] << 8) | buf[off + 1];
+      uint16_t message_len = (buf[off + 2] << 8) | buf[off + 3];
+      if (version != kIpfixVersion || message_len < kIpfixMessageHeaderLen) {
+        framed = false;
+        break;
+      }
+      if (message_len > len - off)
+        break;
+      off += message_len;
+      n_complete++;
+    }
+
+    /* If we lost track of message boundaries, let the parser say what
+     * is wrong. */
+    size_t end = framed ? off : len;
+    if (end > 0) {
+      std::unique_ptr<InputSource> is(
+        new BufferInputSource(buf, end, c->exporter_id));
+      std::shared_ptr<ErrorContext> err = collect_once(*collector, *is);
+      if (err != 0) {
+        keep_error(err, std::move(is));
+        return false;
+      }
+      add(n_messages, n_complete);
+    }
+
+    *used = end;
+    return framed;
+  }
+
+  void TCPCollector::Worker::close_connection(int fd, bool error) {
+    auto c = connections.find(fd);
+    collector->drop_exporter(c->second->exporter_id);
+    (void) close(fd);
+    connections.erase(c);
+
+    add(n_open, -1);
+    if (error)
+      add(n_errors, 1);
+  }
+
+  void TCPCollector::Worker::keep_error(std::shared_ptr<ErrorContext> err,
+                                        std::unique_ptr<InputSource> is) {
+    std::lock_guard<std::mutex> l(error_lock);
+    last_error = err;
+    failed_input = std::move(is);
+  }
+
+  std::shared_ptr<ErrorContext>
+  TCPCollector::Worker::get_last_error() const {
+    std::lock_guard<std::mutex> l(error_lock);
+    return last_error;
+  }
+
+  TCPCollector::Stats TCPCollector::Worker::get_stats() const {
+    Stats ret;
+    ret.n_accepted = n_accepted.load(std::memory_order_relaxed);
+    ret.n_open = n_open.load(std::memory_order_relaxed);
+    ret.n_messages = n_messages.load(std::memory_order_relaxed);
+    ret.n_bytes = n_bytes.load(std::memory_order_relaxed);
+    ret.n_errors = n_errors.load(std::memory_order_relaxed);
+    return ret;
+  }
+
+  TCPCollector::TCPCollector(unsigned int n_workers)
+    : listen_fd(-1),
+      stop_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      port(0),
+      resync_policy(MessageStreamParser::stop_on_error) {
+    if (n_workers == 0)
+      n_workers = 1;
+    for (unsigned int k = 0; k < n_workers; k++)
+      workers.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+
+  TCPCollector::~TCPCollector() {
+    close_sockets();
+    if (stop_fd >= 0)
+      (void) close(stop_fd);
+  }
+
+  void TCPCollector::close_sockets() {
+    if (listen_fd >= 0) {
+      (void) close(listen_fd);
+      listen_fd = -1;
+    }
+    port = 0;
+  }
+
+  std::shared_ptr<ErrorContext>
+  TCPCollector::bind(const struct sockaddr* sa, size_t sa_len) {
+    close_sockets();
+
+    listen_fd = socket(sa->sa_family,
+                       SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int on = 1;
+    if (listen_fd < 0
+        || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on,
+                      sizeof(on)) < 0
+        || ::bind(listen_fd, sa, sa_len) < 0
+        || listen(listen_fd, SOMAXCONN) < 0) {
+      int e = errno;
+      close_sockets();
+      libfc_RETURN_ERROR(fatal, system_error, "Can't listen on TCP socket",
+                         e, 0, 0, 0, 0);
+    }
+
+    struct sockaddr_storage bound;
+    socklen_t bound_len = sizeof(bound);
+    if (getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&bound),
+                    &bound_len) < 0) {
+      int e = errno;
+      close_sockets();
+      libfc_RETURN_ERROR(fatal, system_error, "Can't get bound address",
+                         e, 0, 0, 0, 0);
+    }
+
+    if (bound.ss_family == AF_INET)
+      port = ntohs(reinterpret_cast<struct sockaddr_in*>(&bound)->sin_port);
+    else if (bound.ss_family == AF_INET6)
+      port = ntohs(reinterpret_cast<struct sockaddr_in6*>(&bound)->sin6_port);
+
+    libfc_RETURN_OK();
+  }
+
+  uint16_t TCPCollector::get_port() const {
+    return port;
+  }
+
+  void TCPCollector::set_resync_policy(
+      MessageStreamParser::ResyncPolicy policy) {
+    resync_policy = policy;
+  }
+
+  std::shared_ptr<ErrorContext> TCPCollector::run() {
+    if (listen_fd < 0)
+      libfc_RETURN_ERROR(fatal, inconsistent_state,
+                         "run() called before bind()", 0, 0, 0, 0, 0);
+    if (stop_fd < 0)
+      libfc_RETURN_ERROR(fatal, system_error, "Can't create stop event",
+                         0, 0, 0, 0, 0);
+
+    for (unsigned int k = 0; k < workers.size(); k++) {
+      PlacementCollector* c = make_collector(k);
+      c->set_resync_policy(resync_policy);
+      std::shared_ptr<ErrorContext> err
+        = workers[k]->start(c, listen_fd, stop_fd);
+      if (err != 0)
+        return err;
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& w : workers)
+      threads.push_back(std::thread(&Worker::run, w.get()));
+
+    for (auto& t : threads)
+      t.join();
+
+    /* Ready for the next run(). */
+    uint64_t value;
+    (void) ::read(stop_fd, &value, sizeof(value));
+
+    libfc_RETURN_OK();
+  }
+
+  void TCPCollector::stop() {
+    uint64_t one = 1;
+    if (stop_fd >= 0)
+      (void) write(stop_fd, &one, sizeof(one));
+  }
+
+  unsigned int TCPCollector::get_n_workers() const {
+    return workers.size();
+  }
+
+  PlacementCollector* TCPCollector::get_collector(unsigned int worker) const {
+    return workers[worker]->collector.get();
+  }
+
+  TCPCollector::Stats
+  TCPCollector::get_worker_stats(unsigned int worker) const {
+    return workers[worker]->get_stats();
+  }
+
+  std::shared_ptr<ErrorContext>
+  TCPCollector::get_worker_error(unsigned int worker) const {
+    return workers[worker]->get_last_error();
+  }
+
+  TCPCollector::Stats TCPCollector::get_stats() const {
+    Stats ret = { 0, 0, 0, 0, 0 };
+    for (auto& w : workers) {
+      Stats s = w->get_stats();
+      ret.n_accepted += s.n_accepted;
+      ret.n_open += s.n_open;
+      ret.n_messages += s.n_messages;
+      ret.n_bytes += s.n_bytes;
+      ret.n_errors += s.n_errors;
+    }
+    return ret;
+  }
+
+} // namespace libfc
@@ -0,0 +1,204 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_TCPCOLLECTOR_H_
+#  define _libfc_TCPCOLLECTOR_H_
+
+#  include <cstdint>
+#  include <memory>
+#  include <vector>
+
+#  include <sys/socket.h>
+
+#  include "ErrorContext.h"
+#  include "PlacementCollector.h"
+
+namespace libfc {
+
+  /** Collects IPFIX from many TCP exporters with a few threads.
+   *
+   * Listens on one socket and drives all accepted connections from a
+   * small pool of workers, each with its own epoll(7) instance.
+   * Workers accept connections themselves, so a connection stays
+   * with the worker that accepted it.  Sockets are non-blocking; a
+   * worker reads whatever has arrived on a connection, keeps an
+   * incomplete message until the rest of it arrives, and hands
+   * complete messages to its PlacementCollector.
+   *
+   * There is one PlacementCollector per worker, made by the virtual
+   * make_collector() factory, and it is shared by all connections of
+   * that worker.  Templates are nevertheless kept per connection,
+   * because each connection is a separate exporter (see
+   * InputSource::get_exporter_id()); they are dropped when the
+   * connection closes.  Callbacks on different workers run
+   * concurrently, callbacks on one worker never do.
+   *
+   * A connection whose messages fail to parse is closed; the other
+   * connections are not affected.  The error is counted, and the last
+   * one is kept; see get_worker_error().
+   *
+   * @code
+   * class MyCollector : public TCPCollector {
+   * protected:
+   *   PlacementCollector* make_collector(unsigned int worker) {
+   *     return new MyPlacementCollector();
+   *   }
+   * };
+   *
+   * MyCollector c(4);
+   * std::shared_ptr<ErrorContext> err = c.bind(sa, sa_len);
+   * if (err == 0)
+   *   err = c.run();   // until c.stop() is called
+   * @endcode
+   */
+  class TCPCollector {
+  public:
+    /** Per-worker counters; see get_stats(). */
+    struct Stats {
+      /** Connections accepted. */
+      uint64_t n_accepted;
+
+      /** Connections currently open. */
+      uint64_t n_open;
+
+      /** Complete messages handed to the collector. */
+      uint64_t n_messages;
+
+      /** Bytes received. */
+      uint64_t n_bytes;
+
+      /** Connections closed because of a parse or read error. */
+      uint64_t n_errors;
+    };
+
+    /** Creates a collector.
+     *
+     * @param n_workers the number of worker threads, at least 1
+     */
+    TCPCollector(unsigned int n_workers);
+
+    virtual ~TCPCollector();
+
+    /** Opens, binds and listens on the listening socket.
+     *
+     * If the port in @a sa is 0, the kernel picks one; see
+     * get_port().
+     *
+     * @param sa the address to listen on
+     * @param sa_len the length of the address, in bytes
+     *
+     * @return an error context, or null if no error occurred
+     */
+    std::shared_ptr<ErrorContext> bind(const struct sockaddr* sa,
+                                       size_t sa_len);
+
+    /** Returns the port we listen on, in host byte order, or 0 if
+     * bind() hasn't succeeded. */
+    uint16_t get_port() const;
+
+    /** Sets what the workers' parsers do with malformed messages.
+     * Takes effect with the next run(). */
+    void set_resync_policy(MessageStreamParser::ResyncPolicy policy);
+
+    /** Collects until stop() is called.
+     *
+     * Makes the workers' collectors, starts the workers and waits for
+     * them.  Connections still open when stop() is called are
+     * closed.
+     *
+     * @return an error context if the workers could not be started,
+     *   or null
+     */
+    std::shared_ptr<ErrorContext> run();
+
+    /** Makes run() return.  May be called from any thread, including
+     * from a callback. */
+    void stop();
+
+    /** Returns the number of workers. */
+    unsigned int get_n_workers() const;
+
+    /** Returns worker @a worker's collector, or null before the first
+     * run().  The collectors are kept until the next run() or until
+     * this object is destroyed. */
+    PlacementCollector* get_collector(unsigned int worker) const;
+
+    /** Returns the counters of one worker.
+     *
+     * May be called from any thread while run() is collecting. */
+    Stats get_worker_stats(unsigned int worker) const;
+
+    /** Returns the error that most recently made worker @a worker
+     * close a connection, or null.
+     *
+     * Connections closed because a read failed or the stream ended
+     * in the middle of a message are counted in Stats::n_errors, but
+     * leave no error context.  May be called from any thread while
+     * run() is collecting. */
+    std::shared_ptr<ErrorContext> get_worker_error(unsigned int worker) const;
+
+    /** Returns the counters summed over all workers.
+     *
+     * May be called from any thread while run() is collecting. */
+    Stats get_stats() const;
+
+  protected:
+    /** Makes the collector for one worker.
+     *
+     * Called by run(), on the calling thread, once per worker.  The
+     * collector is owned by this object.
+     *
+     * @param worker the worker number, from 0 to get_n_workers() - 1
+     *
+     * @return a new collector
+     */
+    virtual PlacementCollector* make_collector(unsigned int worker) = 0;
+
+  private:
+    TCPCollector(const TCPCollector&) = delete;
+    TCPCollector& operator=(const TCPCollector&) = delete;
+
+    class Worker;
+
+    void close_sockets();
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    int listen_fd;
+    int stop_fd;
+    uint16_t port;
+    MessageStreamParser::ResyncPolicy resync_policy;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_TCPCOLLECTOR_H_
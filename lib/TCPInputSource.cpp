@@ -24,16 +24,25 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "TCPInputSource.h"
 
 namespace libfc {
 
-  TCPInputSource::TCPInputSource(int fd)
+  TCPInputSource::TCPInputSource(int fd, size_t block_size)
     : fd(fd),
+      reader(fd, block_size),
+      exporter_id(0),
       message_offset(0),
       current_offset(0) {
+    struct sockaddr_storage peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getpeername(fd, reinterpret_cast<struct sockaddr*>(&peer),
+                    &peer_len) == 0)
+      exporter_id = make_exporter_id(
+        reinterpret_cast<struct sockaddr*>(&peer), peer_len);
   }
 
   TCPInputSource::~TCPInputSource() {
@@ -41,14 +50,18 @@ namespace libfc {
   }
 
   ssize_t TCPInputSource::read(uint8_t* buf, uint16_t len) {
-    ssize_t ret = ::read(fd, buf, len);
+    ssize_t ret = reader.read(buf, len);
     if (ret > 0)
-      current_offset += message_offset;
+      current_offset += ret;
     return ret;
   }
 
+  ssize_t TCPInputSource::peek(uint8_t* buf, uint16_t len) {
+    return reader.peek(buf, len);
+  }
+
   bool TCPInputSource::resync() {
-    // TODO
+    /* Nothing to drop; the parser scans forward through read(). */
     return true;
   }
 
@@ -66,7 +79,11 @@ namespace libfc {
   }
 
   bool TCPInputSource::can_peek() const {
-    return false;
+    return true;
+  }
+
+  uint64_t TCPInputSource::get_exporter_id() const {
+    return exporter_id;
   }
 
 } // namespace libfc
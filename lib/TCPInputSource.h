@@ -32,6 +32,7 @@
 #ifndef _libfc_TCPINPUTSOURCE_H_
 #  define _libfc_TCPINPUTSOURCE_H_
 
+#  include "BufferedReader.h"
 #  include "InputSource.h"
 
 namespace libfc {
@@ -39,21 +40,33 @@ namespace libfc {
   class TCPInputSource : public InputSource {
   public:
     /** Creates a TCP input source from a file descriptor.
+     *
+     * Reads are buffered; see BufferedReader.  A read only blocks
+     * until the bytes asked for have arrived, so the block size can
+     * be large without delaying messages.
      *
      * @param fd the file descriptor belonging to a TCP socket
+     * @param block_size how many bytes to read from the socket at most
      */
-    TCPInputSource(int fd);
+    TCPInputSource(int fd,
+                   size_t block_size = BufferedReader::kMinBlockSize);
     ~TCPInputSource();
 
     ssize_t read(uint8_t* buf, uint16_t len);
+    ssize_t peek(uint8_t* buf, uint16_t len);
     bool resync();
     size_t get_message_offset() const;
     void advance_message_offset();
     const char* get_name() const;
     bool can_peek() const;
+    uint64_t get_exporter_id() const;
 
   private:
     int fd;
+    BufferedReader reader;
+
+    /** Identifies the peer; see InputSource::get_exporter_id(). */
+    uint64_t exporter_id;
     size_t message_offset;
     size_t current_offset;
   };
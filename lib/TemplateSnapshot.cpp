@@ -0,0 +1,157 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Constants.h"
+#include "TemplateSnapshot.h"
+#include "decode_util.h"
+
+namespace libfc {
+
+  void TemplateSnapshot::add_message(const uint8_t* message, size_t len) {
+    if (len < kIpfixMessageHeaderLen)
+      return;
+
+    uint32_t observation_domain = decode_uint32(message + 12);
+    const uint8_t* cur = message + kIpfixMessageHeaderLen;
+    const uint8_t* message_end = message + len;
+
+    while (cur + kIpfixSetHeaderLen <= message_end) {
+      uint16_t set_id = decode_uint16(cur + 0);
+      uint16_t set_length = decode_uint16(cur + 2);
+      if (set_length < kIpfixSetHeaderLen || cur + set_length > message_end)
+        return;
+
+      if (set_id == kIpfixTemplateSetID
+          || set_id == kIpfixOptionTemplateSetID)
+        add_template_set(observation_domain, set_id,
+                         cur + kIpfixSetHeaderLen,
+                         set_length - kIpfixSetHeaderLen);
+      cur += set_length;
+    }
+  }
+
+  void TemplateSnapshot::add_template_set(uint32_t observation_domain,
+                                          uint16_t set_id,
+                                          const uint8_t* buf, size_t len) {
+    const size_t header_len = set_id == kIpfixOptionTemplateSetID
+      ? kOptionsTemplateHeaderLen : kTemplateHeaderLen;
+    const uint8_t* cur = buf;
+    const uint8_t* set_end = buf + len;
+
+    while (cur + header_len <= set_end) {
+      const uint8_t* record = cur;
+      uint16_t template_id = decode_uint16(cur + 0);
+      uint16_t field_count = decode_uint16(cur + 2);
+
+      cur += header_len;
+      for (unsigned int field = 0; field < field_count; field++) {
+        if (cur + kFieldSpecifierLen > set_end)
+          return;
+        bool enterprise = decode_uint16(cur) & 0x8000;
+        cur += kFieldSpecifierLen + (enterprise ? kEnterpriseLen : 0);
+        if (cur > set_end)
+          return;
+      }
+
+      /* Like the content handler, ignore withdrawals. */
+      if (field_count == 0)
+        continue;
+
+      Template& t = templates[(static_cast<uint64_t>(observation_domain)
+                               << 32) | template_id];
+      t.set_id = set_id;
+      t.record.assign(record, cur);
+    }
+  }
+
+  void TemplateSnapshot::clear() {
+    templates.clear();
+  }
+
+  size_t TemplateSnapshot::size() const {
+    return templates.size();
+  }
+
+  void TemplateSnapshot::append_messages(uint32_t export_time,
+                                         std::vector<uint8_t>& out) const {
+    /* Offsets of the current message and set in out, if any. */
+    bool in_message = false;
+    bool in_set = false;
+    size_t message_start = 0;
+    size_t set_start = 0;
+    uint32_t domain = 0;
+    uint16_t set_id = 0;
+
+    auto end_set = [&]() {
+      if (in_set)
+        put_uint16(out, set_start + 2, out.size() - set_start);
+      in_set = false;
+    };
+
+    auto end_message = [&]() {
+      end_set();
+      if (in_message)
+        put_uint16(out, message_start + 2, out.size() - message_start);
+      in_message = false;
+    };
+
+    for (auto i = templates.begin(); i != templates.end(); ++i) {
+      uint32_t t_domain = static_cast<uint32_t>(i->first >> 32);
+      const Template& t = i->second;
+
+      if (in_message
+          && (t_domain != domain
+              || out.size() - message_start + kIpfixSetHeaderLen
+                 + t.record.size() > kIpfixMaxMessageLen))
+        end_message();
+      if (in_set && t.set_id != set_id)
+        end_set();
+
+      if (!in_message) {
+        message_start = out.size();
+        append_uint16(out, kIpfixVersion);
+        append_uint16(out, 0);
+        append_uint32(out, export_time);
+        append_uint32(out, 0);
+        append_uint32(out, t_domain);
+        domain = t_domain;
+        in_message = true;
+      }
+
+      if (!in_set) {
+        set_start = out.size();
+        append_uint16(out, t.set_id);
+        append_uint16(out, 0);
+        set_id = t.set_id;
+        in_set = true;
+      }
+
+      out.insert(out.end(), t.record.begin(), t.record.end());
+    }
+
+    end_message();
+  }
+
+} // namespace libfc
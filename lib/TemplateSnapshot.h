@@ -0,0 +1,102 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_TEMPLATESNAPSHOT_H_
+#  define _libfc_TEMPLATESNAPSHOT_H_
+
+#  include <cstdint>
+#  include <map>
+#  include <vector>
+
+namespace libfc {
+
+  /** The templates in effect at some point of an IPFIX message
+   * stream, kept in wire format.
+   *
+   * Feed it the messages of a stream in order, and it tracks the
+   * latest definition of every template and options template, per
+   * observation domain, the way PlacementContentHandler does (that
+   * is, withdrawals are ignored).  Copies are cheap enough to take
+   * one every few megabytes.
+   *
+   * A snapshot can be turned back into IPFIX messages that define
+   * all its templates.  Parsing those messages before parsing the
+   * stream from the snapshot's point onwards puts a parser into the
+   * same template state as parsing the stream from the start.
+   */
+  class TemplateSnapshot {
+  public:
+    /** Records the template sets of one message.
+     *
+     * @param message the message, starting with its header
+     * @param len the length of the message, as given in the header
+     */
+    void add_message(const uint8_t* message, size_t len);
+
+    /** Forgets all templates. */
+    void clear();
+
+    /** Returns the number of templates. */
+    size_t size() const;
+
+    /** Appends IPFIX messages that define all templates.
+     *
+     * There is one message per observation domain, or more if the
+     * templates don't fit into one.
+     *
+     * @param export_time the export time to put into the messages
+     * @param out where to append the messages
+     */
+    void append_messages(uint32_t export_time,
+                         std::vector<uint8_t>& out) const;
+
+  private:
+    void add_template_set(uint32_t observation_domain, uint16_t set_id,
+                          const uint8_t* buf, size_t len);
+
+    struct Template {
+      /** kIpfixTemplateSetID or kIpfixOptionTemplateSetID. */
+      uint16_t set_id;
+
+      /** The template record, starting with the template ID. */
+      std::vector<uint8_t> record;
+    };
+
+    /** Templates by observation domain (high 32 bits) and template
+     * ID (low 16 bits). */
+    std::map<uint64_t, Template> templates;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_TEMPLATESNAPSHOT_H_
@@ -0,0 +1,222 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+#ifndef _libfc_TEMPLATETABLE_H_
+#  define _libfc_TEMPLATETABLE_H_
+
+#  include <cassert>
+#  include <cstddef>
+#  include <cstdint>
+#  include <vector>
+
+namespace libfc {
+
+  /** A hash table from template keys to values.
+   *
+   * A template key combines everything that identifies a template in
+   * a session (observation domain and template ID, see
+   * PlacementContentHandler::make_template_key()) into one 64-bit
+   * integer.  The table uses open addressing with linear probing, so
+   * a lookup is usually a single cache miss, where a std::map would
+   * walk a tree.
+   *
+   * Any other 64-bit key works just as well; InfoModel keys
+   * enterprise-specific IEs by InfoElement::key().
+   *
+   * Pointers to values are invalidated by insertion and erasure.
+   *
+   * @param V the value type, which must be default-constructible and
+   *   copyable
+   */
+  template<typename V>
+  class TemplateTable {
+  public:
+    /** Creates an empty table. */
+    TemplateTable() : n_entries(0), shift(64) {
+    }
+
+    /** Looks up a key.
+     *
+     * @param key the key to look up
+     *
+     * @return the value for this key, or null if the key is not in
+     *   the table
+     */
+    V* find(uint64_t key) {
+      if (n_entries == 0)
+        return 0;
+      for (size_t i = home(key); ; i = next(i)) {
+        if (!slots[i].used)
+          return 0;
+        if (slots[i].key == key)
+          return &slots[i].value;
+      }
+    }
+
+    /** Looks up a key.
+     *
+     * @param key the key to look up
+     *
+     * @return the value for this key, or null if the key is not in
+     *   the table
+     */
+    const V* find(uint64_t key) const {
+      return const_cast<TemplateTable*>(this)->find(key);
+    }
+
+    /** Returns the value for a key, inserting a default value if the
+     * key is not in the table.
+     *
+     * @param key the key to look up
+     *
+     * @return the value for this key
+     */
+    V& operator[](uint64_t key) {
+      /* Keep the load factor at or below 1/2. */
+      if (2*(n_entries + 1) > slots.size())
+        grow();
+
+      size_t i = home(key);
+      for (; slots[i].used; i = next(i)) {
+        if (slots[i].key == key)
+          return slots[i].value;
+      }
+
+      slots[i].used = true;
+      slots[i].key = key;
+      slots[i].value = V();
+      n_entries++;
+      return slots[i].value;
+    }
+
+    /** Removes a key from the table.
+     *
+     * @param key the key to remove
+     *
+     * @return true if the key was in the table, false otherwise
+     */
+    bool erase(uint64_t key) {
+      if (n_entries == 0)
+        return false;
+
+      size_t i = home(key);
+      for (; slots[i].key != key; i = next(i)) {
+        if (!slots[i].used)
+          return false;
+      }
+      if (!slots[i].used)
+        return false;
+
+      /* Move later entries of the same probe sequence into the hole,
+       * so that lookups need no tombstones. */
+      for (size_t j = next(i); slots[j].used; j = next(j)) {
+        size_t h = home(slots[j].key);
+        bool movable = i <= j ? (h <= i || h > j) : (h <= i && h > j);
+        if (movable) {
+          slots[i] = slots[j];
+          i = j;
+        }
+      }
+      slots[i].used = false;
+      slots[i].value = V();
+      n_entries--;
+      return true;
+    }
+
+    /** Returns the number of keys in the table.
+     *
+     * @return the number of keys in the table
+     */
+    size_t size() const {
+      return n_entries;
+    }
+
+    /** Calls a function for every entry in the table, in no
+     * particular order.  The function must not insert or erase.
+     *
+     * @param f function, called as f(key, value)
+     */
+    template<typename F>
+    void for_each(F f) {
+      for (size_t i = 0; i < slots.size(); ++i)
+        if (slots[i].used)
+          f(slots[i].key, slots[i].value);
+    }
+
+  private:
+    struct Slot {
+      Slot() : key(0), used(false), value() {
+      }
+
+      uint64_t key;
+      bool used;
+      V value;
+    };
+
+    /** Fibonacci hashing: the top bits of key times 2^64/phi. */
+    size_t home(uint64_t key) const {
+      return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> shift);
+    }
+
+    size_t next(size_t i) const {
+      return (i + 1) & (slots.size() - 1);
+    }
+
+    void grow() {
+      std::vector<Slot> old;
+      old.swap(slots);
+
+      size_t capacity = old.empty() ? 16 : 2*old.size();
+      slots.resize(capacity);
+      shift = 64;
+      for (size_t c = capacity; c > 1; c >>= 1)
+        shift--;
+      n_entries = 0;
+
+      for (size_t i = 0; i < old.size(); ++i)
+        if (old[i].used)
+          (*this)[old[i].key] = old[i].value;
+    }
+
+    /** The slots; the size is a power of two, or zero. */
+    std::vector<Slot> slots;
+
+    /** Number of used slots. */
+    size_t n_entries;
+
+    /** 64 - log2(slots.size()). */
+    unsigned int shift;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_TEMPLATETABLE_H_
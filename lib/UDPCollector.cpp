@@ -0,0 +1,310 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "UDPCollector.h"
+#include "UDPInputSource.h"
+
+#include "exceptions/FormatError.h"
+
+namespace libfc {
+
+  /** Everything that belongs to one shard. */
+  struct UDPCollector::Shard {
+    Shard()
+      : fd(-1), n_restarts(0), n_earlier_resyncs(0),
+        n_earlier_skipped_bytes(0) {
+    }
+
+    int fd;
+    std::unique_ptr<PlacementCollector> collector;
+    std::unique_ptr<UDPInputSource> is;
+    std::shared_ptr<ErrorContext> result;
+
+    /** Restarts, and what the parser counted before the latest one;
+     * each restart resets the parser's counters. */
+    std::atomic<uint64_t> n_restarts;
+    std::atomic<uint64_t> n_earlier_resyncs;
+    std::atomic<uint64_t> n_earlier_skipped_bytes;
+  };
+
+  UDPCollector::UDPCollector(unsigned int n_shards)
+    : port(0),
+      batch_size(UDPInputSource::kDefaultBatchSize),
+      receive_buffer_size(0),
+      pin_shards(true),
+      resync_policy(MessageStreamParser::stop_on_error),
+      stopping(false) {
+    if (n_shards == 0)
+      n_shards = 1;
+    for (unsigned int k = 0; k < n_shards; k++)
+      shards.push_back(std::unique_ptr<Shard>(new Shard()));
+  }
+
+  UDPCollector::~UDPCollector() {
+    close_sockets();
+  }
+
+  void UDPCollector::close_sockets() {
+    for (auto& s : shards)
+      if (s->fd >= 0) {
+        (void) close(s->fd);
+        s->fd = -1;
+      }
+    port = 0;
+  }
+
+  std::shared_ptr<ErrorContext>
+  UDPCollector::bind(const struct sockaddr* sa, size_t sa_len) {
+    close_sockets();
+
+    struct sockaddr_storage bound;
+    if (sa_len > sizeof(bound))
+      libfc_RETURN_ERROR(fatal, format_error,
+                         "Socket address too long (" << sa_len
+                         << " bytes)", 0, 0, 0, 0, 0);
+    memcpy(&bound, sa, sa_len);
+    socklen_t bound_len = sa_len;
+
+    for (auto& s : shards) {
+      s->fd = socket(sa->sa_family, SOCK_DGRAM, 0);
+      int on = 1;
+      if (s->fd < 0
+          || setsockopt(s->fd, SOL_SOCKET, SO_REUSEPORT, &on,
+                        sizeof(on)) < 0
+          || ::bind(s->fd, reinterpret_cast<struct sockaddr*>(&bound),
+                    bound_len) < 0) {
+        int e = errno;
+        close_sockets();
+        libfc_RETURN_ERROR(fatal, system_error,
+                           "Can't open SO_REUSEPORT socket", e,
+                           0, 0, 0, 0);
+      }
+
+      /* If the kernel picked the port, the other shards need it too. */
+      if (s == shards.front()
+          && getsockname(s->fd, reinterpret_cast<struct sockaddr*>(&bound),
+                         &bound_len) < 0) {
+        int e = errno;
+        close_sockets();
+        libfc_RETURN_ERROR(fatal, system_error,
+                           "Can't get bound address", e, 0, 0, 0, 0);
+      }
+    }
+
+    if (bound.ss_family == AF_INET)
+      port = ntohs(reinterpret_cast<struct sockaddr_in*>(&bound)->sin_port);
+    else if (bound.ss_family == AF_INET6)
+      port = ntohs(reinterpret_cast<struct sockaddr_in6*>(&bound)->sin6_port);
+
+    /* Everything get_stats() and stop() look at exists before run()
+     * starts the shards' threads. */
+    for (unsigned int k = 0; k < shards.size(); k++) {
+      Shard& s = *shards[k];
+      s.is.reset();
+      s.collector.reset(make_collector(k));
+      s.is.reset(new UDPInputSource(s.fd, batch_size));
+      s.result.reset();
+      s.n_restarts = 0;
+      s.n_earlier_resyncs = 0;
+      s.n_earlier_skipped_bytes = 0;
+    }
+    stopping = false;
+
+    libfc_RETURN_OK();
+  }
+
+  uint16_t UDPCollector::get_port() const {
+    return port;
+  }
+
+  void UDPCollector::set_batch_size(unsigned int _batch_size) {
+    batch_size = _batch_size;
+  }
+
+  void UDPCollector::set_receive_buffer_size(int bytes) {
+    receive_buffer_size = bytes;
+  }
+
+  void UDPCollector::set_pin_shards(bool pin) {
+    pin_shards = pin;
+  }
+
+  void UDPCollector::set_resync_policy(
+      MessageStreamParser::ResyncPolicy policy) {
+    resync_policy = policy;
+  }
+
+  /** Pins the calling thread to the n-th CPU it may run on. */
+  static void pin_to_cpu(unsigned int n) {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+      return;
+
+    int n_allowed = CPU_COUNT(&allowed);
+    if (n_allowed <= 1)
+      return;
+
+    int wanted = n % n_allowed;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &allowed) && wanted-- == 0) {
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        (void) pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+        return;
+      }
+#endif /* defined(__linux__) */
+  }
+
+  std::shared_ptr<ErrorContext> UDPCollector::run() {
+    if (port == 0)
+      libfc_RETURN_ERROR(fatal, inconsistent_state,
+                         "run() called before bind()", 0, 0, 0, 0, 0);
+
+    for (auto& s : shards) {
+      s->collector->set_resync_policy(resync_policy);
+      if (receive_buffer_size > 0 && s->fd >= 0)
+        (void) s->is->set_receive_buffer_size(receive_buffer_size);
+      s->result.reset();
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned int k = 0; k < shards.size(); k++)
+      if (shards[k]->fd >= 0)
+        threads.push_back(std::thread([this, k]() {
+              if (pin_shards)
+                pin_to_cpu(k);
+              run_shard(k);
+            }));
+
+    for (auto& t : threads)
+      t.join();
+
+    for (auto& s : shards)
+      if (s->result != 0)
+        return s->result;
+
+    libfc_RETURN_OK();
+  }
+
+  /** Runs one collect(), turning a decode error thrown under
+   * stop_on_error into an error context. */
+  static std::shared_ptr<ErrorContext>
+  collect_once(PlacementCollector& collector, UDPInputSource& is) {
+    try {
+      return collector.collect(is);
+    } catch (FormatError& e) {
+      libfc_RETURN_ERROR(recoverable, format_error, e.what(), 0, &is,
+                         0, 0, 0);
+    }
+  }
+
+  void UDPCollector::run_shard(unsigned int k) {
+    Shard& s = *shards[k];
+
+    while (true) {
+      s.result = collect_once(*s.collector, *s.is);
+      if (stopping.load(std::memory_order_acquire))
+        return;
+
+      if (s.result != 0 && s.result->get_error() == Error::system_error) {
+        /* The socket is no good.  Once it is closed, the kernel
+         * sends its flows to the other shards' sockets. */
+        std::lock_guard<std::mutex> lock(fd_mutex);
+        (void) close(s.fd);
+        s.fd = -1;
+        return;
+      }
+
+      /* The parser gave up on a malformed message.  Nothing else on
+       * this socket is wrong, so go on with the next datagram. */
+      const MessageStreamParser* parser = s.collector->get_parser();
+      s.n_earlier_resyncs += parser->get_n_resyncs();
+      s.n_earlier_skipped_bytes += parser->get_n_skipped_bytes();
+      s.n_restarts++;
+      s.is->resync();
+    }
+  }
+
+  void UDPCollector::stop() {
+    stopping.store(true, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(fd_mutex);
+    for (auto& s : shards)
+      if (s->fd >= 0)
+        s->is->shutdown();
+  }
+
+  unsigned int UDPCollector::get_n_shards() const {
+    return shards.size();
+  }
+
+  PlacementCollector* UDPCollector::get_collector(unsigned int shard) const {
+    return shards[shard]->collector.get();
+  }
+
+  UDPCollector::Stats
+  UDPCollector::get_shard_stats(unsigned int shard) const {
+    Stats ret = { 0, 0, 0, 0, 0 };
+    const Shard& s = *shards[shard];
+
+    if (s.is != 0) {
+      ret.n_datagrams = s.is->get_n_datagrams();
+      ret.n_kernel_drops = s.is->get_n_kernel_drops();
+    }
+    if (s.collector != 0) {
+      const MessageStreamParser* parser = s.collector->get_parser();
+      ret.n_resyncs = s.n_earlier_resyncs + parser->get_n_resyncs();
+      ret.n_skipped_bytes = s.n_earlier_skipped_bytes
+        + parser->get_n_skipped_bytes();
+    }
+    ret.n_restarts = s.n_restarts;
+    return ret;
+  }
+
+  UDPCollector::Stats UDPCollector::get_stats() const {
+    Stats ret = { 0, 0, 0, 0, 0 };
+    for (unsigned int k = 0; k < shards.size(); k++) {
+      Stats s = get_shard_stats(k);
+      ret.n_datagrams += s.n_datagrams;
+      ret.n_kernel_drops += s.n_kernel_drops;
+      ret.n_resyncs += s.n_resyncs;
+      ret.n_skipped_bytes += s.n_skipped_bytes;
+      ret.n_restarts += s.n_restarts;
+    }
+    return ret;
+  }
+
+} // namespace libfc
@@ -0,0 +1,224 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_UDPCOLLECTOR_H_
+#  define _libfc_UDPCOLLECTOR_H_
+
+#  include <atomic>
+#  include <cstdint>
+#  include <memory>
+#  include <mutex>
+#  include <vector>
+
+#  include <sys/socket.h>
+
+#  include "ErrorContext.h"
+#  include "PlacementCollector.h"
+
+namespace libfc {
+
+  class UDPInputSource;
+
+  /** Collects IPFIX over UDP on several cores.
+   *
+   * Opens one SO_REUSEPORT socket per shard, all bound to the same
+   * address, and runs each shard in its own thread, optionally pinned
+   * to a core.  The kernel distributes datagrams among the sockets by
+   * a hash over the flow's addresses and ports, so every exporter
+   * stays on one shard.  Each shard therefore has its own
+   * PlacementCollector, with its own parser, content handler and
+   * templates, and shards share no state at all.
+   *
+   * Subclasses say what a shard's collector looks like:
+   *
+   * @code
+   * class MyCollector : public UDPCollector {
+   * protected:
+   *   PlacementCollector* make_collector(unsigned int shard) {
+   *     return new MyPlacementCollector();
+   *   }
+   * };
+   *
+   * MyCollector c(4);
+   * std::shared_ptr<ErrorContext> err = c.bind(sa, sa_len);
+   * if (err == 0)
+   *   err = c.run();   // until c.stop() is called
+   * @endcode
+   *
+   * Callbacks on different shards run concurrently.
+   */
+  class UDPCollector {
+  public:
+    /** Per-shard counters; see get_stats(). */
+    struct Stats {
+      /** Datagrams received. */
+      uint64_t n_datagrams;
+
+      /** Datagrams the kernel dropped because a receive buffer was
+       * full. */
+      uint64_t n_kernel_drops;
+
+      /** Times the parser resynchronised after a malformed message. */
+      uint64_t n_resyncs;
+
+      /** Bytes skipped while resynchronising. */
+      uint64_t n_skipped_bytes;
+
+      /** Times a shard's parser stopped on an error and was started
+       * again. */
+      uint64_t n_restarts;
+    };
+
+    /** Creates a collector.
+     *
+     * @param n_shards the number of sockets and threads, at least 1
+     */
+    UDPCollector(unsigned int n_shards);
+
+    virtual ~UDPCollector();
+
+    /** Opens and binds the sockets, and makes the shards'
+     * collectors.
+     *
+     * If the port in @a sa is 0, the kernel picks one; see
+     * get_port().
+     *
+     * @param sa the address to bind to
+     * @param sa_len the length of the address, in bytes
+     *
+     * @return an error context, or null if no error occurred
+     */
+    std::shared_ptr<ErrorContext> bind(const struct sockaddr* sa,
+                                       size_t sa_len);
+
+    /** Returns the port the sockets are bound to, in host byte order,
+     * or 0 if bind() hasn't succeeded. */
+    uint16_t get_port() const;
+
+    /** Sets the number of datagrams to receive per system call.
+     * Takes effect with the next bind(). */
+    void set_batch_size(unsigned int batch_size);
+
+    /** Sets each socket's receive buffer size; see
+     * UDPInputSource::set_receive_buffer_size().  Takes effect with
+     * the next run().  0, the default, keeps the system's default. */
+    void set_receive_buffer_size(int bytes);
+
+    /** Sets whether to pin shard k to the k-th core this process may
+     * run on (modulo the number of such cores).  On by default. */
+    void set_pin_shards(bool pin);
+
+    /** Sets what the shards' parsers do with malformed messages.
+     * Takes effect with the next run(). */
+    void set_resync_policy(MessageStreamParser::ResyncPolicy policy);
+
+    /** Collects until stop() is called.
+     *
+     * Starts one thread per shard and waits for all of them.  A shard
+     * whose parser stops on an error (see set_resync_policy()) starts
+     * parsing again; see Stats::n_restarts.  A shard whose socket
+     * fails closes it, so that the kernel hands its exporters to the
+     * other shards, and stops; the others go on.
+     *
+     * @return the error of the first shard whose socket failed, or
+     *   null if all shards ended normally
+     */
+    std::shared_ptr<ErrorContext> run();
+
+    /** Makes run() return.  May be called from any thread, including
+     * from a callback.  The sockets are shut down, so call bind()
+     * again before the next run(). */
+    void stop();
+
+    /** Returns the number of shards. */
+    unsigned int get_n_shards() const;
+
+    /** Returns shard @a shard's collector, or null before the first
+     * bind().  The collectors are kept until the next bind() or until
+     * this object is destroyed, so that results can be merged after
+     * run() returns. */
+    PlacementCollector* get_collector(unsigned int shard) const;
+
+    /** Returns the counters of one shard.
+     *
+     * May be called from any thread while run() is collecting, for
+     * example from a callback or a monitoring thread. */
+    Stats get_shard_stats(unsigned int shard) const;
+
+    /** Returns the counters summed over all shards.
+     *
+     * May be called from any thread while run() is collecting, for
+     * example from a callback or a monitoring thread. */
+    Stats get_stats() const;
+
+  protected:
+    /** Makes the collector for one shard.
+     *
+     * Called by bind(), on the calling thread, once per shard.  The
+     * collector is owned by this object.
+     *
+     * @param shard the shard number, from 0 to get_n_shards() - 1
+     *
+     * @return a new collector
+     */
+    virtual PlacementCollector* make_collector(unsigned int shard) = 0;
+
+  private:
+    UDPCollector(const UDPCollector&) = delete;
+    UDPCollector& operator=(const UDPCollector&) = delete;
+
+    struct Shard;
+
+    void close_sockets();
+
+    /** Runs shard @a k until stop() is called or its socket fails. */
+    void run_shard(unsigned int k);
+
+    std::vector<std::unique_ptr<Shard> > shards;
+    uint16_t port;
+    unsigned int batch_size;
+    int receive_buffer_size;
+    bool pin_shards;
+    MessageStreamParser::ResyncPolicy resync_policy;
+
+    /** Set by stop(), cleared by bind(). */
+    std::atomic<bool> stopping;
+
+    /** Keeps stop() from shutting down a socket that a failed shard
+     * is closing. */
+    std::mutex fd_mutex;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_UDPCOLLECTOR_H_
@@ -23,26 +23,195 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
 #include <cstring>
 
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
+#include "Constants.h"
 #include "UDPInputSource.h"
 
 namespace libfc {
 
+  const unsigned int UDPInputSource::kDefaultBatchSize;
+
+  /** Room for one datagram, or for several coalesced ones. */
+  static const size_t kDatagramBufferLen = kMaxMessageLen + 1;
+
+  /** Room for the SO_RXQ_OVFL and UDP_GRO control messages. */
+  static const size_t kControlLen = CMSG_SPACE(sizeof(uint32_t))
+    + CMSG_SPACE(sizeof(int));
+
+  UDPInputSource::UDPInputSource(int fd, unsigned int batch_size)
+    : fd(fd),
+      filter(false),
+      accepted_exporter_id(0),
+      batch_size(std::max(batch_size, 1U)) {
+    init();
+  }
+
   UDPInputSource::UDPInputSource(const struct sockaddr* _sa, size_t _sa_len,
                                  int _fd) 
-    : sa_len(_sa_len), fd(_fd) {
-    memcpy(&sa, _sa, _sa_len);
+    : fd(_fd),
+      filter(true),
+      accepted_exporter_id(make_exporter_id(_sa, _sa_len)),
+      batch_size(kDefaultBatchSize) {
+    init();
+  }
+
+  void UDPInputSource::init() {
+    buffers.resize(batch_size * kDatagramBufferLen);
+    controls.resize(batch_size * kControlLen);
+    addresses.resize(batch_size);
+    iovecs.resize(batch_size);
+    headers.resize(batch_size);
+
+    for (unsigned int k = 0; k < batch_size; k++) {
+      iovecs[k].iov_base = &buffers[k * kDatagramBufferLen];
+      iovecs[k].iov_len = kDatagramBufferLen;
+    }
+
+    n_received = 0;
+    next_received = 0;
+    gro_next = 0;
+    gro_left = 0;
+    gro_size = 0;
+    datagram = 0;
+    datagram_len = 0;
+    pos = 0;
+    exporter_id = filter ? accepted_exporter_id : 0;
+    n_datagrams = 0;
+    n_kernel_drops = 0;
+    stopping = false;
+
+#if defined(SO_RXQ_OVFL)
+    int on = 1;
+    (void) setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+#endif /* defined(SO_RXQ_OVFL) */
+  }
+
+  void UDPInputSource::count_datagram() {
+    n_datagrams.store(n_datagrams.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+  }
+
+  int UDPInputSource::next_datagram() {
+    while (true) {
+      if (gro_left > 0) {
+        datagram = gro_next;
+        datagram_len = std::min(gro_left, gro_size);
+        gro_next += datagram_len;
+        gro_left -= datagram_len;
+        pos = 0;
+        count_datagram();
+        return 1;
+      }
+
+      if (next_received == n_received) {
+        for (unsigned int k = 0; k < batch_size; k++) {
+          struct msghdr& h = headers[k].msg_hdr;
+          h.msg_name = &addresses[k];
+          h.msg_namelen = sizeof(addresses[k]);
+          h.msg_iov = &iovecs[k];
+          h.msg_iovlen = 1;
+          h.msg_control = &controls[k * kControlLen];
+          h.msg_controllen = kControlLen;
+          h.msg_flags = 0;
+        }
+
+        int ret;
+        do
+          ret = recvmmsg(fd, &headers[0], batch_size, MSG_WAITFORONE, 0);
+        while (ret < 0 && errno == EINTR
+               && !stopping.load(std::memory_order_acquire));
+
+        if (stopping.load(std::memory_order_acquire))
+          return 0;
+        else if (ret < 0)
+          return -1;
+        else if (ret == 0)
+          return 0;
+
+        n_received = ret;
+        next_received = 0;
+      }
+
+      unsigned int k = next_received++;
+      const struct msghdr& h = headers[k].msg_hdr;
+      size_t len = headers[k].msg_len;
+
+      gro_size = 0;
+      for (struct cmsghdr* c = CMSG_FIRSTHDR(&h); c != 0;
+           c = CMSG_NXTHDR(const_cast<struct msghdr*>(&h), c)) {
+#if defined(SO_RXQ_OVFL)
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+          uint32_t drops;
+          memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+          n_kernel_drops.store(drops, std::memory_order_relaxed);
+        }
+#endif /* defined(SO_RXQ_OVFL) */
+#if defined(UDP_GRO)
+        if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+          int size;
+          memcpy(&size, CMSG_DATA(c), sizeof(size));
+          gro_size = size;
+        }
+#endif /* defined(UDP_GRO) */
+      }
+
+      /* An empty datagram holds no message. */
+      if (len == 0)
+        continue;
+
+      uint64_t sender = make_exporter_id(
+        reinterpret_cast<const struct sockaddr*>(&addresses[k]),
+        h.msg_namelen);
+      if (filter && sender != accepted_exporter_id)
+        continue;
+      exporter_id = sender;
+
+      const uint8_t* buf = static_cast<const uint8_t*>(iovecs[k].iov_base);
+      if (gro_size > 0 && len > gro_size) {
+        gro_next = buf;
+        gro_left = len;
+        continue;
+      }
+
+      datagram = buf;
+      datagram_len = len;
+      pos = 0;
+      count_datagram();
+      return 1;
+    }
   }
 
   ssize_t UDPInputSource::read(uint8_t* buf, uint16_t len) {
-    // TODO
-    return 0;
+    ssize_t ret = peek(buf, len);
+    if (ret > 0)
+      pos += ret;
+    return ret;
+  }
+
+  ssize_t UDPInputSource::peek(uint8_t* buf, uint16_t len) {
+    if (pos == datagram_len) {
+      int ret = next_datagram();
+      if (ret <= 0)
+        return ret;
+    }
+
+    size_t n = std::min(datagram_len - pos, static_cast<size_t>(len));
+    memcpy(buf, datagram + pos, n);
+    return n;
   }
 
   bool UDPInputSource::resync() {
+    /* The next message starts with the next datagram. */
+    pos = datagram_len;
     return true;
   }
 
@@ -51,6 +220,8 @@ namespace libfc {
   }
 
   void UDPInputSource::advance_message_offset() {
+    /* Whatever the message didn't use of the datagram is padding. */
+    pos = datagram_len;
   }
 
   const char* UDPInputSource::get_name() const {
@@ -58,8 +229,45 @@ namespace libfc {
   }
 
   bool UDPInputSource::can_peek() const {
+    return true;
+  }
+
+  uint64_t UDPInputSource::get_exporter_id() const {
+    return exporter_id;
+  }
+
+  bool UDPInputSource::set_receive_buffer_size(int bytes) {
+#if defined(SO_RCVBUFFORCE)
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes,
+                   sizeof(bytes)) == 0)
+      return true;
+#endif /* defined(SO_RCVBUFFORCE) */
+    return setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) == 0;
+  }
+
+  bool UDPInputSource::enable_gro() {
+#if defined(UDP_GRO)
+    int on = 1;
+    return setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+#else /* !defined(UDP_GRO) */
+    errno = ENOPROTOOPT;
     return false;
+#endif /* defined(UDP_GRO) */
   }
 
+  uint64_t UDPInputSource::get_n_datagrams() const {
+    return n_datagrams.load(std::memory_order_relaxed);
+  }
+
+  uint32_t UDPInputSource::get_n_kernel_drops() const {
+    return n_kernel_drops.load(std::memory_order_relaxed);
+  }
+
+  void UDPInputSource::shutdown() {
+    stopping.store(true, std::memory_order_release);
+    /* On an unconnected UDP socket, shutdown() fails with ENOTCONN,
+     * but wakes up recvmmsg() anyway. */
+    (void) ::shutdown(fd, SHUT_RD);
+  }
 
 } // namespace libfc
@@ -33,13 +33,44 @@
 #ifndef _libfc_UDPINPUTSOURCE_H_
 #  define _libfc_UDPINPUTSOURCE_H_
 
+#  include <atomic>
+#  include <vector>
+
+#  include <sys/socket.h>
+
 #  include "InputSource.h"
 
 namespace libfc {
 
+  /** An input source reading IPFIX messages from a UDP socket.
+   *
+   * Every datagram holds one message.  A read returns bytes of one
+   * datagram only; when it is used up, or when the parser has
+   * finished a message (see advance_message_offset()), the next read
+   * starts the next datagram.  Datagrams are received in batches
+   * with recvmmsg(2), so that a busy collector makes one system call
+   * for many messages.
+   *
+   * Empty datagrams are dropped like any other datagram that holds
+   * no message.  The stream ends only when another thread calls
+   * shutdown().
+   */
   class UDPInputSource : public InputSource {
   public:
-    /** Creates a UDP input source from a file descriptor.
+    /** The default number of datagrams received per system call. */
+    static const unsigned int kDefaultBatchSize = 32;
+
+    /** Creates a UDP input source from a file descriptor, accepting
+     * messages from any exporter.
+     *
+     * @param fd the file descriptor belonging to a bound UDP socket
+     * @param batch_size the largest number of datagrams received at
+     *   once
+     */
+    UDPInputSource(int fd, unsigned int batch_size = kDefaultBatchSize);
+
+    /** Creates a UDP input source from a file descriptor, accepting
+     * messages from one exporter only.
      *
      * @param sa the socket address of the peer from whom we accept messages
      * @param sa_len the length of the socket address, in bytes
@@ -48,16 +79,113 @@ namespace libfc {
     UDPInputSource(const struct sockaddr* sa, size_t sa_len, int fd);
 
     ssize_t read(uint8_t* buf, uint16_t len);
+    ssize_t peek(uint8_t* buf, uint16_t len);
     bool resync();
     size_t get_message_offset() const;
     void advance_message_offset();
     const char* get_name() const;
     bool can_peek() const;
 
+    /** Returns an identifier for the sender of the current datagram.
+     *
+     * @return an identifier for the sender of the current datagram
+     */
+    uint64_t get_exporter_id() const;
+
+    /** Sets the size of the socket's receive buffer.
+     *
+     * A larger buffer rides out bursts that arrive while the parser
+     * is busy.  Tries SO_RCVBUFFORCE first, which needs
+     * CAP_NET_ADMIN but ignores net.core.rmem_max, and then
+     * SO_RCVBUF.
+     *
+     * @param bytes the requested buffer size
+     *
+     * @return true on success, false (with errno set) on error
+     */
+    bool set_receive_buffer_size(int bytes);
+
+    /** Asks the kernel to coalesce datagrams of a flow (UDP GRO).
+     *
+     * Coalesced datagrams are split up again before parsing, so this
+     * only saves work in the kernel and in recvmmsg().  Needs Linux
+     * 5.0 or later.
+     *
+     * @return true on success, false (with errno set) on error
+     */
+    bool enable_gro();
+
+    /** Returns the number of datagrams received so far.
+     *
+     * This and get_n_kernel_drops() may be called from another thread
+     * while a parser reads from this source. */
+    uint64_t get_n_datagrams() const;
+
+    /** Returns how many datagrams the kernel dropped on this socket
+     * because its receive buffer was full (SO_RXQ_OVFL).
+     *
+     * The count is as of the most recently received datagram. */
+    uint32_t get_n_kernel_drops() const;
+
+    /** Ends the stream.
+     *
+     * May be called from any thread.  Wakes up a reader blocked in
+     * recvmmsg(2) by shutting the socket down for reading.  The
+     * reader finishes the batch it has and then reports the end of
+     * the stream.
+     */
+    void shutdown();
+
   private:
-    struct sockaddr sa;
-    size_t sa_len;
+    void init();
+
+    /** Moves to the next datagram, receiving a batch if necessary.
+     *
+     * @return 1 on success, 0 at the end of the stream, -1 on error
+     */
+    int next_datagram();
+
+    void count_datagram();
+
     int fd;
+
+    /** Whether to accept only datagrams from accepted_exporter_id. */
+    bool filter;
+    uint64_t accepted_exporter_id;
+
+    /** Batch receive state; one entry per datagram in a batch. */
+    unsigned int batch_size;
+    std::vector<uint8_t> buffers;
+    std::vector<uint8_t> controls;
+    std::vector<struct sockaddr_storage> addresses;
+    std::vector<struct iovec> iovecs;
+    std::vector<struct mmsghdr> headers;
+
+    /** Number of datagrams in the last batch, and the next one to
+     * parse. */
+    unsigned int n_received;
+    unsigned int next_received;
+
+    /** What's left of a coalesced datagram, and the size of the
+     * datagrams in it. */
+    const uint8_t* gro_next;
+    size_t gro_left;
+    size_t gro_size;
+
+    /** The current datagram, and the position in it. */
+    const uint8_t* datagram;
+    size_t datagram_len;
+    size_t pos;
+
+    /** Identifies the sender of the current datagram. */
+    uint64_t exporter_id;
+
+    /** Only the reading thread writes these. */
+    std::atomic<uint64_t> n_datagrams;
+    std::atomic<uint32_t> n_kernel_drops;
+
+    /** Set by shutdown(). */
+    std::atomic<bool> stopping;
   };
 
 } // namespace libfc
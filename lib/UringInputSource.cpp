@@ -0,0 +1,517 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(_libfc_HAVE_IO_URING_)
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+#endif /* defined(_libfc_HAVE_IO_URING_) */
+
+#include "UringInputSource.h"
+
+namespace libfc {
+
+#if defined(_libfc_HAVE_IO_URING_)
+
+  /** An io_uring, set up and driven through raw system calls.
+   *
+   * Only one thread uses a ring, so the only ordering needed is
+   * between us and the kernel: acquire when reading the kernel's
+   * completion tail, release when publishing our submission tail
+   * and completion head.
+   */
+  class UringInputSource::Ring {
+  public:
+    /** Sets up a ring.
+     *
+     * @param entries the number of reads that may be in flight
+     *
+     * @return the ring, or 0 if the kernel has no io_uring
+     */
+    static Ring* create(unsigned int entries) {
+      struct io_uring_params p;
+      memset(&p, 0, sizeof(p));
+
+      int ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+      if (ring_fd < 0)
+        return 0;
+
+      Ring* r = new Ring(ring_fd, entries);
+      if (!r->map(p)) {
+        delete r;
+        return 0;
+      }
+      return r;
+    }
+
+    ~Ring() {
+      if (sqes != MAP_FAILED)
+        (void) munmap(sqes, sqes_len);
+      if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+        (void) munmap(cq_ptr, cq_len);
+      if (sq_ptr != MAP_FAILED)
+        (void) munmap(sq_ptr, sq_len);
+      (void) close(ring_fd);
+    }
+
+    /** Queues and submits a read.
+     *
+     * @param tag identifies the read in its completion; must be less
+     *   than the number of entries, and only one read per tag may be
+     *   in flight
+     *
+     * @return true if the read was submitted, false (with errno set)
+     *   if not
+     */
+    bool submit_read(int fd, void* buf, size_t len, uint64_t offset,
+                     uint64_t tag) {
+      assert(tag < iovecs.size());
+
+      unsigned int tail = *sq_tail;
+      unsigned int index = tail & *sq_mask;
+      struct io_uring_sqe* sqe = &sqes[index];
+
+      iovecs[tag].iov_base = buf;
+      iovecs[tag].iov_len = len;
+
+      /* READV rather than READ, which only arrived in 5.6. */
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = fd;
+      sqe->off = offset;
+      sqe->addr = reinterpret_cast<uint64_t>(&iovecs[tag]);
+      sqe->len = 1;
+      sqe->user_data = tag;
+
+      sq_array[index] = index;
+      __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+      /* The kernel consumes nothing from a failed submission, so take
+       * the entry back rather than have the next one submit it. */
+      int ret = enter(1, 0, 0);
+      if (ret < 1) {
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        if (ret == 0)
+          errno = EAGAIN;
+        return false;
+      }
+      return true;
+    }
+
+    /** Waits until at least one read has completed.
+     *
+     * @return true on success, false (with errno set) on error
+     */
+    bool wait() {
+      return enter(0, 1, IORING_ENTER_GETEVENTS) >= 0;
+    }
+
+    /** Calls f(tag, result) for every completed read, where result is
+     * what read(2) would have returned, or minus the errno. */
+    template<typename F>
+    void for_each_completion(F f) {
+      unsigned int head = *cq_head;
+      unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+      for (; head != tail; head++) {
+        const struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        f(cqe->user_data, cqe->res);
+      }
+
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+  private:
+    Ring(int ring_fd, unsigned int entries)
+      : ring_fd(ring_fd),
+        sq_ptr(MAP_FAILED), sq_len(0),
+        cq_ptr(MAP_FAILED), cq_len(0),
+        sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqes_len(0),
+        iovecs(entries) {
+    }
+
+    bool map(const struct io_uring_params& p) {
+      sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+      cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+      if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_len = cq_len = std::max(sq_len, cq_len);
+
+      sq_ptr = mmap(0, sq_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+      if (sq_ptr == MAP_FAILED)
+        return false;
+
+      if (p.features & IORING_FEAT_SINGLE_MMAP)
+        cq_ptr = sq_ptr;
+      else {
+        cq_ptr = mmap(0, cq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd,
+                      IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED)
+          return false;
+      }
+
+      sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+      sqes = static_cast<struct io_uring_sqe*>(
+        mmap(0, sqes_len, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+      if (sqes == MAP_FAILED)
+        return false;
+
+      uint8_t* sq = static_cast<uint8_t*>(sq_ptr);
+      sq_tail = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+      sq_mask = reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+      sq_array = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+
+      uint8_t* cq = static_cast<uint8_t*>(cq_ptr);
+      cq_head = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+      cq_tail = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+      cq_mask = reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+      cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+      return true;
+    }
+
+    int enter(unsigned int to_submit, unsigned int min_complete,
+              unsigned int flags) {
+      int ret;
+      do
+        ret = syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                      min_complete, flags, 0, 0);
+      while (ret < 0 && errno == EINTR);
+      return ret;
+    }
+
+    int ring_fd;
+
+    void* sq_ptr;
+    size_t sq_len;
+    void* cq_ptr;
+    size_t cq_len;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /** The iovec of each tag's read, which must stay put until the
+     * read completes. */
+    std::vector<struct iovec> iovecs;
+  };
+
+#else /* !defined(_libfc_HAVE_IO_URING_) */
+
+  /** No io_uring; every UringInputSource falls back to buffered
+   * reads. */
+  class UringInputSource::Ring {
+  public:
+    static Ring* create(unsigned int entries) {
+      return 0;
+    }
+
+    bool submit_read(int fd, void* buf, size_t len, uint64_t offset,
+                     uint64_t tag) {
+      errno = ENOSYS;
+      return false;
+    }
+
+    bool wait() {
+      errno = ENOSYS;
+      return false;
+    }
+
+    template<typename F>
+    void for_each_completion(F f) {
+    }
+  };
+
+#endif /* defined(_libfc_HAVE_IO_URING_) */
+
+  const unsigned int UringInputSource::kDefaultQueueDepth;
+
+  /** Alignment of buffers, offsets and lengths for O_DIRECT. */
+  static const size_t kDirectAlignment = 4096;
+
+  static size_t round_block_size(size_t block_size) {
+    block_size = std::max(block_size, BufferedReader::kMinBlockSize);
+    return (block_size + kDirectAlignment - 1)
+      / kDirectAlignment * kDirectAlignment;
+  }
+
+  UringInputSource::UringInputSource(int fd, std::string file_name,
+                                     unsigned int queue_depth,
+                                     size_t block_size, bool direct)
+    : fd(fd),
+      reader(fd, block_size),
+      ring(0),
+      block_size(round_block_size(block_size)),
+      direct(false),
+      current_block(0),
+      pos(0),
+      at_eof(false),
+      message_offset(0),
+      current_offset(0),
+      file_name(file_name),
+      name(0) {
+    queue_depth = std::max(queue_depth, 2U);
+
+    ring = Ring::create(queue_depth);
+    if (ring == 0) {
+      reader.advise_sequential();
+      return;
+    }
+
+    blocks.resize(queue_depth);
+    for (size_t slot = 0; slot < blocks.size(); slot++) {
+      void* p = 0;
+      if (posix_memalign(&p, kDirectAlignment, this->block_size) != 0) {
+        for (size_t k = 0; k < slot; k++)
+          free(blocks[k].data);
+        blocks.clear();
+        delete ring;
+        ring = 0;
+        reader.advise_sequential();
+        return;
+      }
+      blocks[slot].data = static_cast<uint8_t*>(p);
+    }
+
+    /* Reads carry their own offsets, so start where the descriptor
+     * is, like a plain read(2) would. */
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0)
+      start = 0;
+
+    if (direct && start % kDirectAlignment == 0) {
+      int flags = fcntl(fd, F_GETFL);
+      this->direct = flags >= 0 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+    }
+
+    for (size_t slot = 0; slot < blocks.size(); slot++) {
+      blocks[slot].offset = start + slot * this->block_size;
+      blocks[slot].filled = 0;
+      blocks[slot].in_flight = false;
+      blocks[slot].complete = false;
+      blocks[slot].error = 0;
+      submit(slot);
+    }
+  }
+
+  UringInputSource::~UringInputSource() {
+    if (ring != 0) {
+      /* The kernel may still be writing into the buffers. */
+      bool drained = true;
+      while (drained
+             && std::any_of(blocks.begin(), blocks.end(),
+                            [](const Block& b) { return b.in_flight; })) {
+        drained = ring->wait();
+        ring->for_each_completion([this](uint64_t tag, int res) {
+            blocks[tag].in_flight = false;
+          });
+      }
+
+      /* If the ring failed, leaking the buffers is all we can do. */
+      if (drained)
+        for (size_t slot = 0; slot < blocks.size(); slot++)
+          free(blocks[slot].data);
+      delete ring;
+    }
+
+    (void) close(fd); // FIXME: Error handling?
+    delete[] const_cast<char*>(name);
+  }
+
+  void UringInputSource::submit(size_t slot) {
+    Block& b = blocks[slot];
+
+    b.in_flight = ring->submit_read(fd, b.data + b.filled,
+                                    block_size - b.filled,
+                                    b.offset + b.filled, slot);
+    if (!b.in_flight) {
+      b.error = errno;
+      b.complete = true;
+    }
+  }
+
+  void UringInputSource::recycle(size_t block_no) {
+    Block& b = blocks[block_no % blocks.size()];
+
+    assert(b.complete && !b.in_flight);
+    b.offset += blocks.size() * block_size;
+    b.filled = 0;
+    b.complete = at_eof;
+    b.error = 0;
+    if (!at_eof)
+      submit(block_no % blocks.size());
+  }
+
+  void UringInputSource::reap() {
+    ring->for_each_completion([this](uint64_t tag, int res) {
+        Block& b = blocks[tag];
+
+        b.in_flight = false;
+        if (res == -EINTR || res == -EAGAIN)
+          submit(tag);
+        else if (res < 0) {
+          b.error = -res;
+          b.complete = true;
+        } else if (res == 0) {
+          at_eof = true;
+          b.complete = true;
+        } else {
+          b.filled += res;
+          if (b.filled == block_size)
+            b.complete = true;
+          else if (direct) {
+            /* Direct reads are only short at the end of the file, and
+             * the rest couldn't be read at an unaligned offset anyway. */
+            at_eof = true;
+            b.complete = true;
+          } else
+            submit(tag);
+        }
+      });
+  }
+
+  bool UringInputSource::wait_for(size_t slot) {
+    while (!blocks[slot].complete) {
+      if (!ring->wait())
+        return false;
+      reap();
+    }
+
+    if (blocks[slot].error != 0) {
+      errno = blocks[slot].error;
+      return false;
+    }
+    return true;
+  }
+
+  ssize_t UringInputSource::copy_out(uint8_t* buf, uint16_t len,
+                                     bool consume) {
+    size_t block_no = current_block;
+    size_t p = pos;
+    size_t done = 0;
+
+    while (done < len) {
+      size_t slot = block_no % blocks.size();
+      if (!wait_for(slot))
+        return -1;
+
+      const Block& b = blocks[slot];
+      if (p == b.filled) {
+        if (b.filled < block_size)
+          break; // End of file.
+
+        block_no++;
+        p = 0;
+
+        /* Since len is less than block_size, we never reach a block
+         * that hasn't been read yet. */
+        assert(block_no < current_block + blocks.size());
+        continue;
+      }
+
+      size_t n = std::min(b.filled - p, len - done);
+      memcpy(buf + done, b.data + p, n);
+      p += n;
+      done += n;
+    }
+
+    /* Only now that nothing can fail are the blocks we read through
+     * given back, so that an error leaves the data where it was. */
+    if (consume) {
+      for (; current_block < block_no; current_block++)
+        recycle(current_block);
+      pos = p;
+    }
+    return done;
+  }
+
+  ssize_t UringInputSource::read(uint8_t* buf, uint16_t len) {
+    ssize_t ret = ring != 0 ? copy_out(buf, len, true)
+                            : reader.read(buf, len);
+    if (ret > 0)
+      current_offset += ret;
+    return ret;
+  }
+
+  ssize_t UringInputSource::peek(uint8_t* buf, uint16_t len) {
+    return ring != 0 ? copy_out(buf, len, false) : reader.peek(buf, len);
+  }
+
+  bool UringInputSource::resync() {
+    /* Nothing to drop; the parser scans forward through read(). */
+    return true;
+  }
+
+  size_t UringInputSource::get_message_offset() const {
+    return message_offset;
+  }
+
+  void UringInputSource::advance_message_offset() {
+    message_offset += current_offset;
+    current_offset = 0;
+  }
+
+  const char* UringInputSource::get_name() const {
+    if (name == 0) {
+      std::ostringstream sstr;
+
+      sstr << "Uring(name=\"" << file_name << "\")";
+      std::string s = sstr.str();
+
+      name = new char[s.length() + 1];
+      std::strcpy(const_cast<char*>(name), s.c_str());
+    }
+    
+    return name;
+  }
+
+  bool UringInputSource::can_peek() const {
+    return true;
+  }
+
+  bool UringInputSource::is_uring() const {
+    return ring != 0;
+  }
+
+} // namespace libfc
@@ -0,0 +1,144 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_URINGINPUTSOURCE_H_
+#  define _libfc_URINGINPUTSOURCE_H_
+
+#  include <string>
+#  include <vector>
+
+#  include "BufferedReader.h"
+#  include "InputSource.h"
+
+namespace libfc {
+
+  /** An input source that reads a file through io_uring.
+   *
+   * A blocking read(2) keeps only one request in flight, which
+   * leaves fast storage idle while the parser works.  This input
+   * source keeps a number of large reads queued in an io_uring and
+   * parses from whichever block has arrived.  It talks to the kernel
+   * through raw system calls, so it needs no liburing.
+   *
+   * If the kernel (or a seccomp filter) does not provide io_uring,
+   * or libfc was built without _libfc_HAVE_IO_URING_, the file is
+   * read through a BufferedReader instead, as by FileInputSource.
+   */
+  class UringInputSource : public InputSource {
+  public:
+    /** The default number of reads kept in flight. */
+    static const unsigned int kDefaultQueueDepth = 4;
+
+    /** Creates an io_uring input source from a file descriptor.
+     *
+     * @param fd the file descriptor belonging to an IPFIX data file;
+     *   it is read from its current offset and closed when the input
+     *   source is destroyed
+     * @param name the name you want this file to be known to diagnostics
+     * @param queue_depth how many reads to keep in flight; at least 2
+     * @param block_size how many bytes to read at once; rounded up to
+     *   a multiple of 4096 and at least BufferedReader::kMinBlockSize
+     * @param direct whether to bypass the page cache with O_DIRECT,
+     *   so that scanning an archive doesn't evict more useful pages;
+     *   ignored where the file system doesn't support it
+     */
+    UringInputSource(int fd, std::string file_name,
+                     unsigned int queue_depth = kDefaultQueueDepth,
+                     size_t block_size = BufferedReader::kDefaultBlockSize,
+                     bool direct = false);
+    ~UringInputSource();
+
+    ssize_t read(uint8_t* buf, uint16_t len);
+    ssize_t peek(uint8_t* buf, uint16_t len);
+    bool resync();
+    size_t get_message_offset() const;
+    void advance_message_offset();
+    const char* get_name() const;
+    bool can_peek() const;
+
+    /** Returns whether reads go through io_uring.
+     *
+     * @return true if reads go through io_uring, false if they go
+     *   through a BufferedReader instead
+     */
+    bool is_uring() const;
+
+  private:
+    /** The submission and completion queues; see UringInputSource.cpp. */
+    class Ring;
+
+    /** One read buffer. Block number k lives in blocks[k % depth]. */
+    struct Block {
+      uint8_t* data;
+
+      /** The file offset of the block. */
+      uint64_t offset;
+      size_t filled;
+      bool in_flight;
+      bool complete;
+
+      /** The errno of a failed read, or 0. */
+      int error;
+    };
+
+    void submit(size_t slot);
+    void recycle(size_t block_no);
+    bool wait_for(size_t slot);
+    void reap();
+    ssize_t copy_out(uint8_t* buf, uint16_t len, bool consume);
+
+    int fd;
+    BufferedReader reader;
+    Ring* ring;
+
+    size_t block_size;
+    bool direct;
+    std::vector<Block> blocks;
+
+    /** The number of the block being parsed, and the position in it. */
+    size_t current_block;
+    size_t pos;
+
+    /** Set once a read came up short; later blocks are past the end
+     * of the file. */
+    bool at_eof;
+
+    size_t message_offset;
+    size_t current_offset;
+    std::string file_name;
+    mutable const char* name;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_URINGINPUTSOURCE_H_
@@ -31,19 +31,17 @@
 #include "Constants.h"
 #include "V9MessageStreamParser.h"
 
-#if defined(_libfc_HAVE_LOG4CPLUS_)
-#  include <log4cplus/logger.h>
-#  include <log4cplus/loggingmacros.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+#include "logging.h"
 
 #include "decode_util.h"
 
+#include "exceptions/FormatError.h"
+
 namespace libfc {
 
   V9MessageStreamParser::V9MessageStreamParser() 
-    : offset(0)
+    : offset(0),
+      message_len(0)
 #if defined(_libfc_HAVE_LOG4CPLUS_)
                ,
     logger(log4cplus::Logger::getInstance(LOG4CPLUS_TEXT("V9MessageStreamParser")))
@@ -69,10 +67,9 @@ namespace libfc {
      * it's needed for the expansion of libfc_RETURN_CALLBACK_ERROR. */
     uint16_t message_size = 0;
 
-    libfc_RETURN_CALLBACK_ERROR(start_session());
+    start_parse();
 
-    /* Take care when changing message from an array to a pointer. */
-    memset(message, '\0', sizeof(message));
+    libfc_RETURN_CALLBACK_ERROR(start_session());
 
     /* Member `offset' initialised here as well as in the constructor
      * so that you know it's not forgotten. */
@@ -81,203 +78,41 @@ namespace libfc {
     /** The number of bytes available after the latest read operation,
      * or -1 if a read error occurred. */
     errno = 0;
-    ssize_t nbytes = is.read(message, kV9MessageHeaderLen);
+    ssize_t nbytes = read_input(is, message, kV9MessageHeaderLen);
 
     while (nbytes > 0) {
-      uint8_t* cur = message;
-
-      if (static_cast<size_t>(nbytes) < kV9MessageHeaderLen) {
-        libfc_RETURN_ERROR(recoverable, short_header, 
-                           "Wanted " 
-                           << kV9MessageHeaderLen
-                           << " bytes for V9 message header, got only "
-                           << nbytes,
-                           0, &is, message, nbytes, 0);
-      }
-      assert(static_cast<size_t>(nbytes) == kV9MessageHeaderLen);
-
-      uint16_t version = decode_uint16(cur +  0);
-      if (version != kV9Version)
-        libfc_RETURN_ERROR(recoverable, message_version_number, 
-                           "Expected message version " 
-                           << libfc_HEX(4) << kV9Version 
-                           << ", got " << libfc_HEX(4) << version,
-                           0, &is, message, nbytes, 0);
-
-      /* Via Brian and demux_statdat.c: the v9 format does not have
-       * the message size (in bytes) in the header, but rather the
-       * number of records.  Since records are in sets and since we
-       * can only see the set headers but not count the records
-       * without actually going through them one by one, this record
-       * count is totally useless.
-       *
-       * So, in order JUST to get the message size, we need to iterate
-       * over the message, set by set, stopping only when we see the
-       * next message header, or EOF.  Don't you like v9 already?
-       *
-       * TODO: Optimisation idea: we COULD save the offsets to
-       * the sets in order to save us the offset computation the
-       * second time around.  Should deframing turn out to be a
-       * performance problem, we should try that.
-       */
-      message_size = kV9MessageHeaderLen;
-      
-      /* Take care when changing message from an array to a pointer. */
-      assert(cur + kV9SetHeaderLen <= message + sizeof(message));
-      cur = message + message_size;
-
-      errno = 0;
-      nbytes = is.peek(cur, kV9SetHeaderLen);
-
-      unsigned int set_no = 1;
-      uint16_t current_set_id = 0;
-
-      while (nbytes > 0 && static_cast<size_t>(nbytes) == kV9SetHeaderLen) {
-        current_set_id = decode_uint16(cur + 0);
-        if (current_set_id == kV9Version)
-          break;
-        else if (current_set_id == kV5Version)
-          libfc_RETURN_ERROR(recoverable, message_version_number, 
-                             "Wanted " << kV9Version
-                             << " as version number, but got " << kV5Version,
-                             0, &is, message, nbytes, 0);
-
-        /* Please leave this assert in. It *ought* to be always true,
-         * and in thie case, the compiler should be able to optimize
-         * it away. */
-        assert(kV9SetLenOffset + sizeof(uint16_t) <= kV9SetHeaderLen);
-        uint16_t set_length = decode_uint16(cur + kV9SetLenOffset);
-
-        /* Take care when changing message from an array to a pointer. */
-        if (cur + set_length > message + sizeof(message))
-          libfc_RETURN_ERROR(recoverable, long_set, 
-                             "While scanning V9 message, set size " 
-                             << set_length << " exceeds message space",
-                             0, &is, message, cur - message,
-                             message_size);
-          
-        /* Take care when changing message from an array to a pointer. */
-        assert(cur + set_length <= message + sizeof(message));
-        errno = 0;
-        ssize_t read_bytes = is.read(cur, set_length);
-        
-        if (read_bytes != set_length)
-          libfc_RETURN_ERROR(recoverable, short_body, 
-                             "While scanning V9 message, wanted " 
-                             << set_length << " bytes for set, got " 
-                             << read_bytes,
-                             errno, &is, message, cur - message,
-                             message_size);
-
-        assert(read_bytes == set_length);
-        message_size += set_length;
-        cur = message + message_size;
-
-        /* Take care when changing message from an array to a pointer. */
-        assert(cur + kV9SetHeaderLen <= message + sizeof(message));
-        errno = 0;
-        nbytes = is.peek(cur, kV9SetHeaderLen);
-
-        set_no++;
+      size_t message_start = offset;
+
+      framing_error = false;
+      in_message = false;
+      message_len = nbytes;
+
+      std::shared_ptr<ErrorContext> err;
+      try {
+        err = parse_message(is, nbytes);
+      } catch (FormatError& e) {
+        /* Records that don't fit their set are reported by
+         * exception.  Callers that stop on errors get it as before. */
+        if (resync_policy != resync_on_error)
+          throw;
+        err.reset(new ErrorContext(ErrorContext::recoverable,
+                                   Error(Error::format_error), 0, e.what(),
+                                   &is, message,
+                                   static_cast<uint16_t>(message_len), 0));
       }
 
-      if (nbytes < 0) 
-        libfc_RETURN_ERROR(fatal, system_error, "read error", errno,
-                           &is, message, 0, 0);
-
-      /* Basetime computation as per email from Brian:
-       *
-       * (2) The header in general is different, crucially containing
-       * information from which a basetime (router start time) can be
-       * derived, since the timestamps in the message are all relative
-       * to the basetime. The uncorrected basetime in epoch
-       * milliseconds is given by:
-       *
-       *   uint64_t basetime_ms = (uint64_t)ntohl(hdr->export_s) * 1000 
-       *     - ntohl(hdr->sysuptime_ms);
-       */
-      libfc_RETURN_CALLBACK_ERROR(
-        start_message(version,
-                      message_size,
-                      decode_uint32(message +  8),
-                      decode_uint32(message + 12),
-                      decode_uint32(message + 16),
-                      static_cast<uint64_t>(decode_uint32(message + 8))*1000 
-                        - static_cast<uint64_t>(decode_uint32(message + 4))));
-
-      /* This assert should be true since message_size is a uint16_t
-       * and message is a static buffer of size 65535. But beware if
-       * you change message to a pointer. */
-      assert(message_size <= sizeof(message));
-      const uint8_t* message_end = message + message_size;
-
-      /* Now the message is read. Start over again, this time decoding sets. */
-      offset = kV9MessageHeaderLen;
-      cur = message + kV9MessageHeaderLen;
-      assert (cur <= message_end);
-      
-      /* Decode sets.
-       *
-       * If you don't like the pointer comparisons using <=, please
-       * read the corresponding comment in IPFIXMessageStreamParser.cpp.
-       */
-      set_no = 1;
-      while (cur + kV9SetHeaderLen <= message_end) {
-        /* Decode set header. */
-        uint16_t set_id = decode_uint16(cur + 0);
-        uint16_t set_length = decode_uint16(cur + 2);
-        const uint8_t* set_end = cur + set_length;
-        
-        if (set_end > message_end)
-          libfc_RETURN_ERROR(recoverable, long_set, 
-                             "Long set: set_len=" << set_length 
-                             << ",set_end=" << static_cast<const void*>(set_end) 
-                             << ",message_len=" << message_size
-                             << ",message_end=" << static_cast<const void*>(message_end),
-                             0, &is, message, message_size, offset);
-
-        cur += kV9SetHeaderLen;
-
-        if (set_id == kV9TemplateSetID) {
-          libfc_RETURN_CALLBACK_ERROR(
-            start_template_set(
-              set_id, set_length - kV9SetHeaderLen, cur));
-          cur += set_length - kV9SetHeaderLen;
-          libfc_RETURN_CALLBACK_ERROR(end_template_set());
-        } else if (set_id == kV9OptionTemplateSetID) {
-          libfc_RETURN_CALLBACK_ERROR(
-            start_options_template_set(
-              set_id, set_length - kV9SetHeaderLen, cur));
-          cur += set_length - kV9SetHeaderLen;
-          libfc_RETURN_CALLBACK_ERROR(
-            end_options_template_set());
-        } else if (set_id >= kV9MinDataSetId) {
-          libfc_RETURN_CALLBACK_ERROR(
-            start_data_set(
-              set_id, set_length - kV9SetHeaderLen, cur));
-          cur += set_length - kV9SetHeaderLen;
-          libfc_RETURN_CALLBACK_ERROR(end_data_set());
-        } else
-          libfc_RETURN_ERROR(recoverable, format_error,
-                             "Set has ID " << set_id << ", which is not "
-                             "a V9 template, options template or data set ID",
-                             0, &is, message, message_size, offset);
-
-        assert(cur == set_end);
-        assert(cur <= message_end);
-
-        set_no++;
+      if (err != 0) {
+        uint64_t skipped_before = get_n_skipped_bytes();
+        if (!recover(is, message, message_len, err))
+          return err;
+        offset = message_start + (framing_error
+                                  ? get_n_skipped_bytes() - skipped_before
+                                  : message_len);
       }
 
-      LOG4CPLUS_TRACE(logger, "Got " << (set_no - 1) << " sets");
-
-      libfc_RETURN_CALLBACK_ERROR(end_message());
-
-      offset += nbytes;
       is.advance_message_offset();
-      memset(message, '\0', sizeof(message));
       errno = 0;
-      nbytes = is.read(message, kV9MessageHeaderLen);
+      nbytes = read_input(is, message, kV9MessageHeaderLen);
     }
 
     if (nbytes < 0) {
@@ -294,11 +129,264 @@ namespace libfc {
      * end_session() gives an error, message_size bytes may be copied
      * from a (now non-existent) message. */
     message_size = 0;
-    memset(message, '\0', sizeof(message));
 
     libfc_RETURN_CALLBACK_ERROR(end_session());
 
     libfc_RETURN_OK();
   }
 
+  std::shared_ptr<ErrorContext>
+  V9MessageStreamParser::parse_message(InputSource& is, ssize_t nbytes) {
+    uint16_t message_size = 0;
+
+    uint8_t* cur = message;
+
+    if (static_cast<size_t>(nbytes) < kV9MessageHeaderLen) {
+      framing_error = true;
+      libfc_RETURN_ERROR(recoverable, short_header, 
+                         "Wanted " 
+                         << kV9MessageHeaderLen
+                         << " bytes for V9 message header, got only "
+                         << nbytes,
+                         0, &is, message, nbytes, 0);
+    }
+    assert(static_cast<size_t>(nbytes) == kV9MessageHeaderLen);
+
+    uint16_t version = decode_uint16(cur +  0);
+    if (version != kV9Version) {
+      framing_error = true;
+      libfc_RETURN_ERROR(recoverable, message_version_number, 
+                         "Expected message version " 
+                         << libfc_HEX(4) << kV9Version 
+                         << ", got " << libfc_HEX(4) << version,
+                         0, &is, message, nbytes, 0);
+    }
+
+    /* Via Brian and demux_statdat.c: the v9 format does not have
+     * the message size (in bytes) in the header, but rather the
+     * number of records.  Since records are in sets and since we
+     * can only see the set headers but not count the records
+     * without actually going through them one by one, this record
+     * count is totally useless.
+     *
+     * So, in order JUST to get the message size, we need to iterate
+     * over the message, set by set, stopping only when we see the
+     * next message header, or EOF.  Don't you like v9 already?
+     *
+     * TODO: Optimisation idea: we COULD save the offsets to
+     * the sets in order to save us the offset computation the
+     * second time around.  Should deframing turn out to be a
+     * performance problem, we should try that.
+     */
+    message_size = kV9MessageHeaderLen;
+    
+    /* Take care when changing message from an array to a pointer. */
+    assert(cur + kV9SetHeaderLen <= message + sizeof(message));
+    cur = message + message_size;
+
+    errno = 0;
+    nbytes = peek_input(is, cur, kV9SetHeaderLen);
+
+    unsigned int set_no = 1;
+    uint16_t current_set_id = 0;
+
+    while (nbytes > 0 && static_cast<size_t>(nbytes) == kV9SetHeaderLen) {
+      current_set_id = decode_uint16(cur + 0);
+      if (current_set_id == kV9Version)
+        break;
+      else if (current_set_id == kV5Version) {
+        framing_error = true;
+        libfc_RETURN_ERROR(recoverable, message_version_number, 
+                           "Wanted " << kV9Version
+                           << " as version number, but got " << kV5Version,
+                           0, &is, message, nbytes, 0);
+      }
+
+      /* Please leave this assert in. It *ought* to be always true,
+       * and in thie case, the compiler should be able to optimize
+       * it away. */
+      assert(kV9SetLenOffset + sizeof(uint16_t) <= kV9SetHeaderLen);
+      uint16_t set_length = decode_uint16(cur + kV9SetLenOffset);
+
+      if (set_length < kV9SetHeaderLen) {
+        framing_error = true;
+        libfc_RETURN_ERROR(recoverable, format_error,
+                           "While scanning V9 message, set size "
+                           << set_length << " is shorter than the "
+                           "set header",
+                           0, &is, message, cur - message,
+                           message_size);
+      }
+
+      /* Take care when changing message from an array to a pointer. */
+      if (cur + set_length > message + sizeof(message)) {
+        framing_error = true;
+        libfc_RETURN_ERROR(recoverable, long_set, 
+                           "While scanning V9 message, set size " 
+                           << set_length << " exceeds message space",
+                           0, &is, message, cur - message,
+                           message_size);
+      }
+        
+      /* Take care when changing message from an array to a pointer. */
+      assert(cur + set_length <= message + sizeof(message));
+      errno = 0;
+      ssize_t read_bytes = read_input(is, cur, set_length);
+      
+      if (read_bytes > 0)
+        message_len += read_bytes;
+
+      if (read_bytes != set_length) {
+        framing_error = true;
+        libfc_RETURN_ERROR(recoverable, short_body, 
+                           "While scanning V9 message, wanted " 
+                           << set_length << " bytes for set, got " 
+                           << read_bytes,
+                           errno, &is, message, cur - message,
+                           message_size);
+      }
+
+      assert(read_bytes == set_length);
+      message_size += set_length;
+      cur = message + message_size;
+
+      /* Take care when changing message from an array to a pointer. */
+      assert(cur + kV9SetHeaderLen <= message + sizeof(message));
+      errno = 0;
+      nbytes = peek_input(is, cur, kV9SetHeaderLen);
+
+      set_no++;
+    }
+
+    if (nbytes < 0) 
+      libfc_RETURN_ERROR(fatal, system_error, "read error", errno,
+                         &is, message, 0, 0);
+
+    /* Basetime computation as per email from Brian:
+     *
+     * (2) The header in general is different, crucially containing
+     * information from which a basetime (router start time) can be
+     * derived, since the timestamps in the message are all relative
+     * to the basetime. The uncorrected basetime in epoch
+     * milliseconds is given by:
+     *
+     *   uint64_t basetime_ms = (uint64_t)ntohl(hdr->export_s) * 1000 
+     *     - ntohl(hdr->sysuptime_ms);
+     */
+    libfc_RETURN_CALLBACK_ERROR(set_exporter(is.get_exporter_id()));
+    libfc_RETURN_CALLBACK_ERROR(
+      start_message(version,
+                    message_size,
+                    decode_uint32(message +  8),
+                    decode_uint32(message + 12),
+                    decode_uint32(message + 16),
+                    static_cast<uint64_t>(decode_uint32(message + 8))*1000 
+                      - static_cast<uint64_t>(decode_uint32(message + 4))));
+    in_message = true;
+
+    /* This assert should be true since message_size is a uint16_t
+     * and message is a static buffer of size 65535. But beware if
+     * you change message to a pointer. */
+    assert(message_size <= sizeof(message));
+    const uint8_t* message_end = message + message_size;
+
+    /* Now the message is read. Start over again, this time decoding sets. */
+    offset = kV9MessageHeaderLen;
+    cur = message + kV9MessageHeaderLen;
+    assert (cur <= message_end);
+    
+    /* Decode sets.
+     *
+     * If you don't like the pointer comparisons using <=, please
+     * read the corresponding comment in IPFIXMessageStreamParser.cpp.
+     */
+    set_no = 1;
+    while (cur + kV9SetHeaderLen <= message_end) {
+      /* Decode set header. */
+      uint16_t set_id = decode_uint16(cur + 0);
+      uint16_t set_length = decode_uint16(cur + 2);
+      const uint8_t* set_end = cur + set_length;
+      
+      if (set_end > message_end) {
+        framing_error = true;
+        libfc_RETURN_ERROR(recoverable, long_set, 
+                           "Long set: set_len=" << set_length 
+                           << ",set_end=" << static_cast<const void*>(set_end) 
+                           << ",message_len=" << message_size
+                           << ",message_end=" << static_cast<const void*>(message_end),
+                           0, &is, message, message_size, offset);
+      }
+
+      cur += kV9SetHeaderLen;
+
+      if (set_id == kV9TemplateSetID) {
+        libfc_RETURN_CALLBACK_ERROR(
+          start_template_set(
+            set_id, set_length - kV9SetHeaderLen, cur));
+        cur += set_length - kV9SetHeaderLen;
+        libfc_RETURN_CALLBACK_ERROR(end_template_set());
+      } else if (set_id == kV9OptionTemplateSetID) {
+        libfc_RETURN_CALLBACK_ERROR(
+          start_options_template_set(
+            set_id, set_length - kV9SetHeaderLen, cur));
+        cur += set_length - kV9SetHeaderLen;
+        libfc_RETURN_CALLBACK_ERROR(
+          end_options_template_set());
+      } else if (set_id >= kV9MinDataSetId) {
+        libfc_RETURN_CALLBACK_ERROR(
+          start_data_set(
+            set_id, set_length - kV9SetHeaderLen, cur));
+        cur += set_length - kV9SetHeaderLen;
+        libfc_RETURN_CALLBACK_ERROR(end_data_set());
+      } else {
+        framing_error = true;
+        libfc_RETURN_ERROR(recoverable, format_error,
+                           "Set has ID " << set_id << ", which is not "
+                           "a V9 template, options template or data set ID",
+                           0, &is, message, message_size, offset);
+      }
+
+      assert(cur == set_end);
+      assert(cur <= message_end);
+
+      set_no++;
+    }
+
+    LOG4CPLUS_TRACE(logger, "Got " << (set_no - 1) << " sets");
+
+    in_message = false;
+    libfc_RETURN_CALLBACK_ERROR(end_message());
+
+    offset += nbytes;
+    libfc_RETURN_OK();
+  }
+
+  MessageStreamParser::Plausibility
+  V9MessageStreamParser::check_message_start(const uint8_t* buf,
+                                             size_t len,
+                                             size_t* needed) const {
+    /* V9 headers carry no message length, so all that can be checked
+     * is the version and the header of the first set. */
+    if (len < kV9MessageHeaderLen + kV9SetHeaderLen) {
+      *needed = kV9MessageHeaderLen + kV9SetHeaderLen;
+      return need_more;
+    }
+
+    if (decode_uint16(buf + 0) != kV9Version)
+      return implausible;
+
+    uint16_t set_id = decode_uint16(buf + kV9MessageHeaderLen);
+    uint16_t set_length = decode_uint16(buf + kV9MessageHeaderLen
+                                        + kV9SetLenOffset);
+
+    if (set_id != kV9TemplateSetID
+        && set_id != kV9OptionTemplateSetID
+        && set_id < kV9MinDataSetId)
+      return implausible;
+    if (set_length < kV9SetHeaderLen)
+      return implausible;
+
+    return plausible;
+  }
+
 } // namespace libfc
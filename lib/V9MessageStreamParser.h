@@ -47,7 +47,21 @@ namespace libfc {
     V9MessageStreamParser();
     std::shared_ptr<ErrorContext> parse(InputSource& is);
 
+  protected:
+    Plausibility check_message_start(const uint8_t* buf, size_t len,
+                                     size_t* needed) const;
+
   private:
+    /** Parses one message whose header has just been read.
+     *
+     * @param is the input source
+     * @param nbytes the number of header bytes read
+     *
+     * @return an ErrorContext, describing the error, or 0 if there
+     *   was no error.
+     */
+    std::shared_ptr<ErrorContext> parse_message(InputSource& is,
+                                                ssize_t nbytes);
     /** The current message. */
     uint8_t message[kMaxMessageLen];
 
@@ -55,6 +69,9 @@ namespace libfc {
      * reporting, and for error reporting @em{only}. */
     size_t offset;
 
+    /** The number of bytes of the current message read so far. */
+    size_t message_len;
+
 #  if defined(_libfc_HAVE_LOG4CPLUS_)
     log4cplus::Logger logger;
 #  endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
@@ -66,7 +66,7 @@ namespace libfc {
   }
 
   bool WandioInputSource::resync() {
-    // TODO
+    /* Nothing to drop; the parser scans forward through read(). */
     return true;
   }
 
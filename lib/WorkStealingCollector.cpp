@@ -0,0 +1,679 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <thread>
+
+#include "Constants.h"
+#include "RingBuffer.h"
+#include "WorkStealingCollector.h"
+#include "decode_util.h"
+
+#include "exceptions/FormatError.h"
+
+#define WS_REPORT_CALLBACK_ERROR(call)                                  \
+    do {                                                                \
+      /* Make sure call is evaluated only once */                       \
+      std::shared_ptr<ErrorContext> err = call;                         \
+      if (err != 0)                                                     \
+        return err;                                                     \
+    } while (0)
+
+namespace libfc {
+
+  /** reclaim() doesn't run for fewer definitions than this. */
+  static const size_t kMinReclaim = 64;
+
+  /** One definition of a template; never changed once published. */
+  struct WorkStealingCollector::Template {
+    /** Which template this defines; see n_slots. */
+    size_t slot;
+
+    /** Tells definitions of the same template apart; never 0. */
+    uint64_t serial;
+
+    uint64_t exporter_id;
+    uint32_t observation_domain;
+
+    /** kIpfixTemplateSetID or kIpfixOptionTemplateSetID. */
+    uint16_t set_id;
+
+    /** The template record, as on the wire. */
+    std::vector<uint8_t> record;
+
+    /** Tasks that point to this definition. */
+    mutable std::atomic<unsigned int> n_refs;
+
+    /** Whether a newer definition has replaced this one, or its
+     * exporter has been dropped.  Only the reader uses this. */
+    mutable bool replaced;
+  };
+
+  /** Copies of data sets; goes back to the pool when the last of its
+   * data sets is decoded. */
+  struct WorkStealingCollector::Chunk {
+    std::vector<uint8_t> bytes;
+
+    /** Tasks that point into this chunk, plus one while the reader
+     * fills it. */
+    std::atomic<unsigned int> n_refs;
+  };
+
+  /** A data set to decode. */
+  struct WorkStealingCollector::Task {
+    /** The definition of the data set's template, or null if there
+     * was none when the data set was read. */
+    const Template* tmpl;
+
+    Chunk* chunk;
+    const uint8_t* buf;
+
+    uint64_t exporter_id;
+
+    /** Tasks are numbered in stream order. */
+    uint64_t index;
+
+    uint32_t export_time;
+    uint32_t sequence_number;
+    uint32_t observation_domain;
+    uint16_t id;
+    uint16_t length;
+  };
+
+  /** The state of one collect() call.
+   *
+   * This is also the content handler of the reader's parser: it
+   * publishes template definitions and turns data sets into tasks.
+   */
+  class WorkStealingCollector::Pool : public ContentHandler {
+  public:
+    Pool(WorkStealingCollector& owner, unsigned int n_workers,
+         InputSource& is);
+
+    std::shared_ptr<ErrorContext> start_session();
+    std::shared_ptr<ErrorContext> end_session();
+    std::shared_ptr<ErrorContext> set_exporter(uint64_t exporter_id);
+    std::shared_ptr<ErrorContext> start_message(uint16_t version,
+                                                uint16_t length,
+                                                uint32_t export_time,
+                                                uint32_t sequence_number,
+                                                uint32_t observation_domain,
+                                                uint64_t base_time);
+    std::shared_ptr<ErrorContext> end_message();
+    std::shared_ptr<ErrorContext> start_template_set(uint16_t set_id,
+                                                     uint16_t set_length,
+                                                     const uint8_t* buf);
+    std::shared_ptr<ErrorContext> end_template_set();
+    std::shared_ptr<ErrorContext> start_options_template_set(
+        uint16_t set_id, uint16_t set_length, const uint8_t* buf);
+    std::shared_ptr<ErrorContext> end_options_template_set();
+    std::shared_ptr<ErrorContext> start_data_set(uint16_t id,
+                                                 uint16_t length,
+                                                 const uint8_t* buf);
+    std::shared_ptr<ErrorContext> end_data_set();
+
+    /** Takes a task, from worker @a worker's queue if possible, or
+     * else from another worker's. */
+    bool take(unsigned int worker, Task& task);
+
+    /** Gives back a decoded task's share of its chunk. */
+    void release(Chunk* chunk);
+
+    /** Tells the workers that there will be no more tasks. */
+    void finish();
+
+    /** The first error of each worker, with the index of its task. */
+    struct Result {
+      uint64_t index;
+      std::shared_ptr<ErrorContext> error;
+    };
+
+    std::vector<Result> results;
+    InputSource& is;
+    Waiter workers_waiter;
+    std::atomic<bool> failed;
+    std::atomic<bool> done;
+
+  private:
+    /** Size of a chunk; holds at least a few of the largest data
+     * sets. */
+    static const size_t kChunkSize = 256 * 1024;
+
+    /** Takes a chunk from the pool, waiting for one if necessary. */
+    Chunk* take_chunk();
+
+    void submit(const Task& task);
+
+    WorkStealingCollector& owner;
+    std::vector<std::unique_ptr<SpmcRing<Task> > > queues;
+    std::vector<std::unique_ptr<Chunk> > chunks;
+    MpscRing<Chunk*> free_chunks;
+    Waiter reader_waiter;
+
+    /** The chunk that data sets are copied into. */
+    Chunk* chunk;
+
+    unsigned int next_worker;
+    uint64_t next_index;
+
+    uint64_t exporter_id;
+    TemplateTable<const Template*>* templates;
+    uint32_t export_time;
+    uint32_t sequence_number;
+    uint32_t observation_domain;
+  };
+
+  WorkStealingCollector::Pool::Pool(WorkStealingCollector& owner,
+                                    unsigned int n_workers,
+                                    InputSource& is)
+    : results(n_workers),
+      is(is),
+      failed(false),
+      done(false),
+      owner(owner),
+      free_chunks(2 * n_workers + 2),
+      chunk(0),
+      next_worker(0),
+      next_index(0),
+      exporter_id(0),
+      templates(&owner.current[0]),
+      export_time(0),
+      sequence_number(0),
+      observation_domain(0) {
+    for (unsigned int w = 0; w < n_workers; w++)
+      queues.push_back(std::unique_ptr<SpmcRing<Task> >(
+                         new SpmcRing<Task>(owner.queue_depth)));
+
+    for (unsigned int k = 0; k < 2 * n_workers + 2; k++) {
+      Chunk* c = new Chunk();
+      c->bytes.reserve(kChunkSize);
+      chunks.push_back(std::unique_ptr<Chunk>(c));
+      bool pushed = free_chunks.push(c);
+      assert(pushed);
+      (void) pushed;
+    }
+  }
+
+  WorkStealingCollector::Chunk* WorkStealingCollector::Pool::take_chunk() {
+    Chunk* c = 0;
+    if (!free_chunks.pop(c)) {
+      owner.n_reader_stalls.fetch_add(1, std::memory_order_relaxed);
+      reader_waiter.wait([this, &c]() { return free_chunks.pop(c); });
+    }
+    c->bytes.clear();
+    c->n_refs.store(1, std::memory_order_relaxed);
+    return c;
+  }
+
+  void WorkStealingCollector::Pool::release(Chunk* c) {
+    if (c->n_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      bool pushed = free_chunks.push(c);
+      assert(pushed);
+      (void) pushed;
+      reader_waiter.wake();
+    }
+  }
+
+  bool WorkStealingCollector::Pool::take(unsigned int worker, Task& task) {
+    bool have = queues[worker]->pop(task);
+
+    const unsigned int n_workers = queues.size();
+    for (unsigned int k = 1; !have && k < n_workers; k++)
+      if (queues[(worker + k) % n_workers]->pop(task)) {
+        owner.n_steals.fetch_add(1, std::memory_order_relaxed);
+        have = true;
+      }
+
+    /* The reader may be waiting for room in a queue.  Chunks hold
+     * many tasks, so it can't count on release() to wake it. */
+    if (have)
+      reader_waiter.wake();
+    return have;
+  }
+
+  void WorkStealingCollector::Pool::submit(const Task& task) {
+    owner.n_tasks.fetch_add(1, std::memory_order_relaxed);
+
+    const unsigned int n_workers = queues.size();
+    auto push = [this, n_workers, &task]() {
+      for (unsigned int k = 0; k < n_workers; k++) {
+        unsigned int w = (next_worker + k) % n_workers;
+        if (queues[w]->push(task)) {
+          next_worker = (w + 1) % n_workers;
+          return true;
+        }
+      }
+      return false;
+    };
+
+    if (!push()) {
+      owner.n_reader_stalls.fetch_add(1, std::memory_order_relaxed);
+      reader_waiter.wait(push);
+    }
+    workers_waiter.wake();
+  }
+
+  void WorkStealingCollector::Pool::finish() {
+    if (chunk != 0)
+      release(chunk);
+    chunk = 0;
+
+    done.store(true, std::memory_order_release);
+    workers_waiter.wake_all();
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::Pool::start_session() {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext> WorkStealingCollector::Pool::end_session() {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::Pool::set_exporter(uint64_t exporter_id) {
+    if (exporter_id != this->exporter_id) {
+      this->exporter_id = exporter_id;
+      templates = &owner.current[exporter_id];
+    }
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::Pool::start_message(uint16_t version,
+                                             uint16_t length,
+                                             uint32_t export_time,
+                                             uint32_t sequence_number,
+                                             uint32_t observation_domain,
+                                             uint64_t base_time) {
+    if (failed.load(std::memory_order_relaxed))
+      libfc_RETURN_ERROR(fatal, aborted_by_user,
+                         "A decoder failed", 0, 0, 0, 0, 0);
+
+    this->export_time = export_time;
+    this->sequence_number = sequence_number;
+    this->observation_domain = observation_domain;
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext> WorkStealingCollector::Pool::end_message() {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::Pool::start_template_set(uint16_t set_id,
+                                                  uint16_t set_length,
+                                                  const uint8_t* buf) {
+    const size_t header_len = set_id == kIpfixOptionTemplateSetID
+      ? kOptionsTemplateHeaderLen : kTemplateHeaderLen;
+    const uint8_t* cur = buf;
+    const uint8_t* set_end = buf + set_length;
+
+    /* Malformed records are published anyway; the workers' content
+     * handlers report them. */
+    while (cur + header_len <= set_end) {
+      const uint8_t* record = cur;
+      uint16_t template_id = decode_uint16(cur + 0);
+      uint16_t field_count = decode_uint16(cur + 2);
+
+      cur += header_len;
+      for (unsigned int field = 0; field < field_count && cur < set_end;
+           field++) {
+        bool enterprise = decode_uint16(cur) & 0x8000;
+        cur += kFieldSpecifierLen + (enterprise ? kEnterpriseLen : 0);
+      }
+      cur = std::min(cur, set_end);
+
+      /* Like the content handler, ignore withdrawals. */
+      if (field_count == 0)
+        continue;
+
+      const Template*& t
+        = (*templates)[(static_cast<uint64_t>(observation_domain) << 16)
+                       | template_id];
+      if (t != 0 && t->set_id == set_id
+          && t->record.size() == static_cast<size_t>(cur - record)
+          && std::equal(record, cur, t->record.begin()))
+        continue;
+
+      Template* definition = new Template();
+      definition->exporter_id = exporter_id;
+      definition->observation_domain = observation_domain;
+      definition->set_id = set_id;
+      definition->record.assign(record, cur);
+      t = owner.publish(definition, t);
+    }
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::Pool::end_template_set() {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::Pool::start_options_template_set(
+      uint16_t set_id, uint16_t set_length, const uint8_t* buf) {
+    return start_template_set(set_id, set_length, buf);
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::Pool::end_options_template_set() {
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::Pool::start_data_set(uint16_t id,
+                                              uint16_t length,
+                                              const uint8_t* buf) {
+    if (chunk == 0 || chunk->bytes.size() + length > kChunkSize) {
+      if (chunk != 0)
+        release(chunk);
+      chunk = take_chunk();
+    }
+
+    /* The chunk's bytes were reserved up front, so this never moves
+     * the data sets already in it. */
+    size_t off = chunk->bytes.size();
+    chunk->bytes.insert(chunk->bytes.end(), buf, buf + length);
+    chunk->n_refs.fetch_add(1, std::memory_order_relaxed);
+
+    const Template* const* t
+      = templates->find((static_cast<uint64_t>(observation_domain) << 16)
+                        | id);
+
+    Task task;
+    task.tmpl = t == 0 ? 0 : *t;
+    if (task.tmpl != 0)
+      task.tmpl->n_refs.fetch_add(1, std::memory_order_relaxed);
+    task.chunk = chunk;
+    task.buf = chunk->bytes.data() + off;
+    task.exporter_id = exporter_id;
+    task.index = next_index++;
+    task.export_time = export_time;
+    task.sequence_number = sequence_number;
+    task.observation_domain = observation_domain;
+    task.id = id;
+    task.length = length;
+    submit(task);
+    libfc_RETURN_OK();
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::Pool::end_data_set() {
+    libfc_RETURN_OK();
+  }
+
+  WorkStealingCollector::WorkStealingCollector(unsigned int n_workers)
+    : n_replaced(0),
+      reclaim_at(kMinReclaim),
+      n_slots(0),
+      next_serial(0),
+      queue_depth(kDefaultQueueDepth),
+      n_tasks(0),
+      n_steals(0),
+      n_template_installs(0),
+      n_reader_stalls(0) {
+    collectors.resize(n_workers == 0 ? 1 : n_workers);
+    installed.resize(collectors.size());
+  }
+
+  WorkStealingCollector::~WorkStealingCollector() {
+  }
+
+  void WorkStealingCollector::set_queue_depth(size_t n_tasks) {
+    queue_depth = std::max(n_tasks, static_cast<size_t>(1));
+  }
+
+  void WorkStealingCollector::set_resync_policy(
+      MessageStreamParser::ResyncPolicy policy) {
+    reader.set_resync_policy(policy);
+  }
+
+  const WorkStealingCollector::Template*
+  WorkStealingCollector::publish(Template* definition, const Template* old) {
+    if (old != 0) {
+      definition->slot = old->slot;
+      old->replaced = true;
+      n_replaced++;
+    } else if (!free_slots.empty()) {
+      definition->slot = free_slots.back();
+      free_slots.pop_back();
+    } else
+      definition->slot = n_slots++;
+    definition->serial = ++next_serial;
+    definition->n_refs.store(0, std::memory_order_relaxed);
+    definition->replaced = false;
+    published.push_back(std::unique_ptr<const Template>(definition));
+
+    /* Doubling the threshold keeps this linear in the number of
+     * definitions, even if tasks hold on to replaced ones. */
+    if (published.size() >= reclaim_at) {
+      reclaim();
+      reclaim_at = std::max(kMinReclaim, 2 * published.size());
+    }
+    return definition;
+  }
+
+  void WorkStealingCollector::reclaim() {
+    if (n_replaced == 0)
+      return;
+
+    /* Pairs with the release in work(): a task's worker is done with
+     * the definition before its reference is given back. */
+    auto unused = [](const std::unique_ptr<const Template>& t) {
+      return t->replaced
+        && t->n_refs.load(std::memory_order_acquire) == 0;
+    };
+    auto end = std::remove_if(published.begin(), published.end(), unused);
+    n_replaced -= published.end() - end;
+    published.erase(end, published.end());
+  }
+
+  void WorkStealingCollector::drop_exporter(uint64_t exporter_id) {
+    for (auto& t : published)
+      if (t->exporter_id == exporter_id && !t->replaced) {
+        t->replaced = true;
+        n_replaced++;
+        free_slots.push_back(t->slot);
+      }
+    current.erase(exporter_id);
+    reclaim();
+
+    for (auto& c : collectors)
+      if (c != 0)
+        c->drop_exporter(exporter_id);
+  }
+
+  size_t WorkStealingCollector::get_n_definitions() const {
+    return published.size();
+  }
+
+  unsigned int WorkStealingCollector::get_n_workers() const {
+    return collectors.size();
+  }
+
+  PlacementCollector*
+  WorkStealingCollector::get_collector(unsigned int worker) const {
+    return collectors[worker].get();
+  }
+
+  const MessageStreamParser* WorkStealingCollector::get_parser() const {
+    return &reader;
+  }
+
+  WorkStealingCollector::Stats WorkStealingCollector::get_stats() const {
+    Stats stats;
+    stats.n_tasks = n_tasks.load(std::memory_order_relaxed);
+    stats.n_steals = n_steals.load(std::memory_order_relaxed);
+    stats.n_template_installs
+      = n_template_installs.load(std::memory_order_relaxed);
+    stats.n_reader_stalls = n_reader_stalls.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::decode(unsigned int worker, const Task& task) {
+    ContentHandler* ch = collectors[worker]->get_content_handler();
+
+    WS_REPORT_CALLBACK_ERROR(ch->set_exporter(task.exporter_id));
+
+    const Template* t = task.tmpl;
+    if (t != 0) {
+      std::vector<uint64_t>& mine = installed[worker];
+      if (mine.size() <= t->slot)
+        mine.resize(t->slot + 1, 0);
+
+      if (mine[t->slot] != t->serial) {
+        uint16_t length = kIpfixMessageHeaderLen + kIpfixSetHeaderLen
+          + t->record.size();
+        WS_REPORT_CALLBACK_ERROR(
+          ch->start_message(kIpfixVersion, length, task.export_time, 0,
+                            task.observation_domain, 0));
+        if (t->set_id == kIpfixOptionTemplateSetID) {
+          WS_REPORT_CALLBACK_ERROR(
+            ch->start_options_template_set(t->set_id, t->record.size(),
+                                           t->record.data()));
+          WS_REPORT_CALLBACK_ERROR(ch->end_options_template_set());
+        } else {
+          WS_REPORT_CALLBACK_ERROR(
+            ch->start_template_set(t->set_id, t->record.size(),
+                                   t->record.data()));
+          WS_REPORT_CALLBACK_ERROR(ch->end_template_set());
+        }
+        WS_REPORT_CALLBACK_ERROR(ch->end_message());
+
+        mine[t->slot] = t->serial;
+        n_template_installs.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    uint16_t length = kIpfixMessageHeaderLen + kIpfixSetHeaderLen
+      + task.length;
+    WS_REPORT_CALLBACK_ERROR(
+      ch->start_message(kIpfixVersion, length, task.export_time,
+                        task.sequence_number, task.observation_domain, 0));
+    try {
+      WS_REPORT_CALLBACK_ERROR(
+        ch->start_data_set(task.id, task.length, task.buf));
+    } catch (FormatError& e) {
+      /* Leave the handler outside of any message, so that the
+       * collector can be used again. */
+      (void) ch->end_message();
+      libfc_RETURN_ERROR(recoverable, format_error, e.what(), 0, 0,
+                         0, 0, 0);
+    }
+    WS_REPORT_CALLBACK_ERROR(ch->end_data_set());
+    /* This delivers the data set's batches. */
+    WS_REPORT_CALLBACK_ERROR(ch->end_message());
+
+    libfc_RETURN_OK();
+  }
+
+  void WorkStealingCollector::work(unsigned int worker, Pool& pool) {
+    ContentHandler* ch = collectors[worker]->get_content_handler();
+    Pool::Result& result = pool.results[worker];
+
+    std::shared_ptr<ErrorContext> err = ch->start_session();
+
+    for (;;) {
+      Task task;
+      bool have = false;
+      pool.workers_waiter.wait([&]() {
+          have = pool.take(worker, task);
+          return have || pool.done.load(std::memory_order_acquire);
+        });
+      /* Tasks queued before done was set are visible now. */
+      if (!have && !pool.take(worker, task))
+        break;
+
+      /* After a failure, tasks are only given back, so that the
+       * reader doesn't wait for their chunks forever. */
+      if (err == 0 && !pool.failed.load(std::memory_order_relaxed)) {
+        err = decode(worker, task);
+        if (err != 0) {
+          err->set_input_source(&pool.is);
+          err->set_message(task.buf, task.length);
+          result.index = task.index;
+          result.error = err;
+          pool.failed.store(true, std::memory_order_relaxed);
+        }
+      }
+      if (task.tmpl != 0)
+        task.tmpl->n_refs.fetch_sub(1, std::memory_order_release);
+      pool.release(task.chunk);
+    }
+
+    if (err == 0 && !pool.failed.load(std::memory_order_relaxed)) {
+      err = ch->end_session();
+      if (err != 0) {
+        result.index = std::numeric_limits<uint64_t>::max();
+        result.error = err;
+      }
+    }
+  }
+
+  std::shared_ptr<ErrorContext>
+  WorkStealingCollector::collect(InputSource& is) {
+    n_tasks = 0;
+    n_steals = 0;
+    n_template_installs = 0;
+    n_reader_stalls = 0;
+
+    for (unsigned int w = 0; w < collectors.size(); w++)
+      if (collectors[w] == 0)
+        collectors[w].reset(make_collector(w));
+
+    Pool pool(*this, collectors.size(), is);
+    reader.set_content_handler(&pool);
+
+    std::vector<std::thread> threads;
+    for (unsigned int w = 0; w < collectors.size(); w++)
+      threads.push_back(std::thread(&WorkStealingCollector::work, this, w,
+                                    std::ref(pool)));
+
+    std::shared_ptr<ErrorContext> reader_error = reader.parse(is);
+    pool.finish();
+
+    for (auto& t : threads)
+      t.join();
+
+    /* No task is left, so every replaced definition can go. */
+    reclaim();
+
+    Pool::Result* first = 0;
+    for (auto& r : pool.results)
+      if (r.error != 0 && (first == 0 || r.index < first->index))
+        first = &r;
+
+    return first == 0 ? reader_error : first->error;
+  }
+
+} // namespace libfc
@@ -0,0 +1,245 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_WORKSTEALINGCOLLECTOR_H_
+#  define _libfc_WORKSTEALINGCOLLECTOR_H_
+
+#  include <atomic>
+#  include <cstdint>
+#  include <map>
+#  include <memory>
+#  include <vector>
+
+#  include "ErrorContext.h"
+#  include "IPFIXMessageStreamParser.h"
+#  include "InputSource.h"
+#  include "PlacementCollector.h"
+#  include "TemplateTable.h"
+
+namespace libfc {
+
+  /** Collects an IPFIX message stream by decoding its data sets on a
+   * work-stealing pool of threads.
+   *
+   * The thread that calls collect() reads and frames messages with
+   * an ordinary IPFIXMessageStreamParser, so malformed messages are
+   * reported (or resynchronised, see set_resync_policy()) as in a
+   * sequential parse.  Every data set becomes a task, which goes to
+   * the workers' queues in turn.  A worker takes tasks from its own
+   * queue first, and steals from the others' when that is empty.  A
+   * huge message is thus decoded by all workers at once, and a worker
+   * that is busy with a large data set holds up only that data set.
+   *
+   * The reader keeps the latest definition of every template in wire
+   * format.  A definition never changes once it is published; a
+   * changed template gets a new definition with a new serial number.
+   * Every task points to the definition that was current when its
+   * data set was read.  Before decoding a data set, a worker installs
+   * that definition in its own content handler, unless it is the one
+   * it installed last for that template.  Workers therefore share
+   * templates without locks, and every data set is decoded with the
+   * template a sequential parse would have used, whichever worker
+   * steals it.  Only changed templates make new definitions.  A
+   * definition that has been replaced is freed once no task points to
+   * it; the current ones are kept until their exporter is dropped (see
+   * drop_exporter()) or this object is destroyed.
+   *
+   * Every worker has its own PlacementCollector, made by the virtual
+   * make_collector() factory on the first collect() and kept until
+   * this object is destroyed.  Each data set reaches the worker's
+   * content handler as a message of its own, so a batch placement
+   * template (see
+   * PlacementCollector::register_batch_placement_template()) gets
+   * one end_batch() per data set, unless the data set has more
+   * records than the batch holds.  Callbacks on different workers
+   * run concurrently, and data sets may complete out of stream
+   * order.
+   *
+   * If a worker fails, the others stop decoding, the reader stops
+   * reading, and collect() returns the error of the failing data set
+   * that came first in the stream.  Such an error points to the
+   * input source, but its offset is relative to the data set.  A
+   * record that fails to decode is such an error, whatever the
+   * resynchronisation policy: workers see data sets, not messages,
+   * and so have nothing to resynchronise to.
+   *
+   * Only IPFIX is supported.
+   */
+  class WorkStealingCollector {
+  public:
+    /** Default for set_queue_depth(). */
+    static const size_t kDefaultQueueDepth = 256;
+
+    /** Counters for the last collect(). */
+    struct Stats {
+      /** Data sets handed to workers. */
+      uint64_t n_tasks;
+
+      /** Data sets that a worker took from another worker's queue. */
+      uint64_t n_steals;
+
+      /** Template definitions that workers installed. */
+      uint64_t n_template_installs;
+
+      /** How often the reader had to wait for a worker. */
+      uint64_t n_reader_stalls;
+    };
+
+    /** Creates a collector.
+     *
+     * @param n_workers the number of decoder threads, at least 1;
+     *   usually one per core
+     */
+    WorkStealingCollector(unsigned int n_workers);
+
+    virtual ~WorkStealingCollector();
+
+    /** Collects an IPFIX message stream.
+     *
+     * @param is the input source to read from
+     *
+     * @return the error of the first failing data set, or of the
+     *   reader, or null
+     */
+    std::shared_ptr<ErrorContext> collect(InputSource& is);
+
+    /** Sets how many data sets may wait in each worker's queue. */
+    void set_queue_depth(size_t n_tasks);
+
+    /** Sets what the reader does with malformed messages. */
+    void set_resync_policy(MessageStreamParser::ResyncPolicy policy);
+
+    /** Forgets an exporter's templates, in the reader and in every
+     * worker's collector.  Must not be called while collect() is
+     * running.
+     *
+     * @param exporter_id the exporter to forget
+     */
+    void drop_exporter(uint64_t exporter_id);
+
+    /** Returns the number of template definitions kept, current or
+     * still in use by a task. */
+    size_t get_n_definitions() const;
+
+    /** Returns the number of workers. */
+    unsigned int get_n_workers() const;
+
+    /** Returns worker @a worker's collector, or null before the first
+     * collect(). */
+    PlacementCollector* get_collector(unsigned int worker) const;
+
+    /** Returns the reader's parser, for its resynchronisation
+     * counters. */
+    const MessageStreamParser* get_parser() const;
+
+    /** Returns the counters for the last collect().  May be called
+     * from another thread while collect() is running. */
+    Stats get_stats() const;
+
+  protected:
+    /** Makes the collector for one worker.
+     *
+     * Called by the first collect(), on the calling thread, once per
+     * worker.  The collector is owned by this object.
+     *
+     * @param worker the worker number, from 0 to get_n_workers() - 1
+     *
+     * @return a new collector
+     */
+    virtual PlacementCollector* make_collector(unsigned int worker) = 0;
+
+  private:
+    WorkStealingCollector(const WorkStealingCollector&) = delete;
+    WorkStealingCollector& operator=(const WorkStealingCollector&) = delete;
+
+    struct Template;
+    struct Chunk;
+    struct Task;
+    class Pool;
+
+    void work(unsigned int worker, Pool& pool);
+
+    std::shared_ptr<ErrorContext> decode(unsigned int worker,
+                                         const Task& task);
+
+    /** Publishes a new definition, reusing a free slot if there is
+     * one.  Called by the reader only. */
+    const Template* publish(Template* definition, const Template* old);
+
+    /** Frees replaced definitions that no task points to.  Called by
+     * the reader only. */
+    void reclaim();
+
+    std::vector<std::unique_ptr<PlacementCollector> > collectors;
+    IPFIXMessageStreamParser reader;
+
+    /** Every template definition that is current or may still be
+     * used by a task. */
+    std::vector<std::unique_ptr<const Template> > published;
+
+    /** Definitions in published that have been replaced. */
+    size_t n_replaced;
+
+    /** reclaim() runs when published grows to this size. */
+    size_t reclaim_at;
+
+    /** The current definitions, per exporter, keyed by observation
+     * domain and template ID. */
+    std::map<uint64_t, TemplateTable<const Template*> > current;
+
+    /** Templates are numbered as they are first seen, so that
+     * workers can keep what they installed in a vector. */
+    size_t n_slots;
+
+    /** Slots of dropped exporters' templates, for reuse.  A reused
+     * slot gets definitions with new serial numbers, so workers
+     * install them afresh. */
+    std::vector<size_t> free_slots;
+
+    uint64_t next_serial;
+
+    /** For every worker and template, the serial number of the
+     * definition the worker installed last, or 0. */
+    std::vector<std::vector<uint64_t> > installed;
+
+    size_t queue_depth;
+
+    std::atomic<uint64_t> n_tasks;
+    std::atomic<uint64_t> n_steals;
+    std::atomic<uint64_t> n_template_installs;
+    std::atomic<uint64_t> n_reader_stalls;
+  };
+
+} // namespace libfc
+
+#endif // _libfc_WORKSTEALINGCOLLECTOR_H_
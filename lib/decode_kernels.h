@@ -0,0 +1,118 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file Fixed-width transfer kernels for decode plans.
+ *
+ * Each kernel moves one big-endian integer of a fixed wire width into
+ * a native integer of a fixed destination size, zero-extending
+ * reduced-length encodings.  Since both widths are template
+ * parameters, the compiler turns every kernel into one unaligned
+ * load, at most one byte swap and one store.
+ *
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ */
+
+#ifndef _libfc_DECODE_KERNELS_H_
+#  define _libfc_DECODE_KERNELS_H_
+
+#  include <cstdint>
+#  include <cstring>
+
+#  include "ipfix_endian.h"
+
+namespace libfc {
+
+  /** Maps a width in octets to the unsigned integer type of that
+   * width. */
+  template<unsigned int W> struct uint_of_width;
+  template<> struct uint_of_width<1> { typedef uint8_t type; };
+  template<> struct uint_of_width<2> { typedef uint16_t type; };
+  template<> struct uint_of_width<4> { typedef uint32_t type; };
+  template<> struct uint_of_width<8> { typedef uint64_t type; };
+
+  /** Converts a value from network byte order to host byte order. */
+  inline uint8_t network_to_host(uint8_t v) { return v; }
+
+#  if defined(IPFIX_LITTLE_ENDIAN)
+  inline uint16_t network_to_host(uint16_t v) { return __builtin_bswap16(v); }
+  inline uint32_t network_to_host(uint32_t v) { return __builtin_bswap32(v); }
+  inline uint64_t network_to_host(uint64_t v) { return __builtin_bswap64(v); }
+#  elif defined(IPFIX_BIG_ENDIAN)
+  inline uint16_t network_to_host(uint16_t v) { return v; }
+  inline uint32_t network_to_host(uint32_t v) { return v; }
+  inline uint64_t network_to_host(uint64_t v) { return v; }
+#  else
+#    error libfc does not compile on weird-endian machines.
+#  endif
+
+  /** Loads a big-endian unsigned integer of W octets.
+   *
+   * The buffer need not be aligned.
+   *
+   * @param buf the first octet of the value
+   *
+   * @return the value in host byte order
+   */
+  template<unsigned int W>
+  inline typename uint_of_width<W>::type load_big_endian(const uint8_t* buf) {
+    typename uint_of_width<W>::type v;
+    memcpy(&v, buf, W);
+    return network_to_host(v);
+  }
+
+  /** Transfers a big-endian unsigned integer of W octets into a
+   * native integer of D octets.
+   *
+   * If W < D, this is a reduced-length encoding and the value is
+   * zero-extended, exactly like the generic transfer in DecodePlan
+   * does.  Floating-point values of the same width are moved as
+   * their bit patterns.
+   *
+   * @param buf the first octet of the value on the wire
+   * @param p destination; need not be aligned
+   */
+  template<unsigned int W, unsigned int D>
+  inline void transfer_big_endian(const uint8_t* buf, void* p) {
+    static_assert(W <= D, "wire width exceeds destination size");
+    typename uint_of_width<D>::type v = load_big_endian<W>(buf);
+    memcpy(p, &v, D);
+  }
+
+  /** Copies N octets without any conversion.
+   *
+   * @param buf the first octet of the value on the wire
+   * @param p destination
+   */
+  template<unsigned int N>
+  inline void transfer_octets(const uint8_t* buf, void* p) {
+    memcpy(p, buf, N);
+  }
+
+} // namespace libfc
+
+#endif /* _libfc_DECODE_KERNELS_H_ */
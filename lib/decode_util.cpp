@@ -44,9 +44,32 @@ namespace libfc {
       | (static_cast<uint32_t>(buf[3]) <<  0);
   }
 
+  void append_uint16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value >> 0));
+  }
+
+  void append_uint32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >>  8));
+    out.push_back(static_cast<uint8_t>(value >>  0));
+  }
+
+  void append_uint64(std::vector<uint8_t>& out, uint64_t value) {
+    append_uint32(out, static_cast<uint32_t>(value >> 32));
+    append_uint32(out, static_cast<uint32_t>(value >>  0));
+  }
+
+  void put_uint16(std::vector<uint8_t>& out, size_t off, uint16_t value) {
+    out[off + 0] = static_cast<uint8_t>(value >> 8);
+    out[off + 1] = static_cast<uint8_t>(value >> 0);
+  }
+
   void report_error(const std::string message, ...) {
     static const size_t buf_size = 10240;
-    static char buf[buf_size];
+    /* Not static: collectors decode on several threads at once. */
+    char buf[buf_size];
     va_list args;
   
     va_start(args, message);
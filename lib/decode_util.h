@@ -36,6 +36,7 @@
 #  include <cstdint>
 #  include <iomanip>
 #  include <string>
+#  include <vector>
 
 namespace libfc {
 
@@ -88,6 +89,43 @@ namespace libfc {
    */
   extern uint32_t decode_uint32(const uint8_t* buf);
 
+  /** Appends a 16-bit value to a buffer, in network byte order.
+   *
+   * The counterpart of decode_uint16(), for code that builds IPFIX
+   * messages or other big-endian data in memory.
+   *
+   * @param out the buffer to append to
+   * @param value the value to append
+   */
+  extern void append_uint16(std::vector<uint8_t>& out, uint16_t value);
+
+  /** Appends a 32-bit value to a buffer, in network byte order.
+   *
+   * @param out the buffer to append to
+   * @param value the value to append
+   */
+  extern void append_uint32(std::vector<uint8_t>& out, uint32_t value);
+
+  /** Appends a 64-bit value to a buffer, in network byte order.
+   *
+   * @param out the buffer to append to
+   * @param value the value to append
+   */
+  extern void append_uint64(std::vector<uint8_t>& out, uint64_t value);
+
+  /** Overwrites a 16-bit value in a buffer, in network byte order.
+   *
+   * Used to fill in a length once what it covers has been appended.
+   * It is the responsibility of the caller to make sure that out
+   * holds at least two octets from off on.
+   *
+   * @param out the buffer to write to
+   * @param off where in the buffer to write the value
+   * @param value the value to write
+   */
+  extern void put_uint16(std::vector<uint8_t>& out, size_t off,
+                         uint16_t value);
+
   /** Prints an error message.
    *
    * @param message format string a la printf(3)
@@ -36,20 +36,15 @@
 #include "InfoModel.h"
 #include "PlacementTemplate.h"
 #include "PlacementCollector.h"
-#include "FileInputSource.h"
+#include "MmapInputSource.h"
 #include "WandioInputSource.h"
 #include "exceptions/FormatError.h"
 #include "exceptions/IESpecError.h"
 
 #if defined(_libfc_HAVE_LOG4CPLUS_)
 #  include <log4cplus/configurator.h>
-#  include <log4cplus/loggingmacros.h>
-#  include <log4cplus/logger.h>
-#else
-#  define LOG4CPLUS_TRACE(logger, expr)
-#  define LOG4CPLUS_WARN(logger, expr)
-#  define LOG4CPLUS_INFO(logger, expr)
 #endif
+#include "logging.h"
 
 using namespace libfc;
 
@@ -90,13 +85,11 @@ public:
     register_placement_template(&(t->tmpl));
   }
 
-  std::shared_ptr<ErrorContext>
-      start_placement(const PlacementTemplate* tmpl) {
-    libfc_RETURN_OK();
+  Status on_start_placement(const PlacementTemplate* tmpl) {
+    return Status::ok();
   }
 
-  std::shared_ptr<ErrorContext>
-      end_placement(const PlacementTemplate* t) {
+  Status on_end_placement(const PlacementTemplate* t) {
 
     /* INSANE HACK which probably works -- get template from object.
      *
@@ -114,10 +107,10 @@ public:
         - offsetof(struct libfc_template_t, tmpl));
 
     if (this_template != 0)
-      if (this_template->callback(this_template, this_template->vparg) <= 0) {
-        libfc_RETURN_ERROR(fatal, aborted_by_user, "C callback abort", 0, 0, 0, 0, 0);
-      }
-    libfc_RETURN_OK();
+      if (this_template->callback(this_template, this_template->vparg) <= 0)
+        return Status(Error::aborted_by_user, "C callback abort",
+                      ErrorContext::fatal);
+    return Status::ok();
   }
     
   std::shared_ptr<ErrorContext>
@@ -192,7 +185,7 @@ extern int libfc_collect_from_file(int fd, const char* name,
                                    struct libfc_template_group_t* t) {
   int ret = 1;
 
-  FileInputSource is(fd, name);
+  MmapInputSource is(fd, name);
   try {
     t->binding->collect(is);
   } catch (FormatError e) {
@@ -0,0 +1,126 @@
+/* Hi Emacs, please use -*- mode: C++; -*- */
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Stephan Neuhaus <neuhaust@tik.ee.ethz.ch>
+ *
+ * Logging for libfc.
+ *
+ * Include this header instead of log4cplus/loggingmacros.h.  It
+ * makes the LOG4CPLUS_... macros available whether or not log4cplus
+ * is, and it removes log statements below a static level at compile
+ * time, so that they cost nothing at all, not even the test of the
+ * logger's run-time level.  The static level is set with
+ *
+ * @code
+ * -Dlibfc_LOG_LEVEL=libfc_LOG_LEVEL_TRACE
+ * @endcode
+ *
+ * (or the LOG_LEVEL cmake option) and defaults to INFO, so TRACE
+ * and DEBUG statements are compiled out of normal builds and WARN
+ * remains available.  Statements at or above the static level are
+ * still subject to the level that log4cplus is configured with.
+ *
+ * Loggers are hoisted out of objects that are created often with
+ * libfc_DEFINE_LOGGER, since log4cplus::Logger::getInstance() takes
+ * a global lock.  Such a logger is used as logger() rather than
+ * logger.
+ */
+
+#ifndef _libfc_LOGGING_H_
+#  define _libfc_LOGGING_H_
+
+#  define libfc_LOG_LEVEL_TRACE 0
+#  define libfc_LOG_LEVEL_DEBUG 1
+#  define libfc_LOG_LEVEL_INFO  2
+#  define libfc_LOG_LEVEL_WARN  3
+#  define libfc_LOG_LEVEL_ERROR 4
+#  define libfc_LOG_LEVEL_FATAL 5
+#  define libfc_LOG_LEVEL_OFF   6
+
+#  if defined(_libfc_HAVE_LOG4CPLUS_)
+#    include <log4cplus/logger.h>
+#    include <log4cplus/loggingmacros.h>
+#    if !defined(libfc_LOG_LEVEL)
+#      define libfc_LOG_LEVEL libfc_LOG_LEVEL_INFO
+#    endif /* !defined(libfc_LOG_LEVEL) */
+#  else /* !defined(_libfc_HAVE_LOG4CPLUS_) */
+#    undef libfc_LOG_LEVEL
+#    define libfc_LOG_LEVEL libfc_LOG_LEVEL_OFF
+#  endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+
+#  if libfc_LOG_LEVEL > libfc_LOG_LEVEL_TRACE
+#    undef LOG4CPLUS_TRACE
+#    define LOG4CPLUS_TRACE(logger, expr) do { } while (0)
+#  endif
+#  if libfc_LOG_LEVEL > libfc_LOG_LEVEL_DEBUG
+#    undef LOG4CPLUS_DEBUG
+#    define LOG4CPLUS_DEBUG(logger, expr) do { } while (0)
+#  endif
+#  if libfc_LOG_LEVEL > libfc_LOG_LEVEL_INFO
+#    undef LOG4CPLUS_INFO
+#    define LOG4CPLUS_INFO(logger, expr) do { } while (0)
+#  endif
+#  if libfc_LOG_LEVEL > libfc_LOG_LEVEL_WARN
+#    undef LOG4CPLUS_WARN
+#    define LOG4CPLUS_WARN(logger, expr) do { } while (0)
+#  endif
+#  if libfc_LOG_LEVEL > libfc_LOG_LEVEL_ERROR
+#    undef LOG4CPLUS_ERROR
+#    define LOG4CPLUS_ERROR(logger, expr) do { } while (0)
+#  endif
+#  if libfc_LOG_LEVEL > libfc_LOG_LEVEL_FATAL
+#    undef LOG4CPLUS_FATAL
+#    define LOG4CPLUS_FATAL(logger, expr) do { } while (0)
+#  endif
+
+  /** Defines a logger for one translation unit.
+   *
+   * This defines a function @a var() that returns the logger.  The
+   * logger is looked up on first use, instead of once per object.
+   * It is not looked up during static initialisation, which would
+   * run before log4cplus is initialised and in no particular order
+   * across translation units.
+   *
+   * @param var the name of the logger function
+   * @param name the name of the logger
+   */
+#  if defined(_libfc_HAVE_LOG4CPLUS_)
+#    define libfc_DEFINE_LOGGER(var, name)                            \
+  static inline log4cplus::Logger& var() {                            \
+    static log4cplus::Logger instance                                 \
+      = log4cplus::Logger::getInstance(LOG4CPLUS_TEXT(name));         \
+    return instance;                                                  \
+  }                                                                   \
+  static_assert(true, "libfc_DEFINE_LOGGER needs a semicolon")
+#  else /* !defined(_libfc_HAVE_LOG4CPLUS_) */
+#    define libfc_DEFINE_LOGGER(var, name)                            \
+  static_assert(true, "no logger without log4cplus")
+#  endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
+
+#endif /* _libfc_LOGGING_H_ */
@@ -0,0 +1,405 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of ETH Zürich nor the names of other contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/test_tools.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "BasicOctetArray.h"
+#include "ColumnDecoder.h"
+#include "DecodePlan.h"
+#include "IETemplate.h"
+#include "InfoModel.h"
+#include "NativeDecoder.h"
+#include "OctetArrayView.h"
+#include "PlacementTemplate.h"
+
+#include "exceptions/FormatError.h"
+
+using namespace libfc;
+
+BOOST_AUTO_TEST_SUITE(DecodePlans)
+
+static const InfoElement* ie(const char* name) {
+  const InfoElement* ret = InfoModel::instance().lookupIE(name);
+  BOOST_REQUIRE(ret != 0);
+  return ret;
+}
+
+BOOST_AUTO_TEST_CASE(FixedPrefix) {
+  IETemplate wt;
+  wt.add(ie("octetDeltaCount"));          //  0: 8 octets
+  wt.add(ie("packetDeltaCount"));         //  8: 8 octets
+  wt.add(ie("protocolIdentifier"));       // 16: 1 octet
+  wt.add(ie("sourceTransportPort"));      // 17: 2 octets
+  wt.add(ie("sourceIPv4Address"));        // 19: 4 octets
+  wt.add(ie("destinationIPv4Address"));   // 23: 4 octets
+  wt.add(ie("destinationTransportPort")); // 27: 2 octets
+
+  uint64_t octets = 0;
+  uint32_t source = 0;
+  uint16_t port = 0;
+
+  PlacementTemplate pt;
+  pt.register_placement(ie("sourceIPv4Address"), &source, 0);
+  pt.register_placement(ie("destinationTransportPort"), &port, 0);
+  pt.register_placement(ie("octetDeltaCount"), &octets, 0);
+
+  DecodePlan plan(&pt, &wt);
+
+  /* Skips in the fixed prefix cost nothing. */
+  BOOST_CHECK_EQUAL(plan.size(), 3U);
+  BOOST_CHECK_EQUAL(plan.get_fixed_prefix_length(), 29U);
+
+  static const uint8_t record[] = {
+    0x00,0x00,0x00,0x00,0x00,0x01,0x02,0x03,
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+    0x06,
+    0xab,0xcd,
+    0x0a,0x00,0x00,0x01,
+    0x0a,0x00,0x00,0x02,
+    0x00,0x50 };
+
+  BOOST_CHECK_EQUAL(plan.execute(record, sizeof(record)), sizeof(record));
+  BOOST_CHECK_EQUAL(octets, 0x10203ULL);
+  BOOST_CHECK_EQUAL(source, 0x0a000001U);
+  BOOST_CHECK_EQUAL(port, 80);
+
+  /* A record that is too short for the fixed prefix is an error. */
+  BOOST_CHECK_THROW(plan.execute(record, sizeof(record) - 1), FormatError);
+}
+
+BOOST_AUTO_TEST_CASE(VarlenTail) {
+  IETemplate wt;
+  wt.add(ie("protocolIdentifier"));
+  wt.add(ie("interfaceName"));
+  wt.add(ie("octetDeltaCount"));
+  wt.add(ie("packetDeltaCount"));
+  wt.add(ie("sourceTransportPort"));
+  wt.add(ie("interfaceDescription"));
+
+  uint8_t protocol = 0;
+  uint16_t port = 0;
+  BasicOctetArray description;
+
+  PlacementTemplate pt;
+  pt.register_placement(ie("protocolIdentifier"), &protocol, 0);
+  pt.register_placement(ie("sourceTransportPort"), &port, 0);
+  pt.register_placement(ie("interfaceDescription"), &description, 0);
+
+  DecodePlan plan(&pt, &wt);
+
+  /* protocolIdentifier in the prefix; then skip interfaceName, one
+   * coalesced skip for the two counters, and two transfers. */
+  BOOST_CHECK_EQUAL(plan.size(), 5U);
+  BOOST_CHECK_EQUAL(plan.get_fixed_prefix_length(), 1U);
+
+  static const uint8_t record[] = {
+    0x11,
+    0x04,'e','t','h','0',
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x02,
+    0x00,0x35,
+    0x03,'l','a','n' };
+
+  BOOST_CHECK_EQUAL(plan.execute(record, sizeof(record)), sizeof(record));
+  BOOST_CHECK_EQUAL(protocol, 17);
+  BOOST_CHECK_EQUAL(port, 53);
+  BOOST_CHECK_EQUAL(description.to_string(), "lan");
+}
+
+BOOST_AUTO_TEST_CASE(Kernels) {
+  IETemplate wt;
+  wt.add(ie("octetDeltaCount")->forLen(4));   // 4 -> 8
+  wt.add(ie("packetDeltaCount")->forLen(2));  // 2 -> 8
+  wt.add(ie("octetTotalCount")->forLen(3));   // 3 -> 8, generic
+  wt.add(ie("sourceTransportPort"));          // 2 -> 2
+  wt.add(ie("sourceIPv6Address"));            // 16 -> 16
+  wt.add(ie("samplingProbability"));          // 8 -> 8, float64
+
+  uint64_t octets = 0;
+  uint64_t packets = 0;
+  uint64_t total = 0;
+  uint16_t port = 0;
+  uint8_t address[16] = { 0 };
+  double probability = 0;
+  double reduced_probability = 0;
+
+  PlacementTemplate pt;
+  pt.register_placement(ie("octetDeltaCount"), &octets, 0);
+  pt.register_placement(ie("packetDeltaCount"), &packets, 0);
+  pt.register_placement(ie("octetTotalCount"), &total, 0);
+  pt.register_placement(ie("sourceTransportPort"), &port, 0);
+  pt.register_placement(ie("sourceIPv6Address"), address, 0);
+  pt.register_placement(ie("samplingProbability"), &probability, 0);
+
+  DecodePlan plan(&pt, &wt);
+
+  static const uint8_t record[] = {
+    0x80,0x00,0x00,0x01,
+    0x12,0x34,
+    0x01,0x02,0x03,
+    0x01,0xbb,
+    0x20,0x01,0x0d,0xb8,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,
+    0x3f,0xee,0x00,0x00,0x00,0x00,0x00,0x00 };
+
+  BOOST_CHECK_EQUAL(plan.execute(record, sizeof(record)), sizeof(record));
+  BOOST_CHECK_EQUAL(octets, 0x80000001ULL);
+  BOOST_CHECK_EQUAL(packets, 0x1234ULL);
+  BOOST_CHECK_EQUAL(total, 0x10203ULL);
+  BOOST_CHECK_EQUAL(port, 443);
+  BOOST_CHECK_EQUAL(address[0], 0x20);
+  BOOST_CHECK_EQUAL(address[15], 0x01);
+  BOOST_CHECK_EQUAL(probability, 0.9375);
+
+  /* The same IE, now only in its reduced-length form. */
+  IETemplate reduced_wt;
+  reduced_wt.add(ie("samplingProbability")->forLen(4));
+
+  PlacementTemplate reduced_pt;
+  reduced_pt.register_placement(ie("samplingProbability"),
+                                &reduced_probability, 0);
+
+  static const uint8_t reduced_record[] = { 0x3f,0x40,0x00,0x00 };
+
+  DecodePlan reduced_plan(&reduced_pt, &reduced_wt);
+  BOOST_CHECK_EQUAL(reduced_plan.execute(reduced_record,
+                                         sizeof(reduced_record)),
+                    sizeof(reduced_record));
+  BOOST_CHECK_EQUAL(reduced_probability, 0.75);
+}
+
+BOOST_AUTO_TEST_CASE(NativeCode) {
+  IETemplate wt;
+  wt.add(ie("octetDeltaCount"));                 // 8 -> 8
+  wt.add(ie("packetDeltaCount")->forLen(4));     // 4 -> 8
+  wt.add(ie("protocolIdentifier"));              // 1 -> 1
+  wt.add(ie("sourceTransportPort"));             // 2 -> 2
+  wt.add(ie("sourceIPv6Address"));               // 16 -> 16
+  wt.add(ie("samplingProbability")->forLen(4));  // float into double
+  wt.add(ie("interfaceName"));                   // varlen, interpreted
+
+  uint64_t octets = 0;
+  uint64_t packets = 0;
+  uint8_t protocol = 0;
+  uint16_t port = 0;
+  uint8_t address[16] = { 0 };
+  double probability = 0;
+  BasicOctetArray name;
+
+  PlacementTemplate pt;
+  pt.register_placement(ie("octetDeltaCount"), &octets, 0);
+  pt.register_placement(ie("packetDeltaCount"), &packets, 0);
+  pt.register_placement(ie("protocolIdentifier"), &protocol, 0);
+  pt.register_placement(ie("sourceTransportPort"), &port, 0);
+  pt.register_placement(ie("sourceIPv6Address"), address, 0);
+  pt.register_placement(ie("samplingProbability"), &probability, 0);
+  pt.register_placement(ie("interfaceName"), &name, 0);
+
+  DecodePlan plan(&pt, &wt);
+
+  BOOST_CHECK_EQUAL(plan.compile(), NativeDecoder::is_supported());
+  BOOST_CHECK_EQUAL(plan.is_compiled(), NativeDecoder::is_supported());
+
+  static const uint8_t record[] = {
+    0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,
+    0x80,0x00,0x00,0x02,
+    0x06,
+    0x00,0x16,
+    0xfe,0x80,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x2a,
+    0x3f,0x40,0x00,0x00,
+    0x02,'l','o' };
+
+  BOOST_CHECK_EQUAL(plan.execute(record, sizeof(record)), sizeof(record));
+  BOOST_CHECK_EQUAL(octets, 0x0102030405060708ULL);
+  BOOST_CHECK_EQUAL(packets, 0x80000002ULL);
+  BOOST_CHECK_EQUAL(protocol, 6);
+  BOOST_CHECK_EQUAL(port, 22);
+  BOOST_CHECK_EQUAL(address[0], 0xfe);
+  BOOST_CHECK_EQUAL(address[15], 0x2a);
+  BOOST_CHECK_EQUAL(probability, 0.75);
+  BOOST_CHECK_EQUAL(name.to_string(), "lo");
+
+  /* Bounds are still checked before the native code runs. */
+  BOOST_CHECK_THROW(plan.execute(record, 20), FormatError);
+
+  /* Booleans need error handling and are not compiled. */
+  IETemplate bool_wt;
+  bool_wt.add(ie("octetDeltaCount"));
+  bool_wt.add(ie("dataRecordsReliability"));
+
+  bool reliable = false;
+  PlacementTemplate bool_pt;
+  bool_pt.register_placement(ie("octetDeltaCount"), &octets, 0);
+  bool_pt.register_placement(ie("dataRecordsReliability"), &reliable, 0);
+
+  DecodePlan bool_plan(&bool_pt, &bool_wt);
+  BOOST_CHECK(!bool_plan.compile());
+  BOOST_CHECK(!bool_plan.is_compiled());
+}
+
+BOOST_AUTO_TEST_CASE(References) {
+  IETemplate wt;
+  wt.add(ie("protocolIdentifier"));
+  wt.add(ie("interfaceName")->forLen(4));
+  wt.add(ie("interfaceDescription"));
+
+  uint8_t protocol = 0;
+  OctetArrayView name;
+  OctetArrayView description;
+
+  PlacementTemplate pt;
+  pt.register_placement(ie("protocolIdentifier"), &protocol, 0);
+  BOOST_CHECK(pt.register_reference_placement(ie("interfaceName"), &name));
+  BOOST_CHECK(pt.register_reference_placement(ie("interfaceDescription"),
+                                              &description));
+  BOOST_CHECK(!pt.register_reference_placement(ie("octetDeltaCount"), &name));
+
+  static const uint8_t record[] = {
+    0x06,
+    'e','t','h','0',
+    0x03,'l','a','n' };
+
+  /* Once interpreted, once compiled; either way, the views point
+   * into the record. */
+  for (int compiled = 0; compiled < 2; ++compiled) {
+    DecodePlan plan(&pt, &wt);
+    plan.set_compile_threshold(0);
+    if (compiled)
+      BOOST_CHECK_EQUAL(plan.compile(), NativeDecoder::is_supported());
+
+    name = OctetArrayView();
+    description = OctetArrayView();
+
+    BOOST_CHECK_EQUAL(plan.execute(record, sizeof(record)), sizeof(record));
+    BOOST_CHECK_EQUAL(protocol, 6);
+    BOOST_CHECK(name.get_buf() == record + 1);
+    BOOST_CHECK_EQUAL(name.get_length(), 4U);
+    BOOST_CHECK_EQUAL(name.to_string(), "eth0");
+    BOOST_CHECK(description.get_buf() == record + 6);
+    BOOST_CHECK_EQUAL(description.to_string(), "lan");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Columns) {
+  static const char* names[] = {
+    "protocolIdentifier",     // 1 -> 1
+    "vlanId",                 // 1 -> 2, reduced
+    "sourceTransportPort",    // 2 -> 2
+    "ingressInterface",       // 2 -> 4, reduced
+    "packetDeltaCount",       // 2 -> 8, reduced
+    "sourceIPv4Address",      // 4 -> 4
+    "octetDeltaCount",        // 4 -> 8, reduced
+    "octetTotalCount",        // 8 -> 8
+    "sourceIPv6Address",      // 16 -> 16
+    "dataRecordsReliability", // boolean
+  };
+  static const uint16_t lengths[] = { 1, 1, 2, 2, 2, 4, 4, 8, 16, 1 };
+  const size_t n_fields = sizeof(names)/sizeof(names[0]);
+
+  IETemplate wt;
+  for (size_t f = 0; f < n_fields; ++f)
+    wt.add(ie(names[f])->forLen(lengths[f]));
+
+  /* Odd number of records, so that every vector path has a rest. */
+  const size_t n_records = 37;
+  const uint16_t stride = 41;
+  BOOST_REQUIRE_EQUAL(wt.minlen(), stride);
+
+  std::vector<uint8_t> data(n_records*stride);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<uint8_t>(i*131 + 7);
+  for (size_t r = 0; r < n_records; ++r)
+    data[r*stride + stride - 1] = 1 + r % 2;
+
+  /* Reference: record by record. */
+  uint8_t protocol;
+  uint16_t vlan, port;
+  uint32_t interface, source;
+  uint64_t packets, octets, total;
+  uint8_t address[16];
+  bool reliable;
+  void* scalars[] = { &protocol, &vlan, &port, &interface, &packets,
+                      &source, &octets, &total, address, &reliable };
+
+  PlacementTemplate row_pt;
+  for (size_t f = 0; f < n_fields; ++f)
+    row_pt.register_placement(ie(names[f]), scalars[f], 0);
+  DecodePlan row_plan(&row_pt, &wt);
+
+  /* Columns. */
+  std::vector<uint8_t> c_protocol(n_records);
+  std::vector<uint16_t> c_vlan(n_records), c_port(n_records);
+  std::vector<uint32_t> c_interface(n_records), c_source(n_records);
+  std::vector<uint64_t> c_packets(n_records), c_octets(n_records),
+    c_total(n_records);
+  std::vector<uint8_t> c_address(16*n_records);
+  bool c_reliable[n_records];
+  void* columns[] = { &c_protocol[0], &c_vlan[0], &c_port[0],
+                      &c_interface[0], &c_packets[0], &c_source[0],
+                      &c_octets[0], &c_total[0], &c_address[0],
+                      c_reliable };
+
+  PlacementTemplate column_pt;
+  for (size_t f = 0; f < n_fields; ++f)
+    column_pt.register_placement(ie(names[f]), columns[f], 0);
+  DecodePlan column_plan(&column_pt, &wt);
+  BOOST_REQUIRE(column_plan.is_fixed_stride());
+
+  ColumnDecoder decoder(&column_plan);
+  BOOST_CHECK_EQUAL(decoder.get_stride(), stride);
+
+  for (int isa = ColumnDecoder::isa_scalar;
+       isa <= ColumnDecoder::best_isa(); ++isa) {
+    BOOST_TEST_CHECKPOINT("isa " << isa);
+    decoder.set_isa(static_cast<ColumnDecoder::isa_t>(isa));
+    BOOST_CHECK_EQUAL(decoder.get_isa(), isa);
+
+    /* Decode in two batches, to check the row offset. */
+    decoder.decode(&data[0], 20, 0);
+    decoder.decode(&data[20*stride], n_records - 20, 20);
+
+    for (size_t r = 0; r < n_records; ++r) {
+      row_plan.execute(&data[r*stride], stride);
+      BOOST_CHECK_EQUAL(c_protocol[r], protocol);
+      BOOST_CHECK_EQUAL(c_vlan[r], vlan);
+      BOOST_CHECK_EQUAL(c_port[r], port);
+      BOOST_CHECK_EQUAL(c_interface[r], interface);
+      BOOST_CHECK_EQUAL(c_packets[r], packets);
+      BOOST_CHECK_EQUAL(c_source[r], source);
+      BOOST_CHECK_EQUAL(c_octets[r], octets);
+      BOOST_CHECK_EQUAL(c_total[r], total);
+      BOOST_CHECK(memcmp(&c_address[16*r], address, 16) == 0);
+      BOOST_CHECK_EQUAL(c_reliable[r], reliable);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
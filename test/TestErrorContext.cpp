@@ -25,7 +25,9 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
  */
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/test_tools.hpp>
@@ -100,4 +102,129 @@ BOOST_AUTO_TEST_CASE(ShortMsg) {
   delete msg;
 }
 
+BOOST_AUTO_TEST_CASE(Resync) {
+  InfoModel& model = InfoModel::instance();
+
+  uint32_t population;
+
+  PlacementTemplate pt;
+  pt.register_placement(model.lookupIE("samplingPopulation"),
+                        &population, 0);
+
+  class MyCollector : public PlacementCollector {
+  public:
+    MyCollector(const PlacementTemplate* pt)
+      : PlacementCollector(PlacementCollector::ipfix), n_records(0) {
+      register_placement_template(pt);
+    }
+
+    std::shared_ptr<libfc::ErrorContext>
+        end_placement(const PlacementTemplate* tmpl) {
+      n_records++;
+      libfc_RETURN_OK();
+    }
+
+    unsigned int n_records;
+  };
+
+  static const unsigned char garbage[] = {
+    0xde, 0xad, 0xbe, 0xef, 0x00, 0x0a, 0x00 };
+
+  /* A good message, garbage, a message with a wrong version number,
+   * and another good message. */
+  std::vector<unsigned char> stream;
+  stream.insert(stream.end(), good_msg, good_msg + sizeof good_msg);
+  stream.insert(stream.end(), garbage, garbage + sizeof garbage);
+  size_t bad_off = stream.size();
+  stream.insert(stream.end(), good_msg, good_msg + sizeof good_msg);
+  stream[bad_off + 1] = 0x0b;
+  stream.insert(stream.end(), good_msg, good_msg + sizeof good_msg);
+
+  MyCollector strict(&pt);
+  BufferInputSource is1(&stream[0], stream.size());
+  BOOST_CHECK(strict.collect(is1) != 0);
+  BOOST_CHECK_EQUAL(strict.n_records, 1U);
+
+  MyCollector lenient(&pt);
+  lenient.set_resync_policy(MessageStreamParser::resync_on_error);
+  BufferInputSource is2(&stream[0], stream.size());
+  BOOST_CHECK(lenient.collect(is2) == 0);
+  BOOST_CHECK_EQUAL(lenient.n_records, 2U);
+  BOOST_CHECK_EQUAL(lenient.get_parser()->get_n_resyncs(), 1U);
+  BOOST_CHECK_EQUAL(lenient.get_parser()->get_n_skipped_bytes(),
+                    sizeof garbage + sizeof good_msg);
+
+  /* A truncated message at the end of the stream is skipped. */
+  stream.resize(sizeof good_msg + 40);
+  std::copy(good_msg, good_msg + 40, stream.begin() + sizeof good_msg);
+
+  MyCollector tail(&pt);
+  tail.set_resync_policy(MessageStreamParser::resync_on_error);
+  BufferInputSource is3(&stream[0], stream.size());
+  BOOST_CHECK(tail.collect(is3) == 0);
+  BOOST_CHECK_EQUAL(tail.n_records, 1U);
+  BOOST_CHECK_EQUAL(tail.get_parser()->get_n_skipped_bytes(), 40U);
+}
+
+BOOST_AUTO_TEST_CASE(ResyncContent) {
+  class MyCollector : public PlacementCollector {
+  public:
+    MyCollector() : PlacementCollector(PlacementCollector::ipfix) {
+      pt.register_placement(
+        InfoModel::instance().lookupIE("samplingPopulation"),
+        populations, 0);
+      register_batch_placement_template(&pt, 16);
+    }
+
+    std::shared_ptr<libfc::ErrorContext>
+        end_batch(const PlacementTemplate* tmpl, size_t n_records) {
+      batch_sizes.push_back(n_records);
+      libfc_RETURN_OK();
+    }
+
+    std::vector<size_t> batch_sizes;
+
+  private:
+    PlacementTemplate pt;
+    uint32_t populations[16];
+  };
+
+  /* A good message, one whose record has an interfaceName that
+   * overruns the data set, and another good message. */
+  std::vector<unsigned char> stream(good_msg, good_msg + sizeof good_msg);
+  size_t bad_off = stream.size();
+  stream.insert(stream.end(), good_msg, good_msg + sizeof good_msg);
+  stream[bad_off + 48] = 0xfe;
+  stream.insert(stream.end(), good_msg, good_msg + sizeof good_msg);
+
+  MyCollector strict;
+  BufferInputSource is1(&stream[0], stream.size());
+  BOOST_CHECK_THROW(strict.collect(is1), FormatError);
+
+  MyCollector lenient;
+  lenient.set_resync_policy(MessageStreamParser::resync_on_error);
+  BufferInputSource is2(&stream[0], stream.size());
+  BOOST_CHECK(lenient.collect(is2) == 0);
+  BOOST_CHECK_EQUAL(lenient.batch_sizes.size(), 2U);
+  BOOST_CHECK_EQUAL(lenient.get_parser()->get_n_skipped_messages(), 1U);
+  BOOST_CHECK_EQUAL(lenient.get_parser()->get_n_resyncs(), 0U);
+
+  /* A good record followed by a set with a bad ID: the record is
+   * delivered with its own message, not with the next one. */
+  static const unsigned char bad_set[] = { 0x00, 0x05, 0x00, 0x04 };
+  stream.assign(good_msg, good_msg + sizeof good_msg);
+  stream.insert(stream.end(), bad_set, bad_set + sizeof bad_set);
+  stream[3] += sizeof bad_set;
+  stream.insert(stream.end(), good_msg, good_msg + sizeof good_msg);
+
+  MyCollector framing;
+  framing.set_resync_policy(MessageStreamParser::resync_on_error);
+  BufferInputSource is3(&stream[0], stream.size());
+  BOOST_CHECK(framing.collect(is3) == 0);
+  BOOST_REQUIRE_EQUAL(framing.batch_sizes.size(), 2U);
+  BOOST_CHECK_EQUAL(framing.batch_sizes[0], 1U);
+  BOOST_CHECK_EQUAL(framing.batch_sizes[1], 1U);
+  BOOST_CHECK_EQUAL(framing.get_parser()->get_n_resyncs(), 1U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
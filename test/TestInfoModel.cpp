@@ -28,6 +28,9 @@
 #include <boost/test/test_tools.hpp>
 #include <boost/test/unit_test.hpp>
 
+#include <thread>
+#include <vector>
+
 #include "InfoElement.h"
 #include "InfoModel.h"
 
@@ -63,4 +66,117 @@ BOOST_AUTO_TEST_CASE(InfoElement01) {
   BOOST_CHECK_EQUAL(e->toIESpec(), "octetDeltaCount(1)<unsigned64>[8]");
 }
 
+BOOST_AUTO_TEST_CASE(ReducedLength) {
+  libfc::InfoModel& m = libfc::InfoModel::instance();
+
+  m.default5103();
+
+  /* Short variants come from the inline table, long ones from the
+   * map; either way, the same IE comes back every time. */
+  const libfc::InfoElement* octets4 = m.lookupIE(0, 1, 4);
+  BOOST_REQUIRE(octets4 != 0);
+  BOOST_CHECK_EQUAL(octets4->len(), 4);
+  BOOST_CHECK_EQUAL(m.lookupIE(0, 1, 4), octets4);
+  BOOST_CHECK_EQUAL(m.lookupIE(0, 1, 8), m.lookupIE("octetDeltaCount"));
+
+  const libfc::InfoElement* long_octets = m.lookupIE(0, 1, 100);
+  BOOST_REQUIRE(long_octets != 0);
+  BOOST_CHECK_EQUAL(long_octets->len(), 100);
+  BOOST_CHECK_EQUAL(m.lookupIE(0, 1, 100), long_octets);
+
+  const libfc::InfoElement* reverse = m.lookupIE(29305, 1, 4);
+  BOOST_REQUIRE(reverse != 0);
+  BOOST_CHECK_EQUAL(reverse->pen(), 29305U);
+  BOOST_CHECK_EQUAL(reverse->len(), 4);
+
+  /* Numbers beyond the IANA table and unknown PENs are not there. */
+  BOOST_CHECK(m.lookupIE(0, 32000, 4) == 0);
+  BOOST_CHECK(m.lookupIE(29306, 1, 4) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentLookup) {
+  libfc::InfoModel& m = libfc::InfoModel::instance();
+
+  m.defaultIPFIX();
+
+  const unsigned int n_readers = 4;
+  const uint16_t n_unknown = 200;
+
+  /* Readers ask for reduced-length variants while a writer keeps
+   * adding IEs.  Boost.Test is not thread-safe, so the threads only
+   * record what they saw and the checks happen afterwards. */
+  std::vector<std::vector<const libfc::InfoElement*> > seen(n_readers);
+  std::vector<std::thread> threads;
+
+  for (unsigned int t = 0; t < n_readers; ++t)
+    threads.push_back(std::thread([&m, &seen, t] {
+          for (unsigned int i = 0; i < 1000; ++i)
+            for (uint16_t len = 1; len <= 8; ++len)
+              if (i == 0)
+                seen[t].push_back(m.lookupIE(0, 1, len));
+              else if (m.lookupIE(0, 1, len) != seen[t][len - 1])
+                seen[t][len - 1] = 0;
+        }));
+  threads.push_back(std::thread([&m] {
+        for (uint16_t n = 1; n <= n_unknown; ++n)
+          m.add_unknown(4711, n, 4);
+      }));
+
+  for (auto i = threads.begin(); i != threads.end(); ++i)
+    i->join();
+
+  for (unsigned int t = 0; t < n_readers; ++t) {
+    for (uint16_t len = 1; len <= 8; ++len) {
+      BOOST_REQUIRE(seen[t][len - 1] != 0);
+      BOOST_CHECK_EQUAL(seen[t][len - 1], seen[0][len - 1]);
+      BOOST_CHECK_EQUAL(seen[t][len - 1]->len(), len);
+    }
+  }
+
+  for (uint16_t n = 1; n <= n_unknown; ++n) {
+    const libfc::InfoElement* ie = m.lookupIE(4711, n, 4);
+    BOOST_REQUIRE(ie != 0);
+    BOOST_CHECK_EQUAL(ie->number(), n);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(UnknownIEs) {
+  libfc::InfoModel& m = libfc::InfoModel::instance();
+
+  m.defaultIPFIX();
+
+  /* Unknown IEs are found again, also in other lengths, and known
+   * ones are never replaced by unknown ones. */
+  BOOST_CHECK(m.lookupIE(0, 32001, 4) == 0);
+  const libfc::InfoElement* unknown = m.add_unknown(0, 32001, 4);
+  BOOST_REQUIRE(unknown != 0);
+  BOOST_CHECK_EQUAL(unknown->number(), 32001);
+  BOOST_CHECK_EQUAL(unknown->len(), 4);
+  BOOST_CHECK_EQUAL(m.lookupIE(0, 32001, 4), unknown);
+  BOOST_CHECK_EQUAL(m.add_unknown(0, 32001, 4), unknown);
+  BOOST_CHECK_EQUAL(m.lookupIE(0, 32001, 2)->len(), 2);
+
+  BOOST_CHECK_EQUAL(m.add_unknown(0, 1, 8), m.lookupIE("octetDeltaCount"));
+
+  const libfc::InfoElement* reserved = m.add_unknown(0, 0, 4);
+  BOOST_REQUIRE(reserved != 0);
+  BOOST_CHECK_EQUAL(m.lookupIE(0, 0, 4), reserved);
+}
+
+BOOST_AUTO_TEST_CASE(LargeIANANumber) {
+  libfc::InfoModel& m = libfc::InfoModel::instance();
+
+  m.defaultIPFIX();
+
+  /* Large IANA numbers are hashed, not indexed, but found all the
+   * same. */
+  m.add("largeNumberedCounter(32002)<unsigned64>[8]");
+  const libfc::InfoElement* ie = m.lookupIE(0, 32002, 8);
+  BOOST_REQUIRE(ie != 0);
+  BOOST_CHECK_EQUAL(ie->name(), "largeNumberedCounter");
+  BOOST_CHECK_EQUAL(m.lookupIE("largeNumberedCounter"), ie);
+  BOOST_CHECK(m.lookupIE(0, 32003, 8) == 0);
+  BOOST_CHECK_EQUAL(m.lookupIE(0, 1, 8), m.lookupIE("octetDeltaCount"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -25,7 +25,16 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
 #include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/test_tools.hpp>
@@ -38,33 +47,1582 @@
 #  define LOG4CPLUS_DEBUG(logger, expr)
 #endif /* defined(_libfc_HAVE_LOG4CPLUS_) */
 
+#include "BasicOctetArray.h"
 #include "BufferInputSource.h"
 #include "PlacementContentHandler.h"
 #include "FileInputSource.h"
 #include "IPFIXMessageStreamParser.h"
+#include "IndexedFileInputSource.h"
 #include "InfoModel.h"
+#include "MmapInputSource.h"
+#include "ParallelFileCollector.h"
+#include "PipelinedCollector.h"
+#include "TCPCollector.h"
+#include "UDPCollector.h"
+#include "UDPInputSource.h"
+#include "UringInputSource.h"
+#include "WorkStealingCollector.h"
 #include "PlacementCollector.h"
 
 #include "exceptions/FormatError.h"
 
 using namespace libfc;
 
+/* A message with a template set that defines template 1001
+ * (samplingPopulation, interfaceName, samplingProbability and
+ * interfaceDescription) and a data set with one record.  Most tests
+ * below use it. */
+static const unsigned char kMessage[] = {
+    0x00,0x0a,0x00,0x56,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,0x00,0x02,0x00,0x18,0x03,0xe9,0x00,0x04,0x01,0x36,0x00,0x04,0x00,0x52,0xff,0xff,0x01,0x37,0x00,0x08,0x00,0x53,0xff,0xff,0x03,0xe9,0x00,0x2e,0x10,0x20,0x30,0x40,0x04,0x65,0x74,0x68,0x30,0x3f,0xee,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x46,0x69,0x72,0x73,0x74,0x20,0x65,0x74,0x68,0x65,0x72,0x6e,0x65,0x74,0x20,0x69,0x6e,0x74,0x65,0x72,0x66,0x61,0x63,0x65 };
+
+/* Length of kMessage up to its data set. */
+static const size_t kHeaderAndTemplate = 40;
+
+/* A message that redefines template 1001 to hold only
+ * samplingPopulation, and a data set with one record. */
+static const unsigned char kRedefinition[] = {
+    0x00,0x0a,0x00,0x24,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,0x00,0x02,0x00,0x0c,0x03,0xe9,0x00,0x01,0x01,0x36,0x00,0x04,0x03,0xe9,0x00,0x08,0x10,0x20,0x30,0x40 };
+
+/* Length of kRedefinition up to its data set. */
+static const size_t kRedefinitionHeaderAndTemplate = 28;
+
+/* Returns a copy of a message without its template set. */
+static std::vector<unsigned char> data_only(const unsigned char* msg,
+                                            size_t size,
+                                            size_t header_and_template) {
+  std::vector<unsigned char> ret(msg, msg + 16);
+  ret.insert(ret.end(), msg + header_and_template, msg + size);
+  ret[2] = static_cast<unsigned char>(ret.size() >> 8);
+  ret[3] = static_cast<unsigned char>(ret.size());
+  return ret;
+}
+
+/* kMessage, data-only copies of it, kRedefinition and data-only
+ * copies of that, n_messages each, followed by a truncated message
+ * header. */
+static std::vector<unsigned char> redefinition_stream(
+    unsigned int n_messages) {
+  std::vector<unsigned char> old_data
+    = data_only(kMessage, sizeof(kMessage), kHeaderAndTemplate);
+  std::vector<unsigned char> new_data
+    = data_only(kRedefinition, sizeof(kRedefinition),
+                kRedefinitionHeaderAndTemplate);
+
+  std::vector<unsigned char> contents(kMessage, kMessage + sizeof(kMessage));
+  for (unsigned int i = 1; i < n_messages; i++)
+    contents.insert(contents.end(), old_data.begin(), old_data.end());
+  contents.insert(contents.end(), kRedefinition,
+                  kRedefinition + sizeof(kRedefinition));
+  for (unsigned int i = 1; i < n_messages; i++)
+    contents.insert(contents.end(), new_data.begin(), new_data.end());
+  contents.insert(contents.end(), kMessage, kMessage + 10);
+  return contents;
+}
+
 BOOST_AUTO_TEST_SUITE(PlacementInterface)
 
 BOOST_AUTO_TEST_CASE(SkipDataSet) {
-  static const unsigned char msg[] = {
-    0x00,0x0a,0x00,0x56,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,0x00,0x02,0x00,0x18,0x03,0xe9,0x00,0x04,0x01,0x36,0x00,0x04,0x00,0x52,0xff,0xff,0x01,0x37,0x00,0x08,0x00,0x53,0xff,0xff,0x03,0xe9,0x00,0x2e,0x10,0x20,0x30,0x40,0x04,0x65,0x74,0x68,0x30,0x3f,0xee,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x46,0x69,0x72,0x73,0x74,0x20,0x65,0x74,0x68,0x65,0x72,0x6e,0x65,0x74,0x20,0x69,0x6e,0x74,0x65,0x72,0x66,0x61,0x63,0x65 };
 
   PlacementContentHandler dsr;
   IPFIXMessageStreamParser ir;
 
   ir.set_content_handler(&dsr);
 
-  BufferInputSource is(msg, sizeof(msg));
+  BufferInputSource is(kMessage, sizeof(kMessage));
   ir.parse(is);
 
 }
 
+BOOST_AUTO_TEST_CASE(PlanCache) {
+  /* Same message as in SkipDataSet, sent twice, so the template is
+   * repeated unchanged and the second data set can reuse the plan. */
+  std::vector<unsigned char> msg(kMessage, kMessage + sizeof(kMessage));
+  msg.insert(msg.end(), kMessage, kMessage + sizeof(kMessage));
+
+  class MyCollector : public PlacementCollector {
+  public:
+    MyCollector()
+      : PlacementCollector(PlacementCollector::ipfix), n_records(0) {
+    }
+
+    std::shared_ptr<ErrorContext>
+        start_placement(const PlacementTemplate* tmpl) {
+      libfc_RETURN_OK();
+    }
+
+    std::shared_ptr<ErrorContext>
+        end_placement(const PlacementTemplate* tmpl) {
+      n_records++;
+      libfc_RETURN_OK();
+    }
+
+    unsigned int n_records;
+  };
+
+  uint32_t sampling_population = 0;
+  BasicOctetArray interface_name;
+
+  PlacementTemplate my_template;
+  my_template.register_placement(
+    InfoModel::instance().lookupIE("samplingPopulation"),
+    &sampling_population, 0);
+  my_template.register_placement(
+    InfoModel::instance().lookupIE("interfaceName"),
+    &interface_name, 0);
+
+  MyCollector cb;
+  PlacementContentHandler dsr;
+  IPFIXMessageStreamParser ir;
+
+  dsr.register_placement_template(&my_template, &cb);
+  ir.set_content_handler(&dsr);
+
+  BufferInputSource is(msg.data(), msg.size());
+  BOOST_CHECK(ir.parse(is) == 0);
+
+  BOOST_CHECK_EQUAL(cb.n_records, 2U);
+  BOOST_CHECK_EQUAL(sampling_population, 0x10203040U);
+  BOOST_CHECK_EQUAL(interface_name.to_string(), "eth0");
+  BOOST_CHECK_EQUAL(dsr.get_plan_cache_misses(), 1U);
+  BOOST_CHECK_EQUAL(dsr.get_plan_cache_hits(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(Matching) {
+  InfoModel& model = InfoModel::instance();
+
+  IETemplate wt;
+  wt.add(model.lookupIE("samplingPopulation"));
+  wt.add(model.lookupIE("interfaceName"));
+  wt.add(model.lookupIE("samplingProbability"));
+  wt.add(model.lookupIE("interfaceDescription"));
+
+  uint32_t population;
+  double probability;
+  uint64_t octets;
+
+  PlacementTemplate subset;
+  subset.register_placement(model.lookupIE("samplingProbability"),
+                            &probability, 0);
+  subset.register_placement(model.lookupIE("samplingPopulation"),
+                            &population, 0);
+
+  PlacementTemplate other;
+  other.register_placement(model.lookupIE("samplingPopulation"),
+                           &population, 0);
+  other.register_placement(model.lookupIE("octetDeltaCount"), &octets, 0);
+
+  BOOST_CHECK_EQUAL(subset.is_match(&wt, 0), 2U);
+  BOOST_CHECK_EQUAL(other.is_match(&wt, 0), 0U);
+
+  std::set<const InfoElement*> unmatched;
+  BOOST_CHECK_EQUAL(subset.is_match(&wt, &unmatched), 2U);
+  BOOST_CHECK_EQUAL(unmatched.size(), 2U);
+  BOOST_CHECK(unmatched.count(model.lookupIE("interfaceName")) == 1);
+
+  /* The message from SkipDataSet, twice. Registering a placement
+   * template must invalidate the cached non-match from the first
+   * message. */
+
+  class MyCollector : public PlacementCollector {
+  public:
+    MyCollector()
+      : PlacementCollector(PlacementCollector::ipfix), n_records(0) {
+    }
+
+    std::shared_ptr<ErrorContext>
+        end_placement(const PlacementTemplate* tmpl) {
+      n_records++;
+      libfc_RETURN_OK();
+    }
+
+    unsigned int n_records;
+  };
+
+  MyCollector cb;
+  PlacementContentHandler dsr;
+  IPFIXMessageStreamParser ir;
+
+  dsr.register_placement_template(&other, &cb);
+  ir.set_content_handler(&dsr);
+
+  BufferInputSource is1(kMessage, sizeof(kMessage));
+  BOOST_CHECK(ir.parse(is1) == 0);
+  BOOST_CHECK_EQUAL(cb.n_records, 0U);
+
+  dsr.register_placement_template(&subset, &cb);
+
+  BufferInputSource is2(kMessage, sizeof(kMessage));
+  BOOST_CHECK(ir.parse(is2) == 0);
+  BOOST_CHECK_EQUAL(cb.n_records, 1U);
+  BOOST_CHECK_EQUAL(population, 0x10203040U);
+  BOOST_CHECK_EQUAL(probability, 0.9375);
+}
+
+BOOST_AUTO_TEST_CASE(StatusCallbacks) {
+  /* The message from SkipDataSet, with one record. */
+
+  class StatusCollector : public PlacementCollector {
+  public:
+    StatusCollector() : PlacementCollector(PlacementCollector::ipfix) {
+    }
+
+    Status on_end_placement(const PlacementTemplate* tmpl) {
+      return Status(Error::aborted_by_user, "enough", ErrorContext::fatal);
+    }
+  };
+
+  class OldCollector : public PlacementCollector {
+  public:
+    OldCollector() : PlacementCollector(PlacementCollector::ipfix) {
+    }
+
+    std::shared_ptr<ErrorContext>
+        end_placement(const PlacementTemplate* tmpl) {
+      libfc_RETURN_ERROR(recoverable, inconsistent_state,
+                         "population " << std::hex << population,
+                         0, 0, 0, 0, 0);
+    }
+
+    uint32_t population;
+  };
+
+  BOOST_CHECK(Status::ok().is_ok());
+  BOOST_CHECK(Status::ok().to_error_context() == 0);
+
+  StatusCollector status_cb;
+  OldCollector old_cb;
+  PlacementTemplate status_template;
+  status_template.register_placement(
+    InfoModel::instance().lookupIE("samplingPopulation"),
+    &old_cb.population, 0);
+  PlacementTemplate old_template;
+  old_template.register_placement(
+    InfoModel::instance().lookupIE("samplingPopulation"),
+    &old_cb.population, 0);
+
+  {
+    PlacementContentHandler dsr;
+    IPFIXMessageStreamParser ir;
+    dsr.register_placement_template(&status_template, &status_cb);
+    ir.set_content_handler(&dsr);
+
+    BufferInputSource is(kMessage, sizeof(kMessage));
+    std::shared_ptr<ErrorContext> e = ir.parse(is);
+    BOOST_REQUIRE(e != 0);
+    BOOST_CHECK_EQUAL(e->get_error(), Error::aborted_by_user);
+    BOOST_CHECK_EQUAL(std::string(e->get_explanation()), "enough");
+  }
+
+  {
+    /* Old-style callbacks get their error context through
+     * unchanged. */
+    PlacementContentHandler dsr;
+    IPFIXMessageStreamParser ir;
+    dsr.register_placement_template(&old_template, &old_cb);
+    ir.set_content_handler(&dsr);
+
+    BufferInputSource is(kMessage, sizeof(kMessage));
+    std::shared_ptr<ErrorContext> e = ir.parse(is);
+    BOOST_REQUIRE(e != 0);
+    BOOST_CHECK_EQUAL(e->get_error(), Error::inconsistent_state);
+    BOOST_CHECK_EQUAL(std::string(e->get_explanation()),
+                      "population 10203040");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Exporters) {
+  /* Exporter 1 defines template 1001 as in SkipDataSet. */
+
+  /* Exporter 2 uses the same domain and template ID for
+   * samplingProbability and samplingPopulation. */
+  static const unsigned char msg2[] = {
+    0x00,0x0a,0x00,0x30,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,
+    0x00,0x02,0x00,0x10,0x03,0xe9,0x00,0x02,0x01,0x37,0x00,0x08,0x01,0x36,0x00,0x04,
+    0x03,0xe9,0x00,0x10,0x3f,0xe0,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x07 };
+
+  /* Exporter 1 again, data only. */
+  static const unsigned char msg3[] = {
+    0x00,0x0a,0x00,0x3e,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x01,0x00,0x01,0xe2,0x40,0x03,0xe9,0x00,0x2e,0x10,0x20,0x30,0x40,0x04,0x65,0x74,0x68,0x30,0x3f,0xee,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x46,0x69,0x72,0x73,0x74,0x20,0x65,0x74,0x68,0x65,0x72,0x6e,0x65,0x74,0x20,0x69,0x6e,0x74,0x65,0x72,0x66,0x61,0x63,0x65 };
+
+  class ExporterInputSource : public BufferInputSource {
+  public:
+    ExporterInputSource(const unsigned char* buf, size_t len, uint64_t id)
+      : BufferInputSource(buf, len), id(id) {
+    }
+
+    uint64_t get_exporter_id() const {
+      return id;
+    }
+
+  private:
+    uint64_t id;
+  };
+
+  class MyCollector : public PlacementCollector {
+  public:
+    MyCollector() : PlacementCollector(PlacementCollector::ipfix) {
+    }
+
+    std::shared_ptr<ErrorContext>
+        end_placement(const PlacementTemplate* tmpl) {
+      populations.push_back(population);
+      probabilities.push_back(probability);
+      libfc_RETURN_OK();
+    }
+
+    uint32_t population;
+    double probability;
+    std::vector<uint32_t> populations;
+    std::vector<double> probabilities;
+  };
+
+  MyCollector cb;
+  PlacementTemplate my_template;
+  my_template.register_placement(
+    InfoModel::instance().lookupIE("samplingPopulation"),
+    &cb.population, 0);
+  my_template.register_placement(
+    InfoModel::instance().lookupIE("samplingProbability"),
+    &cb.probability, 0);
+
+  PlacementContentHandler dsr;
+  IPFIXMessageStreamParser ir;
+  dsr.register_placement_template(&my_template, &cb);
+  ir.set_content_handler(&dsr);
+
+  ExporterInputSource is1(kMessage, sizeof(kMessage), 1);
+  ExporterInputSource is2(msg2, sizeof(msg2), 2);
+  ExporterInputSource is3(msg3, sizeof(msg3), 1);
+  BOOST_CHECK(ir.parse(is1) == 0);
+  BOOST_CHECK(ir.parse(is2) == 0);
+  BOOST_CHECK(ir.parse(is3) == 0);
+
+  BOOST_REQUIRE_EQUAL(cb.populations.size(), 3U);
+  BOOST_CHECK_EQUAL(cb.populations[0], 0x10203040U);
+  BOOST_CHECK_EQUAL(cb.probabilities[0], 0.9375);
+  BOOST_CHECK_EQUAL(cb.populations[1], 7U);
+  BOOST_CHECK_EQUAL(cb.probabilities[1], 0.5);
+  BOOST_CHECK_EQUAL(cb.populations[2], 0x10203040U);
+  BOOST_CHECK_EQUAL(cb.probabilities[2], 0.9375);
+
+  /* Neither template overwrote the other. */
+  BOOST_CHECK_EQUAL(dsr.get_plan_cache_misses(), 2U);
+  BOOST_CHECK_EQUAL(dsr.get_plan_cache_hits(), 1U);
+
+  /* Once exporter 1 is gone, so is its template. */
+  dsr.drop_exporter(1);
+  ExporterInputSource is4(msg3, sizeof(msg3), 1);
+  BOOST_CHECK(ir.parse(is4) == 0);
+  BOOST_CHECK_EQUAL(cb.populations.size(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(Batches) {
+  /* Template 1002 has samplingPopulation and samplingProbability,
+   * both fixed-length, and each message carries three records. */
+  static const unsigned char msg[] = {
+    0x00,0x0a,0x00,0x48,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x00,0x00,0x01,0xe2,0x40,
+    0x00,0x02,0x00,0x10,0x03,0xea,0x00,0x02,0x01,0x36,0x00,0x04,0x01,0x37,0x00,0x08,
+    0x03,0xea,0x00,0x28,
+    0x00,0x00,0x00,0x01,0x3f,0xe0,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x02,0x3f,0xd0,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x03,0x3f,0xc0,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x0a,0x00,0x48,0x50,0x6a,0xce,0xbc,0x00,0x00,0x00,0x01,0x00,0x01,0xe2,0x40,
+    0x00,0x02,0x00,0x10,0x03,0xea,0x00,0x02,0x01,0x36,0x00,0x04,0x01,0x37,0x00,0x08,
+    0x03,0xea,0x00,0x28,
+    0x00,0x00,0x00,0x04,0x3f,0xe0,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x05,0x3f,0xd0,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x06,0x3f,0xc0,0x00,0x00,0x00,0x00,0x00,0x00 };
+
+  /* The message from SkipDataSet, whose template has varlen IEs. */
+
+  static const size_t capacity = 2;
+
+  class MyCollector : public PlacementCollector {
+  public:
+    MyCollector(const unsigned char* msg, size_t msg_size, bool with_name)
+      : PlacementCollector(PlacementCollector::ipfix),
+        is(msg, msg_size), with_name(with_name) {
+      my_template.register_placement(
+        InfoModel::instance().lookupIE("samplingPopulation"),
+        sampling_population, 0);
+      my_template.register_placement(
+        InfoModel::instance().lookupIE("samplingProbability"),
+        sampling_probability, 0);
+      if (with_name)
+        my_template.register_placement(
+          InfoModel::instance().lookupIE("interfaceName"),
+          interface_name, 0);
+      register_batch_placement_template(&my_template, capacity);
+    }
+
+    std::shared_ptr<ErrorContext>
+        end_batch(const PlacementTemplate* tmpl, size_t n_records) {
+      batch_sizes.push_back(n_records);
+      for (size_t k = 0; k < n_records; ++k) {
+        populations.push_back(sampling_population[k]);
+        probabilities.push_back(sampling_probability[k]);
+        if (with_name)
+          names.push_back(interface_name[k].to_string());
+      }
+      libfc_RETURN_OK();
+    }
+
+    std::shared_ptr<ErrorContext> collect() {
+      return PlacementCollector::collect(is);
+    }
+
+    std::vector<size_t> batch_sizes;
+    std::vector<uint32_t> populations;
+    std::vector<double> probabilities;
+    std::vector<std::string> names;
+
+  private:
+    BufferInputSource is;
+    bool with_name;
+    PlacementTemplate my_template;
+    uint32_t sampling_population[capacity];
+    double sampling_probability[capacity];
+    BasicOctetArray interface_name[capacity];
+  };
+
+  /* Template 1002 has a fixed stride, so this is decoded column by
+   * column. */
+  MyCollector fixed(msg, sizeof(msg), false);
+  BOOST_CHECK(fixed.collect() == 0);
+
+  static const size_t expected_sizes[] = { 2, 1, 2, 1 };
+  BOOST_CHECK_EQUAL_COLLECTIONS(fixed.batch_sizes.begin(),
+                                fixed.batch_sizes.end(),
+                                expected_sizes, expected_sizes + 4);
+  BOOST_REQUIRE_EQUAL(fixed.populations.size(), 6U);
+  for (size_t k = 0; k < 6; ++k) {
+    BOOST_CHECK_EQUAL(fixed.populations[k], k + 1);
+    BOOST_CHECK_EQUAL(fixed.probabilities[k], 0.5/(1 << (k % 3)));
+  }
+
+  /* One record per message; batches don't span messages. */
+  std::vector<unsigned char> twice(kMessage, kMessage + sizeof(kMessage));
+  twice.insert(twice.end(), kMessage, kMessage + sizeof(kMessage));
+
+  MyCollector varlen(twice.data(), twice.size(), true);
+  BOOST_CHECK(varlen.collect() == 0);
+
+  BOOST_REQUIRE_EQUAL(varlen.batch_sizes.size(), 2U);
+  BOOST_CHECK_EQUAL(varlen.batch_sizes[0], 1U);
+  BOOST_CHECK_EQUAL(varlen.batch_sizes[1], 1U);
+  BOOST_CHECK_EQUAL(varlen.populations[1], 0x10203040U);
+  BOOST_CHECK_EQUAL(varlen.probabilities[1], 0.9375);
+  BOOST_CHECK_EQUAL(varlen.names[1], "eth0");
+}
+
+/** Counts the records of the message from SkipDataSet. */
+class PopulationCounter : public PlacementCollector {
+public:
+  PopulationCounter()
+    : PlacementCollector(PlacementCollector::ipfix), n_records(0) {
+    InfoModel& model = InfoModel::instance();
+    pt.register_placement(model.lookupIE("samplingPopulation"),
+                          &population, 0);
+    register_placement_template(&pt);
+  }
+
+  std::shared_ptr<ErrorContext>
+      end_placement(const PlacementTemplate* tmpl) {
+    BOOST_CHECK_EQUAL(population, 0x10203040U);
+    n_records++;
+    libfc_RETURN_OK();
+  }
+
+  unsigned int n_records;
+
+private:
+  PlacementTemplate pt;
+  uint32_t population;
+};
+
+BOOST_AUTO_TEST_CASE(PipeInput) {
+  /* The message from SkipDataSet, written to a pipe a few bytes at a
+   * time, so that the reader sees partial reads. */
+  static const unsigned int n_messages = 3;
+
+  int fds[2];
+  BOOST_REQUIRE(pipe(fds) == 0);
+
+  std::thread writer([&fds]() {
+      for (unsigned int i = 0; i < n_messages; i++)
+        for (size_t off = 0; off < sizeof(kMessage); off += 5) {
+          size_t len = std::min(sizeof(kMessage) - off, static_cast<size_t>(5));
+          if (write(fds[1], kMessage + off, len) != static_cast<ssize_t>(len))
+            break;
+          std::this_thread::yield();
+        }
+      (void) close(fds[1]);
+    });
+
+  PopulationCounter cb;
+  FileInputSource is(fds[0], "<pipe>");
+  BOOST_CHECK(cb.collect(is) == 0);
+  writer.join();
+
+  BOOST_CHECK_EQUAL(cb.n_records, n_messages);
+}
+
+BOOST_AUTO_TEST_CASE(MmapInput) {
+  /* The message from SkipDataSet, three times, in a file. The last
+   * copy is truncated. */
+
+  char filename[] = "/tmp/fctestXXXXXX";
+  int fd = mkstemp(filename);
+  BOOST_REQUIRE(fd >= 0);
+  (void) unlink(filename);
+
+  BOOST_REQUIRE(write(fd, kMessage, sizeof(kMessage)) == sizeof(kMessage));
+  BOOST_REQUIRE(write(fd, kMessage, sizeof(kMessage)) == sizeof(kMessage));
+  BOOST_REQUIRE(write(fd, kMessage, 40) == 40);
+
+  PopulationCounter cb;
+  MmapInputSource is(fd, filename);
+  BOOST_CHECK(is.is_mapped());
+
+  std::shared_ptr<ErrorContext> err = cb.collect(is);
+  BOOST_REQUIRE(err != 0);
+  BOOST_CHECK_EQUAL(err->get_error(), Error::short_body);
+  BOOST_CHECK_EQUAL(cb.n_records, 2U);
+}
+
+BOOST_AUTO_TEST_CASE(ParallelFile) {
+  /* The message from SkipDataSet, data-only copies of it, then a
+   * message that redefines template 1001 to hold only
+   * samplingPopulation, and data-only messages for that.  Ranges are
+   * small, so most of them must get their templates from the
+   * pre-scan; with the wrong template, populations come out wrong.
+   * The file ends in a truncated message. */
+  static const unsigned int n_messages = 1000;
+
+  std::vector<unsigned char> contents = redefinition_stream(n_messages);
+
+  char filename[] = "/tmp/fctestXXXXXX";
+  int fd = mkstemp(filename);
+  BOOST_REQUIRE(fd >= 0);
+  (void) unlink(filename);
+  BOOST_REQUIRE(write(fd, &contents[0], contents.size())
+                == static_cast<ssize_t>(contents.size()));
+
+  class MyCollector : public ParallelFileCollector {
+  public:
+    MyCollector() : ParallelFileCollector(3) {
+    }
+
+    std::vector<size_t> ended;
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+
+    void end_range(unsigned int worker, const Range& range) {
+      ended.push_back(range.index);
+    }
+  } collector;
+
+  collector.set_range_size(2048);
+  collector.set_ordered(true);
+
+  std::shared_ptr<ErrorContext> err = collector.collect(fd, filename);
+  (void) close(fd);
+
+  BOOST_REQUIRE(err != 0);
+  BOOST_CHECK_EQUAL(err->get_error(), Error::short_header);
+  BOOST_CHECK_EQUAL(collector.get_n_messages(), 2 * n_messages);
+
+  /* The error is where the truncated message starts in the file, not
+   * in its range. */
+  BOOST_REQUIRE(err->get_input_source() != 0);
+  BOOST_CHECK_EQUAL(err->get_input_source()->get_message_offset()
+                    + err->get_offset(), contents.size() - 10);
+
+  const std::vector<ParallelFileCollector::Range>& ranges
+    = collector.get_ranges();
+  BOOST_REQUIRE(ranges.size() > 10);
+  BOOST_CHECK_EQUAL(ranges.front().begin, 0U);
+  BOOST_CHECK_EQUAL(ranges.back().end, contents.size());
+  for (size_t k = 1; k < ranges.size(); k++)
+    BOOST_CHECK_EQUAL(ranges[k].begin, ranges[k - 1].end);
+
+  BOOST_REQUIRE_EQUAL(collector.ended.size(), ranges.size());
+  for (size_t k = 0; k < ranges.size(); k++)
+    BOOST_CHECK_EQUAL(collector.ended[k], k);
+
+  unsigned int n_records = 0;
+  for (unsigned int w = 0; w < collector.get_n_workers(); w++)
+    n_records += static_cast<PopulationCounter*>(collector.get_collector(w))
+      ->n_records;
+  BOOST_CHECK_EQUAL(n_records, 2 * n_messages);
+}
+
+BOOST_AUTO_TEST_CASE(ParallelFileMalformed) {
+  /* The message from SkipDataSet and data-only copies of it.  In one
+   * message in the middle of the file, the varlen length runs past
+   * the end of the record, so decoding its range throws. */
+  static const unsigned int n_messages = 1000;
+  static const unsigned int bad_message = n_messages / 2;
+
+  std::vector<unsigned char> data_message
+    = data_only(kMessage, sizeof(kMessage), kHeaderAndTemplate);
+
+  std::vector<unsigned char> contents(kMessage, kMessage + sizeof(kMessage));
+  size_t bad_offset = 0;
+  for (unsigned int i = 1; i < n_messages; i++) {
+    if (i == bad_message)
+      bad_offset = contents.size();
+    contents.insert(contents.end(), data_message.begin(),
+                    data_message.end());
+  }
+  contents[bad_offset + 24] = 0xfe;
+
+  char filename[] = "/tmp/fctestXXXXXX";
+  int fd = mkstemp(filename);
+  BOOST_REQUIRE(fd >= 0);
+  (void) unlink(filename);
+  BOOST_REQUIRE(write(fd, &contents[0], contents.size())
+                == static_cast<ssize_t>(contents.size()));
+
+  class MyCollector : public ParallelFileCollector {
+  public:
+    MyCollector() : ParallelFileCollector(3) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+  } collector;
+
+  collector.set_range_size(2048);
+
+  std::shared_ptr<ErrorContext> err = collector.collect(fd, filename);
+  (void) close(fd);
+
+  const std::vector<ParallelFileCollector::Range>& ranges
+    = collector.get_ranges();
+  BOOST_REQUIRE(ranges.size() > 10);
+  BOOST_CHECK(bad_offset > ranges.front().end);
+  BOOST_CHECK(bad_offset < ranges.back().begin);
+
+  BOOST_REQUIRE(err != 0);
+  BOOST_CHECK_EQUAL(err->get_error(), Error::format_error);
+  BOOST_REQUIRE(err->get_input_source() != 0);
+  BOOST_CHECK_EQUAL(err->get_input_source()->get_message_offset(),
+                    bad_offset);
+}
+
+BOOST_AUTO_TEST_CASE(IndexedWindow) {
+  /* Like ParallelFile, but every message is exported one second
+   * after the one before it, starting at 1000, and template 1001 is
+   * redefined at 2000. */
+  static const unsigned int n_messages = 1000;
+  static const uint32_t t0 = 1000;
+
+  std::vector<unsigned char> old_data
+    = data_only(kMessage, sizeof(kMessage), kHeaderAndTemplate);
+  std::vector<unsigned char> new_data
+    = data_only(kRedefinition, sizeof(kRedefinition),
+                kRedefinitionHeaderAndTemplate);
+
+  std::vector<unsigned char> contents;
+  uint32_t t = t0;
+  auto append = [&contents, &t](const unsigned char* m, size_t len) {
+    size_t off = contents.size();
+    contents.insert(contents.end(), m, m + len);
+    for (int k = 0; k < 4; k++)
+      contents[off + 4 + k] = static_cast<unsigned char>(t >> (24 - 8*k));
+    t++;
+  };
+
+  append(kMessage, sizeof(kMessage));
+  for (unsigned int i = 1; i < n_messages; i++)
+    append(&old_data[0], old_data.size());
+  append(kRedefinition, sizeof(kRedefinition));
+  for (unsigned int i = 1; i < n_messages; i++)
+    append(&new_data[0], new_data.size());
+
+  char filename[] = "/tmp/fctestXXXXXX";
+  int fd = mkstemp(filename);
+  BOOST_REQUIRE(fd >= 0);
+  BOOST_REQUIRE(write(fd, &contents[0], contents.size())
+                == static_cast<ssize_t>(contents.size()));
+  (void) close(fd);
+
+  FileIndex built;
+  BOOST_REQUIRE(built.build(filename, 1024) == 0);
+  std::string index_name = FileIndex::sidecar_name(filename);
+  BOOST_REQUIRE(built.save(index_name) == 0);
+
+  /* An index whose messages overlap is damaged.  Message offsets
+   * start at byte 44; make message 1 start with message 0. */
+  unsigned char saved[8];
+  fd = open(index_name.c_str(), O_RDWR);
+  BOOST_REQUIRE(fd >= 0);
+  BOOST_REQUIRE(pread(fd, saved, 8, 44 + 16) == 8);
+  static const unsigned char zero[8] = { 0 };
+  BOOST_REQUIRE(pwrite(fd, zero, 8, 44 + 16) == 8);
+  FileIndex damaged;
+  std::shared_ptr<ErrorContext> load_err = damaged.load(index_name);
+  BOOST_REQUIRE(load_err != 0);
+  BOOST_CHECK_EQUAL(load_err->get_error(), Error::format_error);
+  BOOST_REQUIRE(pwrite(fd, saved, 8, 44 + 16) == 8);
+  (void) close(fd);
+
+  FileIndex index;
+  BOOST_REQUIRE(index.load(index_name) == 0);
+  (void) unlink(index_name.c_str());
+
+  BOOST_CHECK_EQUAL(index.size(), 2 * n_messages);
+  BOOST_CHECK_EQUAL(index.get_file_size(), contents.size());
+  BOOST_CHECK_EQUAL(index.get_entry(1).offset, sizeof(kMessage));
+  BOOST_CHECK_EQUAL(index.get_entry(1).export_time, t0 + 1);
+  BOOST_CHECK_EQUAL(index.get_entry(1).observation_domain, 0x1e240U);
+  BOOST_CHECK_EQUAL(index.find_time(t0 + 500), 500U);
+  BOOST_CHECK_EQUAL(index.find_time(t0 + 5000), index.size());
+  BOOST_CHECK_EQUAL(index.find_end_time(t0 + 500), 500U);
+
+  /* Before, across and after the redefinition. */
+  static const struct {
+    uint32_t begin;
+    uint32_t end;
+  } windows[] = {
+    { t0 + 500, t0 + 600 },
+    { t0 + 990, t0 + 1010 },
+    { t0 + 1500, t0 + 1600 },
+    { t0 + 1990, t0 + 5000 },
+  };
+
+  for (size_t w = 0; w < sizeof(windows)/sizeof(windows[0]); w++) {
+    IndexedFileInputSource is(open(filename, O_RDONLY), filename, index,
+                              windows[w].begin, windows[w].end);
+    unsigned int expected
+      = std::min(windows[w].end, t0 + 2 * n_messages) - windows[w].begin;
+    BOOST_CHECK_EQUAL(is.get_first_message(), windows[w].begin - t0);
+    BOOST_CHECK_EQUAL(is.get_n_messages(), expected);
+
+    PopulationCounter cb;
+    BOOST_CHECK(cb.collect(is) == 0);
+    BOOST_CHECK_EQUAL(cb.n_records, expected);
+  }
+
+  /* An index doesn't fit a file that has changed, even if its size
+   * hasn't. */
+  struct timespec times[2];
+  times[0].tv_sec = times[1].tv_sec = 1;
+  times[0].tv_nsec = times[1].tv_nsec = 0;
+  BOOST_REQUIRE(utimensat(AT_FDCWD, filename, times, 0) == 0);
+
+  IndexedFileInputSource touched(open(filename, O_RDONLY), filename, index,
+                                 t0, t0 + 10);
+  PopulationCounter touched_cb;
+  std::shared_ptr<ErrorContext> touched_err = touched_cb.collect(touched);
+  BOOST_REQUIRE(touched_err != 0);
+  BOOST_CHECK_EQUAL(touched_err->get_system_errno(), ESTALE);
+
+  fd = open(filename, O_WRONLY | O_APPEND);
+  BOOST_REQUIRE(fd >= 0);
+  BOOST_REQUIRE(write(fd, kMessage, sizeof(kMessage)) == sizeof(kMessage));
+  (void) close(fd);
+
+  IndexedFileInputSource stale(open(filename, O_RDONLY), filename, index,
+                               t0, t0 + 10);
+  PopulationCounter cb;
+  std::shared_ptr<ErrorContext> err = cb.collect(stale);
+  BOOST_REQUIRE(err != 0);
+  BOOST_CHECK_EQUAL(err->get_error(), Error::system_error);
+  BOOST_CHECK_EQUAL(err->get_system_errno(), ESTALE);
+  BOOST_CHECK_EQUAL(cb.n_records, 0U);
+
+  (void) unlink(filename);
+}
+
+BOOST_AUTO_TEST_CASE(IndexedOutOfOrder) {
+  /* Three messages exported at 10, 20 and 15.  A window must hold
+   * every message exported in it, whichever edge is out of order. */
+  static const uint32_t times[] = { 10, 20, 15 };
+  static const unsigned int n_messages = sizeof(times)/sizeof(times[0]);
+
+  std::vector<unsigned char> data
+    = data_only(kMessage, sizeof(kMessage), kHeaderAndTemplate);
+
+  std::vector<unsigned char> contents;
+  for (unsigned int i = 0; i < n_messages; i++) {
+    size_t off = contents.size();
+    if (i == 0)
+      contents.insert(contents.end(), kMessage, kMessage + sizeof(kMessage));
+    else
+      contents.insert(contents.end(), data.begin(), data.end());
+    for (int k = 0; k < 4; k++)
+      contents[off + 4 + k]
+        = static_cast<unsigned char>(times[i] >> (24 - 8*k));
+  }
+
+  FileIndex index;
+  index.build(&contents[0], contents.size());
+  BOOST_REQUIRE_EQUAL(index.size(), n_messages);
+  BOOST_CHECK_EQUAL(index.find_time(12), 1U);
+  BOOST_CHECK_EQUAL(index.find_time(18), 1U);
+  BOOST_CHECK_EQUAL(index.find_end_time(12), 1U);
+  BOOST_CHECK_EQUAL(index.find_end_time(18), 3U);
+
+  char filename[] = "/tmp/fctestXXXXXX";
+  int fd = mkstemp(filename);
+  BOOST_REQUIRE(fd >= 0);
+  BOOST_REQUIRE(write(fd, &contents[0], contents.size())
+                == static_cast<ssize_t>(contents.size()));
+  (void) close(fd);
+
+  /* [0, 18) must not stop before the message at 15; [12, 30) must
+   * not start after it. */
+  static const struct {
+    uint32_t begin;
+    uint32_t end;
+    size_t first;
+    size_t n;
+  } windows[] = {
+    { 0, 18, 0, 3 },
+    { 12, 30, 1, 2 },
+    { 0, 12, 0, 1 },
+  };
+
+  for (size_t w = 0; w < sizeof(windows)/sizeof(windows[0]); w++) {
+    IndexedFileInputSource is(open(filename, O_RDONLY), filename, index,
+                              windows[w].begin, windows[w].end);
+    BOOST_CHECK_EQUAL(is.get_first_message(), windows[w].first);
+    BOOST_CHECK_EQUAL(is.get_n_messages(), windows[w].n);
+
+    PopulationCounter cb;
+    BOOST_CHECK(cb.collect(is) == 0);
+    BOOST_CHECK_EQUAL(cb.n_records, windows[w].n);
+  }
+
+  (void) unlink(filename);
+}
+
+BOOST_AUTO_TEST_CASE(PipelinedStream) {
+  /* The stream from ParallelFile, through a pipe.  Batches are small,
+   * so the redefinition of template 1001 falls between batches that
+   * different workers decode at the same time. */
+  static const unsigned int n_messages = 1000;
+
+  std::vector<unsigned char> contents = redefinition_stream(n_messages);
+
+  int fds[2];
+  BOOST_REQUIRE(pipe(fds) == 0);
+
+  std::thread writer([&fds, &contents]() {
+      for (size_t off = 0; off < contents.size(); ) {
+        ssize_t n = write(fds[1], &contents[off], contents.size() - off);
+        if (n <= 0)
+          break;
+        off += n;
+      }
+      (void) close(fds[1]);
+    });
+
+  class MyCollector : public PipelinedCollector {
+  public:
+    MyCollector() : PipelinedCollector(3) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+  } collector;
+
+  collector.set_batch_size(1024);
+  collector.set_queue_depth(2);
+
+  FileInputSource is(fds[0], "<pipe>");
+  std::shared_ptr<ErrorContext> err = collector.collect(is);
+  writer.join();
+
+  BOOST_REQUIRE(err != 0);
+  BOOST_CHECK_EQUAL(err->get_error(), Error::short_header);
+
+  PipelinedCollector::Stats stats = collector.get_stats();
+  BOOST_CHECK_EQUAL(stats.n_template_messages, 2U);
+  BOOST_CHECK(stats.n_batches > 10);
+
+  unsigned int n_records = 0;
+  for (unsigned int w = 0; w < collector.get_n_workers(); w++)
+    n_records += static_cast<PopulationCounter*>(collector.get_collector(w))
+      ->n_records;
+  BOOST_CHECK_EQUAL(n_records, 2 * n_messages);
+}
+
+BOOST_AUTO_TEST_CASE(PipelinedSplitMessage) {
+  /* Messages that define template 1001 as in kMessage, have a data
+   * set for it, redefine it as in kRedefinition and have a data set
+   * for that.  Each data set must be decoded with the definition
+   * that comes just before it in its message, which gives one
+   * record apiece. */
+  static const unsigned int n_messages = 200;
+
+  std::vector<unsigned char> message(kMessage, kMessage + sizeof(kMessage));
+  message.insert(message.end(),
+                 kRedefinition + 16,   /* after the header */
+                 kRedefinition + sizeof(kRedefinition));
+  message[2] = static_cast<unsigned char>(message.size() >> 8);
+  message[3] = static_cast<unsigned char>(message.size());
+
+  std::vector<unsigned char> contents;
+  for (unsigned int i = 0; i < n_messages; i++)
+    contents.insert(contents.end(), message.begin(), message.end());
+
+  class MyCollector : public PipelinedCollector {
+  public:
+    MyCollector() : PipelinedCollector(3) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+  } collector;
+
+  collector.set_batch_size(256);
+  collector.set_queue_depth(2);
+
+  BufferInputSource is(&contents[0], contents.size());
+  BOOST_CHECK(collector.collect(is) == 0);
+
+  unsigned int n_records = 0;
+  for (unsigned int w = 0; w < collector.get_n_workers(); w++)
+    n_records += static_cast<PopulationCounter*>(collector.get_collector(w))
+      ->n_records;
+  BOOST_CHECK_EQUAL(n_records, 2 * n_messages);
+}
+
+BOOST_AUTO_TEST_CASE(PipelinedMalformed) {
+  /* The message from SkipDataSet and data-only copies of it.  In one
+   * message in the middle, the varlen length runs past the end of the
+   * record, so decoding it throws. */
+  static const unsigned int n_messages = 1000;
+
+  std::vector<unsigned char> data_message
+    = data_only(kMessage, sizeof(kMessage), kHeaderAndTemplate);
+
+  std::vector<unsigned char> contents(kMessage, kMessage + sizeof(kMessage));
+  for (unsigned int i = 1; i < n_messages; i++)
+    contents.insert(contents.end(), data_message.begin(),
+                    data_message.end());
+  contents[sizeof(kMessage) + (n_messages / 2) * data_message.size() + 24]
+    = 0xfe;
+
+  class MyCollector : public PipelinedCollector {
+  public:
+    MyCollector() : PipelinedCollector(3) {
+    }
+
+    unsigned int n_records() const {
+      unsigned int ret = 0;
+      for (unsigned int w = 0; w < get_n_workers(); w++)
+        ret += static_cast<PopulationCounter*>(get_collector(w))->n_records;
+      return ret;
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+  };
+
+  /* Stopping on the error hands it to the caller. */
+  {
+    MyCollector collector;
+    collector.set_batch_size(1024);
+
+    BufferInputSource is(&contents[0], contents.size());
+    std::shared_ptr<ErrorContext> err = collector.collect(is);
+    BOOST_REQUIRE(err != 0);
+    BOOST_CHECK_EQUAL(err->get_error(), Error::format_error);
+    BOOST_CHECK(collector.n_records() < n_messages);
+  }
+
+  /* Resynchronising skips just that message, in the worker. */
+  {
+    MyCollector collector;
+    collector.set_batch_size(1024);
+    collector.set_resync_policy(MessageStreamParser::resync_on_error);
+
+    BufferInputSource is(&contents[0], contents.size());
+    BOOST_CHECK(collector.collect(is) == 0);
+    BOOST_CHECK_EQUAL(collector.n_records(), n_messages - 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(WorkStealing) {
+  /* The stream from PipelinedStream.  Data sets that are decoded
+   * with the wrong definition of template 1001 give 0 or 10 records
+   * instead of 1. */
+  static const unsigned int n_messages = 1000;
+
+  std::vector<unsigned char> contents = redefinition_stream(n_messages);
+
+  class MyCollector : public WorkStealingCollector {
+  public:
+    MyCollector() : WorkStealingCollector(3) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+  } collector;
+
+  collector.set_queue_depth(4);
+
+  BufferInputSource is(contents.data(), contents.size());
+  std::shared_ptr<ErrorContext> err = collector.collect(is);
+
+  BOOST_REQUIRE(err != 0);
+  BOOST_CHECK_EQUAL(err->get_error(), Error::short_header);
+
+  WorkStealingCollector::Stats stats = collector.get_stats();
+  BOOST_CHECK_EQUAL(stats.n_tasks, 2 * n_messages);
+  BOOST_CHECK(stats.n_template_installs >= 2);
+
+  unsigned int n_records = 0;
+  for (unsigned int w = 0; w < collector.get_n_workers(); w++)
+    n_records += static_cast<PopulationCounter*>(collector.get_collector(w))
+      ->n_records;
+  BOOST_CHECK_EQUAL(n_records, 2 * n_messages);
+}
+
+BOOST_AUTO_TEST_CASE(WorkStealingMalformed) {
+  /* The message from SkipDataSet and data-only copies of it.  In one
+   * message in the middle, the varlen length runs past the end of the
+   * record, so decoding it throws.  The collector must report that and
+   * stay usable. */
+  static const unsigned int n_messages = 1000;
+
+  std::vector<unsigned char> data_message
+    = data_only(kMessage, sizeof(kMessage), kHeaderAndTemplate);
+
+  std::vector<unsigned char> good(kMessage, kMessage + sizeof(kMessage));
+  for (unsigned int i = 1; i < n_messages; i++)
+    good.insert(good.end(), data_message.begin(), data_message.end());
+
+  std::vector<unsigned char> bad(good);
+  bad[sizeof(kMessage) + (n_messages / 2) * data_message.size() + 24]
+    = 0xfe;
+
+  class MyCollector : public WorkStealingCollector {
+  public:
+    MyCollector() : WorkStealingCollector(3) {
+    }
+
+    unsigned int n_records() const {
+      unsigned int ret = 0;
+      for (unsigned int w = 0; w < get_n_workers(); w++)
+        ret += static_cast<PopulationCounter*>(get_collector(w))->n_records;
+      return ret;
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+  };
+
+  static const MessageStreamParser::ResyncPolicy policies[] = {
+    MessageStreamParser::stop_on_error,
+    MessageStreamParser::resync_on_error
+  };
+
+  for (auto policy : policies) {
+    MyCollector collector;
+    collector.set_queue_depth(4);
+    collector.set_resync_policy(policy);
+
+    BufferInputSource bad_is(bad.data(), bad.size());
+    std::shared_ptr<ErrorContext> err = collector.collect(bad_is);
+    BOOST_REQUIRE(err != 0);
+    BOOST_CHECK_EQUAL(err->get_error(), Error::format_error);
+    BOOST_CHECK(err->get_input_source() == &bad_is);
+
+    unsigned int n_before = collector.n_records();
+    BOOST_CHECK(n_before < n_messages);
+
+    BufferInputSource good_is(good.data(), good.size());
+    BOOST_CHECK(collector.collect(good_is) == 0);
+    BOOST_CHECK_EQUAL(collector.n_records(), n_before + n_messages);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(WorkStealingSlowCallback) {
+  /* One slow worker with a short queue, and data sets that all fit
+   * into one chunk.  The reader fills the queue long before the
+   * chunk is given back, so the worker must wake it whenever it
+   * takes a task. */
+  static const unsigned int n_messages = 50;
+
+  std::vector<unsigned char> data_message
+    = data_only(kMessage, sizeof(kMessage), kHeaderAndTemplate);
+
+  std::vector<unsigned char> contents(kMessage, kMessage + sizeof(kMessage));
+  for (unsigned int i = 1; i < n_messages; i++)
+    contents.insert(contents.end(), data_message.begin(),
+                    data_message.end());
+
+  class SlowCounter : public PopulationCounter {
+  public:
+    std::shared_ptr<ErrorContext>
+        end_placement(const PlacementTemplate* tmpl) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      return PopulationCounter::end_placement(tmpl);
+    }
+  };
+
+  class MyCollector : public WorkStealingCollector {
+  public:
+    MyCollector() : WorkStealingCollector(1) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new SlowCounter();
+    }
+  } collector;
+
+  collector.set_queue_depth(4);
+
+  BufferInputSource is(contents.data(), contents.size());
+  BOOST_CHECK(collector.collect(is) == 0);
+  BOOST_CHECK_EQUAL(collector.get_stats().n_tasks, n_messages);
+  BOOST_CHECK_EQUAL(static_cast<PopulationCounter*>(
+                      collector.get_collector(0))->n_records,
+                    n_messages);
+}
+
+BOOST_AUTO_TEST_CASE(WorkStealingReclaim) {
+  /* Every message redefines template 1001, alternately as in
+   * kMessage and as in kRedefinition.  Replaced definitions must not
+   * pile up, and dropping the exporter must free the rest. */
+  static const unsigned int n_messages = 500;
+
+  std::vector<unsigned char> contents;
+  for (unsigned int i = 0; i < n_messages; i++)
+    if (i % 2 == 0)
+      contents.insert(contents.end(), kMessage, kMessage + sizeof(kMessage));
+    else
+      contents.insert(contents.end(), kRedefinition,
+                      kRedefinition + sizeof(kRedefinition));
+
+  class MyCollector : public WorkStealingCollector {
+  public:
+    MyCollector() : WorkStealingCollector(2) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+  } collector;
+
+  BufferInputSource is(contents.data(), contents.size());
+  BOOST_CHECK(collector.collect(is) == 0);
+  BOOST_CHECK_EQUAL(collector.get_n_definitions(), 1U);
+
+  unsigned int n_records = 0;
+  for (unsigned int w = 0; w < collector.get_n_workers(); w++)
+    n_records += static_cast<PopulationCounter*>(collector.get_collector(w))
+      ->n_records;
+  BOOST_CHECK_EQUAL(n_records, n_messages);
+
+  collector.drop_exporter(0);
+  BOOST_CHECK_EQUAL(collector.get_n_definitions(), 0U);
+
+  /* The freed slot is reused, and the workers install the new
+   * definition. */
+  BufferInputSource again(contents.data(), contents.size());
+  BOOST_CHECK(collector.collect(again) == 0);
+  BOOST_CHECK_EQUAL(collector.get_n_definitions(), 1U);
+
+  n_records = 0;
+  for (unsigned int w = 0; w < collector.get_n_workers(); w++)
+    n_records += static_cast<PopulationCounter*>(collector.get_collector(w))
+      ->n_records;
+  BOOST_CHECK_EQUAL(n_records, 2 * n_messages);
+}
+
+BOOST_AUTO_TEST_CASE(UringInput) {
+  /* The message from SkipDataSet, followed by data-only copies, in a
+   * file spanning several small blocks, so that messages straddle
+   * block boundaries. */
+  static const unsigned int n_messages = 5000;
+
+  std::vector<unsigned char> data_message
+    = data_only(kMessage, sizeof(kMessage), kHeaderAndTemplate);
+
+  std::vector<unsigned char> contents(kMessage, kMessage + sizeof(kMessage));
+  for (unsigned int i = 1; i < n_messages; i++)
+    contents.insert(contents.end(), data_message.begin(),
+                    data_message.end());
+
+  char filename[] = "/tmp/fctestXXXXXX";
+  int fd = mkstemp(filename);
+  BOOST_REQUIRE(fd >= 0);
+  (void) unlink(filename);
+  BOOST_REQUIRE(write(fd, &contents[0], contents.size())
+                == static_cast<ssize_t>(contents.size()));
+  BOOST_REQUIRE(lseek(fd, 0, SEEK_SET) == 0);
+
+  PopulationCounter cb;
+  UringInputSource is(fd, filename, 2, BufferedReader::kMinBlockSize);
+#if defined(_libfc_HAVE_IO_URING_)
+  BOOST_TEST_MESSAGE("UringInput: "
+                     << (is.is_uring() ? "io_uring" : "buffered reads"));
+#else
+  BOOST_CHECK(!is.is_uring());
+#endif /* defined(_libfc_HAVE_IO_URING_) */
+  BOOST_CHECK(cb.collect(is) == 0);
+  BOOST_CHECK_EQUAL(cb.n_records, n_messages);
+}
+
+BOOST_AUTO_TEST_CASE(UDPInput) {
+  /* The message from SkipDataSet, one per datagram, over loopback.
+   * The second datagram has padding after the message, which must
+   * not be taken for the start of another message. */
+  static const unsigned int n_messages = 3;
+
+  struct sockaddr_in collector_sa;
+  memset(&collector_sa, 0, sizeof(collector_sa));
+  collector_sa.sin_family = AF_INET;
+  collector_sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t sa_len = sizeof(collector_sa);
+
+  int collector_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  BOOST_REQUIRE(collector_fd >= 0);
+  BOOST_REQUIRE(bind(collector_fd,
+                     reinterpret_cast<struct sockaddr*>(&collector_sa),
+                     sa_len) == 0);
+  BOOST_REQUIRE(getsockname(collector_fd,
+                            reinterpret_cast<struct sockaddr*>(&collector_sa),
+                            &sa_len) == 0);
+
+  int exporter_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  BOOST_REQUIRE(exporter_fd >= 0);
+  BOOST_REQUIRE(connect(exporter_fd,
+                        reinterpret_cast<struct sockaddr*>(&collector_sa),
+                        sa_len) == 0);
+
+  struct sockaddr_in exporter_sa;
+  socklen_t exporter_sa_len = sizeof(exporter_sa);
+  BOOST_REQUIRE(getsockname(exporter_fd,
+                            reinterpret_cast<struct sockaddr*>(&exporter_sa),
+                            &exporter_sa_len) == 0);
+
+  UDPInputSource is(collector_fd, 2);
+  BOOST_CHECK(is.set_receive_buffer_size(1 << 20));
+
+  std::vector<unsigned char> padded(kMessage, kMessage + sizeof(kMessage));
+  padded.resize(padded.size() + 16, 0);
+
+  /* An empty datagram holds no message and must not end the
+   * stream. */
+  BOOST_REQUIRE(send(exporter_fd, kMessage, sizeof(kMessage), 0)
+                == sizeof(kMessage));
+  BOOST_REQUIRE(send(exporter_fd, kMessage, 0, 0) == 0);
+  BOOST_REQUIRE(send(exporter_fd, &padded[0], padded.size(), 0)
+                == static_cast<ssize_t>(padded.size()));
+  BOOST_REQUIRE(send(exporter_fd, kMessage, sizeof(kMessage), 0)
+                == sizeof(kMessage));
+
+  std::thread stopper([&is]() {
+      while (is.get_n_datagrams() < n_messages)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      is.shutdown();
+    });
+
+  PopulationCounter cb;
+  BOOST_CHECK(cb.collect(is) == 0);
+  stopper.join();
+  BOOST_CHECK_EQUAL(cb.n_records, n_messages);
+  BOOST_CHECK_EQUAL(is.get_n_datagrams(), n_messages);
+  BOOST_CHECK_EQUAL(is.get_n_kernel_drops(), 0U);
+  BOOST_CHECK_EQUAL(is.get_exporter_id(),
+                    InputSource::make_exporter_id(
+                      reinterpret_cast<struct sockaddr*>(&exporter_sa),
+                      exporter_sa_len));
+
+  (void) close(exporter_fd);
+  (void) close(collector_fd);
+}
+
+BOOST_AUTO_TEST_CASE(ShardedUDP) {
+  /* Several exporters send the message from SkipDataSet to a
+   * collector with two shards.  Every exporter must end up on one
+   * shard, which must have seen its template.  The first exporter
+   * starts with a message of the wrong version, which stops its
+   * shard's parser; the shard must start parsing again. */
+  static const unsigned int n_exporters = 8;
+  static const unsigned int n_messages = 10;
+  static const unsigned int n_shards = 2;
+
+  class MyCollector : public UDPCollector {
+  public:
+    MyCollector() : UDPCollector(n_shards) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int shard) {
+      return new PopulationCounter();
+    }
+  } collector;
+
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  BOOST_REQUIRE(collector.bind(reinterpret_cast<struct sockaddr*>(&sa),
+                               sizeof(sa)) == 0);
+  BOOST_REQUIRE(collector.get_port() != 0);
+  sa.sin_port = htons(collector.get_port());
+
+  std::shared_ptr<ErrorContext> result;
+  std::thread runner([&collector, &result]() {
+      result = collector.run();
+    });
+
+  int exporter_fds[n_exporters];
+  for (unsigned int i = 0; i < n_exporters; i++) {
+    exporter_fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    BOOST_REQUIRE(exporter_fds[i] >= 0);
+    BOOST_REQUIRE(connect(exporter_fds[i],
+                          reinterpret_cast<struct sockaddr*>(&sa),
+                          sizeof(sa)) == 0);
+  }
+  std::vector<unsigned char> bad(kMessage, kMessage + sizeof(kMessage));
+  bad[1] = 0x0b;
+  BOOST_REQUIRE(send(exporter_fds[0], &bad[0], bad.size(), 0)
+                == static_cast<ssize_t>(bad.size()));
+  for (unsigned int m = 0; m < n_messages; m++)
+    for (unsigned int i = 0; i < n_exporters; i++)
+      BOOST_REQUIRE(send(exporter_fds[i], kMessage, sizeof(kMessage), 0)
+                    == sizeof(kMessage));
+
+  const unsigned int n_sent = n_exporters * n_messages + 1;
+  auto deadline = std::chrono::steady_clock::now()
+    + std::chrono::seconds(10);
+  while (collector.get_stats().n_datagrams < n_sent
+         && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  collector.stop();
+  runner.join();
+  for (unsigned int i = 0; i < n_exporters; i++)
+    (void) close(exporter_fds[i]);
+
+  BOOST_CHECK(result == 0);
+
+  UDPCollector::Stats stats = collector.get_stats();
+  BOOST_CHECK_EQUAL(stats.n_datagrams, n_sent);
+  BOOST_CHECK_EQUAL(stats.n_kernel_drops, 0U);
+  BOOST_CHECK_EQUAL(stats.n_resyncs, 0U);
+  BOOST_CHECK_EQUAL(stats.n_restarts, 1U);
+
+  unsigned int n_records = 0;
+  for (unsigned int k = 0; k < n_shards; k++) {
+    PopulationCounter* c
+      = static_cast<PopulationCounter*>(collector.get_collector(k));
+    UDPCollector::Stats shard_stats = collector.get_shard_stats(k);
+    BOOST_CHECK_EQUAL(c->n_records,
+                      shard_stats.n_datagrams - shard_stats.n_restarts);
+    n_records += c->n_records;
+  }
+  BOOST_CHECK_EQUAL(n_records, n_sent - 1);
+}
+
+BOOST_AUTO_TEST_CASE(EpollTCP) {
+  /* Many exporters connect to a collector with two workers and send
+   * the message from SkipDataSet three times, in small pieces.  One
+   * more exporter sends only a data set, whose template must not be
+   * found among the other exporters' templates, and one sends
+   * garbage. */
+  static const unsigned int n_exporters = 50;
+  static const unsigned int n_messages = 3;
+
+  class MyCollector : public TCPCollector {
+  public:
+    MyCollector() : TCPCollector(2) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+  } collector;
+
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  BOOST_REQUIRE(collector.bind(reinterpret_cast<struct sockaddr*>(&sa),
+                               sizeof(sa)) == 0);
+  BOOST_REQUIRE(collector.get_port() != 0);
+  sa.sin_port = htons(collector.get_port());
+
+  std::shared_ptr<ErrorContext> result;
+  std::thread runner([&collector, &result]() {
+      result = collector.run();
+    });
+
+  std::vector<unsigned char> stream;
+  for (unsigned int m = 0; m < n_messages; m++)
+    stream.insert(stream.end(), kMessage, kMessage + sizeof(kMessage));
+
+  std::vector<unsigned char> orphan
+    = data_only(kMessage, sizeof(kMessage), kHeaderAndTemplate);
+
+  static const unsigned char garbage[] = {
+    0x00,0x09,0x00,0x10,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 };
+
+  auto connect_to_collector = [&sa]() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    BOOST_REQUIRE(fd >= 0);
+    BOOST_REQUIRE(connect(fd, reinterpret_cast<struct sockaddr*>(&sa),
+                          sizeof(sa)) == 0);
+    return fd;
+  };
+
+  /* Open all connections first, so that they are all open at once. */
+  std::vector<int> fds;
+  for (unsigned int i = 0; i < n_exporters; i++)
+    fds.push_back(connect_to_collector());
+  for (size_t off = 0; off < stream.size(); off += 37) {
+    size_t len = std::min(stream.size() - off, static_cast<size_t>(37));
+    for (unsigned int i = 0; i < n_exporters; i++)
+      BOOST_REQUIRE(write(fds[i], &stream[off], len)
+                    == static_cast<ssize_t>(len));
+  }
+  for (unsigned int i = 0; i < n_exporters; i++)
+    (void) close(fds[i]);
+
+  int fd = connect_to_collector();
+  BOOST_REQUIRE(write(fd, &orphan[0], orphan.size())
+                == static_cast<ssize_t>(orphan.size()));
+  (void) close(fd);
+
+  fd = connect_to_collector();
+  BOOST_REQUIRE(write(fd, garbage, sizeof(garbage)) == sizeof(garbage));
+  (void) close(fd);
+
+  auto deadline = std::chrono::steady_clock::now()
+    + std::chrono::seconds(10);
+  while (std::chrono::steady_clock::now() < deadline) {
+    TCPCollector::Stats stats = collector.get_stats();
+    if (stats.n_accepted == n_exporters + 2 && stats.n_open == 0)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  collector.stop();
+  runner.join();
+  BOOST_CHECK(result == 0);
+
+  TCPCollector::Stats stats = collector.get_stats();
+  BOOST_CHECK_EQUAL(stats.n_accepted, n_exporters + 2);
+  BOOST_CHECK_EQUAL(stats.n_open, 0U);
+  BOOST_CHECK_EQUAL(stats.n_messages, n_exporters * n_messages + 1);
+  BOOST_CHECK_EQUAL(stats.n_bytes, n_exporters * stream.size()
+                    + orphan.size() + sizeof(garbage));
+  BOOST_CHECK_EQUAL(stats.n_errors, 1U);
+
+  unsigned int n_records = 0;
+  for (unsigned int k = 0; k < collector.get_n_workers(); k++)
+    n_records
+      += static_cast<PopulationCounter*>(collector.get_collector(k))
+           ->n_records;
+  BOOST_CHECK_EQUAL(n_records, n_exporters * n_messages);
+}
+
+BOOST_AUTO_TEST_CASE(EpollTCPMalformed) {
+  /* One exporter sends the message from SkipDataSet with a varlen
+   * length that runs past the end of the record, so decoding throws.
+   * Only that connection may be closed; exporters on the same worker
+   * that connect afterwards must still be collected. */
+  static const unsigned int n_exporters = 10;
+
+  class MyCollector : public TCPCollector {
+  public:
+    MyCollector() : TCPCollector(1) {
+    }
+
+  protected:
+    PlacementCollector* make_collector(unsigned int worker) {
+      return new PopulationCounter();
+    }
+  } collector;
+
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  BOOST_REQUIRE(collector.bind(reinterpret_cast<struct sockaddr*>(&sa),
+                               sizeof(sa)) == 0);
+  sa.sin_port = htons(collector.get_port());
+
+  std::shared_ptr<ErrorContext> result;
+  std::thread runner([&collector, &result]() {
+      result = collector.run();
+    });
+
+  std::vector<unsigned char> bad(kMessage, kMessage + sizeof(kMessage));
+  bad[48] = 0xfe;
+
+  auto send_to_collector = [&sa](const unsigned char* buf, size_t len) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    BOOST_REQUIRE(fd >= 0);
+    BOOST_REQUIRE(connect(fd, reinterpret_cast<struct sockaddr*>(&sa),
+                          sizeof(sa)) == 0);
+    BOOST_REQUIRE(write(fd, buf, len) == static_cast<ssize_t>(len));
+    (void) close(fd);
+  };
+
+  auto wait_for = [&collector](unsigned int n_accepted) {
+    auto deadline = std::chrono::steady_clock::now()
+      + std::chrono::seconds(10);
+    while (std::chrono::steady_clock::now() < deadline) {
+      TCPCollector::Stats stats = collector.get_stats();
+      if (stats.n_accepted == n_accepted && stats.n_open == 0)
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+
+  send_to_collector(&bad[0], bad.size());
+  wait_for(1);
+  BOOST_CHECK_EQUAL(collector.get_stats().n_errors, 1U);
+
+  for (unsigned int i = 0; i < n_exporters; i++)
+    send_to_collector(kMessage, sizeof(kMessage));
+  wait_for(n_exporters + 1);
+
+  collector.stop();
+  runner.join();
+  BOOST_CHECK(result == 0);
+
+  TCPCollector::Stats stats = collector.get_stats();
+  BOOST_CHECK_EQUAL(stats.n_accepted, n_exporters + 1);
+  BOOST_CHECK_EQUAL(stats.n_messages, n_exporters);
+  BOOST_CHECK_EQUAL(stats.n_errors, 1U);
+  BOOST_CHECK_EQUAL(
+    static_cast<PopulationCounter*>(collector.get_collector(0))->n_records,
+    n_exporters);
+
+  std::shared_ptr<ErrorContext> err = collector.get_worker_error(0);
+  BOOST_REQUIRE(err != 0);
+  BOOST_CHECK_EQUAL(err->get_error(), Error::format_error);
+}
+
 BOOST_AUTO_TEST_CASE(FileDataSet) {
   const char* filename = "dahlem-01.ipfix";
 
@@ -0,0 +1,95 @@
+/* Copyright (c) 2011-2014 ETH Zürich. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of ETH Zürich, nor the names of its contributors 
+ *      may be used to endorse or promote products derived from this software 
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL ETH 
+ * ZURICH BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+ * PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER 
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR 
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF 
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/test_tools.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+
+#include "TemplateTable.h"
+
+using namespace libfc;
+
+BOOST_AUTO_TEST_SUITE(Basics)
+BOOST_AUTO_TEST_SUITE(TemplateTables)
+
+BOOST_AUTO_TEST_CASE(InsertFind) {
+  TemplateTable<int> t;
+
+  BOOST_CHECK(t.find(256) == 0);
+  BOOST_CHECK_EQUAL(t.size(), 0U);
+
+  t[256] = 1;
+  t[(static_cast<uint64_t>(7) << 16) + 256] = 2;
+  BOOST_CHECK_EQUAL(t.size(), 2U);
+  BOOST_REQUIRE(t.find(256) != 0);
+  BOOST_CHECK_EQUAL(*t.find(256), 1);
+  BOOST_CHECK_EQUAL(*t.find((static_cast<uint64_t>(7) << 16) + 256), 2);
+  BOOST_CHECK(t.find(257) == 0);
+
+  /* Existing keys are not inserted again. */
+  t[256] = 3;
+  BOOST_CHECK_EQUAL(t.size(), 2U);
+  BOOST_CHECK_EQUAL(*t.find(256), 3);
+}
+
+BOOST_AUTO_TEST_CASE(AgainstMap) {
+  /* Enough keys to grow the table several times, with erasures in
+   * between, compared against std::map.  Keys are clustered like
+   * real template keys: a few domains, consecutive template IDs. */
+  TemplateTable<uint64_t> t;
+  std::map<uint64_t, uint64_t> m;
+
+  uint64_t x = 1;
+  for (int round = 0; round < 20000; ++round) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint64_t key = ((x >> 60) << 16) + 256 + ((x >> 32) % 300);
+
+    if ((x >> 20) % 3 == 0) {
+      BOOST_CHECK_EQUAL(t.erase(key), m.erase(key) == 1);
+    } else {
+      t[key] = round;
+      m[key] = round;
+    }
+  }
+
+  BOOST_CHECK_EQUAL(t.size(), m.size());
+  for (auto i = m.begin(); i != m.end(); ++i) {
+    BOOST_REQUIRE(t.find(i->first) != 0);
+    BOOST_CHECK_EQUAL(*t.find(i->first), i->second);
+  }
+
+  size_t n = 0;
+  t.for_each([&](uint64_t key, uint64_t& value) {
+      n++;
+      BOOST_CHECK_EQUAL(m[key], value);
+    });
+  BOOST_CHECK_EQUAL(n, m.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+BOOST_AUTO_TEST_SUITE_END()